@@ -0,0 +1,95 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : display_core.c
+*
+* Description:
+* ------------
+* This file implements the platform-neutral core of BlankWindow (see display_core.h).
+* A message costs a few span fills in memory instead of a GDI call per rectangle, and the screen is only touched once per refresh, with a single
+* copy of the bounding rectangle of everything drawn since the last present (a moving sprite and a score in opposite corners are copied together
+* with what lies between them, which is still far cheaper than a copy per message).
+*
+*************************************************************************/
+
+#include <string.h>
+#include "display_core.h"
+
+int DISPLAY_init(DISPLAY_t *display, unsigned int refresh_ms)
+{
+    memset(display, 0, sizeof(DISPLAY_t));
+    display->refresh_ms = (refresh_ms != 0) ? refresh_ms : DISPLAY_REFRESH_MS;
+    return RENDER_init(&display->back, DISPLAY_WIDTH, DISPLAY_HEIGHT);
+}
+
+void DISPLAY_free(DISPLAY_t *display)
+{
+    RENDER_free(&display->back);
+}
+
+void DISPLAY_message(DISPLAY_t *display, const unsigned char *msg, int msg_size)
+{
+    display->receives++;
+    RENDER_message(&display->back, msg, msg_size);
+}
+
+int DISPLAY_drain(DISPLAY_t *display, DISPLAY_receive_t receive, void *user)
+{
+    unsigned char *msg;
+    int count, length;
+
+    for (count = 0; count < DISPLAY_MAX_DRAIN; count++) {
+        length = receive(user, &msg);
+        if (length <= 0) {
+            break;
+        }
+        DISPLAY_message(display, msg, length);
+    }
+    return count;
+}
+
+int DISPLAY_present(DISPLAY_t *display, unsigned long long now_ms, DISPLAY_rect_t *rect, unsigned int *wait_ms)
+{
+    DISPLAY_rect_t dirty;
+    unsigned int x1, y1;
+
+    // the bounds of the back buffer's changes since the last present
+    if (RENDER_take_dirty(&display->back, &dirty.x, &dirty.y, &dirty.width, &dirty.height)) {
+        if (!display->pending_valid) {
+            display->pending = dirty;
+            display->pending_valid = 1;
+        } else {
+            x1 = display->pending.x + display->pending.width;
+            y1 = display->pending.y + display->pending.height;
+            if (dirty.x + dirty.width > x1) {
+                x1 = dirty.x + dirty.width;
+            }
+            if (dirty.y + dirty.height > y1) {
+                y1 = dirty.y + dirty.height;
+            }
+            if (dirty.x < display->pending.x) {
+                display->pending.x = dirty.x;
+            }
+            if (dirty.y < display->pending.y) {
+                display->pending.y = dirty.y;
+            }
+            display->pending.width = x1 - display->pending.x;
+            display->pending.height = y1 - display->pending.y;
+        }
+    }
+
+    if (!display->pending_valid) {
+        *wait_ms = DISPLAY_WAIT_IDLE;
+        return 0;
+    }
+    if (now_ms < display->next_present_ms) {
+        *wait_ms = (unsigned int)(display->next_present_ms - now_ms);
+        return 0;
+    }
+    *rect = display->pending;
+    display->pending_valid = 0;
+    display->next_present_ms = now_ms + display->refresh_ms;
+    display->presents++;
+    *wait_ms = DISPLAY_WAIT_IDLE;
+    return 1;
+}
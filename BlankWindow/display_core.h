@@ -0,0 +1,70 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : display_core.h
+*
+* Description:
+* ------------
+* Header file for display_core.c, the platform-neutral part of BlankWindow: it drains every message waiting on its sources, draws them into a
+* back buffer (with ../render.c), and tells the shell when to show the part of the back buffer that changed, at most once per display refresh.
+* The shells only receive the messages and copy pixels to the screen: main.cpp on Windows, and display_server.c on Linux (also a load test).
+*
+*************************************************************************/
+
+#ifndef __DISPLAY_CORE_H
+#define __DISPLAY_CORE_H
+
+#include "../render.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DISPLAY_WIDTH      320 // the back buffer, the canvas of draw.c (the 256X256 pixels of the original messages, and the 320X200 of mode 13H)
+#define DISPLAY_HEIGHT     256
+#define DISPLAY_REFRESH_MS 16 // the time between presents, unless the shell knows the display's refresh rate
+#define DISPLAY_MAX_DRAIN  4096 // messages drawn per source and wakeup at most, so a flood of messages doesn't starve the shell's own events
+
+/* Gets the next message waiting on a source without blocking: sets *msg to it and returns its length, or returns -1 if there is none (the
+   message stays valid until the next call).
+*/
+typedef int (*DISPLAY_receive_t)(void *user, unsigned char **msg);
+
+// the part of the back buffer to show
+typedef struct {
+    unsigned int x, y, width, height;
+} DISPLAY_rect_t;
+
+typedef struct {
+    RENDER_target_t back; // the back buffer, as 0x00RRGGBB pixels
+    unsigned int refresh_ms;
+    unsigned long long next_present_ms; // the earliest time of the next present
+    DISPLAY_rect_t pending; // changed since the last present (if pending_valid)
+    int pending_valid;
+    unsigned long long receives; // datagrams (or records of the shared-memory ring) received
+    unsigned long long presents;
+} DISPLAY_t;
+
+// allocates the back buffer (black). Returns 0 on success, and -1 if there isn't enough memory
+int DISPLAY_init(DISPLAY_t *display, unsigned int refresh_ms);
+void DISPLAY_free(DISPLAY_t *display);
+
+// draws a received message (or batch of messages) into the back buffer
+void DISPLAY_message(DISPLAY_t *display, const unsigned char *msg, int msg_size);
+
+// draws every message waiting on a source (at most DISPLAY_MAX_DRAIN of them), and returns how many were received
+int DISPLAY_drain(DISPLAY_t *display, DISPLAY_receive_t receive, void *user);
+
+/* Returns whether the shell should show the back buffer now: something changed since the last present, and the refresh interval is over (times
+   are in milliseconds of any monotonic clock). If so, *rect is the part that changed. Otherwise, returns 0 with the milliseconds until the next
+   present is due in *wait_ms (or DISPLAY_WAIT_IDLE if nothing changed), which is how long the shell may sleep if no message arrives.
+*/
+int DISPLAY_present(DISPLAY_t *display, unsigned long long now_ms, DISPLAY_rect_t *rect, unsigned int *wait_ms);
+
+#define DISPLAY_WAIT_IDLE 0xffffffff
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DISPLAY_CORE_H */
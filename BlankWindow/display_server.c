@@ -0,0 +1,483 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : display_server.c
+*
+* Description:
+* ------------
+* BlankWindow without a window, for Linux (and other POSIX systems): the same display core (display_core.c) receiving the same sources as
+* main.cpp, the UDP port and the shared-memory ring of draw_ring.h, except that a present only copies the changed rectangle of the back buffer
+* to a front buffer instead of the screen. So the receiver can be load-tested against a simulator on a machine without Windows. It is built as:
+*     gcc -O2 -o display_server display_server.c display_core.c ../render.c
+* (with -lrt on older C libraries), and run as:
+*     display_server [-p port] [-o image.ppm] [-t idle seconds] [-bench messages]
+* It prints what it received and how fast it was drawn when it stops: after the given number of idle seconds (never by default), or on Ctrl+C.
+* -o writes the front buffer as a PPM image then, and -bench draws the given number of synthetic messages straight into the core (no sockets),
+* to measure the drawing itself.
+*
+*************************************************************************/
+
+#define _GNU_SOURCE // recvmmsg
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#include "../draw_protocol.h"
+#include "../draw_ring.h"
+#include "display_core.h"
+
+#define PORT        9999 // the port draw.c sends to
+#define RCVBUF      (4 * 1024 * 1024) // the socket's receive buffer, like main.cpp
+#define RECV_BATCH  64 // datagrams received per recvmmsg call
+#define POLL_MS     10 // the longest sleep on one source, before the other one is looked at again
+
+typedef struct {
+    int socket;
+    unsigned char buffers[RECV_BATCH][DRAW_MAX_DATAGRAM];
+    int lengths[RECV_BATCH];
+    int count, next; // datagrams received by the last call, and the next one to hand out
+} udp_source_t;
+
+typedef struct {
+    draw_ring_t *ring;
+    uint32_t tail;
+    unsigned char buffer[DRAW_MAX_DATAGRAM];
+} ring_source_t;
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int signal_number)
+{
+    (void)signal_number;
+    stop = 1;
+}
+
+static unsigned long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int udp_open(udp_source_t *udp, int port)
+{
+    struct sockaddr_in address;
+    int size = RCVBUF;
+
+    memset(udp, 0, sizeof(udp_source_t));
+    udp->socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (udp->socket < 0) {
+        perror("socket");
+        return -1;
+    }
+    setsockopt(udp->socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((unsigned short)port);
+    if (bind(udp->socket, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        perror("bind");
+        close(udp->socket);
+        udp->socket = -1;
+        return -1;
+    }
+    fcntl(udp->socket, F_SETFL, fcntl(udp->socket, F_GETFL) | O_NONBLOCK);
+    return 0;
+}
+
+// a DISPLAY_receive_t handing out the datagrams of the socket, which are received RECV_BATCH at a time
+static int receive_udp(void *user, unsigned char **msg)
+{
+    udp_source_t *udp = (udp_source_t *)user;
+#ifdef __linux__
+    struct mmsghdr headers[RECV_BATCH];
+    struct iovec vectors[RECV_BATCH];
+    int i;
+#endif
+    ssize_t length;
+
+    if (udp->socket < 0) {
+        return -1;
+    }
+    if (udp->next == udp->count) {
+#ifdef __linux__
+        memset(headers, 0, sizeof(headers));
+        for (i = 0; i < RECV_BATCH; i++) {
+            vectors[i].iov_base = udp->buffers[i];
+            vectors[i].iov_len = DRAW_MAX_DATAGRAM;
+            headers[i].msg_hdr.msg_iov = &vectors[i];
+            headers[i].msg_hdr.msg_iovlen = 1;
+        }
+        udp->count = recvmmsg(udp->socket, headers, RECV_BATCH, MSG_DONTWAIT, NULL);
+        for (i = 0; i < udp->count; i++) {
+            udp->lengths[i] = (int)headers[i].msg_len;
+        }
+#else
+        length = recv(udp->socket, udp->buffers[0], DRAW_MAX_DATAGRAM, MSG_DONTWAIT);
+        udp->count = (length >= 0) ? 1 : -1;
+        udp->lengths[0] = (int)length;
+#endif
+        udp->next = 0;
+        if (udp->count <= 0) {
+            udp->count = 0;
+            return -1;
+        }
+    }
+    *msg = udp->buffers[udp->next];
+    length = udp->lengths[udp->next++];
+    return (length > 0) ? (int)length : 0;
+}
+
+// maps the ring (creating it if the simulator didn't yet), and skips the messages already in it, like shm_listen.cpp
+static int ring_open(ring_source_t *source)
+{
+    void *mapped;
+    int fd;
+
+    source->ring = NULL;
+    fd = shm_open(DRAW_RING_NAME, O_RDWR | O_CREAT, 0600);
+    if (fd < 0 || ftruncate(fd, sizeof(draw_ring_t)) != 0) {
+        perror("shm_open");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    mapped = mmap(NULL, sizeof(draw_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    source->ring = (draw_ring_t *)mapped;
+    if (source->ring->magic == 0) {
+        source->ring->version = DRAW_RING_VERSION;
+        source->ring->magic = DRAW_RING_MAGIC;
+    } else if (source->ring->magic != DRAW_RING_MAGIC || source->ring->version != DRAW_RING_VERSION) {
+        printf("Unknown ring version : %u\n", source->ring->version);
+        munmap(mapped, sizeof(draw_ring_t));
+        source->ring = NULL;
+        return -1;
+    }
+    source->tail = (uint32_t)DRAW_RING_load(&source->ring->head);
+    DRAW_RING_store(&source->ring->tail, source->tail);
+    return 0;
+}
+
+// a DISPLAY_receive_t reading the next record of the ring
+static int receive_ring(void *user, unsigned char **msg)
+{
+    ring_source_t *source = (ring_source_t *)user;
+    draw_ring_t *ring = source->ring;
+    unsigned char length[DRAW_RING_RECORD_SIZE];
+    uint32_t head, size;
+
+    if (ring == NULL) {
+        return -1;
+    }
+    head = (uint32_t)DRAW_RING_load(&ring->head);
+    if (head == source->tail) {
+        return -1;
+    }
+    DRAW_ring_read(ring, source->tail, length, DRAW_RING_RECORD_SIZE);
+    size = length[0] | (length[1] << 8);
+    if (size == 0 || size > DRAW_MAX_DATAGRAM || size > head - source->tail - DRAW_RING_RECORD_SIZE) {
+        source->tail = head; // not a record the simulator wrote
+        DRAW_RING_store(&ring->tail, source->tail);
+        return -1;
+    }
+    DRAW_ring_read(ring, source->tail + DRAW_RING_RECORD_SIZE, source->buffer, size);
+    source->tail += DRAW_RING_RECORD_SIZE + size;
+    DRAW_RING_store(&ring->tail, source->tail);
+    *msg = source->buffer;
+    return (int)size;
+}
+
+// sleeps until the ring gets a record (woken by the simulator through the futex, see draw_ring.h) or timeout_ms pass
+static void ring_wait(ring_source_t *source, unsigned int timeout_ms)
+{
+    draw_ring_t *ring = source->ring;
+#ifdef __linux__
+    struct timespec timeout;
+    int32_t sequence = DRAW_RING_load(&ring->wake_sequence);
+
+    DRAW_RING_store(&ring->waiting, 1);
+    if ((uint32_t)DRAW_RING_load(&ring->head) == source->tail) {
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+        syscall(SYS_futex, &ring->wake_sequence, FUTEX_WAIT, sequence, &timeout, NULL, 0);
+    }
+    DRAW_RING_store(&ring->waiting, 0);
+#else
+    (void)ring;
+    (void)source;
+    usleep((timeout_ms < 1 ? 1 : timeout_ms) * 1000); // without a futex the ring is polled
+#endif
+}
+
+// "shows" the changed rectangle: copies its rows of the back buffer to the front buffer, which is what a real shell copies to the screen
+static void present(const DISPLAY_t *display, uint32_t *front, const DISPLAY_rect_t *rect, unsigned long long *copied)
+{
+    unsigned int y;
+    size_t offset;
+
+    for (y = rect->y; y < rect->y + rect->height; y++) {
+        offset = (size_t)y * DISPLAY_WIDTH + rect->x;
+        memcpy(&front[offset], &display->back.pixels[offset], rect->width * sizeof(uint32_t));
+    }
+    *copied += (unsigned long long)rect->width * rect->height;
+}
+
+static int write_ppm(const char *path, const uint32_t *pixels)
+{
+    FILE *file = fopen(path, "wb");
+    unsigned char rgb[DISPLAY_WIDTH * 3];
+    unsigned int x, y;
+
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    for (y = 0; y < DISPLAY_HEIGHT; y++) {
+        for (x = 0; x < DISPLAY_WIDTH; x++) {
+            rgb[3 * x] = (unsigned char)(pixels[y * DISPLAY_WIDTH + x] >> 16);
+            rgb[3 * x + 1] = (unsigned char)(pixels[y * DISPLAY_WIDTH + x] >> 8);
+            rgb[3 * x + 2] = (unsigned char)pixels[y * DISPLAY_WIDTH + x];
+        }
+        fwrite(rgb, 1, sizeof(rgb), file);
+    }
+    fclose(file);
+    return 0;
+}
+
+static void print_stats(const DISPLAY_t *display, double seconds, unsigned long long copied)
+{
+    if (seconds <= 0) {
+        seconds = 1e-9;
+    }
+    printf("%llu datagrams, %llu messages, %llu pixels drawn in %.3f seconds: %.0f messages/s, %.0f pixels/s\n", display->receives,
+        display->back.messages, display->back.pixels_drawn, seconds, display->back.messages / seconds, display->back.pixels_drawn / seconds);
+    printf("%llu presents, %llu pixels copied\n", display->presents, copied);
+}
+
+// writes the 12-byte header of a versioned message
+static void put_header(unsigned char *msg, int type, int encoding, int x, int y, int width, int height)
+{
+    msg[0] = DRAW_MSG_MAGIC;
+    msg[1] = DRAW_PROTOCOL_VERSION;
+    msg[2] = (unsigned char)type;
+    msg[3] = (unsigned char)encoding;
+    msg[4] = (unsigned char)x;
+    msg[5] = (unsigned char)(x >> 8);
+    msg[6] = (unsigned char)y;
+    msg[7] = (unsigned char)(y >> 8);
+    msg[8] = (unsigned char)width;
+    msg[9] = (unsigned char)(width >> 8);
+    msg[10] = (unsigned char)height;
+    msg[11] = (unsigned char)(height >> 8);
+}
+
+/* Draws count synthetic messages straight into the core, the mix draw.c sends for an animation (sprites as raw, RLE and delta bitmaps, fills of
+   the background, and the original rectangles), at positions all over the canvas, presenting on the real clock as the server does.
+*/
+static void bench(DISPLAY_t *display, uint32_t *front, unsigned long count)
+{
+    unsigned char msgs[5][DRAW_MAX_DATAGRAM];
+    int sizes[5];
+    unsigned long i;
+    unsigned int wait_ms;
+    unsigned long long copied = 0;
+    DISPLAY_rect_t rect;
+    double start;
+    int k, x, y;
+
+    // a 64X20 raw bitmap
+    put_header(msgs[0], DRAW_MSG_BITMAP, DRAW_ENCODING_RAW, 0, 0, 64, 20);
+    for (k = 0; k < 64 * 20; k++) {
+        msgs[0][DRAW_HEADER_SIZE + k] = (unsigned char)(k * 7);
+    }
+    sizes[0] = DRAW_HEADER_SIZE + 64 * 20;
+    // the same size in runs of 16 pixels
+    put_header(msgs[1], DRAW_MSG_BITMAP, DRAW_ENCODING_RLE, 0, 0, 64, 20);
+    for (k = 0; k < 64 * 20 / 16; k++) {
+        msgs[1][DRAW_HEADER_SIZE + 2 * k] = 16;
+        msgs[1][DRAW_HEADER_SIZE + 2 * k + 1] = (unsigned char)(32 + k);
+    }
+    sizes[1] = DRAW_HEADER_SIZE + 64 * 20 / 16 * 2;
+    // the same size with runs of 5 changed pixels every 8
+    put_header(msgs[2], DRAW_MSG_BITMAP, DRAW_ENCODING_DELTA, 0, 0, 64, 20);
+    for (k = 0; k < 64 * 20 / 8; k++) {
+        msgs[2][DRAW_HEADER_SIZE + 3 * k] = 3;
+        msgs[2][DRAW_HEADER_SIZE + 3 * k + 1] = 5;
+        msgs[2][DRAW_HEADER_SIZE + 3 * k + 2] = (unsigned char)(64 + k);
+    }
+    sizes[2] = DRAW_HEADER_SIZE + 64 * 20 / 8 * 3;
+    // a 96X48 fill
+    put_header(msgs[3], DRAW_MSG_FILL, DRAW_ENCODING_RAW, 0, 0, 96, 48);
+    msgs[3][DRAW_HEADER_SIZE] = 1;
+    sizes[3] = DRAW_HEADER_SIZE + 1;
+    // a 40X40 rectangle
+    msgs[4][0] = 255;
+    msgs[4][1] = 180;
+    msgs[4][2] = 0;
+    sizes[4] = DRAW_RECT_MSG_SIZE;
+
+    start = now_seconds();
+    for (i = 0; i < count; i++) {
+        k = (int)(i % 5);
+        x = (int)((i * 37) % (DISPLAY_WIDTH - 40));
+        y = (int)((i * 23) % (DISPLAY_HEIGHT - 40));
+        if (k == 4) {
+            msgs[4][3] = (unsigned char)(x & 0xff); // the original message has 8-bit corners
+            msgs[4][4] = (unsigned char)y;
+            msgs[4][5] = (unsigned char)((x & 0xff) + 40);
+            msgs[4][6] = (unsigned char)(y + 40);
+        } else {
+            msgs[k][4] = (unsigned char)x;
+            msgs[k][5] = (unsigned char)(x >> 8);
+            msgs[k][6] = (unsigned char)y;
+        }
+        DISPLAY_message(display, msgs[k], sizes[k]);
+        if ((i & 63) == 0 && DISPLAY_present(display, now_ms(), &rect, &wait_ms)) {
+            present(display, front, &rect, &copied);
+        }
+    }
+    print_stats(display, now_seconds() - start, copied);
+}
+
+static void usage(const char *program)
+{
+    printf("Usage: %s [-p port] [-o image.ppm] [-t idle seconds] [-bench messages]\n", program);
+}
+
+int main(int argc, char *argv[])
+{
+    DISPLAY_t display;
+    DISPLAY_rect_t rect;
+    udp_source_t *udp;
+    ring_source_t ring;
+    uint32_t *front;
+    const char *image = NULL;
+    unsigned long bench_messages = 0;
+    unsigned long long copied = 0, last_message_ms;
+    unsigned int wait_ms, timeout_ms;
+    double first = 0, last = 0;
+    int port = PORT, idle_seconds = 0, received, ring_last = 0, i;
+    struct pollfd fd;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            image = argv[++i];
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            idle_seconds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-bench") == 0 && i + 1 < argc) {
+            bench_messages = strtoul(argv[++i], NULL, 10);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    front = (uint32_t *)calloc(DISPLAY_WIDTH * DISPLAY_HEIGHT, sizeof(uint32_t));
+    udp = (udp_source_t *)malloc(sizeof(udp_source_t));
+    if (front == NULL || udp == NULL || DISPLAY_init(&display, DISPLAY_REFRESH_MS) != 0) {
+        printf("Not enough memory for the display\n");
+        return 1;
+    }
+    if (bench_messages != 0) {
+        bench(&display, front, bench_messages);
+    } else {
+        // either source is enough (like in main.cpp, a simulator using the other one is just never heard)
+        udp_open(udp, port);
+        ring_open(&ring);
+        if (udp->socket < 0 && ring.ring == NULL) {
+            return 1;
+        }
+        signal(SIGINT, on_signal);
+        signal(SIGTERM, on_signal);
+        printf("Listening on port %d%s\n", port, (ring.ring != NULL) ? " and on the shared-memory ring" : "");
+        fflush(stdout);
+
+        last_message_ms = now_ms();
+        while (!stop) {
+            received = DISPLAY_drain(&display, receive_ring, &ring);
+            ring_last = (received > 0) ? 1 : ring_last;
+            i = DISPLAY_drain(&display, receive_udp, udp);
+            ring_last = (i > 0) ? 0 : ring_last;
+            received += i;
+            if (received > 0) {
+                last = now_seconds();
+                if (first == 0) {
+                    first = last;
+                }
+                last_message_ms = now_ms();
+            }
+            if (DISPLAY_present(&display, now_ms(), &rect, &wait_ms)) {
+                present(&display, front, &rect, &copied);
+            }
+            if (received != 0) {
+                continue;
+            }
+            if (idle_seconds != 0 && now_ms() - last_message_ms >= (unsigned long long)idle_seconds * 1000) {
+                break;
+            }
+
+            /* Sleeping on the source that delivered last until it gets a message, or the next present is due. A process can't sleep on a
+               futex and a socket at once, so the sleep is cut at POLL_MS, after which the other source is looked at too.
+            */
+            timeout_ms = (wait_ms < POLL_MS) ? wait_ms : POLL_MS;
+            if (ring_last && ring.ring != NULL) {
+                ring_wait(&ring, timeout_ms);
+            } else if (udp->socket >= 0) {
+                fd.fd = udp->socket;
+                fd.events = POLLIN;
+                poll(&fd, 1, (int)timeout_ms);
+            } else {
+                ring_wait(&ring, timeout_ms);
+            }
+        }
+        // the last changes are shown, as the refresh would
+        if (DISPLAY_present(&display, now_ms() + display.refresh_ms, &rect, &wait_ms)) {
+            present(&display, front, &rect, &copied);
+        }
+        print_stats(&display, last - first, copied);
+        if (image != NULL) {
+            write_ppm(image, front);
+        }
+        if (udp->socket >= 0) {
+            close(udp->socket);
+        }
+        if (ring.ring != NULL) {
+            munmap(ring.ring, sizeof(draw_ring_t));
+        }
+    }
+
+    free(udp);
+    free(front);
+    DISPLAY_free(&display);
+    return 0;
+}
@@ -8,6 +8,8 @@ By Allen Sherrod and Wendy Jones
 #include <Gdiplus.h>
 #include <stdio.h>
 #include "udp_listen.h"
+#include "shm_listen.h"
+#include "display_core.h"
 
 #define SCALE 2
 
@@ -17,6 +19,37 @@ HBRUSH hYellow = CreateSolidBrush(RGB(255,255,0));
 LRESULT CALLBACK WndProc( HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam );
 int scale = SCALE;
 
+DISPLAY_t display; // the messages are drawn into its back buffer, which is only copied to the window
+
+// a 32-bit top-down device independent bitmap, describing rows of the back buffer
+BITMAPINFO dib;
+
+
+// copies a rectangle of the back buffer to the window (whole rows of the back buffer are described to GDI, starting at the rectangle's first row)
+void blit(HDC hDC, const DISPLAY_rect_t *rect)
+{
+  dib.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+  dib.bmiHeader.biWidth = DISPLAY_WIDTH;
+  dib.bmiHeader.biHeight = -(LONG)rect->height; // top-down
+  dib.bmiHeader.biPlanes = 1;
+  dib.bmiHeader.biBitCount = 32;
+  dib.bmiHeader.biCompression = BI_RGB;
+  StretchDIBits(hDC, rect->x * scale, rect->y * scale, rect->width * scale, rect->height * scale, rect->x, 0, rect->width, rect->height,
+    &display.back.pixels[(size_t)rect->y * DISPLAY_WIDTH], &dib, DIB_RGB_COLORS, SRCCOPY);
+}
+
+
+int receive_shm(void *user, unsigned char **msg)
+{
+  return SHM_get_msg_non_blocking(msg);
+}
+
+
+int receive_udp(void *user, unsigned char **msg)
+{
+  return UDP_get_msg_non_blocking(msg);
+}
+
 
 int WINAPI wWinMain( HINSTANCE hInstance, HINSTANCE prevInstance, LPWSTR cmdLine, int cmdShow )
 {
@@ -37,7 +70,7 @@ int WINAPI wWinMain( HINSTANCE hInstance, HINSTANCE prevInstance, LPWSTR cmdLine
   if( !RegisterClassEx( &wndClass ) )
     return -1;
 
-  RECT rc = { 0, 0, 511, 511 };
+  RECT rc = { 0, 0, DISPLAY_WIDTH * SCALE - 1, DISPLAY_HEIGHT * SCALE - 1 };
   AdjustWindowRect( &rc, WS_OVERLAPPEDWINDOW, FALSE );
 
   HWND hwnd = CreateWindowA( "VirtualScreenClass", "UDP Virtual Screen",
@@ -49,31 +82,42 @@ int WINAPI wWinMain( HINSTANCE hInstance, HINSTANCE prevInstance, LPWSTR cmdLine
   }
 
   UDP_init(); // initializing udp listener (server)
+  SHM_init(); // and the shared-memory ring, for a simulator using UDP_TRANSPORT_SHARED_MEMORY
+  HDC hDC = GetDC(hwnd);
+  int refresh = GetDeviceCaps(hDC, VREFRESH); // presenting once per refresh of the display (0 or 1 if it isn't known)
+  if (DISPLAY_init(&display, (refresh > 1) ? 1000 / refresh : DISPLAY_REFRESH_MS) != 0) {
+    return -1;
+  }
   ShowWindow( hwnd, cmdShow ); // showing window
 
 
   // Demo Initialize
   MSG msg = { 0 };
-  RECT my_rect;
-  HDC hDC = GetDC(hwnd);
-  unsigned char *buf = NULL;
-  int res;
+  HANDLE events[2] = { SHM_event(), UDP_event() };
+  DISPLAY_rect_t rect;
+  unsigned int wait_ms;
 
   while( msg.message != WM_QUIT ) {
     if( PeekMessage( &msg, 0, 0, 0, PM_REMOVE ) ) {
       TranslateMessage( &msg );
       DispatchMessage( &msg );
-    } else {
-       res = UDP_get_msg_non_blocking(&buf); // checking if a UDP message was received
-       if (res == 0) { // UDP message received
-         HBRUSH color = CreateSolidBrush(RGB((unsigned int)buf[0], (unsigned int)buf[1], (unsigned int)buf[2]));
-         SetRect(&my_rect, (unsigned int)buf[3] * scale, (unsigned int)buf[4]* scale, (unsigned int)buf[5]* scale, (unsigned int)buf[6]* scale);
-         FillRect(hDC, &my_rect, color);
-         DeleteObject(color);
-       }
+      continue;
+    }
+    // everything waiting is drawn into the back buffer (a simulator using the shared-memory ring first), and the window is only updated
+    // once per refresh
+    int received = DISPLAY_drain(&display, receive_shm, NULL) + DISPLAY_drain(&display, receive_udp, NULL);
+    if (DISPLAY_present(&display, GetTickCount64(), &rect, &wait_ms)) {
+      blit(hDC, &rect);
+    }
+    if (received == 0) {
+      // sleeping until a message arrives on either source, the window gets a message, or the next present is due
+      SHM_begin_wait();
+      MsgWaitForMultipleObjects(2, events, FALSE, (wait_ms == DISPLAY_WAIT_IDLE) ? INFINITE : wait_ms, QS_ALLINPUT);
+      SHM_end_wait();
     }
   }
 
+  DISPLAY_free(&display);
   return static_cast<int>( msg.wParam );
 }
 
@@ -86,6 +130,10 @@ LRESULT CALLBACK WndProc( HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam
   switch( message ) {
   case WM_PAINT:
     hDC = BeginPaint( hwnd, &paintStruct );
+    if (display.back.pixels != NULL) {
+      DISPLAY_rect_t all = { 0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT };
+      blit(hDC, &all); // the whole back buffer, since the window may have been covered
+    }
     EndPaint( hwnd, &paintStruct );
     break;
 
@@ -0,0 +1,111 @@
+#include<stdio.h>
+#include<windows.h>
+#include "../draw_protocol.h"
+#include "../draw_ring.h"
+
+HANDLE mapping, event;
+draw_ring_t *ring;
+uint32_t tail; // bytes read so far (published to the simulator after every message)
+unsigned char shm_buf[DRAW_MAX_DATAGRAM];
+
+int SHM_init()
+{
+  // whichever of the simulator and the window starts first creates the ring
+  mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(draw_ring_t), DRAW_RING_NAME);
+  if (mapping == NULL) {
+    printf("CreateFileMapping failed with error code : %lu", GetLastError());
+    return EXIT_FAILURE;
+  }
+  ring = (draw_ring_t *)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(draw_ring_t));
+  event = CreateEventA(NULL, FALSE, FALSE, DRAW_RING_EVENT_NAME);
+  if (ring == NULL || event == NULL) {
+    printf("Mapping the ring failed with error code : %lu", GetLastError());
+    return EXIT_FAILURE;
+  }
+  if (ring->magic == 0) {
+    ring->version = DRAW_RING_VERSION;
+    ring->magic = DRAW_RING_MAGIC;
+  } else if (ring->magic != DRAW_RING_MAGIC || ring->version != DRAW_RING_VERSION) {
+    printf("Unknown ring version : %u", ring->version);
+    UnmapViewOfFile(ring);
+    ring = NULL;
+    return EXIT_FAILURE;
+  }
+
+  // the messages written before the window was opened are skipped, like the datagrams sent before it listened
+  tail = (uint32_t)DRAW_RING_load(&ring->head);
+  DRAW_RING_store(&ring->tail, tail);
+  return 0;
+} /* SHM_init */
+
+
+void SHM_terminate(void)
+{
+  if (ring != NULL) {
+    UnmapViewOfFile(ring);
+  }
+  if (event != NULL) {
+    CloseHandle(event);
+  }
+  if (mapping != NULL) {
+    CloseHandle(mapping);
+  }
+  ring = NULL;
+} /* SHM_terminate */
+
+
+int SHM_get_msg_non_blocking(unsigned char **buffer)
+{
+  unsigned char length[DRAW_RING_RECORD_SIZE];
+  uint32_t head, size;
+
+  *buffer = shm_buf;
+  if (ring == NULL) {
+    return -1;
+  }
+  head = (uint32_t)DRAW_RING_load(&ring->head);
+  if (head == tail) {
+    return -1;
+  }
+  DRAW_ring_read(ring, tail, length, DRAW_RING_RECORD_SIZE);
+  size = length[0] | (length[1] << 8);
+  if (size == 0 || size > DRAW_MAX_DATAGRAM || size > head - tail - DRAW_RING_RECORD_SIZE) {
+    tail = head; // not a record the simulator wrote, so everything up to head is skipped
+    DRAW_RING_store(&ring->tail, tail);
+    return -1;
+  }
+  DRAW_ring_read(ring, tail + DRAW_RING_RECORD_SIZE, shm_buf, size);
+  tail += DRAW_RING_RECORD_SIZE + size;
+  DRAW_RING_store(&ring->tail, tail);
+  return (int)size;
+} /* SHM_get_msg_non_blocking */
+
+
+HANDLE SHM_event(void)
+{
+  if (event == NULL) {
+    event = CreateEvent(NULL, FALSE, FALSE, NULL); // never signaled if the ring couldn't be mapped
+  }
+  return event;
+} /* SHM_event */
+
+
+void SHM_begin_wait(void)
+{
+  if (ring == NULL) {
+    return;
+  }
+  // waiting is set before head is looked at again, so the simulator either sees it and signals the event, or wrote before the look
+  DRAW_RING_store(&ring->waiting, 1);
+  if ((uint32_t)DRAW_RING_load(&ring->head) != tail) {
+    SetEvent(event);
+  }
+} /* SHM_begin_wait */
+
+
+void SHM_end_wait(void)
+{
+  if (ring != NULL) {
+    DRAW_RING_store(&ring->waiting, 0);
+  }
+} /* SHM_end_wait */
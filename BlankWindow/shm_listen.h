@@ -0,0 +1,11 @@
+int SHM_init();
+void SHM_terminate(void);
+
+int SHM_get_msg_non_blocking(unsigned char **buffer); // the next message of the shared-memory ring, returns its length (-1 if there is none)
+
+// an event signaled when the simulator writes to the ring, once SHM_begin_wait was called
+HANDLE SHM_event(void);
+
+// tells the simulator to signal the event (which is signaled right away if the ring isn't empty), and stops it once the wait is over
+void SHM_begin_wait(void);
+void SHM_end_wait(void);
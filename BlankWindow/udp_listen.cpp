@@ -1,16 +1,19 @@
 #include<stdio.h>
 #include<winsock2.h>
+#include "../draw_protocol.h"
 
 #pragma comment(lib,"ws2_32.lib") // Winsock Library
 
-#define BUFLEN 64	// Max length of buffer
+#define BUFLEN DRAW_MAX_DATAGRAM	// Max length of buffer (the longest message draw.c sends)
 #define PORT 9999 // The port on which to listen for incoming data
+#define RCVBUF (4 * 1024 * 1024) // the socket's receive buffer, which holds a burst of datagrams while the window is busy
 
 SOCKET s;
 struct sockaddr_in server, si_other;
 int slen , recv_len;
 unsigned char buf[BUFLEN];
 WSADATA wsa;
+HANDLE recv_event; // signaled when datagrams arrive
 
 int UDP_init()
 {
@@ -39,6 +42,14 @@ int UDP_init()
 		//exit(EXIT_FAILURE);
     return EXIT_FAILURE;
 	}
+
+  int size = RCVBUF;
+  setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char *)&size, sizeof(size));
+  // an auto-reset event, signaled whenever a datagram arrives after the socket was found empty (this also makes the socket non-blocking)
+  if (recv_event == NULL) {
+    recv_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+  }
+  WSAEventSelect(s, recv_event, FD_READ);
   return 0;
 } /* UDP_init */
 
@@ -59,27 +70,24 @@ unsigned char *UDP_get_msg(void)
 
 int UDP_get_msg_non_blocking(unsigned char **buffer)
 {
-    struct timeval timeout;
-    struct fd_set fds;
-    int res;
-
     *buffer = buf; // setting buffer pointer
-    timeout.tv_sec = 0; // 0 seconds
-    timeout.tv_usec = 10; // 10 useconds
-
-    // Setup fd_set structure
-    FD_ZERO(&fds);
-    FD_SET(s, &fds); // Return value: -1: error occurred 0: timed out > 0: data ready to be read
-    res = select(0, &fds, 0, 0, &timeout);
-    if (res <= 0) {
-      return -1; // -1 means an error had occured
-    } else {
-      recv_len = recvfrom(s, (char *)buf, BUFLEN, 0, (struct sockaddr *) &si_other, &slen);
-      if (recv_len <= 0) { // reinitializing UPD server in case of socket error
-        UDP_terminate();
-        UDP_init();
-        return -1;
-      }
-      return 0; // 0 means a valid message was received
+    recv_len = recvfrom(s, (char *)buf, BUFLEN, 0, (struct sockaddr *) &si_other, &slen);
+    if (recv_len == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK) {
+      return -1; // no datagram is waiting
+    }
+    if (recv_len <= 0) { // reinitializing UPD server in case of socket error
+      UDP_terminate();
+      UDP_init();
+      return -1;
     }
+    return recv_len; // the length of the valid message that was received
 } /* UDP_get_msg_non_blocking */
+
+
+HANDLE UDP_event(void)
+{
+  if (recv_event == NULL) {
+    recv_event = CreateEvent(NULL, FALSE, FALSE, NULL); // never signaled if the socket couldn't be created
+  }
+  return recv_event;
+} /* UDP_event */
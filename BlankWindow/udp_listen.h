@@ -3,4 +3,5 @@ int UDP_init();
 void UDP_terminate(void);
 
 unsigned char *UDP_get_msg(void); // blocking until message is ready (not used here)
-int UDP_get_msg_non_blocking(unsigned char **buffer); // non blockign polling of message
+int UDP_get_msg_non_blocking(unsigned char **buffer); // non blockign polling of message, returns its length (-1 if there is none)
+HANDLE UDP_event(void); // an event signaled when datagrams arrive
@@ -1,94 +1,451 @@
 #include<stdio.h>
+#include<string.h>
 #include "draw.h"
+#include "draw_protocol.h"
+#include "draw_queue.h"
+#include "headless.h"
 #include "udp.h"
 
-#define DRAW_MSG_SIZE 7 // 3 bytes for color (r, g, b) 2 bytes for (x1,y1), 2 bytes for (x2,y2) 
+// the area of BlankWindow's screen the draw module keeps a copy of (the 256X256 pixels of the original messages, and the 320X200 of mode 13H)
+#define DRAW_CANVAS_WIDTH  320
+#define DRAW_CANVAS_HEIGHT 256
+#define DRAW_TILE_SIZE     16 // the canvas is compared with what BlankWindow shows a tile of DRAW_TILE_SIZE X DRAW_TILE_SIZE pixels at a time
+#define DRAW_TILES_X       (DRAW_CANVAS_WIDTH / DRAW_TILE_SIZE)
+#define DRAW_TILES_Y       (DRAW_CANVAS_HEIGHT / DRAW_TILE_SIZE)
 
-unsigned char msg[DRAW_MSG_SIZE];
+unsigned char msg[DRAW_MAX_DATAGRAM]; // the message being built (a 7-byte rectangle message, or a versioned one)
+static unsigned char delta_payload[DRAW_MAX_PAYLOAD]; // where the delta encoding is built, while the run-length encoding is built in msg
 
+// the canvas as drawn so far, and as last sent to BlankWindow (both start black, like its window), as color indices
+static unsigned char canvas[DRAW_CANVAS_HEIGHT][DRAW_CANVAS_WIDTH];
+static unsigned char shown[DRAW_CANVAS_HEIGHT][DRAW_CANVAS_WIDTH];
+static unsigned char touched[DRAW_TILES_Y][DRAW_TILES_X]; // tiles of the canvas drawn on since the last flush
+static unsigned int num_touched;
+static int resync; // a message was dropped from the full queue, so the next flush sends the whole canvas
+static int headless; // the messages are drawn by the headless display instead of being sent to BlankWindow
+
+// an encoding of rows of pixels into a payload, which is built a row at a time
 typedef struct {
-	unsigned char R;
-	unsigned char G;
-	unsigned char B;
-} pixel_rgb_t;
-
-// VGA Mode-13H palette (total of 256 colors)
-pixel_rgb_t palette[] = {
-	{  0,  0,  0}, {  0,  0,170}, {  0,170,  0}, {  0,170,170}, {170,  0,  0}, {170,  0,170}, {170, 85,  0}, {170,170,170},
-	{ 85, 85, 85}, { 85, 85,255}, { 85,255, 85}, { 85,255,255}, {255, 85, 85}, {255, 85,255}, {255,255, 85}, {255,255,255}, 
-	{  0,  0,  0}, { 20, 20, 20}, { 32, 32, 32}, { 44, 44, 44}, { 56, 56, 56}, { 68, 68, 68}, { 80, 80, 80}, { 97, 97, 97}, 
-	{113,113,113}, {129,129,129}, {145,145,145}, {161,161,161}, {182,182,182}, {202,202,202}, {226,226,226}, {255,255,255}, 
-	{  0,  0,255}, { 64,  0,255}, {125,  0,255}, {190,  0,255}, {255,  0,255}, {255,  0,190}, {255,  0,125}, {255,  0, 64}, 
-	{255,  0,  0}, {255, 64,  0}, {255,125,  0}, {255,190,  0}, {255,255,  0}, {190,255,  0}, {125,255,  0}, { 64,255,  0}, 
-	{  0,255,  0}, {  0,255, 64}, {  0,255,125}, {  0,255,190}, {  0,255,255}, {  0,190,255}, {  0,125,255}, {  0, 64,255}, 
-	{125,125,255}, {157,125,255}, {190,125,255}, {222,125,255}, {255,125,255}, {255,125,222}, {255,125,190}, {255,125,157}, 
-	{255,125,125}, {255,157,125}, {255,190,125}, {255,222,125}, {255,255,125}, {222,255,125}, {190,255,125}, {157,255,125}, 
-	{125,255,125}, {125,255,157}, {125,255,190}, {125,255,222}, {125,255,255}, {125,222,255}, {125,190,255}, {125,157,255}, 
-	{182,182,255}, {198,182,255}, {218,182,255}, {234,182,255}, {255,182,255}, {255,182,234}, {255,182,218}, {255,182,198}, 
-	{255,182,182}, {255,198,182}, {255,218,182}, {255,234,182}, {255,255,182}, {234,255,182}, {218,255,182}, {198,255,182}, 
-	{182,255,182}, {182,255,198}, {182,255,218}, {182,255,234}, {182,255,255}, {182,234,255}, {182,218,255}, {182,198,255}, 
-	{  0,  0,113}, { 28,  0,113}, { 56,  0,113}, { 85,  0,113}, {113,  0,113}, {113,  0, 85}, {113,  0, 56}, {113,  0, 28}, 
-	{113,  0,  0}, {113, 28,  0}, {113, 56,  0}, {113, 85,  0}, {113,113,  0}, { 85,113,  0}, { 56,113,  0}, { 28,113,  0}, 
-	{  0,113,  0}, {  0,113, 28}, {  0,113, 56}, {  0,113, 85}, {  0,113,113}, {  0, 85,113}, {  0, 56,113}, {  0, 28,113}, 
-	{ 56, 56,113}, { 68, 56,113}, { 85, 56,113}, { 97, 56,113}, {113, 56,113}, {113, 56, 97}, {113, 56, 85}, {113, 56, 68}, 
-	{113, 56, 56}, {113, 68, 56}, {113, 85, 56}, {113, 97, 56}, {113,113, 56}, { 97,113, 56}, { 85,113, 56}, { 68,113, 56}, 
-	{ 56,113, 56}, { 56,113, 68}, { 56,113, 85}, { 56,113, 97}, { 56,113,113}, { 56, 97,113}, { 56, 85,113}, { 56, 68,113}, 
-	{ 80, 80,113}, { 89, 80,113}, { 97, 80,113}, {105, 80,113}, {113, 80,113}, {113, 80,105}, {113, 80, 97}, {113, 80, 89}, 
-	{113, 80, 80}, {113, 89, 80}, {113, 97, 80}, {113,105, 80}, {113,113, 80}, {105,113, 80}, { 97,113, 80}, { 89,113, 80}, 
-	{ 80,113, 80}, { 80,113, 89}, { 80,113, 97}, { 80,113,105}, { 80,113,113}, { 80,105,113}, { 80, 97,113}, { 80, 89,113}, 
-	{  0,  0, 64}, { 16,  0, 64}, { 32,  0, 64}, { 48,  0, 64}, { 64,  0, 64}, { 64,  0, 48}, { 64,  0, 32}, { 64,  0, 16}, 
-	{ 64,  0,  0}, { 64, 16,  0}, { 64, 32,  0}, { 64, 48,  0}, { 64, 64,  0}, { 48, 64,  0}, { 32, 64,  0}, { 16, 64,  0}, 
-	{  0, 64,  0}, {  0, 64, 16}, {  0, 64, 32}, {  0, 64, 48}, {  0, 64, 64}, {  0, 48, 64}, {  0, 32, 64}, {  0, 16, 64}, 
-	{ 32, 32, 64}, { 40, 32, 64}, { 48, 32, 64}, { 56, 32, 64}, { 64, 32, 64}, { 64, 32, 56}, { 64, 32, 48}, { 64, 32, 40}, 
-	{ 64, 32, 32}, { 64, 40, 32}, { 64, 48, 32}, { 64, 56, 32}, { 64, 64, 32}, { 56, 64, 32}, { 48, 64, 32}, { 40, 64, 32}, 
-	{ 32, 64, 32}, { 32, 64, 40}, { 32, 64, 48}, { 32, 64, 56}, { 32, 64, 64}, { 32, 56, 64}, { 32, 48, 64}, { 32, 40, 64}, 
-	{ 44, 44, 64}, { 48, 44, 64}, { 52, 44, 64}, { 60, 44, 64}, { 64, 44, 64}, { 64, 44, 60}, { 64, 44, 52}, { 64, 44, 48}, 
-	{ 64, 44, 44}, { 64, 48, 44}, { 64, 52, 44}, { 64, 60, 44}, { 64, 64, 44}, { 60, 64, 44}, { 52, 64, 44}, { 48, 64, 44}, 
-	{ 44, 64, 44}, { 44, 64, 48}, { 44, 64, 52}, { 44, 64, 60}, { 44, 64, 64}, { 44, 60, 64}, { 44, 52, 64}, { 44, 48, 64}, 
-	{  0,  0,  0}, {  0,  0,  0}, {  0,  0,  0}, {  0,  0,  0}, {  0,  0,  0}, {  0,  0,  0}, {  0,  0,  0}, {  0,  0,  0}
-};
+  unsigned char *payload;
+  unsigned int used; // bytes written to the payload
+  unsigned int run; // length of the last run, which isn't written until it ends (0 if there is none)
+  unsigned char index; // color index of the last run
+  unsigned int skip; // (delta encoding) unchanged pixels before the last run
+  unsigned int content; // (delta encoding) bytes up to the end of the last run that draws pixels (the runs that only skip may follow it)
+} encoder_t;
 
 
 void DRAW_init(void)
 {
   UDP_init();
+  QUEUE_init();
 } /* DRAW_init */
 
 
+int DRAW_init_headless(const char *path, int format)
+{
+  if (HEADLESS_init(path, format) != 0) {
+    return -1;
+  }
+  headless = 1;
+  resync = 1; // the image starts black, so the canvas drawn so far (e.g. before an earlier DRAW_terminate) is drawn into it whole at the next flush
+  return 0;
+} /* DRAW_init_headless */
+
+
 void DRAW_terminate(void)
 {
+  DRAW_flush();
+  if (headless) {
+    HEADLESS_terminate();
+    headless = 0;
+    return;
+  }
+  QUEUE_terminate();
   UDP_terminate();
 } /* DRAW_terminate */
 
 
-void DRAW_rectangle(unsigned char color, unsigned char x, unsigned char y, unsigned char width, unsigned char height)
+void DRAW_set_queue_policy(int policy)
 {
-	msg[0] = palette[color].R;
-	msg[1] = palette[color].G;
-	msg[2] = palette[color].B;
-	msg[3] = x;
-	msg[4] = y;
-	msg[5] = x + width;
-	msg[6] = y + height;
+  QUEUE_set_policy(policy);
+} /* DRAW_set_queue_policy */
+
+
+void DRAW_get_queue_stats(DRAW_queue_stats_t *stats)
+{
+  QUEUE_get_stats(stats);
+} /* DRAW_get_queue_stats */
+
+
+// hands a message to the sender thread (or draws it right away on the headless display)
+static void send_msg(int msg_size)
+{
+  if (headless) {
+    HEADLESS_message(msg, msg_size);
+    return;
+  }
+  if (QUEUE_send(msg, msg_size) != 0) { // this message or the oldest queued one was dropped
+    resync = 1;
+  }
+} /* send_msg */
+
 
-  UDP_send(msg, DRAW_MSG_SIZE);
+// stores a 16-bit field of a message in little-endian order
+static void put16(unsigned char *p, unsigned int value)
+{
+  p[0] = (unsigned char)value;
+  p[1] = (unsigned char)(value >> 8);
+} /* put16 */
+
+
+static void write_header(unsigned char type, unsigned char encoding, unsigned int x, unsigned int y, unsigned int width, unsigned int height)
+{
+  msg[0] = DRAW_MSG_MAGIC;
+  msg[1] = DRAW_PROTOCOL_VERSION;
+  msg[2] = type;
+  msg[3] = encoding;
+  put16(&msg[4], x);
+  put16(&msg[6], y);
+  put16(&msg[8], width);
+  put16(&msg[10], height);
+} /* write_header */
+
+
+/* Clips a rectangle to the canvas. Returns 0 if nothing of it is left. If shadow is set, the rectangle must also lie wholly inside the canvas,
+   since only such drawing is kept for the next flush (anything else is sent right away).
+*/
+static int clip(unsigned int *x, unsigned int *y, unsigned int *width, unsigned int *height, int shadow)
+{
+  if (shadow) {
+    return *x + *width <= DRAW_CANVAS_WIDTH && *y + *height <= DRAW_CANVAS_HEIGHT;
+  }
+  if (*x >= DRAW_CANVAS_WIDTH || *y >= DRAW_CANVAS_HEIGHT) {
+    return 0;
+  }
+  if (*x + *width > DRAW_CANVAS_WIDTH) {
+    *width = DRAW_CANVAS_WIDTH - *x;
+  }
+  if (*y + *height > DRAW_CANVAS_HEIGHT) {
+    *height = DRAW_CANVAS_HEIGHT - *y;
+  }
+  return 1;
+} /* clip */
+
+
+// marks the tiles of a rectangle inside the canvas as drawn on
+static void touch(unsigned int x, unsigned int y, unsigned int width, unsigned int height)
+{
+  unsigned int tx, ty;
+
+  for (ty = y / DRAW_TILE_SIZE; ty <= (y + height - 1) / DRAW_TILE_SIZE; ty++) {
+    for (tx = x / DRAW_TILE_SIZE; tx <= (x + width - 1) / DRAW_TILE_SIZE; tx++) {
+      if (!touched[ty][tx]) {
+        touched[ty][tx] = 1;
+        num_touched++;
+      }
+    }
+  }
+} /* touch */
+
+
+// sends a rectangle filled with a single color right away
+static void send_rectangle(unsigned char color, unsigned int x, unsigned int y, unsigned int width, unsigned int height)
+{
+  if (x + width <= 0xff && y + height <= 0xff) {
+    // the original message, for the rectangles whose corners fit in a byte
+    msg[0] = DRAW_palette[color].R;
+    msg[1] = DRAW_palette[color].G;
+    msg[2] = DRAW_palette[color].B;
+    msg[3] = (unsigned char)x;
+    msg[4] = (unsigned char)y;
+    msg[5] = (unsigned char)(x + width);
+    msg[6] = (unsigned char)(y + height);
+    send_msg(DRAW_RECT_MSG_SIZE);
+  } else {
+    write_header(DRAW_MSG_FILL, DRAW_ENCODING_RAW, x, y, width, height);
+    msg[DRAW_HEADER_SIZE] = color;
+    send_msg(DRAW_HEADER_SIZE + 1);
+  }
+} /* send_rectangle */
+
+
+void DRAW_rectangle(unsigned char color, uint16_t x, uint16_t y, uint16_t width, uint16_t height)
+{
+  unsigned int cx = x, cy = y, cwidth = width, cheight = height, row;
+
+  if (width == 0 || height == 0) {
+    return; // nothing to draw
+  }
+
+  if (clip(&cx, &cy, &cwidth, &cheight, 1) && (unsigned int)width * height < DRAW_TILE_SIZE * DRAW_TILE_SIZE) {
+    // a small rectangle is drawn on the canvas, and sent with the rest of the frame
+    for (row = cy; row < cy + cheight; row++) {
+      memset(&canvas[row][cx], color, cwidth);
+    }
+    touch(cx, cy, cwidth, cheight);
+    return;
+  }
+
+  // a large fill is sent right away as a single message, and BlankWindow shows the part of it on the canvas from now on
+  send_rectangle(color, x, y, width, height);
+  if (clip(&cx, &cy, &cwidth, &cheight, 0)) {
+    for (row = cy; row < cy + cheight; row++) {
+      memset(&canvas[row][cx], color, cwidth);
+      memset(&shown[row][cx], color, cwidth);
+    }
+  }
 } /* DRAW_rectangle */
 
 
-void DRAW_pixel(unsigned char color, unsigned char x, unsigned char y)
+void DRAW_pixel(unsigned char color, uint16_t x, uint16_t y)
 {
   DRAW_rectangle(color, x, y, 1, 1); // a pixel is a 1X1 sized rectangle
 } /* DRAW_pixel */
 
 
-void DRAW_bitmap(unsigned char *bitmap, unsigned char x, unsigned char y, unsigned char width, unsigned char height)
+// writes the last run to the payload (at most DRAW_ENTRY_SIZE bytes, which the encoders always leave room for)
+static void end_run(encoder_t *e, int encoding)
+{
+  if (e->run == 0) {
+    return;
+  }
+  if (encoding == DRAW_ENCODING_DELTA) {
+    e->payload[e->used++] = (unsigned char)e->skip;
+    e->skip = 0;
+  }
+  e->payload[e->used++] = (unsigned char)e->run;
+  e->payload[e->used++] = e->index;
+  e->run = 0;
+  e->content = e->used;
+} /* end_run */
+
+
+/* Appends a row of pixels to an encoding (DRAW_ENCODING_RLE, or DRAW_ENCODING_DELTA against the previous pixels of the row).
+   Returns 0 if the row doesn't fit in the payload (while still leaving room for the last run).
+*/
+static int encode_row(encoder_t *e, int encoding, const unsigned char *pixels, const unsigned char *previous, unsigned int count)
 {
-  unsigned char col, row;
-  
-  for (row = 0; row < height; row++) {
-    for (col = 0; col < width; col++) {
-      DRAW_pixel(*bitmap, x + col, y + row);
-  	  bitmap++;
+  unsigned int entry = (encoding == DRAW_ENCODING_DELTA) ? 3 : 2; // bytes of a run
+  // room for ending the last run, for a run that only skips pixels, and for the run a new pixel starts
+  unsigned int room = (encoding == DRAW_ENCODING_DELTA) ? 3 * entry : 2 * entry;
+  unsigned int i;
+
+  for (i = 0; i < count; i++) {
+    if (e->run != 0 && pixels[i] == e->index && e->run < DRAW_RLE_MAX_RUN) {
+      e->run++; // continuing the run (in the delta encoding, over an unchanged pixel of the same color as well)
+      continue;
+    }
+    if (e->used + room > DRAW_MAX_PAYLOAD) {
+      return 0;
+    }
+    end_run(e, encoding);
+    if (encoding == DRAW_ENCODING_DELTA && pixels[i] == previous[i]) {
+      if (e->skip == DRAW_RLE_MAX_RUN) {
+        // a run of no pixels, to skip more than a byte can count
+        e->payload[e->used++] = DRAW_RLE_MAX_RUN;
+        e->payload[e->used++] = 0;
+        e->payload[e->used++] = 0;
+        e->skip = 0;
+      }
+      e->skip++;
+      continue;
+    }
+    e->index = pixels[i];
+    e->run = 1;
+  }
+  return e->used + entry <= DRAW_MAX_PAYLOAD;
+} /* encode_row */
+
+
+// encodes as many rows as fit in a message, and returns their number
+static unsigned int encode_rows(encoder_t *e, int encoding, const unsigned char *pixels, const unsigned char *previous, unsigned int stride,
+                                unsigned int width, unsigned int height)
+{
+  encoder_t saved;
+  unsigned int rows = 0;
+
+  while (rows < height) {
+    saved = *e;
+    if (!encode_row(e, encoding, pixels + (size_t)rows * stride, (previous != NULL) ? previous + (size_t)rows * stride : NULL, width)) {
+      *e = saved; // dropping the part of the row that was written
+      break;
+    }
+    rows++;
+  }
+  end_run(e, encoding);
+  if (encoding == DRAW_ENCODING_DELTA) {
+    e->used = e->content; // the pixels after the last run are unchanged anyway
+  }
+  return rows;
+} /* encode_rows */
+
+
+/* Sends the first rows of a bitmap strip (at most width X height pixels, whose rows are stride bytes apart) in a single message, in the encoding that
+   carries the most rows (or the same rows in the fewest bytes): raw, run-length encoded, or (if the pixels BlankWindow shows there are given) only
+   the runs of pixels which changed. Returns the number of rows sent.
+*/
+static unsigned int send_rows(const unsigned char *pixels, const unsigned char *previous, unsigned int stride, unsigned int x, unsigned int y,
+                              unsigned int width, unsigned int height)
+{
+  encoder_t rle, delta;
+  unsigned int raw_rows = DRAW_MAX_PAYLOAD / width;
+  unsigned int rle_rows, delta_rows = 0, row;
+
+  if (raw_rows > height) {
+    raw_rows = height;
+  }
+  memset(&rle, 0, sizeof(rle));
+  rle.payload = msg + DRAW_HEADER_SIZE;
+  rle_rows = encode_rows(&rle, DRAW_ENCODING_RLE, pixels, NULL, stride, width, height);
+  if (previous != NULL) {
+    memset(&delta, 0, sizeof(delta));
+    delta.payload = delta_payload;
+    delta_rows = encode_rows(&delta, DRAW_ENCODING_DELTA, pixels, previous, stride, width, height);
+  }
+
+  if (delta_rows > 0 && delta_rows >= rle_rows && delta_rows >= raw_rows &&
+      (delta_rows > rle_rows || delta.used <= rle.used) && (delta_rows > raw_rows || delta.used <= raw_rows * width)) {
+    if (delta.used != 0) { // nothing changed in these rows otherwise
+      memcpy(msg + DRAW_HEADER_SIZE, delta_payload, delta.used);
+      write_header(DRAW_MSG_BITMAP, DRAW_ENCODING_DELTA, x, y, width, delta_rows);
+      send_msg(DRAW_HEADER_SIZE + delta.used);
+    }
+    return delta_rows;
+  }
+  if (rle_rows > raw_rows || (rle_rows == raw_rows && rle.used < raw_rows * width)) {
+    write_header(DRAW_MSG_BITMAP, DRAW_ENCODING_RLE, x, y, width, rle_rows);
+    send_msg(DRAW_HEADER_SIZE + rle.used);
+    return rle_rows;
+  }
+
+  for (row = 0; row < raw_rows; row++) {
+    memcpy(msg + DRAW_HEADER_SIZE + row * width, pixels + (size_t)row * stride, width);
+  }
+  write_header(DRAW_MSG_BITMAP, DRAW_ENCODING_RAW, x, y, width, raw_rows);
+  send_msg(DRAW_HEADER_SIZE + raw_rows * width);
+  return raw_rows;
+} /* send_rows */
+
+
+// sends a bitmap (whose rows are stride bytes apart) right away, in as few messages as possible
+static void send_bitmap(const unsigned char *pixels, const unsigned char *previous, unsigned int stride, unsigned int x, unsigned int y,
+                        unsigned int width, unsigned int height)
+{
+  unsigned int col, row, strip_width;
+
+  // a strip of columns at a time (the whole bitmap, unless a row doesn't fit in a message), and as many of its rows as fit in each message
+  for (col = 0; col < width; col += strip_width) {
+    strip_width = width - col;
+    if (strip_width > DRAW_MAX_PAYLOAD) {
+      strip_width = DRAW_MAX_PAYLOAD;
+    }
+    for (row = 0; row < height; ) {
+      row += send_rows(pixels + (size_t)row * stride + col, (previous != NULL) ? previous + (size_t)row * stride + col : NULL, stride,
+                       x + col, y + row, strip_width, height - row);
+    }
+  }
+} /* send_bitmap */
+
+
+void DRAW_bitmap(const unsigned char *bitmap, uint16_t x, uint16_t y, uint16_t width, uint16_t height)
+{
+  unsigned int cx = x, cy = y, cwidth = width, cheight = height, row;
+
+  if (width == 0 || height == 0) {
+    return;
+  }
+
+  if (clip(&cx, &cy, &cwidth, &cheight, 1)) {
+    // drawn on the canvas, and sent with the rest of the frame
+    for (row = 0; row < height; row++) {
+      memcpy(&canvas[y + row][x], bitmap + (size_t)row * width, width);
+    }
+    touch(x, y, width, height);
+    return;
+  }
+
+  // a bitmap which doesn't fit in the canvas is sent right away, and BlankWindow shows the part of it on the canvas from now on
+  send_bitmap(bitmap, NULL, width, x, y, width, height);
+  if (clip(&cx, &cy, &cwidth, &cheight, 0)) {
+    for (row = 0; row < cheight; row++) {
+      memcpy(&canvas[cy + row][cx], bitmap + (size_t)row * width, cwidth);
+      memcpy(&shown[cy + row][cx], bitmap + (size_t)row * width, cwidth);
     }
   }
 } /* DRAW_bitmap */
+
+
+// returns whether a tile of the canvas differs from what BlankWindow shows
+static int tile_changed(unsigned int tx, unsigned int ty)
+{
+  unsigned int row;
+
+  for (row = ty * DRAW_TILE_SIZE; row < (ty + 1) * DRAW_TILE_SIZE; row++) {
+    if (memcmp(&canvas[row][tx * DRAW_TILE_SIZE], &shown[row][tx * DRAW_TILE_SIZE], DRAW_TILE_SIZE) != 0) {
+      return 1;
+    }
+  }
+  return 0;
+} /* tile_changed */
+
+
+// sends the tiles of the canvas which changed since the last flush
+static void flush_tiles(void)
+{
+  unsigned char changed[DRAW_TILES_Y][DRAW_TILES_X];
+  unsigned int tx, ty, last_tx, last_ty, i, row, x, y, width;
+  int full;
+
+  if ((num_touched == 0 && !resync) || (resync && QUEUE_full())) {
+    return;
+  }
+  // after a message was dropped, what BlankWindow shows isn't known anymore, so every tile is sent, and without the delta encoding
+  full = resync;
+  resync = 0;
+  for (ty = 0; ty < DRAW_TILES_Y; ty++) {
+    for (tx = 0; tx < DRAW_TILES_X; tx++) {
+      changed[ty][tx] = full || (touched[ty][tx] && tile_changed(tx, ty));
+    }
+  }
+  memset(touched, 0, sizeof(touched));
+  num_touched = 0;
+
+  // every run of changed tiles in a row of tiles, together with the same tiles of the rows below it as long as they all changed too, is sent
+  // as one bitmap, encoded against what BlankWindow shows there
+  for (ty = 0; ty < DRAW_TILES_Y; ty++) {
+    for (tx = 0; tx < DRAW_TILES_X; tx++) {
+      if (!changed[ty][tx]) {
+        continue;
+      }
+      for (last_tx = tx; last_tx + 1 < DRAW_TILES_X && changed[ty][last_tx + 1]; last_tx++);
+      for (last_ty = ty; last_ty + 1 < DRAW_TILES_Y; last_ty++) {
+        for (i = tx; i <= last_tx && changed[last_ty + 1][i]; i++);
+        if (i <= last_tx) {
+          break;
+        }
+      }
+      for (row = ty; row <= last_ty; row++) {
+        memset(&changed[row][tx], 0, last_tx - tx + 1);
+      }
+
+      x = tx * DRAW_TILE_SIZE;
+      y = ty * DRAW_TILE_SIZE;
+      width = (last_tx - tx + 1) * DRAW_TILE_SIZE;
+      send_bitmap(&canvas[y][x], full ? NULL : &shown[y][x], DRAW_CANVAS_WIDTH, x, y, width, (last_ty - ty + 1) * DRAW_TILE_SIZE);
+      for (row = y; row < (last_ty + 1) * DRAW_TILE_SIZE; row++) {
+        memcpy(&shown[row][x], &canvas[row][x], width);
+      }
+      tx = last_tx;
+    }
+  }
+} /* flush_tiles */
+
+
+void DRAW_flush(void)
+{
+  flush_tiles();
+  if (headless) {
+    HEADLESS_frame();
+  }
+} /* DRAW_flush */
@@ -1,7 +1,47 @@
+#ifndef __DRAW_H
+#define __DRAW_H
+
+#include <stdint.h>
 
 void DRAW_init(void);
 void DRAW_terminate(void);
 
-void DRAW_rectangle(unsigned char color, unsigned char x, unsigned char y, unsigned char width, unsigned char height);
-void DRAW_pixel(unsigned char color, unsigned char x, unsigned char y);
-void DRAW_bitmap(unsigned char *bitmap, unsigned char x, unsigned char y, unsigned char width, unsigned char height);
+// the formats of the headless display's frames
+#define DRAW_HEADLESS_PPM 0
+#define DRAW_HEADLESS_PNG 1
+#define DRAW_HEADLESS_Y4M 2
+
+// Initializes the DRAW module without BlankWindow (instead of DRAW_init): the messages are drawn in-process, and every frame is written to path
+// in the format (see headless.h). Returns 0 on success, and -1 (after printing why) if the output can't be created. End with DRAW_terminate.
+int DRAW_init_headless(const char *path, int format);
+
+void DRAW_rectangle(unsigned char color, uint16_t x, uint16_t y, uint16_t width, uint16_t height);
+void DRAW_pixel(unsigned char color, uint16_t x, uint16_t y);
+void DRAW_bitmap(const unsigned char *bitmap, uint16_t x, uint16_t y, uint16_t width, uint16_t height);
+
+// Pixels, small rectangles and bitmaps are drawn on a copy of the canvas, and sent when the frame ends: DRAW_flush compares the tiles that were drawn
+// on with what BlankWindow shows, and sends only the ones that changed (see draw_protocol.h). Large rectangles, and anything outside the copy, are sent right away.
+void DRAW_flush(void);
+
+// what happens when the queue of messages waiting for the sender thread is full (see DRAW_set_queue_policy)
+#define DRAW_QUEUE_BLOCK       0 // drawing waits until the sender thread makes room, so nothing is lost
+#define DRAW_QUEUE_DROP_OLDEST 1 // the oldest queued message is dropped, and the whole canvas is sent once there is room, in place of what was lost
+#define DRAW_QUEUE_COALESCE    2 // the new message is dropped, and the whole canvas is sent once there is room, in place of everything lost
+
+typedef struct {
+  unsigned long long messages; // messages drawn
+  unsigned long long datagrams; // datagrams sent (each packing one message or more)
+  unsigned long long sends; // calls to UDP_send_many (each sending one datagram or more)
+  unsigned long long stalls; // times drawing waited for room in the queue
+  unsigned long long dropped; // messages dropped from a full queue
+  unsigned long long lost; // datagrams lost to socket errors (after one, the sends back off for a while, see udp.h)
+} DRAW_queue_stats_t;
+
+// The messages are sent by a thread of their own, so drawing never waits for the network unless the queue is full and the policy is DRAW_QUEUE_BLOCK
+// (the default is DRAW_QUEUE_COALESCE). Can be called at any time, from the thread drawing.
+void DRAW_set_queue_policy(int policy);
+
+// the statistics of the queue (the datagrams and sends are only final once DRAW_terminate returns)
+void DRAW_get_queue_stats(DRAW_queue_stats_t *stats);
+
+#endif /* __DRAW_H */
@@ -0,0 +1,96 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : draw_protocol.h
+*
+* Description:
+* ------------
+* The messages sent by draw.c to BlankWindow over UDP (included by both sides, so the simulator and the window always agree on the format).
+* There are two kinds of messages, told apart by their length:
+* - The original 7-byte rectangle message: r, g, b, x1, y1, x2, y2 (the corners are in pixels, x2 and y2 excluded).
+* - Versioned messages, which start with a 12-byte header (all of the 16-bit fields are little-endian):
+*       [0] DRAW_MSG_MAGIC, [1] DRAW_PROTOCOL_VERSION, [2] type, [3] encoding, [4..5] x, [6..7] y, [8..9] width, [10..11] height
+*   followed by the pixels of the width X height rectangle at (x,y), as color indices of the palette below:
+*   - DRAW_MSG_FILL: a single color index for the whole rectangle (for rectangles the 7-byte message can't describe).
+*   - DRAW_MSG_BITMAP: the pixels row by row, either one index per pixel (DRAW_ENCODING_RAW) or as runs of the same index (DRAW_ENCODING_RLE),
+*     a (count, index) pair of bytes per run. A run may continue from the end of a row to the start of the next one.
+*     DRAW_ENCODING_DELTA (since version 2) only carries the pixels that changed since the last message drawn there: a (skip, count, index)
+*     triple of bytes per run leaves skip pixels as they are, and then draws a run of count pixels (count may be 0, to skip more than 255
+*     pixels). The pixels after the last run are left as they are.
+*   A bitmap is sent as a few messages, each carrying as many whole rows as fit in a datagram of DRAW_MAX_DATAGRAM bytes (bitmaps wider than
+*   a datagram are sent as strips of columns).
+* - A batch of messages (since version 3), packed in a single datagram by the sender thread of draw_queue.c: a 4-byte header
+*       [0] DRAW_MSG_MAGIC, [1] DRAW_PROTOCOL_VERSION, [2] DRAW_MSG_BATCH, [3] the number of messages
+*   followed by every message (of either kind, but not another batch), as its 16-bit little-endian length and then the message itself.
+*
+*************************************************************************/
+
+#ifndef __DRAW_PROTOCOL_H
+#define __DRAW_PROTOCOL_H
+
+#define DRAW_RECT_MSG_SIZE    7 // 3 bytes for color (r, g, b) 2 bytes for (x1,y1), 2 bytes for (x2,y2)
+
+#define DRAW_MSG_MAGIC        0xD7
+#define DRAW_PROTOCOL_VERSION 3 // version 1 had no DRAW_ENCODING_DELTA, and version 2 no DRAW_MSG_BATCH
+#define DRAW_HEADER_SIZE      12
+#define DRAW_BATCH_HEADER_SIZE 4
+#define DRAW_MAX_DATAGRAM     1400 // fits in a single Ethernet frame, so a message is never fragmented
+#define DRAW_MAX_PAYLOAD      (DRAW_MAX_DATAGRAM - DRAW_HEADER_SIZE)
+
+// message types
+#define DRAW_MSG_FILL         1
+#define DRAW_MSG_BITMAP       2
+#define DRAW_MSG_BATCH        3
+
+// encodings of the pixels of a bitmap message
+#define DRAW_ENCODING_RAW     0
+#define DRAW_ENCODING_RLE     1
+#define DRAW_ENCODING_DELTA   2
+
+#define DRAW_RLE_MAX_RUN      255 // longest run of a (count, index) pair
+
+#define DRAW_PALETTE_SIZE     256
+
+typedef struct {
+	unsigned char R;
+	unsigned char G;
+	unsigned char B;
+} pixel_rgb_t;
+
+// VGA Mode-13H palette (total of 256 colors), which maps the color indices of the messages to RGB values
+static const pixel_rgb_t DRAW_palette[DRAW_PALETTE_SIZE] = {
+	{  0,  0,  0}, {  0,  0,170}, {  0,170,  0}, {  0,170,170}, {170,  0,  0}, {170,  0,170}, {170, 85,  0}, {170,170,170},
+	{ 85, 85, 85}, { 85, 85,255}, { 85,255, 85}, { 85,255,255}, {255, 85, 85}, {255, 85,255}, {255,255, 85}, {255,255,255}, 
+	{  0,  0,  0}, { 20, 20, 20}, { 32, 32, 32}, { 44, 44, 44}, { 56, 56, 56}, { 68, 68, 68}, { 80, 80, 80}, { 97, 97, 97}, 
+	{113,113,113}, {129,129,129}, {145,145,145}, {161,161,161}, {182,182,182}, {202,202,202}, {226,226,226}, {255,255,255}, 
+	{  0,  0,255}, { 64,  0,255}, {125,  0,255}, {190,  0,255}, {255,  0,255}, {255,  0,190}, {255,  0,125}, {255,  0, 64}, 
+	{255,  0,  0}, {255, 64,  0}, {255,125,  0}, {255,190,  0}, {255,255,  0}, {190,255,  0}, {125,255,  0}, { 64,255,  0}, 
+	{  0,255,  0}, {  0,255, 64}, {  0,255,125}, {  0,255,190}, {  0,255,255}, {  0,190,255}, {  0,125,255}, {  0, 64,255}, 
+	{125,125,255}, {157,125,255}, {190,125,255}, {222,125,255}, {255,125,255}, {255,125,222}, {255,125,190}, {255,125,157}, 
+	{255,125,125}, {255,157,125}, {255,190,125}, {255,222,125}, {255,255,125}, {222,255,125}, {190,255,125}, {157,255,125}, 
+	{125,255,125}, {125,255,157}, {125,255,190}, {125,255,222}, {125,255,255}, {125,222,255}, {125,190,255}, {125,157,255}, 
+	{182,182,255}, {198,182,255}, {218,182,255}, {234,182,255}, {255,182,255}, {255,182,234}, {255,182,218}, {255,182,198}, 
+	{255,182,182}, {255,198,182}, {255,218,182}, {255,234,182}, {255,255,182}, {234,255,182}, {218,255,182}, {198,255,182}, 
+	{182,255,182}, {182,255,198}, {182,255,218}, {182,255,234}, {182,255,255}, {182,234,255}, {182,218,255}, {182,198,255}, 
+	{  0,  0,113}, { 28,  0,113}, { 56,  0,113}, { 85,  0,113}, {113,  0,113}, {113,  0, 85}, {113,  0, 56}, {113,  0, 28}, 
+	{113,  0,  0}, {113, 28,  0}, {113, 56,  0}, {113, 85,  0}, {113,113,  0}, { 85,113,  0}, { 56,113,  0}, { 28,113,  0}, 
+	{  0,113,  0}, {  0,113, 28}, {  0,113, 56}, {  0,113, 85}, {  0,113,113}, {  0, 85,113}, {  0, 56,113}, {  0, 28,113}, 
+	{ 56, 56,113}, { 68, 56,113}, { 85, 56,113}, { 97, 56,113}, {113, 56,113}, {113, 56, 97}, {113, 56, 85}, {113, 56, 68}, 
+	{113, 56, 56}, {113, 68, 56}, {113, 85, 56}, {113, 97, 56}, {113,113, 56}, { 97,113, 56}, { 85,113, 56}, { 68,113, 56}, 
+	{ 56,113, 56}, { 56,113, 68}, { 56,113, 85}, { 56,113, 97}, { 56,113,113}, { 56, 97,113}, { 56, 85,113}, { 56, 68,113}, 
+	{ 80, 80,113}, { 89, 80,113}, { 97, 80,113}, {105, 80,113}, {113, 80,113}, {113, 80,105}, {113, 80, 97}, {113, 80, 89}, 
+	{113, 80, 80}, {113, 89, 80}, {113, 97, 80}, {113,105, 80}, {113,113, 80}, {105,113, 80}, { 97,113, 80}, { 89,113, 80}, 
+	{ 80,113, 80}, { 80,113, 89}, { 80,113, 97}, { 80,113,105}, { 80,113,113}, { 80,105,113}, { 80, 97,113}, { 80, 89,113}, 
+	{  0,  0, 64}, { 16,  0, 64}, { 32,  0, 64}, { 48,  0, 64}, { 64,  0, 64}, { 64,  0, 48}, { 64,  0, 32}, { 64,  0, 16}, 
+	{ 64,  0,  0}, { 64, 16,  0}, { 64, 32,  0}, { 64, 48,  0}, { 64, 64,  0}, { 48, 64,  0}, { 32, 64,  0}, { 16, 64,  0}, 
+	{  0, 64,  0}, {  0, 64, 16}, {  0, 64, 32}, {  0, 64, 48}, {  0, 64, 64}, {  0, 48, 64}, {  0, 32, 64}, {  0, 16, 64}, 
+	{ 32, 32, 64}, { 40, 32, 64}, { 48, 32, 64}, { 56, 32, 64}, { 64, 32, 64}, { 64, 32, 56}, { 64, 32, 48}, { 64, 32, 40}, 
+	{ 64, 32, 32}, { 64, 40, 32}, { 64, 48, 32}, { 64, 56, 32}, { 64, 64, 32}, { 56, 64, 32}, { 48, 64, 32}, { 40, 64, 32}, 
+	{ 32, 64, 32}, { 32, 64, 40}, { 32, 64, 48}, { 32, 64, 56}, { 32, 64, 64}, { 32, 56, 64}, { 32, 48, 64}, { 32, 40, 64}, 
+	{ 44, 44, 64}, { 48, 44, 64}, { 52, 44, 64}, { 60, 44, 64}, { 64, 44, 64}, { 64, 44, 60}, { 64, 44, 52}, { 64, 44, 48}, 
+	{ 64, 44, 44}, { 64, 48, 44}, { 64, 52, 44}, { 64, 60, 44}, { 64, 64, 44}, { 60, 64, 44}, { 52, 64, 44}, { 48, 64, 44}, 
+	{ 44, 64, 44}, { 44, 64, 48}, { 44, 64, 52}, { 44, 64, 60}, { 44, 64, 64}, { 44, 60, 64}, { 44, 52, 64}, { 44, 48, 64}, 
+	{  0,  0,  0}, {  0,  0,  0}, {  0,  0,  0}, {  0,  0,  0}, {  0,  0,  0}, {  0,  0,  0}, {  0,  0,  0}, {  0,  0,  0}
+};
+
+#endif /* __DRAW_PROTOCOL_H */
@@ -0,0 +1,253 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : draw_queue.c
+*
+* Description:
+* ------------
+* This file implements the queue of draw messages and its sender thread (see draw_queue.h).
+* The queue is a ring of slots holding a whole message each, with a single producer (the thread drawing, which is the one simulating the program)
+* and a single consumer (the sender thread), like the ring of the trace writer: the producer publishes head with ATOMIC_store once a message was
+* copied into its slot, and keeps a copy of tail so it only reads the consumer's cache line again when the ring looks full. The one exception is
+* DRAW_QUEUE_DROP_OLDEST, where the producer may also take the oldest message out of a full ring. So tail is changed with ATOMIC_cas by both
+* threads: the sender copies a message first and then claims it, and if the producer has dropped it in the meantime (and may already be reusing
+* its slot) the claim fails and the copy is thrown away.
+* The sender takes every message in the ring at once, packing as many of them as fit in each datagram, and hands up to QUEUE_BATCH datagrams to
+* UDP_send_many, which sends them in a single system call where it can. A datagram holding a single message is sent as that message.
+*
+*************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "draw_queue.h"
+#include "draw_protocol.h"
+#include "thread.h"
+#include "udp.h"
+
+// a datagram being packed, with room for a single message of DRAW_MAX_DATAGRAM bytes after the batch header and its length
+typedef struct {
+    unsigned int count; // messages packed in it
+    unsigned int used; // bytes of data, including the batch header
+    unsigned char data[DRAW_BATCH_HEADER_SIZE + 2 + DRAW_MAX_DATAGRAM];
+} datagram_t;
+
+typedef struct {
+    int size;
+    unsigned char data[DRAW_MAX_DATAGRAM];
+} slot_t;
+
+static struct {
+    // written by the producer
+    atomic_t head; // messages put in the ring
+    unsigned long tail_copy; // the last value of tail the producer read
+    int running; // whether the sender thread was started
+    char producer_padding[CACHE_LINE_SIZE];
+    // written by the consumer (and by the producer when it drops the oldest message)
+    atomic_t tail; // messages taken from the ring
+    char consumer_padding[CACHE_LINE_SIZE];
+    atomic_t stopping; // set by QUEUE_terminate once the last message was put in the ring
+    thread_t sender;
+    DRAW_queue_stats_t stats; // the messages, stalls and drops are counted by the producer, the datagrams and sends by the consumer
+} queue;
+
+static int policy = DRAW_QUEUE_COALESCE;
+static slot_t slots[QUEUE_SLOTS];
+static datagram_t datagrams[QUEUE_BATCH]; // only used by the sender thread
+
+
+// starts packing a datagram
+static void start_datagram(datagram_t *d)
+{
+    d->count = 0;
+    d->used = DRAW_BATCH_HEADER_SIZE;
+}
+
+// returns whether another message of the given size fits in a datagram (the first one always does)
+static int fits(const datagram_t *d, int size)
+{
+    return d->count == 0 || (d->count < 0xff && d->used + 2 + size <= DRAW_MAX_DATAGRAM);
+}
+
+static void pack(datagram_t *d, const unsigned char *msg, int size)
+{
+    d->data[d->used] = (unsigned char)size;
+    d->data[d->used + 1] = (unsigned char)(size >> 8);
+    memcpy(&d->data[d->used + 2], msg, size);
+    d->used += 2 + size;
+    d->count++;
+}
+
+// sends the packed datagrams in a single call to UDP_send_many
+static void send_datagrams(unsigned int count)
+{
+    unsigned char *msgs[QUEUE_BATCH];
+    int sizes[QUEUE_BATCH];
+    datagram_t *d;
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+        d = &datagrams[i];
+        if (d->count == 1) {
+            msgs[i] = &d->data[DRAW_BATCH_HEADER_SIZE + 2];
+            sizes[i] = (int)d->used - DRAW_BATCH_HEADER_SIZE - 2;
+        } else {
+            d->data[0] = DRAW_MSG_MAGIC;
+            d->data[1] = DRAW_PROTOCOL_VERSION;
+            d->data[2] = DRAW_MSG_BATCH;
+            d->data[3] = (unsigned char)d->count;
+            msgs[i] = d->data;
+            sizes[i] = (int)d->used;
+        }
+    }
+    UDP_send_many(msgs, sizes, (int)count);
+    queue.stats.datagrams += count;
+    queue.stats.sends++;
+}
+
+static void sender_main(void *arg)
+{
+    unsigned long head, tail;
+    unsigned int count, saved_count, saved_used;
+    datagram_t *d;
+    slot_t *slot;
+    int stopping, size, idle = 0;
+
+    (void)arg;
+    for (;;) {
+        UDP_recover(); // recreates the socket if a send failed a while ago
+        stopping = (int)ATOMIC_load(&queue.stopping); // read before head, so no message put in the ring before stopping is missed
+        head = (unsigned long)ATOMIC_load(&queue.head);
+        tail = (unsigned long)ATOMIC_load(&queue.tail);
+        if (head == tail) {
+            if (stopping) {
+                return;
+            }
+            // a burst of drawing usually goes on right away, so the thread only sleeps once the queue stayed empty for a while
+            THREAD_sleep_ms((idle < QUEUE_IDLE_SPINS) ? 0 : 1);
+            idle++;
+            continue;
+        }
+        idle = 0;
+
+        count = 1;
+        d = &datagrams[0];
+        start_datagram(d);
+        while ((long)(head - tail) > 0) { // tail may even pass head, if the producer dropped messages put in the ring after head was read
+            slot = &slots[tail & (QUEUE_SLOTS - 1)];
+            size = slot->size;
+            if (!fits(d, size)) {
+                if (count == QUEUE_BATCH) {
+                    break; // the rest is sent with the next batch
+                }
+                d = &datagrams[count++];
+                start_datagram(d);
+            }
+            saved_count = d->count;
+            saved_used = d->used;
+            pack(d, slot->data, size);
+            if (!ATOMIC_cas(&queue.tail, (long)tail, (long)(tail + 1))) {
+                // the producer dropped this message (and maybe more) to make room, so the copy may be torn
+                d->count = saved_count;
+                d->used = saved_used;
+                tail = (unsigned long)ATOMIC_load(&queue.tail);
+                continue;
+            }
+            tail++;
+        }
+        if (datagrams[count - 1].count == 0) {
+            count--; // the last datagram was started for messages which were all dropped
+        }
+        if (count > 0) {
+            send_datagrams(count);
+        }
+    }
+}
+
+void QUEUE_init(void)
+{
+    queue.head = 0;
+    queue.tail = 0;
+    queue.tail_copy = 0;
+    queue.stopping = 0;
+    memset(&queue.stats, 0, sizeof(queue.stats));
+    queue.running = (THREAD_create(&queue.sender, sender_main, NULL) == 0);
+    if (!queue.running) {
+        printf("Couldn't start the draw sender thread, so the draw messages are sent right away\n");
+    }
+}
+
+void QUEUE_terminate(void)
+{
+    if (!queue.running) {
+        return;
+    }
+    ATOMIC_store(&queue.stopping, 1);
+    THREAD_join(&queue.sender);
+    queue.running = 0;
+}
+
+int QUEUE_send(const unsigned char *msg, int msg_size)
+{
+    unsigned long head = (unsigned long)queue.head; // only written by this thread
+    slot_t *slot;
+    int result = 0;
+
+    queue.stats.messages++;
+    if (!queue.running) {
+        UDP_send((unsigned char *)msg, msg_size);
+        queue.stats.datagrams++;
+        queue.stats.sends++;
+        return 0;
+    }
+
+    if (head - queue.tail_copy == QUEUE_SLOTS) {
+        queue.tail_copy = (unsigned long)ATOMIC_load(&queue.tail);
+        if (head - queue.tail_copy == QUEUE_SLOTS) {
+            switch (policy) {
+            case DRAW_QUEUE_DROP_OLDEST:
+                // fails if the sender took the oldest message first, which makes room as well
+                if (ATOMIC_cas(&queue.tail, (long)queue.tail_copy, (long)(queue.tail_copy + 1))) {
+                    queue.stats.dropped++;
+                    result = 1;
+                }
+                queue.tail_copy = (unsigned long)ATOMIC_load(&queue.tail);
+                break;
+            case DRAW_QUEUE_COALESCE:
+                queue.stats.dropped++;
+                return -1;
+            default:
+                queue.stats.stalls++;
+                while (head - queue.tail_copy == QUEUE_SLOTS) {
+                    THREAD_sleep_ms(0);
+                    queue.tail_copy = (unsigned long)ATOMIC_load(&queue.tail);
+                }
+                break;
+            }
+        }
+    }
+
+    slot = &slots[head & (QUEUE_SLOTS - 1)];
+    slot->size = msg_size;
+    memcpy(slot->data, msg, msg_size);
+    ATOMIC_store(&queue.head, (long)(head + 1));
+    return result;
+}
+
+int QUEUE_full(void)
+{
+    if ((unsigned long)queue.head - queue.tail_copy == QUEUE_SLOTS) {
+        queue.tail_copy = (unsigned long)ATOMIC_load(&queue.tail);
+    }
+    return queue.running && (unsigned long)queue.head - queue.tail_copy == QUEUE_SLOTS;
+}
+
+void QUEUE_set_policy(int new_policy)
+{
+    policy = new_policy;
+}
+
+void QUEUE_get_stats(DRAW_queue_stats_t *stats)
+{
+    *stats = queue.stats;
+    stats->lost = UDP_lost();
+}
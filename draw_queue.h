@@ -0,0 +1,42 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : draw_queue.h
+*
+* Description:
+* ------------
+* Header file for draw_queue.c, which sends the messages of the draw module on a thread of its own. draw.c only copies every message into a queue,
+* so the program being simulated never waits for a sendto. The sender thread packs the queued messages into as few datagrams as possible
+* (a DRAW_MSG_BATCH message, see draw_protocol.h) and sends many datagrams at a time with UDP_send_many.
+*
+*************************************************************************/
+
+#ifndef __DRAW_QUEUE_H
+#define __DRAW_QUEUE_H
+
+#include "draw.h"
+
+#define QUEUE_SLOTS 512 // messages the queue holds (a power of 2)
+#define QUEUE_BATCH 32 // most datagrams handed to UDP_send_many at once
+#define QUEUE_IDLE_SPINS 100 // times the sender thread finds the queue empty and only yields, before it sleeps a millisecond at a time
+
+// starts the sender thread (called by DRAW_init once the UDP module is initialized). If it can't be started, QUEUE_send sends right away instead
+void QUEUE_init(void);
+
+// sends everything still in the queue and stops the sender thread (called by DRAW_terminate, before the UDP module is terminated)
+void QUEUE_terminate(void);
+
+/* Puts a message of at most DRAW_MAX_DATAGRAM bytes in the queue. If the queue is full, waits for room, drops the oldest message in it, or drops
+   this message, according to the policy. Returns 0 if the message was queued, 1 if it was queued in place of the oldest one (DRAW_QUEUE_DROP_OLDEST
+   only), and -1 if it was dropped (DRAW_QUEUE_COALESCE only). After a drop, the draw module sends the whole canvas once there is room again, in
+   place of whatever was lost.
+*/
+int QUEUE_send(const unsigned char *msg, int msg_size);
+
+// returns whether the queue is full (if so, the draw module puts off sending the whole canvas until it isn't)
+int QUEUE_full(void);
+
+void QUEUE_set_policy(int policy);
+void QUEUE_get_stats(DRAW_queue_stats_t *stats);
+
+#endif /* __DRAW_QUEUE_H */
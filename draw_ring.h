@@ -0,0 +1,84 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : draw_ring.h
+*
+* Description:
+* ------------
+* The shared-memory ring through which the simulator can send its draw messages to BlankWindow instead of over UDP (included by both sides, like
+* draw_protocol.h). The ring is a named mapping (DRAW_RING_NAME) that whichever side starts first creates, and the other opens.
+* The messages are written one after the other as records of a 16-bit little-endian length followed by the message (exactly what would have
+* been the datagram), and a record may wrap around from the end of the data to its start. head and tail count the bytes written and read so far
+* (wrapping around at 2^32): the simulator only writes head, after the records before it, and BlankWindow only writes tail, after it has read them.
+* So the simulator waits for room instead of losing a message, and no message is ever copied more than once on each side.
+* Before sleeping, BlankWindow sets waiting, and the simulator wakes it up after publishing head if it is set: with a named auto-reset event on
+* Windows, and on Linux with a futex on wake_sequence, which the simulator increments first (so a wakeup between the reader's last look at
+* head and its futex wait isn't lost). Elsewhere the reader polls.
+*
+*************************************************************************/
+
+#ifndef __DRAW_RING_H
+#define __DRAW_RING_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define DRAW_RING_MAGIC       0x474e5244 // "DRNG"
+#define DRAW_RING_VERSION     1
+#define DRAW_RING_SIZE        (1 << 20) // bytes of records (a power of 2)
+#define DRAW_RING_RECORD_SIZE 2 // the length before every message
+
+#ifdef _WIN32
+#define DRAW_RING_NAME        "Local\\BlankWindowDrawRing"
+#define DRAW_RING_EVENT_NAME  "Local\\BlankWindowDrawRingEvent"
+#else
+#define DRAW_RING_NAME        "/BlankWindowDrawRing"
+#endif
+
+#define DRAW_RING_LINE_SIZE   64 // every counter is kept on a cache line of its own
+
+typedef struct {
+	uint32_t magic; // DRAW_RING_MAGIC once the side that created the mapping has initialized it
+	uint32_t version;
+	char header_padding[DRAW_RING_LINE_SIZE - 2 * sizeof(uint32_t)];
+	volatile int32_t head; // bytes written by the simulator
+	char head_padding[DRAW_RING_LINE_SIZE - sizeof(int32_t)];
+	volatile int32_t tail; // bytes read by BlankWindow
+	char tail_padding[DRAW_RING_LINE_SIZE - sizeof(int32_t)];
+	volatile int32_t waiting; // set by BlankWindow while it sleeps until head changes
+	volatile int32_t wake_sequence; // (Linux) the futex BlankWindow sleeps on
+	char wake_padding[DRAW_RING_LINE_SIZE - 2 * sizeof(int32_t)];
+	unsigned char data[DRAW_RING_SIZE];
+} draw_ring_t;
+
+// the counters are shared between processes, so they are read and written with full barriers (which also order a store before a later load)
+#ifdef _WIN32
+#define DRAW_RING_load(counter)         InterlockedCompareExchange((volatile LONG *)(counter), 0, 0)
+#define DRAW_RING_store(counter, value) InterlockedExchange((volatile LONG *)(counter), (LONG)(value))
+#define DRAW_RING_increment(counter)    InterlockedIncrement((volatile LONG *)(counter))
+#else
+#define DRAW_RING_load(counter)         __atomic_load_n(counter, __ATOMIC_SEQ_CST)
+#define DRAW_RING_store(counter, value) __atomic_store_n(counter, (int32_t)(value), __ATOMIC_SEQ_CST)
+#define DRAW_RING_increment(counter)    __atomic_add_fetch(counter, 1, __ATOMIC_SEQ_CST)
+#endif
+
+// copies bytes into the ring, or out of it, from a position which may wrap around to the start of the data
+static __inline void DRAW_ring_write(draw_ring_t *ring, uint32_t pos, const unsigned char *bytes, uint32_t count)
+{
+	uint32_t offset = pos & (DRAW_RING_SIZE - 1);
+	uint32_t first = (count < DRAW_RING_SIZE - offset) ? count : DRAW_RING_SIZE - offset;
+
+	memcpy(&ring->data[offset], bytes, first);
+	memcpy(ring->data, bytes + first, count - first);
+}
+
+static __inline void DRAW_ring_read(const draw_ring_t *ring, uint32_t pos, unsigned char *bytes, uint32_t count)
+{
+	uint32_t offset = pos & (DRAW_RING_SIZE - 1);
+	uint32_t first = (count < DRAW_RING_SIZE - offset) ? count : DRAW_RING_SIZE - offset;
+
+	memcpy(bytes, &ring->data[offset], first);
+	memcpy(bytes + first, ring->data, count - first);
+}
+
+#endif /* __DRAW_RING_H */
@@ -7,8 +7,9 @@
 * ------------
 * The MIPS assembly doesn't provide support for VGA graphics, unlike x86 assembly for example, which allows switching to mode 13H for this purpose.
 * In order to simulate this, as an "extension" to the MIPS architecture, we have created a separate Windows desktop application in C++ called BlankWindow.exe,
-* using the Windows API. When running it, a blank window is shown. It listens for 7-byte UDP messages which follow a certain format (as shown in draw.c)
-* composed of RGB and coordinate parameters, and upon receiving such a message, the application draws a rectangle on its screen according to the parameters.
+* using the Windows API. When running it, a blank window is shown. It listens for UDP messages which follow a certain format (as shown in draw_protocol.h):
+* either 7-byte messages composed of RGB and coordinate parameters, upon which the application draws a rectangle on its screen according to the parameters,
+* or versioned messages carrying a filled rectangle or rows of a bitmap (as palette color indices, run-length encoded) with 16-bit coordinates.
 * The files udp.h, udp.c provide an interface for sending messages to the server listening on the desktop app, while draw.h and draw.c provide useful
 * functions for drawing a pixel, a rectangle or a whole bitmap represented using an array of bytes. These functions only require passing meaningful parameters,
 * and they will take care of constructing the appropriate UDP message/s and sending them to the desktop app.
@@ -20,22 +21,21 @@
 *************************************************************************/
 
 #include "draw_syscalls.h"
+#include "mips_decode.h" // for the definition of MIPS_cpu_t
 
-void handle_draw_syscalls()
+void handle_draw_syscalls(MIPS_cpu_t *cpu)
 {
-    // converting from unsigned long to unsigned char (no loss of data since all arguments are in range 0-255)
-    unsigned char color = (unsigned char)registers[SYSCALL_DRAW_ARG1_REG];
-    unsigned char x = (unsigned char)registers[SYSCALL_DRAW_ARG2_REG];
-    unsigned char y = (unsigned char)registers[SYSCALL_DRAW_ARG3_REG];
-    unsigned char width = (unsigned char)registers[SYSCALL_DRAW_ARG4_REG];
-    unsigned char height = (unsigned char)registers[SYSCALL_DRAW_ARG5_REG];
+    // converting from uint32_t to the sizes of the message fields (a color index is 0-255, and coordinates are 16-bit)
+    unsigned char color = (unsigned char)cpu->registers[SYSCALL_DRAW_ARG1_REG];
+    uint16_t x = (uint16_t)cpu->registers[SYSCALL_DRAW_ARG2_REG];
+    uint16_t y = (uint16_t)cpu->registers[SYSCALL_DRAW_ARG3_REG];
+    uint16_t width = (uint16_t)cpu->registers[SYSCALL_DRAW_ARG4_REG];
+    uint16_t height = (uint16_t)cpu->registers[SYSCALL_DRAW_ARG5_REG];
 
-    // first argument could also contain the bitmap array base address rather than color
-    unsigned char *bitmap = (unsigned char *)data_mem;
-    bitmap += (registers[SYSCALL_DRAW_ARG1_REG] % (DATA_MEM_SIZE * 4)); // advancing the pointer using the address specified in the first register
+    unsigned char *bitmap;
 
     // calling the appropriate DRAW function based on the syscall code
-    switch (registers[SYSCALL_CODES_REG]) {
+    switch (cpu->registers[SYSCALL_CODES_REG]) {
     case SYSCALL_CODE_DRAW_PIXEL:
         DRAW_pixel(color, x, y);
         break;
@@ -43,7 +43,13 @@ void handle_draw_syscalls()
         DRAW_rectangle(color, x, y, width, height);
         break;
     case SYSCALL_CODE_DRAW_BITMAP:
-        DRAW_bitmap(bitmap, x, y, width, height);
+        // the first argument contains the bitmap array base address rather than color. The bitmap is copied out of the address space, since it may span pages
+        bitmap = (unsigned char *)malloc((size_t)width * height + 1);
+        if (bitmap != NULL) {
+            MEM_read(&cpu->mem, cpu->registers[SYSCALL_DRAW_ARG1_REG], bitmap, (size_t)width * height);
+            DRAW_bitmap(bitmap, x, y, width, height);
+            free(bitmap);
+        }
         break;
     default:
         break;
@@ -15,6 +15,6 @@
 #include "mips.h"
 #include "draw.h" // for DRAW module
 
-void handle_draw_syscalls();
+void handle_draw_syscalls(MIPS_cpu_t *cpu);
 
 #endif /* __DRAW_SYSCALLS_H */
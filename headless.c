@@ -0,0 +1,335 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : headless.c
+*
+* Description:
+* ------------
+* This file implements the headless display of the draw module (see headless.h).
+* The PNG files are written without a compression library: the rows are put in stored (uncompressed) deflate blocks, which every PNG reader
+* accepts, so a frame costs a copy and a CRC instead of a compression. The Y4M frames are converted to 4:2:0 YCbCr with the full-range BT.601
+* coefficients of JPEG (C420jpeg), the chroma of every 2X2 pixels taken from their average color.
+*
+*************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "headless.h"
+#include "render.h"
+
+#define STORED_BLOCK_SIZE 65535 // the longest stored deflate block
+#define MAX_FRAME_DIGITS  20 // the widest frame number a path can ask for (%0Nd)
+
+static RENDER_target_t target;
+static int format;
+static char *path;
+static const char *number_end; // (PPM/PNG) the part of path after the frame number (path itself is cut where the number goes)
+static int number_digits; // the digits the frame number is padded to with zeros, or -1 if path has no place for it
+static FILE *stream; // the Y4M stream
+static unsigned char *buffer; // a frame in the output format (the bytes of a PPM image, the zlib stream of a PNG, or the planes of a Y4M frame)
+static unsigned char *rows; // (PNG) the rows of the image, each after its filter byte
+static unsigned long long frames; // frames written
+static unsigned long long drawn; // messages drawn when the last frame was written
+static int failed; // a frame couldn't be written, so no more are
+static uint32_t crc_table[256];
+
+static void put32(unsigned char *p, uint32_t value)
+{
+    p[0] = (unsigned char)(value >> 24);
+    p[1] = (unsigned char)(value >> 16);
+    p[2] = (unsigned char)(value >> 8);
+    p[3] = (unsigned char)value;
+}
+
+static uint32_t crc32(uint32_t crc, const unsigned char *data, size_t length)
+{
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+/* Finds the place for the frame number in path, which must be %d or %0Nd (the frames are numbered by substituting it rather than by using path as
+   a printf format, so that no other conversion in it is ever interpreted). Returns -1 if path has any other '%'.
+*/
+static int parse_path(void)
+{
+    char *p = strchr(path, '%');
+    char *end;
+    long digits = 0;
+
+    number_digits = -1;
+    if (p == NULL) {
+        return 0;
+    }
+    end = p + 1;
+    if (*end == '0') {
+        digits = strtol(end, &end, 10);
+        if (digits < 1 || digits > MAX_FRAME_DIGITS) {
+            return -1;
+        }
+    }
+    if (*end != 'd' || strchr(end, '%') != NULL) {
+        return -1;
+    }
+    *p = '\0';
+    number_end = end + 1;
+    number_digits = (int)digits;
+    return 0;
+}
+
+// the byte size of a frame's buffer in the output format
+static size_t buffer_size(void)
+{
+    size_t raw = (size_t)HEADLESS_HEIGHT * (1 + 3 * HEADLESS_WIDTH);
+
+    switch (format) {
+    case DRAW_HEADLESS_PNG:
+        return 2 + raw + 5 * ((raw + STORED_BLOCK_SIZE - 1) / STORED_BLOCK_SIZE) + 4;
+    case DRAW_HEADLESS_Y4M:
+        return (size_t)HEADLESS_WIDTH * HEADLESS_HEIGHT * 3 / 2;
+    default:
+        return (size_t)HEADLESS_WIDTH * HEADLESS_HEIGHT * 3;
+    }
+}
+
+int HEADLESS_init(const char *output, int output_format)
+{
+    uint32_t c;
+    int i, k;
+
+    format = output_format;
+    frames = 0;
+    drawn = 0;
+    failed = 0;
+    for (i = 0; i < 256; i++) {
+        for (c = (uint32_t)i, k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+    path = (char *)malloc(strlen(output) + 1);
+    buffer = (unsigned char *)malloc(buffer_size());
+    rows = (unsigned char *)malloc((size_t)HEADLESS_HEIGHT * (1 + 3 * HEADLESS_WIDTH));
+    if (path == NULL || buffer == NULL || rows == NULL || RENDER_init(&target, HEADLESS_WIDTH, HEADLESS_HEIGHT) != 0) {
+        printf("Not enough memory for the headless display\n");
+        failed = 1;
+        HEADLESS_terminate();
+        return -1;
+    }
+    strcpy(path, output);
+    if (format != DRAW_HEADLESS_Y4M && parse_path() != 0) {
+        printf("The frame number in %s must be %%d or %%0Nd, and it can't have any other %%\n", output);
+        failed = 1;
+        HEADLESS_terminate();
+        return -1;
+    }
+    if (format == DRAW_HEADLESS_Y4M) {
+        stream = fopen(path, "wb");
+        if (stream == NULL) {
+            printf("Couldn't create %s\n", path);
+            failed = 1;
+            HEADLESS_terminate();
+            return -1;
+        }
+        fprintf(stream, "YUV4MPEG2 W%u H%u %s Ip A1:1 C420jpeg\n", HEADLESS_WIDTH, HEADLESS_HEIGHT, HEADLESS_Y4M_RATE);
+    }
+    return 0;
+}
+
+void HEADLESS_message(const unsigned char *msg, int msg_size)
+{
+    RENDER_message(&target, msg, msg_size);
+}
+
+// the bytes of a PPM image
+static size_t encode_ppm(void)
+{
+    size_t i, n = (size_t)HEADLESS_WIDTH * HEADLESS_HEIGHT;
+    uint32_t pixel;
+
+    for (i = 0; i < n; i++) {
+        pixel = target.pixels[i];
+        buffer[3 * i] = (unsigned char)(pixel >> 16);
+        buffer[3 * i + 1] = (unsigned char)(pixel >> 8);
+        buffer[3 * i + 2] = (unsigned char)pixel;
+    }
+    return 3 * n;
+}
+
+// the zlib stream of a PNG image's rows, each starting with filter type 0 (none)
+static size_t encode_png(void)
+{
+    size_t raw = (size_t)HEADLESS_HEIGHT * (1 + 3 * HEADLESS_WIDTH), used = 0, pos, block;
+    uint32_t a = 1, b = 0, pixel;
+    unsigned int row, col;
+    unsigned char *p = rows;
+
+    for (row = 0; row < HEADLESS_HEIGHT; row++) {
+        *p++ = 0;
+        for (col = 0; col < HEADLESS_WIDTH; col++) {
+            pixel = target.pixels[row * HEADLESS_WIDTH + col];
+            *p++ = (unsigned char)(pixel >> 16);
+            *p++ = (unsigned char)(pixel >> 8);
+            *p++ = (unsigned char)pixel;
+        }
+    }
+
+    buffer[used++] = 0x78; // deflate with a 32K window
+    buffer[used++] = 0x01;
+    for (pos = 0; pos < raw; pos += block) {
+        block = (raw - pos < STORED_BLOCK_SIZE) ? raw - pos : STORED_BLOCK_SIZE;
+        buffer[used++] = (pos + block == raw); // the final block, stored
+        buffer[used++] = (unsigned char)block;
+        buffer[used++] = (unsigned char)(block >> 8);
+        buffer[used++] = (unsigned char)~block;
+        buffer[used++] = (unsigned char)(~block >> 8);
+        memcpy(&buffer[used], &rows[pos], block);
+        used += block;
+    }
+    for (pos = 0; pos < raw; pos++) {
+        a = (a + rows[pos]) % 65521;
+        b = (b + a) % 65521;
+    }
+    put32(&buffer[used], (b << 16) | a);
+    return used + 4;
+}
+
+static unsigned char clamp(int32_t value)
+{
+    return (unsigned char)((value > 255) ? 255 : value);
+}
+
+// the Y, Cb and Cr planes of a Y4M frame
+static size_t encode_y4m(void)
+{
+    unsigned char *y_plane = buffer, *cb_plane = buffer + HEADLESS_WIDTH * HEADLESS_HEIGHT;
+    unsigned char *cr_plane = cb_plane + HEADLESS_WIDTH * HEADLESS_HEIGHT / 4;
+    unsigned int row, col, i;
+    int32_t r, g, b;
+    uint32_t pixel;
+    const uint32_t *p;
+
+    for (i = 0; i < HEADLESS_WIDTH * HEADLESS_HEIGHT; i++) {
+        pixel = target.pixels[i];
+        r = (pixel >> 16) & 0xff;
+        g = (pixel >> 8) & 0xff;
+        b = pixel & 0xff;
+        y_plane[i] = clamp((19595 * r + 38470 * g + 7471 * b + 32768) >> 16);
+    }
+    for (row = 0; row < HEADLESS_HEIGHT; row += 2) {
+        for (col = 0; col < HEADLESS_WIDTH; col += 2) {
+            p = &target.pixels[row * HEADLESS_WIDTH + col];
+            r = (int32_t)(((p[0] >> 16) & 0xff) + ((p[1] >> 16) & 0xff) + ((p[HEADLESS_WIDTH] >> 16) & 0xff) + ((p[HEADLESS_WIDTH + 1] >> 16) & 0xff));
+            g = (int32_t)(((p[0] >> 8) & 0xff) + ((p[1] >> 8) & 0xff) + ((p[HEADLESS_WIDTH] >> 8) & 0xff) + ((p[HEADLESS_WIDTH + 1] >> 8) & 0xff));
+            b = (int32_t)((p[0] & 0xff) + (p[1] & 0xff) + (p[HEADLESS_WIDTH] & 0xff) + (p[HEADLESS_WIDTH + 1] & 0xff));
+            // the sums of 4 pixels, so the coefficients are divided by 4 more (and 128 is the zero of the chroma)
+            i = (row / 2) * (HEADLESS_WIDTH / 2) + col / 2;
+            cb_plane[i] = clamp((-11059 * r - 21709 * g + 32768 * b + (128 << 18) + (1 << 17)) >> 18);
+            cr_plane[i] = clamp((32768 * r - 27439 * g - 5329 * b + (128 << 18) + (1 << 17)) >> 18);
+        }
+    }
+    return (size_t)HEADLESS_WIDTH * HEADLESS_HEIGHT * 3 / 2;
+}
+
+// writes a PNG chunk (its length, type, data and the CRC of the type and data)
+static void write_chunk(FILE *file, const char *type, const unsigned char *data, size_t length)
+{
+    unsigned char bytes[8];
+    uint32_t crc;
+
+    put32(bytes, (uint32_t)length);
+    memcpy(&bytes[4], type, 4);
+    crc = crc32(0xffffffff, &bytes[4], 4);
+    crc = crc32(crc, data, length) ^ 0xffffffff;
+    fwrite(bytes, 1, 8, file);
+    fwrite(data, 1, length, file);
+    put32(bytes, crc);
+    fwrite(bytes, 1, 4, file);
+}
+
+static void write_frame(void)
+{
+    static const unsigned char png_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    unsigned char header[13];
+    char name[1024];
+    FILE *file;
+    size_t length;
+    int ok;
+
+    drawn = target.messages;
+    if (failed) {
+        return;
+    }
+    if (format == DRAW_HEADLESS_Y4M) {
+        length = encode_y4m();
+        ok = fputs("FRAME\n", stream) >= 0 && fwrite(buffer, 1, length, stream) == length;
+    } else {
+        // a file per frame if the path has a place for the frame number
+        if (number_digits >= 0) {
+            snprintf(name, sizeof(name), "%s%0*llu%s", path, number_digits, frames, number_end);
+        } else {
+            snprintf(name, sizeof(name), "%s", path);
+        }
+        file = fopen(name, "wb");
+        if (file == NULL) {
+            printf("Couldn't create %s, so no more frames are written\n", name);
+            failed = 1;
+            return;
+        }
+        if (format == DRAW_HEADLESS_PNG) {
+            length = encode_png();
+            fwrite(png_signature, 1, sizeof(png_signature), file);
+            put32(header, HEADLESS_WIDTH);
+            put32(&header[4], HEADLESS_HEIGHT);
+            header[8] = 8; // bits per sample
+            header[9] = 2; // RGB
+            header[10] = 0; // deflate
+            header[11] = 0; // adaptive filtering
+            header[12] = 0; // no interlacing
+            write_chunk(file, "IHDR", header, sizeof(header));
+            write_chunk(file, "IDAT", buffer, length);
+            write_chunk(file, "IEND", NULL, 0);
+        } else {
+            length = encode_ppm();
+            fprintf(file, "P6\n%u %u\n255\n", HEADLESS_WIDTH, HEADLESS_HEIGHT);
+            fwrite(buffer, 1, length, file);
+        }
+        ok = !ferror(file);
+        ok = (fclose(file) == 0) && ok;
+    }
+    if (!ok) {
+        printf("Couldn't write frame %llu, so no more frames are written\n", frames);
+        failed = 1;
+        return;
+    }
+    frames++;
+}
+
+void HEADLESS_frame(void)
+{
+    if (target.pixels != NULL && target.messages != drawn) {
+        write_frame();
+    }
+}
+
+void HEADLESS_terminate(void)
+{
+    if (target.pixels != NULL && (target.messages != drawn || frames == 0)) {
+        write_frame();
+    }
+    if (stream != NULL) {
+        fclose(stream);
+        stream = NULL;
+    }
+    RENDER_free(&target);
+    free(path);
+    free(buffer);
+    free(rows);
+    path = NULL;
+    buffer = NULL;
+    rows = NULL;
+}
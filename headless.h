@@ -0,0 +1,40 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : headless.h
+*
+* Description:
+* ------------
+* Header file for headless.c, the display the draw module uses instead of BlankWindow after DRAW_init_headless: the messages are drawn in-process
+* (see render.h) into a RENDER_WIDTH X RENDER_HEIGHT image, which is written out at the end of every frame in which something was drawn, as a
+* PPM or PNG file per frame, or as a frame of a single Y4M video stream. So graphics programs can be checked and timed on a machine without a
+* display (e.g. by comparing the frames of two runs).
+*
+*************************************************************************/
+
+#ifndef __HEADLESS_H
+#define __HEADLESS_H
+
+#include "draw.h"
+
+#define HEADLESS_WIDTH    320 // the draw module's canvas
+#define HEADLESS_HEIGHT   256
+#define HEADLESS_Y4M_RATE "F30:1" // the frame rate written in the header of a Y4M stream (a frame per present, whatever the time between them)
+
+/* Starts the headless display, writing the frames to path in the format (DRAW_HEADLESS_PPM, DRAW_HEADLESS_PNG or DRAW_HEADLESS_Y4M). The PPM and
+   PNG frames are each written to a file of their own if path has a place for the frame number, %d or %0Nd (e.g. "frame%04d.png"), and otherwise
+   replace each other, leaving the last frame. Returns 0 on success, and -1 (after printing why) if there isn't enough memory, path has any other %
+   or the Y4M stream can't be created.
+*/
+int HEADLESS_init(const char *path, int format);
+
+// draws a message of the draw module into the image
+void HEADLESS_message(const unsigned char *msg, int msg_size);
+
+// ends a frame: writes the image if anything was drawn since the last frame
+void HEADLESS_frame(void);
+
+// writes the last frame (or a black one if no frame was written at all), and closes the output
+void HEADLESS_terminate(void);
+
+#endif /* __HEADLESS_H */
@@ -12,20 +12,20 @@
 #include "mips.h"
 #include "draw.h"
 
-int main(void) {
-    int finished = 0;
+int main(int argc, char *argv[]) {
     MIPS_info_t mips_info;
+    int i;
 
     MIPS_init("fibonacci_data.hex", "fibonacci_prog.hex");
     MIPS_get_info(&mips_info);
 
-    DRAW_init(); // initializing DRAW module (which initializes the UDP module)
+    DRAW_init(); // initializing DRAW module (which initializes the UDP module and starts the thread sending the draw messages)
 
     // overwriting program memory to manually set a program
 #if 0
     *(mips_info.prog_size) = 18;
-    unsigned long *prog = mips_info.prog_mem_base;
-    memset(prog, 0, PROG_MEM_SIZE * sizeof(unsigned long));
+    uint32_t *prog = mips_info.prog_mem_base;
+    memset(prog, 0, PROG_MEM_SIZE * sizeof(uint32_t));
     prog[0]  = 0x20030007; // addi   r3, r0, 7
     prog[1]  = 0x00602024; // and    r4, r3, r0
     prog[2]  = 0x00032880; // sll    r5, r3, 2
@@ -47,27 +47,32 @@ int main(void) {
     // any additional instruction will not be executed since we exit
 #endif
 
-    while (!finished) {
-        //printf("Instruction #%ld\n", (*(mips_info.pc) >> 2) % PROG_MEM_SIZE);
-        finished = MIPS_step();
-        //printf("%08x\n", mips_info.prog_mem_base[*(mips_info.pc) >> 2]); // printing current instruction (in hex with fixed length of 8)
-        /*for (int i = 0; i < 32; i++) {
-            printf("Register: %d. Value: %lx\n\r", i, mips_info.reg_mem_base[i]);
-        }
-        printf("hi=%lx, lo=%lx\n\n", *(mips_info.hi), *(mips_info.lo));*/
+    // the interpreter runs the program unless another engine is selected
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-block") == 0)
+            MIPS_set_engine(MIPS_ENGINE_BLOCK);
+        else if (strcmp(argv[i], "-jit") == 0)
+            MIPS_set_engine(MIPS_ENGINE_JIT);
+        else if (strcmp(argv[i], "-jit-check") == 0)
+            MIPS_set_engine(MIPS_ENGINE_JIT_CHECK);
     }
+    MIPS_run(0, NULL); // running the whole program inside the simulator's dispatch loop
+    MIPS_print_counters(stderr);
 
     DRAW_terminate();
 
 #if 0
-    char *byte_ptr = (char *)mips_info.data_mem_base;
-    printf("%x\n", byte_ptr[0xdc]);
+    char byte;
+    MIPS_read_memory(0xdc, &byte, sizeof(byte));
+    printf("%x\n", byte);
 
-    long *word_ptr = mips_info.data_mem_base;
-    printf("%x\n", word_ptr[0xdc >> 2]);
+    int32_t word;
+    MIPS_read_memory(0xdc, &word, sizeof(word));
+    printf("%x\n", word);
 
-    short *hw_ptr = (short *)mips_info.data_mem_base;
-    printf("%x", hw_ptr[0xdc >> 1]);
+    short hw;
+    MIPS_read_memory(0xdc, &hw, sizeof(hw));
+    printf("%x", hw);
 #endif
 
 #if 0
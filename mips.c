@@ -9,112 +9,897 @@
 *
 *************************************************************************/
 
+#include <stdarg.h>
 #include "mips.h"
+#include "mips_decode.h"
+#include "mips_block.h"
+#include "mips_jit.h"
+#include "mips_image.h"
+#include "mips_profile.h"
+#include "mips_trace.h"
+#include "mips_cache.h"
+#include "mips_predict.h"
+#include "mips_pipeline.h"
+#include "mips_frame.h"
+#include "mips_console.h"
 #include "draw_syscalls.h"
+#include "thread.h"
+
+static MIPS_cpu_t default_cpu; // the context used by the functions without a context argument
+
+// addresses of a memory layout (see the MIPS_LAYOUT_* constants)
+typedef struct {
+    uint32_t text; // .text base address (the pc reset address)
+    uint32_t data; // .data base address (where the data file is loaded)
+    uint32_t heap; // heap base address (the first address returned by sbrk)
+    uint32_t gp; // initial $gp
+    uint32_t sp; // initial $sp
+} layout_t;
+
+static const layout_t layouts[] = {
+    { RESET_ADDR, 0x00000000, 0x00002000, 0x00001800, 0x00002ffc }, // MIPS_LAYOUT_COMPACT_DATA_AT_0
+    { 0x00400000, 0x10010000, 0x10040000, 0x10008000, 0x7fffeffc }, // MIPS_LAYOUT_DEFAULT
+    { 0x00000000, 0x00002000, 0x00003000, 0x00001800, 0x00003ffc }  // MIPS_LAYOUT_COMPACT_TEXT_AT_0
+};
+
+#define NUM_LAYOUTS (sizeof(layouts) / sizeof(layouts[0]))
+
+// MIPS_counters_t.by_op is indexed by handler class, so its size must follow the list of classes (this fails to compile otherwise)
+typedef char op_classes_check[(NUM_OPS == MIPS_NUM_OP_CLASSES) ? 1 : -1];
+
+#define MIPS_OP_NAME(name) #name,
+static const char *const op_names[NUM_OPS] = { MIPS_OP_LIST(MIPS_OP_NAME) };
+#undef MIPS_OP_NAME
+#define GP_REG 28 // $gp
+#define SP_REG 29 // $sp
+
+// the machine state saved in a snapshot (and in the state segment of a snapshot file), as 32-bit words
+#define STATE_HI           NUM_REG // the registers come first
+#define STATE_LO           (NUM_REG + 1)
+#define STATE_PC           (NUM_REG + 2)
+#define STATE_ALU_RESULT   (NUM_REG + 3)
+#define STATE_HEAP         (NUM_REG + 4)
+#define STATE_INSTRUCTIONS (NUM_REG + 5) // 2 words, low word first
+#define STATE_CLOCK        (NUM_REG + 7) // 2 words, low word first (images saved before the virtual clock was added end here)
+#define STATE_WORDS        (NUM_REG + 9)
+
+struct MIPS_snapshot_s {
+    uint32_t state[STATE_WORDS];
+    int layout;
+    uint32_t text_base;
+    uint32_t *prog_mem; // the program memory words up to the program size
+    unsigned int prog_size;
+    MEM_space_t mem; // shares its pages with the context the snapshot was taken of (see MEM_snapshot)
+};
+
+MIPS_cpu_t *MIPS_create(void)
+{
+    MIPS_cpu_t *cpu = (MIPS_cpu_t *)calloc(1, sizeof(MIPS_cpu_t)); // all registers and memories start as zeros, like the default context
+
+    if (cpu != NULL) {
+        cpu->engine = MIPS_ENGINE_INTERPRETER;
+    }
+    return cpu;
+}
+
+void MIPS_destroy(MIPS_cpu_t *cpu)
+{
+    if (cpu == NULL) {
+        return;
+    }
+    TRACE_stop(cpu);
+    BLOCK_free(cpu);
+    PROFILE_enable(cpu, 0);
+    CACHE_configure(cpu, NULL, NULL);
+    PREDICT_configure(cpu, NULL);
+    PIPELINE_configure(cpu, NULL);
+    FRAME_configure(cpu, NULL);
+    CONSOLE_free(cpu);
+    MEM_reset(&cpu->mem);
+    free(cpu->prog_mem);
+    free(cpu->decoded_prog);
+    free(cpu->run_counts);
+    free(cpu);
+}
+
+// computes the counters that aren't counted while running from the run counts and the predecoded program
+static void update_counters(MIPS_cpu_t *cpu)
+{
+    MIPS_counters_t *c = &cpu->counters;
+    unsigned long long returns = 0, taken;
+    long long count = 0;
+    const decoded_t *d;
+    uint32_t i;
+    int op;
+
+    if (cpu->block != NULL) {
+        BLOCK_count_runs(cpu);
+    }
+    memset(c->by_op, 0, sizeof(c->by_op));
+    for (i = 0; i < cpu->prog_capacity; i++) {
+        count += cpu->run_counts[i]; // the execution count of instruction i (plus the whole passes)
+        if (count + cpu->run_passes != 0) {
+            d = &cpu->decoded_prog[i];
+            c->by_op[d->op] += count + cpu->run_passes;
+            if (d->op == OP_JR && d->rs == NUM_REG - 1) {
+                returns += count + cpu->run_passes;
+            }
+        }
+    }
+
+    c->instructions = 0;
+    for (op = 0; op < NUM_OPS; op++) {
+        c->instructions += c->by_op[op];
+    }
+    taken = cpu->taken[OP_BEQ] + cpu->taken[OP_BNE] + cpu->taken[OP_BLEZ] + cpu->taken[OP_BGTZ];
+    c->branches_taken = taken;
+    c->branches_not_taken = c->by_op[OP_BEQ] + c->by_op[OP_BNE] + c->by_op[OP_BLEZ] + c->by_op[OP_BGTZ] - taken;
+    c->jumps = c->by_op[OP_J] + c->by_op[OP_JR] - returns;
+    c->calls = c->by_op[OP_JAL] + c->by_op[OP_JALR];
+    c->returns = returns;
+    c->loads_byte = c->by_op[OP_LB] + c->by_op[OP_LBU];
+    c->loads_half = c->by_op[OP_LH] + c->by_op[OP_LHU];
+    c->loads_word = c->by_op[OP_LW];
+    c->stores_byte = c->by_op[OP_SB];
+    c->stores_half = c->by_op[OP_SH];
+    c->stores_word = c->by_op[OP_SW];
+    // syscalls made by MIPS_step aren't part of the run time
+    c->execution_ns = (cpu->run_ns > c->syscall_ns) ? cpu->run_ns - c->syscall_ns : 0;
+}
+
+const char *MIPS_op_name(int op)
+{
+    return (op >= 0 && op < NUM_OPS) ? op_names[op] : "?";
+}
+
+void MIPS_cpu_print_counters(MIPS_cpu_t *cpu, FILE *out)
+{
+    const MIPS_counters_t *c = &cpu->counters;
+    double instructions, branches;
+    unsigned int i;
+
+    update_counters(cpu);
+    instructions = (c->instructions > 0) ? (double)c->instructions : 1.0;
+    branches = (c->branches_taken + c->branches_not_taken > 0) ? (double)(c->branches_taken + c->branches_not_taken) : 1.0;
+
+    fprintf(out, "instructions:        %llu\n", c->instructions);
+    for (i = 0; i < NUM_OPS; i++) {
+        if (c->by_op[i] > 0) {
+            fprintf(out, "    %-16s%llu (%.2f%%)\n", op_names[i], c->by_op[i], 100.0 * c->by_op[i] / instructions);
+        }
+    }
+    fprintf(out, "branches:            %llu taken, %llu not taken (%.2f%% taken)\n", c->branches_taken, c->branches_not_taken, 100.0 * c->branches_taken / branches);
+    fprintf(out, "jumps:               %llu, calls: %llu, returns: %llu\n", c->jumps, c->calls, c->returns);
+    fprintf(out, "loads:               %llu byte, %llu half, %llu word\n", c->loads_byte, c->loads_half, c->loads_word);
+    fprintf(out, "stores:              %llu byte, %llu half, %llu word\n", c->stores_byte, c->stores_half, c->stores_word);
+    for (i = 0; i < MIPS_NUM_SYSCALL_COUNTERS; i++) {
+        if (c->syscalls[i] > 0) {
+            fprintf(out, "syscall %2u%s          %llu\n", i, (i == MIPS_NUM_SYSCALL_COUNTERS - 1) ? "+:" : ": ", c->syscalls[i]);
+        }
+    }
+    fprintf(out, "host time:           %.3f ms executing (%.2f ns per instruction), %.3f ms in syscalls\n",
+        c->execution_ns / 1e6, c->execution_ns / instructions, c->syscall_ns / 1e6);
+}
+
+void MIPS_print_counters(FILE *out)
+{
+    MIPS_cpu_print_counters(&default_cpu, out);
+}
+
+// function used for debugging via main. when someone asks for the information, we update the members using the fields of the context
+void MIPS_cpu_get_info(MIPS_cpu_t *cpu, MIPS_info_t *info)
+{
+    info->prog_mem_base = cpu->prog_mem;
+    info->reg_mem_base = cpu->registers;
+    info->pc = &cpu->pc;
+    info->alu_res = &cpu->alu_result;
+    info->hi = &cpu->hi;
+    info->lo = &cpu->lo;
+    info->prog_size = &cpu->prog_size;
+    info->instructions = &cpu->instructions;
+    update_counters(cpu);
+    info->counters = &cpu->counters;
+}
 
-unsigned long data_mem[DATA_MEM_SIZE];
-unsigned long prog_mem[PROG_MEM_SIZE];
-unsigned long registers[NUM_REG]; // register file
-unsigned long hi, lo; // hi, lo registers for multiplication/division results (since they're not among the first 32 registers)
-unsigned long pc; // program counter (counts bytes, not words)
-instruction_t current_instruction;
-unsigned int prog_size; // contains the actual number of instructions in the program
-unsigned long alu_result;
-
-struct control_t {
-    // 1-bit control signals + alu_op
-    unsigned branch : 1; // determines whether to possibly branch to some target (1) or continue to the next instruction (pc + 4) as usual (0)
-    unsigned jump : 1; // this signal is turned on, only when the instruction is j/jal
-    unsigned jump_register : 1; // this signal is turned on, only when the instruction is jr/jalr
-    unsigned jump_and_link : 1; // this signal is turned on, only when the instruction is jal/jalr
-    unsigned reg_dest : 1; // determines whether to take the register destination number for the Write register from rt (0), or from rd (1)
-    unsigned reg_write : 1; // if it's on, the register on the Write register input is written with the value on the Write data input
-    unsigned alu_src : 1; // determines whether to take the second ALU operand from the second register file output (0), or from the sign-extended, lower 16 bits of the instruction (1)
-    unsigned alu_op : 6; // 6-bit field containing the operation that the ALU needs to perform
-    unsigned mem_write : 1; // if it's on, the data memory contents designated by the address input are replaced by the value on the Write data input
-    unsigned mem_read : 1; // if it's on, the data memory contents designated by the address input are put on the Read data output
-    unsigned mem_to_reg : 1; // determines whether to take the value for the register Write data input from the ALU (0), or from the data memory (1)
-} control; // also defines a control variable
-
-// function used for debugging via main. when someone asks for the information, we update the members using the global variables in this file
 void MIPS_get_info(MIPS_info_t *info)
 {
-    info->prog_mem_base = prog_mem;
-    info->data_mem_base = data_mem;
-    info->reg_mem_base = registers;
-    info->pc = &pc;
-    info->alu_res = &alu_result;
-    info->hi = &hi;
-    info->lo = &lo;
-    info->prog_size = &prog_size;
+    MIPS_cpu_get_info(&default_cpu, info);
+}
+
+void MIPS_cpu_read_memory(MIPS_cpu_t *cpu, uint32_t addr, void *buffer, size_t length)
+{
+    MEM_read(&cpu->mem, addr, buffer, length);
+}
+
+void MIPS_cpu_write_memory(MIPS_cpu_t *cpu, uint32_t addr, const void *buffer, size_t length)
+{
+    MEM_write(&cpu->mem, addr, buffer, length);
+}
+
+void MIPS_read_memory(uint32_t addr, void *buffer, size_t length)
+{
+    MIPS_cpu_read_memory(&default_cpu, addr, buffer, length);
+}
+
+void MIPS_write_memory(uint32_t addr, const void *buffer, size_t length)
+{
+    MIPS_cpu_write_memory(&default_cpu, addr, buffer, length);
+}
+
+int MIPS_cpu_set_layout(MIPS_cpu_t *cpu, int layout)
+{
+    if (layout < 0 || layout >= (int)NUM_LAYOUTS) {
+        return -1;
+    }
+    cpu->layout = layout;
+    return 0;
+}
+
+int MIPS_set_layout(int layout)
+{
+    return MIPS_cpu_set_layout(&default_cpu, layout);
+}
+
+int MIPS_get_layout_bases(int layout, uint32_t *text_base, uint32_t *data_base)
+{
+    if (layout < 0 || layout >= (int)NUM_LAYOUTS) {
+        return -1;
+    }
+    *text_base = layouts[layout].text;
+    *data_base = layouts[layout].data;
+    return 0;
+}
+
+// the paced clock restarts at the current time of the virtual clock
+static void anchor_clock(MIPS_cpu_t *cpu)
+{
+    cpu->clock_origin_ns = THREAD_time_ns() - (unsigned long long)(cpu->clock_ms * 1000000.0 / cpu->clock_speed);
+}
+
+int MIPS_cpu_set_clock(MIPS_cpu_t *cpu, int mode, double speed)
+{
+    if (mode < MIPS_CLOCK_REAL || mode > MIPS_CLOCK_PACED || (mode == MIPS_CLOCK_PACED && !(speed > 0))) {
+        return -1;
+    }
+    cpu->clock_mode = mode;
+    if (mode == MIPS_CLOCK_PACED) {
+        cpu->clock_speed = speed;
+        anchor_clock(cpu);
+    }
+    return 0;
+}
+
+int MIPS_set_clock(int mode, double speed)
+{
+    return MIPS_cpu_set_clock(&default_cpu, mode, speed);
+}
+
+void MIPS_cpu_set_console(MIPS_cpu_t *cpu, const MIPS_console_t *console)
+{
+    CONSOLE_set(cpu, console);
+}
+
+int MIPS_cpu_set_memory_console(MIPS_cpu_t *cpu, const char *input, size_t length)
+{
+    return CONSOLE_set_memory(cpu, input, length);
+}
+
+const char *MIPS_cpu_get_console_output(MIPS_cpu_t *cpu, size_t *length)
+{
+    return CONSOLE_get_output(cpu, length);
+}
+
+void MIPS_cpu_flush_console(MIPS_cpu_t *cpu)
+{
+    CONSOLE_flush(cpu);
+}
+
+void MIPS_flush_console(void)
+{
+    MIPS_cpu_flush_console(&default_cpu);
+}
+
+void MIPS_cpu_set_draw(MIPS_cpu_t *cpu, int enabled)
+{
+    cpu->no_draw = !enabled;
+}
+
+int MIPS_cpu_set_framebuffer(MIPS_cpu_t *cpu, const MIPS_framebuffer_config_t *config)
+{
+    return FRAME_configure(cpu, config);
+}
+
+int MIPS_set_framebuffer(const MIPS_framebuffer_config_t *config)
+{
+    return MIPS_cpu_set_framebuffer(&default_cpu, config);
+}
+
+void MIPS_cpu_present(MIPS_cpu_t *cpu)
+{
+    if (cpu->frame != NULL) {
+        FRAME_present(cpu);
+    }
+}
+
+void MIPS_present(void)
+{
+    MIPS_cpu_present(&default_cpu);
+}
+
+void MIPS_cpu_get_framebuffer_stats(MIPS_cpu_t *cpu, MIPS_framebuffer_stats_t *stats)
+{
+    FRAME_get_stats(cpu, stats);
+}
+
+void MIPS_get_framebuffer_stats(MIPS_framebuffer_stats_t *stats)
+{
+    MIPS_cpu_get_framebuffer_stats(&default_cpu, stats);
+}
+
+int MIPS_cpu_set_profiling(MIPS_cpu_t *cpu, int enabled)
+{
+    return PROFILE_enable(cpu, enabled);
+}
+
+int MIPS_set_profiling(int enabled)
+{
+    return MIPS_cpu_set_profiling(&default_cpu, enabled);
 }
 
-// this function fills the passed array with the contents of the file with the specified filename
-int read_file_to_memory(const char *filename, unsigned long *mem)
+// opens a profile output file (NULL if no name is given, or it can't be opened, in which case *result is set to -1)
+static FILE *open_profile_file(const char *filename, int *result)
 {
     FILE *fptr;
-    char buffer[10]; // 8 hex digits + newline char + null terminator
-    int i = 0;
 
-    fptr = fopen(filename, "r"); // opening as a text file
-    while (fgets(buffer, sizeof(buffer), fptr) != NULL) {
-        buffer[strcspn(buffer, "\n")] = '\0'; // removing the trailing newline character added to the buffer by fgets (strcspn finds the index of the first \n)
-        mem[i] = strtoul(buffer, NULL, 16); // converting hex string to long using strtoul (string to UNSIGNED long) function from stdlib
-        i++;
+    if (filename == NULL) {
+        return NULL;
+    }
+    fptr = fopen(filename, "w");
+    if (fptr == NULL) {
+        printf("Can't write %s\n", filename);
+        *result = -1;
+    }
+    return fptr;
+}
+
+int MIPS_cpu_write_profile(MIPS_cpu_t *cpu, const char *flat_filename, const char *stacks_filename)
+{
+    FILE *flat, *stacks;
+    int result = 0;
+
+    if (cpu->profile == NULL || cpu->prog_mem == NULL) {
+        printf("There is no profile to write (profiling isn't enabled, or no program was loaded)\n");
+        return -1;
+    }
+    flat = open_profile_file(flat_filename, &result);
+    stacks = open_profile_file(stacks_filename, &result);
+    if (result == 0) {
+        PROFILE_write(cpu, flat, stacks);
+    }
+    if (flat != NULL) {
+        fclose(flat);
+    }
+    if (stacks != NULL) {
+        fclose(stacks);
+    }
+    return result;
+}
+
+int MIPS_write_profile(const char *flat_filename, const char *stacks_filename)
+{
+    return MIPS_cpu_write_profile(&default_cpu, flat_filename, stacks_filename);
+}
+
+int MIPS_cpu_start_trace(MIPS_cpu_t *cpu, const char *filename)
+{
+    return TRACE_start(cpu, filename);
+}
+
+int MIPS_cpu_stop_trace(MIPS_cpu_t *cpu)
+{
+    return TRACE_stop(cpu);
+}
+
+int MIPS_start_trace(const char *filename)
+{
+    return MIPS_cpu_start_trace(&default_cpu, filename);
+}
+
+int MIPS_stop_trace(void)
+{
+    return MIPS_cpu_stop_trace(&default_cpu);
+}
+
+int MIPS_cpu_set_caches(MIPS_cpu_t *cpu, const MIPS_cache_config_t *icache, const MIPS_cache_config_t *dcache)
+{
+    return CACHE_configure(cpu, icache, dcache);
+}
+
+int MIPS_set_caches(const MIPS_cache_config_t *icache, const MIPS_cache_config_t *dcache)
+{
+    return MIPS_cpu_set_caches(&default_cpu, icache, dcache);
+}
+
+void MIPS_cpu_get_cache_stats(MIPS_cpu_t *cpu, MIPS_cache_stats_t *icache, MIPS_cache_stats_t *dcache)
+{
+    CACHE_get_stats(cpu, icache, dcache);
+}
+
+void MIPS_get_cache_stats(MIPS_cache_stats_t *icache, MIPS_cache_stats_t *dcache)
+{
+    MIPS_cpu_get_cache_stats(&default_cpu, icache, dcache);
+}
+
+void MIPS_cpu_print_caches(MIPS_cpu_t *cpu, FILE *out)
+{
+    CACHE_print(cpu, out);
+}
+
+void MIPS_print_caches(FILE *out)
+{
+    MIPS_cpu_print_caches(&default_cpu, out);
+}
+
+int MIPS_cpu_set_predictors(MIPS_cpu_t *cpu, const MIPS_predictor_config_t *config)
+{
+    return PREDICT_configure(cpu, config);
+}
+
+int MIPS_set_predictors(const MIPS_predictor_config_t *config)
+{
+    return MIPS_cpu_set_predictors(&default_cpu, config);
+}
+
+void MIPS_cpu_get_predictor_stats(MIPS_cpu_t *cpu, MIPS_predictor_stats_t *stats)
+{
+    PREDICT_get_stats(cpu, stats);
+}
+
+void MIPS_get_predictor_stats(MIPS_predictor_stats_t *stats)
+{
+    MIPS_cpu_get_predictor_stats(&default_cpu, stats);
+}
+
+void MIPS_cpu_get_branch_stats(MIPS_cpu_t *cpu, uint32_t pc, MIPS_branch_stats_t *stats)
+{
+    PREDICT_get_branch_stats(cpu, pc, stats);
+}
+
+void MIPS_get_branch_stats(uint32_t pc, MIPS_branch_stats_t *stats)
+{
+    MIPS_cpu_get_branch_stats(&default_cpu, pc, stats);
+}
+
+void MIPS_cpu_print_predictors(MIPS_cpu_t *cpu, FILE *out)
+{
+    PREDICT_print(cpu, out);
+}
+
+void MIPS_print_predictors(FILE *out)
+{
+    MIPS_cpu_print_predictors(&default_cpu, out);
+}
+
+int MIPS_cpu_set_pipeline(MIPS_cpu_t *cpu, const MIPS_pipeline_config_t *config)
+{
+    return PIPELINE_configure(cpu, config);
+}
+
+int MIPS_set_pipeline(const MIPS_pipeline_config_t *config)
+{
+    return MIPS_cpu_set_pipeline(&default_cpu, config);
+}
+
+void MIPS_cpu_get_pipeline_stats(MIPS_cpu_t *cpu, MIPS_pipeline_stats_t *stats)
+{
+    PIPELINE_get_stats(cpu, stats);
+}
+
+void MIPS_get_pipeline_stats(MIPS_pipeline_stats_t *stats)
+{
+    MIPS_cpu_get_pipeline_stats(&default_cpu, stats);
+}
+
+void MIPS_cpu_print_pipeline(MIPS_cpu_t *cpu, FILE *out)
+{
+    PIPELINE_print(cpu, out);
+}
+
+void MIPS_print_pipeline(FILE *out)
+{
+    MIPS_cpu_print_pipeline(&default_cpu, out);
+}
+
+// returns the number of program memory words allocated for a program of the given size: the next power of 2, so that addresses can wrap around with a mask
+uint32_t program_capacity(uint32_t words)
+{
+    uint32_t capacity = PROG_MEM_SIZE;
+
+    while (capacity < words && capacity < 0x40000000) { // the whole 32-bit address space holds 2^30 words
+        capacity <<= 1;
     }
-    fclose(fptr);
+    return capacity;
+}
+
+/* this function puts the given program in program memory (resizing it to fit the program), and predecodes it. The address of the first word is the
+   .text base address of the layout. Returns 0 on success, and -1 if there isn't enough memory for the program
+*/
+int load_program(MIPS_cpu_t *cpu, const uint32_t *words, uint32_t count)
+{
+    uint32_t capacity = program_capacity(count);
+    uint32_t i;
 
-    return i; // returning the number of lines read
+    if (capacity != cpu->prog_capacity) {
+        free(cpu->prog_mem);
+        free(cpu->decoded_prog);
+        free(cpu->run_counts);
+        cpu->prog_mem = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+        cpu->decoded_prog = (decoded_t *)malloc(capacity * sizeof(decoded_t));
+        cpu->run_counts = (long long *)calloc(capacity + 1, sizeof(long long));
+        if (cpu->prog_mem == NULL || cpu->decoded_prog == NULL || cpu->run_counts == NULL) {
+            printf("There isn't enough memory for a program of %u instructions\n", count);
+            free(cpu->prog_mem);
+            free(cpu->decoded_prog);
+            free(cpu->run_counts);
+            cpu->prog_mem = NULL;
+            cpu->decoded_prog = NULL;
+            cpu->run_counts = NULL;
+            cpu->prog_capacity = 0;
+            return -1;
+        }
+        cpu->prog_capacity = capacity;
+    }
+    if (count > 0) {
+        memcpy(cpu->prog_mem, words, count * sizeof(uint32_t));
+    }
+    memset(cpu->prog_mem + count, 0, (capacity - count) * sizeof(uint32_t));
+    cpu->prog_size = count;
+    cpu->text_base = layouts[cpu->layout].text;
+
+    // predecoding the program once, instead of decoding every instruction each time it is executed. The rest of program memory is all zeros,
+    // so its records are copies of the first one
+    for (i = 0; i < count; i++) {
+        predecode(cpu, i);
+    }
+    if (count < capacity) {
+        predecode(cpu, count);
+        for (i = count + 1; i < capacity; i++) {
+            cpu->decoded_prog[i] = cpu->decoded_prog[count];
+        }
+    }
+    return 0;
+}
+
+// clears the performance counters (the counts of the blocks executed so far are collected first, so they aren't added later)
+static void reset_counters(MIPS_cpu_t *cpu)
+{
+    if (cpu->block != NULL) {
+        BLOCK_count_runs(cpu);
+    }
+    memset(cpu->run_counts, 0, (cpu->prog_capacity + 1) * sizeof(long long));
+    cpu->run_passes = 0;
+    memset(cpu->taken, 0, sizeof(cpu->taken));
+    memset(&cpu->counters, 0, sizeof(cpu->counters));
+    cpu->run_ns = 0;
+    if (cpu->profile != NULL) {
+        PROFILE_reset(cpu);
+    }
+    if (cpu->cache != NULL) {
+        CACHE_reset(cpu);
+    }
+    if (cpu->predict != NULL) {
+        PREDICT_reset(cpu);
+    }
+    if (cpu->pipeline != NULL) {
+        PIPELINE_reset(cpu);
+    }
 }
 
-void MIPS_init(const char *data_filename, const char *program_filename)
+// resets the pc and registers the way MARS does when a program is assembled (with $sp and $gp set according to the memory layout)
+static void reset_machine(MIPS_cpu_t *cpu)
 {
+    const layout_t *layout = &layouts[cpu->layout];
     int i;
 
-    read_file_to_memory(data_filename, data_mem);
-    prog_size = read_file_to_memory(program_filename, prog_mem);
+    BLOCK_reset(cpu); // dropping the blocks translated from the previous program
 
-    pc = RESET_ADDR;
+    cpu->pc = cpu->text_base;
+    cpu->heap = layout->heap;
 
-    // clearing registers
+    // clearing registers, except for $gp and $sp
     for (i = 0; i < NUM_REG; i++) {
-        registers[i] = 0;
+        cpu->registers[i] = 0;
+    }
+    cpu->registers[GP_REG] = layout->gp;
+    cpu->registers[SP_REG] = layout->sp;
+    cpu->hi = 0;
+    cpu->lo = 0;
+    cpu->alu_result = 0;
+    cpu->instructions = 0;
+    cpu->clock_ms = 0;
+    cpu->clock_origin_ns = THREAD_time_ns();
+    reset_counters(cpu);
+    if (cpu->frame != NULL) {
+        FRAME_invalidate(cpu); // the framebuffer holds what the new program's data put there
     }
-    hi = 0;
-    lo = 0;
 }
 
-void generate_control(void)
+// copies the machine state of the context to a snapshot's state words, and back
+static void save_state(const MIPS_cpu_t *cpu, uint32_t *state)
+{
+    memcpy(state, cpu->registers, NUM_REG * sizeof(uint32_t));
+    state[STATE_HI] = cpu->hi;
+    state[STATE_LO] = cpu->lo;
+    state[STATE_PC] = cpu->pc;
+    state[STATE_ALU_RESULT] = cpu->alu_result;
+    state[STATE_HEAP] = cpu->heap;
+    state[STATE_INSTRUCTIONS] = (uint32_t)cpu->instructions;
+    state[STATE_INSTRUCTIONS + 1] = (uint32_t)(cpu->instructions >> 32);
+    state[STATE_CLOCK] = (uint32_t)cpu->clock_ms;
+    state[STATE_CLOCK + 1] = (uint32_t)(cpu->clock_ms >> 32);
+}
+
+// words is the number of state words (fewer than STATE_WORDS in older images)
+static void load_state(MIPS_cpu_t *cpu, const uint32_t *state, uint32_t words)
+{
+    memcpy(cpu->registers, state, NUM_REG * sizeof(uint32_t));
+    cpu->registers[0] = 0; // $zero stays zero whatever the file says
+    cpu->hi = state[STATE_HI];
+    cpu->lo = state[STATE_LO];
+    cpu->pc = state[STATE_PC];
+    cpu->alu_result = state[STATE_ALU_RESULT];
+    cpu->heap = state[STATE_HEAP];
+    cpu->instructions = state[STATE_INSTRUCTIONS] | ((unsigned long long)state[STATE_INSTRUCTIONS + 1] << 32);
+    cpu->clock_ms = (words >= STATE_WORDS) ? (state[STATE_CLOCK] | ((unsigned long long)state[STATE_CLOCK + 1] << 32)) : 0;
+    if (cpu->clock_mode == MIPS_CLOCK_PACED) {
+        anchor_clock(cpu);
+    }
+}
+
+int MIPS_cpu_init(MIPS_cpu_t *cpu, const char *data_filename, const char *program_filename)
+{
+    uint32_t *data, *program, data_words, program_words, i;
+    uint32_t addr = layouts[cpu->layout].data;
+    int result;
+
+    data = IMAGE_read_hex(data_filename, &data_words);
+    if (data == NULL) {
+        return -1;
+    }
+    program = IMAGE_read_hex(program_filename, &program_words);
+    if (program == NULL) {
+        free(data);
+        return -1;
+    }
+
+    // clearing data memory first, since the context may have run another program before. Only the pages holding non-zero words are allocated again
+    MEM_reset(&cpu->mem);
+    for (i = 0; i < data_words; i++, addr += 4) {
+        if (data[i] != 0) {
+            memcpy(MEM_write_ptr(&cpu->mem, addr), &data[i], sizeof(uint32_t)); // the words are aligned, so a word never crosses a page
+        }
+    }
+    result = load_program(cpu, program, program_words);
+    free(data);
+    free(program);
+
+    if (result == 0) {
+        reset_machine(cpu);
+    }
+    return result;
+}
+
+int MIPS_init(const char *data_filename, const char *program_filename)
+{
+    return MIPS_cpu_init(&default_cpu, data_filename, program_filename);
+}
+
+int MIPS_cpu_load_image(MIPS_cpu_t *cpu, const char *image_filename)
+{
+    IMAGE_file_t file;
+    const IMAGE_header_t *header;
+    const IMAGE_segment_t *segment;
+    const uint32_t *words, *run_end, *state = NULL;
+    size_t offset = sizeof(IMAGE_header_t);
+    uint32_t i, addr, state_words = 0;
+    int result = 0, have_text = 0;
+
+    if (IMAGE_map(image_filename, &file) != 0) {
+        return -1;
+    }
+    if (IMAGE_validate(&file) != 0) { // after this, the segments can be walked without checking them
+        IMAGE_unmap(&file);
+        return -1;
+    }
+    header = (const IMAGE_header_t *)file.data;
+    if (header->layout >= NUM_LAYOUTS) {
+        printf("%s uses an unknown memory layout (%u)\n", image_filename, header->layout);
+        IMAGE_unmap(&file);
+        return -1;
+    }
+    cpu->layout = header->layout;
+
+    MEM_reset(&cpu->mem);
+    for (i = 0; i < header->num_segments && result == 0; i++) {
+        segment = (const IMAGE_segment_t *)(file.data + offset);
+        words = (const uint32_t *)(segment + 1);
+        offset += sizeof(IMAGE_segment_t) + (size_t)segment->encoded_words * 4;
+
+        if (segment->type == IMAGE_SEGMENT_TEXT) {
+            result = load_program(cpu, words, segment->words);
+            cpu->text_base = segment->addr;
+            have_text = 1;
+        } else if (segment->type == IMAGE_SEGMENT_DATA) {
+            // only the literal runs are written, so loading takes time in proportion to the non-zero part of the segment
+            run_end = words + segment->encoded_words;
+            addr = segment->addr;
+            while (words < run_end) {
+                addr += words[0] * 4;
+                MEM_write(&cpu->mem, addr, &words[2], (size_t)words[1] * 4);
+                addr += words[1] * 4;
+                words += 2 + words[1];
+            }
+        } else if (segment->type == IMAGE_SEGMENT_STATE && segment->words >= STATE_CLOCK) {
+            state = words; // applied once the machine is reset
+            state_words = segment->words;
+        }
+    }
+    if (!have_text && result == 0) {
+        result = load_program(cpu, NULL, 0);
+    }
+
+    if (result == 0) {
+        reset_machine(cpu);
+        if (state != NULL) {
+            load_state(cpu, state, state_words);
+        }
+    }
+    IMAGE_unmap(&file);
+    return result;
+}
+
+int MIPS_load_image(const char *image_filename)
+{
+    return MIPS_cpu_load_image(&default_cpu, image_filename);
+}
+
+MIPS_snapshot_t *MIPS_cpu_snapshot(MIPS_cpu_t *cpu)
+{
+    MIPS_snapshot_t *snapshot = (MIPS_snapshot_t *)calloc(1, sizeof(MIPS_snapshot_t));
+
+    if (snapshot == NULL) {
+        printf("There isn't enough memory for a snapshot\n");
+        return NULL;
+    }
+    snapshot->prog_mem = (uint32_t *)malloc((cpu->prog_size > 0 ? cpu->prog_size : 1) * sizeof(uint32_t));
+    if (snapshot->prog_mem == NULL || MEM_snapshot(&snapshot->mem, &cpu->mem) != 0) {
+        printf("There isn't enough memory for a snapshot\n");
+        free(snapshot->prog_mem);
+        free(snapshot);
+        return NULL;
+    }
+    if (cpu->prog_size > 0) {
+        memcpy(snapshot->prog_mem, cpu->prog_mem, cpu->prog_size * sizeof(uint32_t));
+    }
+    snapshot->prog_size = cpu->prog_size;
+    snapshot->text_base = cpu->text_base;
+    snapshot->layout = cpu->layout;
+    save_state(cpu, snapshot->state);
+    return snapshot;
+}
+
+MIPS_snapshot_t *MIPS_snapshot(void)
+{
+    return MIPS_cpu_snapshot(&default_cpu);
+}
+
+int MIPS_cpu_restore(MIPS_cpu_t *cpu, const MIPS_snapshot_t *snapshot)
+{
+    if (MEM_restore(&cpu->mem, &snapshot->mem) != 0) {
+        printf("There isn't enough memory to restore the snapshot\n");
+        return -1;
+    }
+    cpu->layout = snapshot->layout;
+
+    // when the context already holds the program (the usual case of running it again from the snapshot), its predecoded records and translated
+    // blocks stay valid, so they are kept
+    if (cpu->prog_mem == NULL || cpu->prog_size != snapshot->prog_size || cpu->text_base != snapshot->text_base ||
+        memcmp(cpu->prog_mem, snapshot->prog_mem, snapshot->prog_size * sizeof(uint32_t)) != 0) {
+        if (load_program(cpu, snapshot->prog_mem, snapshot->prog_size) != 0) {
+            return -1;
+        }
+        cpu->text_base = snapshot->text_base;
+        BLOCK_reset(cpu);
+    }
+    load_state(cpu, snapshot->state, STATE_WORDS);
+    reset_counters(cpu);
+    if (cpu->frame != NULL) {
+        FRAME_invalidate(cpu);
+    }
+    return 0;
+}
+
+int MIPS_restore(const MIPS_snapshot_t *snapshot)
+{
+    return MIPS_cpu_restore(&default_cpu, snapshot);
+}
+
+void MIPS_snapshot_free(MIPS_snapshot_t *snapshot)
+{
+    if (snapshot == NULL) {
+        return;
+    }
+    MEM_reset(&snapshot->mem);
+    free(snapshot->prog_mem);
+    free(snapshot);
+}
+
+// adds a page of the snapshot's address space to the image being built (MEM_for_each_page callback)
+static void add_page(void *user, uint32_t addr, const unsigned char *page)
+{
+    IMAGE_add_data((IMAGE_builder_t *)user, addr, (const uint32_t *)page, MEM_PAGE_SIZE / 4);
+}
+
+int MIPS_snapshot_save(const MIPS_snapshot_t *snapshot, const char *filename)
+{
+    IMAGE_builder_t builder;
+
+    IMAGE_begin(&builder);
+    IMAGE_add_words(&builder, IMAGE_SEGMENT_TEXT, snapshot->text_base, snapshot->prog_mem, snapshot->prog_size);
+    MEM_for_each_page(&snapshot->mem, add_page, &builder);
+    IMAGE_add_words(&builder, IMAGE_SEGMENT_STATE, 0, snapshot->state, STATE_WORDS);
+    return IMAGE_finish(&builder, filename, (uint32_t)snapshot->layout);
+}
+
+MIPS_snapshot_t *MIPS_snapshot_load(const char *filename)
+{
+    MIPS_cpu_t *cpu = MIPS_create();
+    MIPS_snapshot_t *snapshot = NULL;
+
+    if (cpu == NULL) {
+        printf("Not enough memory\n");
+        return NULL;
+    }
+    // the file is loaded into a context of its own, which the snapshot is then taken of (the snapshot keeps the pages once the context is gone)
+    if (MIPS_cpu_load_image(cpu, filename) == 0) {
+        snapshot = MIPS_cpu_snapshot(cpu);
+    }
+    MIPS_destroy(cpu);
+    return snapshot;
+}
+
+// this function generates the control signals for the given instruction (called only when predecoding, not for every executed instruction)
+void generate_control(instruction_t inst, struct control_t *control)
 {
     // initial control signals
-    control.branch = 0;
-    control.jump = 0;
-    control.jump_register = 0;
-    control.jump_and_link = 0;
-    control.reg_dest = 1;
-    control.reg_write = 1;
-    control.alu_src = 0;
-    control.alu_op = 0;
-    control.mem_write = 0;
-    control.mem_read = 0;
-    control.mem_to_reg = 0;
-
-    if (current_instruction.commontype.opcode == OPCODE_RTYPE) {
-        control.alu_op = current_instruction.rtype.funct; // for all R-type instructions, alu_op is the funct value
+    control->branch = 0;
+    control->jump = 0;
+    control->jump_register = 0;
+    control->jump_and_link = 0;
+    control->reg_dest = 1;
+    control->reg_write = 1;
+    control->alu_src = 0;
+    control->alu_op = 0;
+    control->mem_write = 0;
+    control->mem_read = 0;
+    control->mem_to_reg = 0;
+
+    if (inst.commontype.opcode == OPCODE_RTYPE) {
+        control->alu_op = inst.rtype.funct; // for all R-type instructions, alu_op is the funct value
 
         // handling special cases
-        switch (current_instruction.rtype.funct) {
+        switch (inst.rtype.funct) {
         case FUNCT_JR:
-            control.jump_register = 1;
-            control.reg_write = 0; // this instruction should not write to the register given to it
+            control->jump_register = 1;
+            control->reg_write = 0; // this instruction should not write to the register given to it
             break;
         case FUNCT_JALR: // note that reg_write is not disabled, because this instruction writes the incremented PC to $ra (31)
-            control.jump_register = 1;
-            control.jump_and_link = 1;
+            control->jump_register = 1;
+            control->jump_and_link = 1;
             break;
         case FUNCT_SYSCALL:
         case FUNCT_BREAK:
-            control.reg_write = 0; // syscall/break do not write to a register
+            control->reg_write = 0; // syscall/break do not write to a register
             break;
         case FUNCT_MTHI:
         case FUNCT_MTLO:
@@ -122,39 +907,39 @@ void generate_control(void)
         case FUNCT_MULTU:
         case FUNCT_DIV:
         case FUNCT_DIVU:
-            control.reg_write = 0; // the instructions in this group write to the hi and lo registers, but not to the registers given to them
+            control->reg_write = 0; // the instructions in this group write to the hi and lo registers, but not to the registers given to them
             break;
         default:
             break;
         }
     } else {
         // common signal values applying for MOST supported non R-type instructions
-        control.reg_dest = 0; // $rt should be written to the regfile, not $rd
-        control.alu_src = 1; // the second ALU operand should come from the immediate value of the instruction
+        control->reg_dest = 0; // $rt should be written to the regfile, not $rd
+        control->alu_src = 1; // the second ALU operand should come from the immediate value of the instruction
 
-        switch (current_instruction.commontype.opcode) { // J-type or I-type
+        switch (inst.commontype.opcode) { // J-type or I-type
         case OPCODE_J:
-            control.reg_write = 0; // this instruction should not write to the register given to it
-            control.jump = 1;
+            control->reg_write = 0; // this instruction should not write to the register given to it
+            control->jump = 1;
             break;
         case OPCODE_JAL: // note that reg_write is not disabled, because this instruction writes the incremented PC to $ra (31)
-            control.jump = 1;
-            control.jump_and_link = 1;
+            control->jump = 1;
+            control->jump_and_link = 1;
             break;
         case OPCODE_BEQ:
         case OPCODE_BNE:
             // note that we do not set the branch signal here because it depends on the ALU result
-            control.reg_write = 0;
-            control.alu_src = 0; // in these instructions, the second ALU operand must come from the second register file output
-            control.alu_op = FUNCT_SUB; // we need to subtract the register values and check whether or not the ALU result is 0
+            control->reg_write = 0;
+            control->alu_src = 0; // in these instructions, the second ALU operand must come from the second register file output
+            control->alu_op = FUNCT_SUB; // we need to subtract the register values and check whether or not the ALU result is 0
             break;
         case OPCODE_BLEZ:
         case OPCODE_BGTZ:
             // again - not setting the branch signal here, but unlike beq and bne, here we don't even care about the ALU result. The logic was moved to branch_control
-            control.reg_write = 0;
+            control->reg_write = 0;
             break;
         case OPCODE_ADDI:
-            control.alu_op = FUNCT_ADD;
+            control->alu_op = FUNCT_ADD;
             break;
 
         /* The term "unsigned" in the addiu instruction name is a misnomer, because the immediate is still sign extended instead of zero extended. It means that the
@@ -168,13 +953,13 @@ void generate_control(void)
            Though in our emulator, we don't try to catch overflows and C does not complain as well if they occur.
         */
         case OPCODE_ADDIU:
-            control.alu_op = FUNCT_ADDU;
+            control->alu_op = FUNCT_ADDU;
             break;
         case OPCODE_SLTI:
-            control.alu_op = FUNCT_SLT;
+            control->alu_op = FUNCT_SLT;
             break;
         case OPCODE_SLTIU:
-            control.alu_op = FUNCT_SLTU;
+            control->alu_op = FUNCT_SLTU;
             break;
         case OPCODE_ANDI:
         case OPCODE_ORI:
@@ -188,277 +973,302 @@ void generate_control(void)
         case OPCODE_LW:
         case OPCODE_LBU:
         case OPCODE_LHU:
-            control.alu_op = FUNCT_ADD; // for the load instructions, we need the ALU to add the value of $rs to the sign-extended immediate
-            control.mem_to_reg = 1; // because the value to be stored in $rt should come from the data memory, not from the ALU result
-            control.mem_read = 1; // because we should read data from memory
+            control->alu_op = FUNCT_ADD; // for the load instructions, we need the ALU to add the value of $rs to the sign-extended immediate
+            control->mem_to_reg = 1; // because the value to be stored in $rt should come from the data memory, not from the ALU result
+            control->mem_read = 1; // because we should read data from memory
             break;
         case OPCODE_SB:
         case OPCODE_SH:
         case OPCODE_SW:
-            control.alu_op = FUNCT_ADD; // for the same reason as the load instructions
-            control.reg_write = 0; // because we are not writing to a register
-            control.mem_write = 1; // because we are writing to memory
+            control->alu_op = FUNCT_ADD; // for the same reason as the load instructions
+            control->reg_write = 0; // because we are not writing to a register
+            control->mem_write = 1; // because we are writing to memory
             break;
         case OPCODE_SPECIAL2:
             // even though mul is not an R-type instruction, it has the exact same format. So we utilize rtype to access the last 6 bits containing the funct
-            if (current_instruction.rtype.funct == FUNCT_MUL) {
-                control.reg_dest = 1; // we need to write to $rd this time
-                control.alu_src = 0; // the second ALU operand should come from $rt
+            if (inst.rtype.funct == FUNCT_MUL) {
+                control->reg_dest = 1; // we need to write to $rd this time
+                control->alu_src = 0; // the second ALU operand should come from $rt
                 // not setting alu_op here, because the mul instruction (assuming it's the only one with SPECIAL2 opcode) is specifically handled in the alu function
             }
             break;
         default:
             // most likely an unsupported instruction, so we want to make sure that it doesn't write to a register
-            control.reg_write = 0;
+            control->reg_write = 0;
             break;
         }
     }
 }
 
-// this function sets the branch signal based on the ALU results. It returns 1 if the current instruction is branch-related and thus required some check, or 0 if not
-int branch_control(unsigned int opcode, signed long alu_src1, unsigned long alu_result) {
-    switch (opcode) {
-    case OPCODE_BEQ:
-        control.branch = (alu_result == 0) ? 1 : 0;
-        break;
-    case OPCODE_BNE:
-        control.branch = (alu_result != 0) ? 1 : 0;
-        break;
-    case OPCODE_BLEZ:
-        // not relying on the ALU result, but on the value (and sign) of $rs
-        control.branch = (alu_src1 <= 0) ? 1 : 0;
-        break;
-    case OPCODE_BGTZ:
-        control.branch = (alu_src1 > 0) ? 1 : 0;
-        break;
-    default:
-        return 0;
-        break;
+// this function returns the handler class of the given instruction
+unsigned char decode_op(instruction_t inst)
+{
+    if (inst.commontype.opcode == OPCODE_RTYPE) {
+        switch (inst.rtype.funct) {
+        case FUNCT_SLL:     return OP_SLL;
+        case FUNCT_SRL:     return OP_SRL;
+        case FUNCT_SRA:     return OP_SRA;
+        case FUNCT_SLLV:    return OP_SLLV;
+        case FUNCT_SRLV:    return OP_SRLV;
+        case FUNCT_SRAV:    return OP_SRAV;
+        case FUNCT_JR:      return OP_JR;
+        case FUNCT_JALR:    return OP_JALR;
+        case FUNCT_SYSCALL: return OP_SYSCALL;
+        case FUNCT_MFHI:    return OP_MFHI;
+        case FUNCT_MTHI:    return OP_MTHI;
+        case FUNCT_MFLO:    return OP_MFLO;
+        case FUNCT_MTLO:    return OP_MTLO;
+        case FUNCT_MULT:    return OP_MULT;
+        case FUNCT_MULTU:   return OP_MULTU;
+        case FUNCT_DIV:     return OP_DIV;
+        case FUNCT_DIVU:    return OP_DIVU;
+        case FUNCT_ADD:     return OP_ADD;
+        case FUNCT_ADDU:    return OP_ADDU;
+        case FUNCT_SUB:     return OP_SUB;
+        case FUNCT_SUBU:    return OP_SUBU;
+        case FUNCT_AND:     return OP_AND;
+        case FUNCT_OR:      return OP_OR;
+        case FUNCT_XOR:     return OP_XOR;
+        case FUNCT_NOR:     return OP_NOR;
+        case FUNCT_SLT:     return OP_SLT;
+        case FUNCT_SLTU:    return OP_SLTU;
+        default:            return OP_NOP; // break, and functs we don't recognize (we never treated them as unsupported instructions)
+        }
     }
 
-    return 1;
+    switch (inst.commontype.opcode) {
+    case OPCODE_J:        return OP_J;
+    case OPCODE_JAL:      return OP_JAL;
+    case OPCODE_BEQ:      return OP_BEQ;
+    case OPCODE_BNE:      return OP_BNE;
+    case OPCODE_BLEZ:     return OP_BLEZ;
+    case OPCODE_BGTZ:     return OP_BGTZ;
+    case OPCODE_ADDI:     return OP_ADDI;
+    case OPCODE_ADDIU:    return OP_ADDIU;
+    case OPCODE_SLTI:     return OP_SLTI;
+    case OPCODE_SLTIU:    return OP_SLTIU;
+    case OPCODE_ANDI:     return OP_ANDI;
+    case OPCODE_ORI:      return OP_ORI;
+    case OPCODE_XORI:     return OP_XORI;
+    case OPCODE_LUI:      return OP_LUI;
+    case OPCODE_LB:       return OP_LB;
+    case OPCODE_LH:       return OP_LH;
+    case OPCODE_LW:       return OP_LW;
+    case OPCODE_LBU:      return OP_LBU;
+    case OPCODE_LHU:      return OP_LHU;
+    case OPCODE_SB:       return OP_SB;
+    case OPCODE_SH:       return OP_SH;
+    case OPCODE_SW:       return OP_SW;
+    case OPCODE_SPECIAL2: return (inst.rtype.funct == FUNCT_MUL) ? OP_MUL : OP_UNSUPPORTED; // mul is assumed to be the only SPECIAL2 instruction
+    default:              return OP_UNSUPPORTED;
+    }
 }
 
-void alu(unsigned long src1, unsigned long src2)
+// this function decodes the program memory word at the given index into its predecoded record, so that executing it requires no further decoding
+void predecode(MIPS_cpu_t *cpu, uint32_t index)
 {
-    long signed_src1 = (long)src1, signed_src2 = (long)src2; // note that long is equivalent to signed long
-    long long mult_result; // 64 bits
-    unsigned long long multu_result;
-    int special = 1; // flag indicating whether we handled one of the special cases (assuming yes at first)
+    decoded_t *d = &cpu->decoded_prog[index];
+    instruction_t inst;
 
-    // handling special cases first
-    switch (current_instruction.commontype.opcode) {
-    case OPCODE_ANDI:
-        alu_result = src1 & (src2 & 0xffffL); // result should contain: src1 & {0 × 16, imm} (L suffix sets the type of the literal to long)
-        break;
-    case OPCODE_ORI:
-        alu_result = src1 | (src2 & 0xffffL); // result should contain: src1 | {0 × 16, imm}
+    inst.inst = cpu->prog_mem[index];
+    generate_control(inst, &d->control);
+
+    d->inst = inst.inst;
+    d->op = decode_op(inst);
+    d->rs = inst.rtype.rs; // the register fields have the same size and position in R-type and I-type instructions
+    d->rt = inst.rtype.rt;
+    d->rd = (d->control.reg_dest) ? inst.rtype.rd : inst.itype.rt; // the Write register, chosen the same way the reg_dest signal chooses it
+    d->shamt = inst.rtype.shamt;
+    d->imm = (short)inst.itype.addr_im; // performing sign extension (short is 16 bits)
+
+    switch (d->op) {
+    case OP_ANDI:
+    case OP_ORI:
+    case OP_XORI:
+        d->imm = inst.itype.addr_im; // these instructions zero-extend the immediate
         break;
-    case OPCODE_XORI:
-        alu_result = src1 ^ (src2 & 0xffffL); // result should contain: src1 ^ {0 × 16, imm}
+    case OP_LUI:
+        d->imm = (int32_t)((uint32_t)inst.itype.addr_im << 16); // {(imm)[15:0], 0 × 16}
         break;
-    case OPCODE_LUI: // load upper immediate
-        alu_result = (src2 << 16) & 0xffff0000L; // result should contain: {(imm)[15:0], 0 × 16}
-        break;
-    case OPCODE_SPECIAL2: // assuming mul instruction
-        /* Multiplying two 32-bit numbers might result in a 64-bit result, from which we need to take the least significant 32 bits according to the
-           documentation of mul. Since alu_result is 32 bits in size, this behavior occurs anyway.
-        */
-        alu_result = signed_src1 * signed_src2;
+    case OP_JAL:
+        d->rd = NUM_REG - 1; // jal always links to $ra
+        /* fall through */
+    case OP_J:
+        d->imm = (int32_t)((uint32_t)inst.jtype.addr << 2); // {address, 00}. The upper 4 bits are taken from pc + 4 when jumping
         break;
     default:
-        special = 0; // we are not in the special case
         break;
     }
+}
 
-    // if a special case was already handled, we need to exit the function
-    if (special) {
+// ends a frame of the graphics syscalls: the tiles they changed are sent to the virtual screen (see DRAW_flush)
+static void end_frame(MIPS_cpu_t *cpu)
+{
+    if (!cpu->no_draw) {
+        DRAW_flush();
+    }
+}
+
+// sleeps according to the clock of the context (see MIPS_cpu_set_clock)
+static void sleep_syscall(MIPS_cpu_t *cpu, uint32_t ms)
+{
+    unsigned long long now, due;
+
+    cpu->clock_ms += ms;
+    if (cpu->clock_mode == MIPS_CLOCK_VIRTUAL) {
+        return;
+    }
+    CONSOLE_flush(cpu); // whatever was printed before sleeping should be seen while sleeping
+    if (cpu->clock_mode == MIPS_CLOCK_REAL) {
+        THREAD_sleep_ms(ms);
         return;
     }
 
-    switch (control.alu_op) {
-    case FUNCT_SLL: // shift left logical (there's no special instruction for shift left arithmetic, because it's essentially the same as left logical)
-        alu_result = src2 << current_instruction.rtype.shamt;
-        break;
-    case FUNCT_SRL: // shift right logical (unsigned right shift)
-        alu_result = src2 >> current_instruction.rtype.shamt;
-        break;
-    case FUNCT_SRA: // shift right arithmetic (signed right shift)
-        /* The result of a right-shift of a signed negative number is implementation-dependent, but the Microsoft C++ compiler uses arithmetic shift as needed:
-           (https://docs.microsoft.com/en-us/cpp/cpp/left-shift-and-right-shift-operators-input-and-output?view=msvc-170#right-shifts) */
-        alu_result = signed_src2 >> current_instruction.rtype.shamt;
-        break;
-    case FUNCT_SLLV: // shift left logical variable
-        alu_result = src2 << src1;
-        break;
-    case FUNCT_SRLV: // shift right logical variable (unsigned right shift)
-        alu_result = src2 >> src1;
-        break;
-    case FUNCT_SRAV: // shift right arithmetic variable (signed right shift)
-        alu_result = signed_src2 >> signed_src1;
-        break;
-    case FUNCT_MFHI: // move from hi
-        alu_result = hi;
-        break;
-    case FUNCT_MTHI: // move to hi
-        hi = src1;
-        break;
-    case FUNCT_MFLO: // move from lo
-        alu_result = lo;
-        break;
-    case FUNCT_MTLO: // move to lo
-        lo = src1;
-        break;
-    case FUNCT_MULT: // signed multiplication
-        mult_result = (long long)signed_src1 * signed_src2; // it is sufficient to cast only one of the operands
-        lo = (unsigned long)mult_result; // casting to unsigned long takes only the least significant 32 bits
-        hi = (unsigned long)(mult_result >> 32); // shifting the higher 32 bits to the lower part so that they are taken when casting to long
-        break;
-    case FUNCT_MULTU: // unsigned multiplication
-        multu_result = (unsigned long long)src1 * src2;
-        lo = (unsigned long)multu_result;
-        hi = (unsigned long)(multu_result >> 32);
-        break;
-    case FUNCT_DIV: // signed division
-        lo = signed_src1 / signed_src2;
-        hi = signed_src1 % signed_src2;
-        break;
-    case FUNCT_DIVU: // unsigned division
-        lo = src1 / src2;
-        hi = src1 % src2;
-        break;
-    case FUNCT_ADD: // note that all load and store instructions rely on this addition to calculate the memory address from which to load, or to which to store
-        alu_result = signed_src1 + signed_src2;
-        break;
-    case FUNCT_ADDU:
-        alu_result = src1 + src2;
-        break;
-    case FUNCT_SUB:
-        alu_result = signed_src1 - signed_src2;
-        break;
-    case FUNCT_SUBU:
-        alu_result = src1 - src2;
-        break;
-    case FUNCT_AND:
-        alu_result = src1 & src2;
-        break;
-    case FUNCT_OR:
-        alu_result = src1 | src2;
-        break;
-    case FUNCT_XOR:
-        alu_result = src1 ^ src2;
-        break;
-    case FUNCT_NOR: // not or
-        alu_result = ~(src1 | src2);
-        break;
-    case FUNCT_SLT: // set on less than (signed comparison)
-        alu_result = (signed_src1 < signed_src2);
-        break;
-    case FUNCT_SLTU: // set on less than (unsigned comparison)
-        alu_result = (src1 < src2);
-        break;
-    default:
-        break;
+    // paced: waiting until the deadline. A host that fell behind starts over from now, instead of catching up by skipping the next waits
+    now = THREAD_time_ns();
+    due = cpu->clock_origin_ns + (unsigned long long)(cpu->clock_ms * 1000000.0 / cpu->clock_speed);
+    if (due > now) {
+        THREAD_sleep_ms((unsigned int)((due - now + 999999) / 1000000));
+    } else {
+        anchor_clock(cpu);
     }
 }
 
-// utility (recursive) function that gets a non-zero number and prints it in binary format
-void print_binary(unsigned long num)
+// returns the time in milliseconds according to the clock of the context
+static unsigned long long time_syscall(MIPS_cpu_t *cpu)
 {
-    if (num == 0) {
-        return;
+    unsigned long long paced;
+
+    switch (cpu->clock_mode) {
+    case MIPS_CLOCK_VIRTUAL:
+        return cpu->clock_ms++; // moving on, so a program polling the time sees it pass
+    case MIPS_CLOCK_PACED:
+        paced = (unsigned long long)((THREAD_time_ns() - cpu->clock_origin_ns) * cpu->clock_speed / 1000000.0);
+        if (paced > cpu->clock_ms) {
+            cpu->clock_ms = paced; // the program computed for a while
+        }
+        return cpu->clock_ms;
+    default:
+        return THREAD_epoch_ms();
     }
-    print_binary(num >> 1);
-    printf("%d", num & 1); // printing the LSB
 }
 
 // returns whether or not an exit syscall was read
-int handle_syscall(void) 
+static int do_syscall(MIPS_cpu_t *cpu)
 {
-    char *str;
+    char *str, *end;
+    uint32_t addr;
+    size_t length;
+    unsigned long long now;
 
     // the syscall code is stored in register $v0 (whose index is given in SYSCALL_CODES_REG)
-    switch (registers[SYSCALL_CODES_REG]) {
+    switch (cpu->registers[SYSCALL_CODES_REG]) {
     case SYSCALL_CODE_PRINT_INT:
-        printf("%d", registers[SYSCALL_ARG1_REG]);
+        CONSOLE_write_int(cpu, (int32_t)cpu->registers[SYSCALL_ARG1_REG]);
         break;
     case SYSCALL_CODE_PRINT_STRING:
-        str = (char *)data_mem; // since string is a pointer, it can get the address of the data memory
-        str += registers[SYSCALL_ARG1_REG]; // using pointer arithmetic to add the address of the null-terminated string to print, from the register that stores it
-        /* Printing characters from this address onward until encountering a null terminator.
+        addr = cpu->registers[SYSCALL_ARG1_REG]; // the address of the null-terminated string to print
+        /* Printing characters from this address onward until encountering a null terminator, a page at a time.
            Note: the data file contains the bytes representing string characters in reverse order. Since this computer's CPU architecture is little endian,
-           the data read from the file is reversed again when storing inside the data_mem array. So the characters are printed in the correct order.
+           the data read from the file is reversed again when storing it in memory. So the characters are printed in the correct order.
         */
-        printf("%s", str);
+        do {
+            str = (char *)MEM_read_ptr(&cpu->mem, addr);
+            length = MEM_PAGE_SIZE - (addr & MEM_PAGE_MASK); // the rest of the page
+            end = (char *)memchr(str, '\0', length);
+            if (end != NULL) {
+                length = end - str;
+            }
+            CONSOLE_write(cpu, str, length);
+            addr += (uint32_t)length;
+        } while (end == NULL && addr != 0); // a string running into the top of the address space ends there
         break;
     case SYSCALL_CODE_PRINT_CHAR:
-        printf("%c", registers[SYSCALL_ARG1_REG]);
+        CONSOLE_write_char(cpu, (char)cpu->registers[SYSCALL_ARG1_REG]);
         break;
     case SYSCALL_CODE_PRINT_INT_HEX:
-        printf("%x", registers[SYSCALL_ARG1_REG]);
+        CONSOLE_write_hex(cpu, cpu->registers[SYSCALL_ARG1_REG]);
         break;
     case SYSCALL_CODE_PRINT_INT_BIN:
-        // if the number is 0, simply printing it
-        if (registers[SYSCALL_ARG1_REG] == 0) {
-            printf("%d", registers[SYSCALL_ARG1_REG]);
-        } else {
-            // else use the utility function
-            print_binary(registers[SYSCALL_ARG1_REG]);
-        }
+        CONSOLE_write_binary(cpu, cpu->registers[SYSCALL_ARG1_REG]);
         break;
     case SYSCALL_CODE_PRINT_UINT:
-        printf("%u", registers[SYSCALL_ARG1_REG]);
+        CONSOLE_write_uint(cpu, cpu->registers[SYSCALL_ARG1_REG]);
         break;
     case SYSCALL_CODE_READ_INT:
-        scanf("%d", &registers[SYSCALL_CODES_REG]); // the number read should be stored in $v0 (register 2), the same as the syscall codes register
+        // the number read should be stored in $v0 (register 2), the same as the syscall codes register (the output is flushed first, see mips_console.h)
+        end_frame(cpu); // showing what was drawn before waiting for input
+        CONSOLE_read_int(cpu, (int32_t *)&cpu->registers[SYSCALL_CODES_REG]);
+        break;
+    case SYSCALL_CODE_SBRK:
+        // returning the current end of the heap, and moving it forward by the requested size (rounded up to a whole word, like MARS does)
+        cpu->registers[SYSCALL_CODES_REG] = cpu->heap;
+        cpu->heap += (cpu->registers[SYSCALL_ARG1_REG] + 3) & ~3U;
         break;
     case SYSCALL_CODE_SLEEP:
-        Sleep(registers[SYSCALL_ARG1_REG]);
+        end_frame(cpu); // an animation sleeps between its frames
+        sleep_syscall(cpu, cpu->registers[SYSCALL_ARG1_REG]);
+        break;
+    case SYSCALL_CODE_TIME:
+        now = time_syscall(cpu);
+        cpu->registers[SYSCALL_ARG1_REG] = (uint32_t)now;
+        cpu->registers[SYSCALL_ARG2_REG] = (uint32_t)(now >> 32);
         break;
     case SYSCALL_CODE_EXIT:
-        printf("\n-- program is finished running --\n");
+        CONSOLE_printf(cpu, "\n-- program is finished running --\n");
+        CONSOLE_flush(cpu);
+        if (cpu->frame != NULL) {
+            FRAME_present(cpu); // showing the last frame
+        }
+        end_frame(cpu);
         return 1; // exiting the step function
         break;
     case SYSCALL_CODE_DRAW_PIXEL:
     case SYSCALL_CODE_DRAW_RECTANGLE:
     case SYSCALL_CODE_DRAW_BITMAP:
-        handle_draw_syscalls();
+        if (!cpu->no_draw) {
+            handle_draw_syscalls(cpu);
+        }
+        break;
+    case SYSCALL_CODE_PRESENT:
+        if (cpu->frame != NULL) {
+            FRAME_present(cpu);
+        }
+        end_frame(cpu);
         break;
     default:
-        printf("Unknown syscall code %ld\n", registers[SYSCALL_CODES_REG]);
+        CONSOLE_printf(cpu, "Unknown syscall code %d\n", cpu->registers[SYSCALL_CODES_REG]);
         break;
     }
 
     return 0;
 }
 
-// this function returns the value located at the given address in data memory, based on the size to read, specified by the load instruction (byte/halfword/word)
-unsigned long load_from_memory(unsigned long addr)
+/* this function returns the value located at the given address in data memory, based on the size to read, specified by the load instruction opcode (byte/halfword/word).
+   The lower address bits that would make a halfword/word unaligned are ignored, so an access never crosses a page.
+*/
+uint32_t load_from_memory(MIPS_cpu_t *cpu, unsigned int opcode, uint32_t addr)
 {
-    char *byte_ptr;
-    short *hw_ptr; // halfword (16 bits)
-    unsigned long result = 0;
+    int16_t halfword;
+    uint32_t result = 0;
 
-    switch (current_instruction.commontype.opcode) {
+    switch (opcode) {
     case OPCODE_LB:
-        byte_ptr = (char *)data_mem; // when dereferencing a char (byte) pointer, we will only get the least significant 8 bits as necessary
-        result = byte_ptr[addr % (DATA_MEM_SIZE * 4)]; // we want the address to fall within the data array, but DATA_MEM_SIZE counts words whereas addr counts bytes, so we have to multiply the size by 4
+        result = (int8_t)*MEM_read_ptr(&cpu->mem, addr); // sign-extending the byte
         break;
     case OPCODE_LH:
-        hw_ptr = (short *)data_mem; // when dereferencing a short (halfword) pointer, we will only get the least significant 16 bits as necessary
-        result = hw_ptr[(addr >> 1) % (DATA_MEM_SIZE * 2)]; // hw_ptr[addr] would evaluate to a memory address 2*addr bytes ahead of hw_ptr, so we have to divide addr by 2
+        memcpy(&halfword, MEM_read_ptr(&cpu->mem, addr & ~1U), sizeof(halfword)); // memcpy, since the page holds bytes
+        result = halfword; // sign-extending the halfword
         break;
     case OPCODE_LW:
-        // we don't need to use a special pointer since data_mem is already a pointer to 32 bits (word)
-        result = data_mem[(addr >> 2) % DATA_MEM_SIZE]; // data_mem[addr] would evaluate to a memory address 4*addr bytes ahead of data_mem, so we have to divide addr by 4
+        memcpy(&result, MEM_read_ptr(&cpu->mem, addr & ~3U), sizeof(result));
         break;
     case OPCODE_LBU: // load byte unsigned
-        byte_ptr = (char *)data_mem;
-        result = byte_ptr[addr % (DATA_MEM_SIZE * 4)] & 0xffL; // result should contain: {0 × 24, Mem1B(R[$rs] + SignExt16b(imm))}
+        result = *MEM_read_ptr(&cpu->mem, addr); // result should contain: {0 × 24, Mem1B(R[$rs] + SignExt16b(imm))}
         break;
     case OPCODE_LHU: // load halfword unsigned
-        hw_ptr = (short *)data_mem;
-        result = hw_ptr[(addr >> 1) % (DATA_MEM_SIZE * 2)] & 0xffffL; // result should contain: {0 × 16, Mem2B(R[$rs] + SignExt16b(imm))}
+        memcpy(&halfword, MEM_read_ptr(&cpu->mem, addr & ~1U), sizeof(halfword));
+        result = (uint16_t)halfword; // result should contain: {0 × 16, Mem2B(R[$rs] + SignExt16b(imm))}
         break;
     default:
         break;
@@ -467,104 +1277,341 @@ unsigned long load_from_memory(unsigned long addr)
     return result;
 }
 
-// this function stores the given value (or part of it) at the given address in data memory, based on the size to store, specified by the store instruction (byte/halfword/word)
-void store_in_memory(unsigned long addr, unsigned long value)
+// this function stores the given value (or part of it) at the given address in data memory, based on the size to store, specified by the store instruction opcode (byte/halfword/word)
+void store_in_memory(MIPS_cpu_t *cpu, unsigned int opcode, uint32_t addr, uint32_t value)
 {
-    char *byte_ptr;
-    short *hw_ptr; // halfword (16 bits)
+    uint16_t halfword;
 
-    switch (current_instruction.commontype.opcode) {
+    switch (opcode) {
     case OPCODE_SB:
-        byte_ptr = (char *)data_mem;
-        byte_ptr[addr % (DATA_MEM_SIZE * 4)] = (char)value; // taking only the least significant 8 bits from the value
+        *MEM_write_ptr(&cpu->mem, addr) = (unsigned char)value; // taking only the least significant 8 bits from the value
         break;
     case OPCODE_SH:
-        hw_ptr = (short *)data_mem;
-        hw_ptr[(addr >> 1) % (DATA_MEM_SIZE * 2)] = (short)value; // taking only the least significant 16 bits from the value
+        halfword = (uint16_t)value; // taking only the least significant 16 bits from the value
+        memcpy(MEM_write_ptr(&cpu->mem, addr & ~1U), &halfword, sizeof(halfword));
         break;
     case OPCODE_SW:
-        data_mem[(addr >> 2) % DATA_MEM_SIZE] = value; // storing the entire 32-bit value
+        memcpy(MEM_write_ptr(&cpu->mem, addr & ~3U), &value, sizeof(value)); // storing the entire 32-bit value
         break;
     default:
         break;
     }
 }
 
-int MIPS_step(void)
+/* Engine macros for MIPS_interpret (see mips_handlers.h). The interpreter keeps the pc up to date after every instruction, and fetches (and if
+   needed, predecodes again) every instruction from program memory.
+*/
+#define PC run_pc
+
+// fetching the predecoded record of the instruction at run_pc (predecoding it again first, if its program memory word was overwritten since)
+#define FETCH() \
+    do { \
+        index = PROG_INDEX(cpu, run_pc); \
+        d = &cpu->decoded_prog[index]; \
+        if (d->inst != cpu->prog_mem[index]) { \
+            predecode(cpu, index); \
+        } \
+    } while (0)
+
+// retiring the current instruction and continuing with the one at run_pc, unless the budget is used up
+#define CONTINUE() \
+    do { \
+        if (--budget == 0) { \
+            reason = MIPS_RUN_BUDGET; \
+            goto out; \
+        } \
+        FETCH(); \
+        DISPATCH(); \
+    } while (0)
+
+// the same as CONTINUE, but also checking the stop flag. It is used after every taken branch/jump and syscall, so any guest loop checks it
+#define CONTINUE_CHECK_STOP() \
+    do { \
+        if (stop != NULL && *stop) { \
+            reason = MIPS_RUN_STOPPED; \
+            goto out; \
+        } \
+        CONTINUE(); \
+    } while (0)
+
+#define NEXT() \
+    do { \
+        run_pc += 4; \
+        CONTINUE(); \
+    } while (0)
+
+// ending the current run of instructions (see count_run) with the current one, and starting the next run at run_pc
+#define END_RUN() \
+    do { \
+        count_run(cpu, PROG_INDEX(cpu, run_start), run_budget - budget + 1, 1); \
+        run_start = run_pc; \
+        run_budget = budget - 1; \
+    } while (0)
+
+#define JUMP(target) \
+    do { \
+        cpu->taken[d->op]++; \
+        run_pc = (target); \
+        END_RUN(); \
+        CONTINUE_CHECK_STOP(); \
+    } while (0)
+
+// the number of instructions retired by the context so far, including the current one (reported to the profiler)
+#define RETIRED() (cpu->instructions + initial_budget - budget + 1)
+
+#define CALL(target) \
+    do { \
+        if (cpu->profile != NULL) { \
+            PROFILE_call(cpu, (target), PC + 4, RETIRED()); \
+        } \
+        JUMP(target); \
+    } while (0)
+
+#define JUMP_REGISTER(target) \
+    do { \
+        if (cpu->profile != NULL && d->rs == NUM_REG - 1) { \
+            PROFILE_return(cpu, (target), RETIRED()); \
+        } \
+        JUMP(target); \
+    } while (0)
+
+#define CALL_REGISTER(target) CALL(target)
+
+// syscalls end the run as well, so that the run is always empty when the stop flag is found set
+#define RESUME() \
+    do { \
+        run_pc += 4; \
+        END_RUN(); \
+        CONTINUE_CHECK_STOP(); \
+    } while (0)
+
+#define EXIT() \
+    do { \
+        reason = MIPS_RUN_EXIT; \
+        goto out; \
+    } while (0)
+
+int MIPS_interpret(MIPS_cpu_t *cpu, unsigned long long budget, volatile int *stop)
 {
-    unsigned long alu_src1, alu_src2; // parameters passed to alu
-    short imm; // variable to contain the immediate value from the instruction, if it exists (short is 16 bits)
-    long sign_ext_imm; // variable to contain the sign-extended immediate value
-    unsigned long tmp; // for jr/jalr
-
-    // reading next instruction and setting control signals
-    current_instruction.inst = prog_mem[(pc >> 2) % PROG_MEM_SIZE]; // prog_mem contains 32-bit (long) elements, but pc counts bytes, so we divide it by 4 and use modulus so that the index falls in the prog_mem array range
-    generate_control();
-
-    alu_src1 = registers[current_instruction.rtype.rs]; // will also work for I-type instructions (whose rs has the same size and position as R-type)
-
-    imm = (short)current_instruction.itype.addr_im; // taking the immediate value from the instruction
-    sign_ext_imm = imm; // performing sign extension
-    alu_src2 = (control.alu_src) ? sign_ext_imm : registers[current_instruction.rtype.rt]; // choosing the relevant value - rt or the sign-extended immediate (storing sign_ext_imm in an unsigned long does no harm)
-    alu(alu_src1, alu_src2); // calculates alu_result
-
-    // checking if we need to write to a register (later on handling jumps writing to R[31])
-    if (control.reg_write && !control.jump_and_link) {
-        // first checking if we need to read a value from the memory into the register (only load instructions)
-        if (control.mem_read && control.mem_to_reg) { // these signals are always both on or both off
-            // all load instructions write to $rt
-            registers[current_instruction.itype.rt] = load_from_memory(alu_result);
-        } else {
-            // checking if we need to write to $rd (R-type + mul instruction)
-            if (control.reg_dest) {
-                registers[current_instruction.rtype.rd] = alu_result; // writing the ALU result
-            } else {
-                registers[current_instruction.itype.rt] = alu_result; // writing the ALU result to $rt (applies to: addi, addiu, slti, sltiu, andi, ori, xori, lui)
-            }
+#ifdef MIPS_THREADED_DISPATCH
+#define MIPS_OP_LABEL(name) &&op_##name,
+    static void *const handlers[NUM_OPS] = { MIPS_OP_LIST(MIPS_OP_LABEL) };
+#undef MIPS_OP_LABEL
+#endif
+    uint32_t run_pc = cpu->pc; // working copy of the program counter, written back when returning
+    uint32_t run_start = cpu->pc; // address of the first instruction of the current run
+    unsigned long long run_budget; // the budget left when the current run started (runs don't branch, so it tells their length)
+    uint32_t index;
+    const decoded_t *d;
+    unsigned long long initial_budget;
+    int reason;
+
+    if (budget == 0) {
+        budget = ~0ULL; // no limit (practically)
+    }
+    if (stop != NULL && *stop) {
+        return MIPS_RUN_STOPPED;
+    }
+    initial_budget = budget;
+    run_budget = budget;
+
+    FETCH();
+#ifdef MIPS_THREADED_DISPATCH
+    DISPATCH();
+#else
+dispatch:
+    switch (d->op) {
+#endif
+
+#include "mips_handlers.h"
+
+#ifndef MIPS_THREADED_DISPATCH
+    }
+#endif
+
+out:
+    // counting the last run, unless it's empty (the budget ran out right after a jump/syscall). An exit syscall is always part of the run
+    if (reason == MIPS_RUN_EXIT || (reason == MIPS_RUN_BUDGET && run_pc != run_start)) {
+        count_run(cpu, PROG_INDEX(cpu, run_start), run_budget - budget + (reason != MIPS_RUN_BUDGET), 1);
+    }
+    cpu->pc = run_pc;
+    // the budget is charged when continuing to the next instruction, so unless it was used up, the last instruction wasn't charged yet
+    cpu->instructions += initial_budget - budget + (reason != MIPS_RUN_BUDGET);
+    return reason;
+}
+
+#undef PC
+#undef FETCH
+#undef CONTINUE
+#undef CONTINUE_CHECK_STOP
+#undef NEXT
+#undef END_RUN
+#undef JUMP
+#undef RETIRED
+#undef CALL
+#undef JUMP_REGISTER
+#undef CALL_REGISTER
+#undef RESUME
+#undef EXIT
+
+// handles a syscall, counting it by code and timing it
+int handle_syscall(MIPS_cpu_t *cpu)
+{
+    uint32_t code = cpu->registers[SYSCALL_CODES_REG];
+    unsigned long long start = THREAD_time_ns();
+    int finished;
+
+    cpu->syscall_code = code;
+    finished = do_syscall(cpu);
+
+    cpu->counters.syscall_ns += THREAD_time_ns() - start;
+    cpu->counters.syscalls[(code < MIPS_NUM_SYSCALL_COUNTERS) ? code : MIPS_NUM_SYSCALL_COUNTERS - 1]++;
+    return finished;
+}
+
+int MIPS_cpu_set_engine(MIPS_cpu_t *cpu, int new_engine)
+{
+    int jit_mode = (new_engine == MIPS_ENGINE_JIT) ? BLOCK_JIT_ON : (new_engine == MIPS_ENGINE_JIT_CHECK) ? BLOCK_JIT_CHECK : BLOCK_JIT_OFF;
+
+    if (new_engine != MIPS_ENGINE_INTERPRETER) {
+        jit_mode = BLOCK_set_jit(cpu, jit_mode);
+        if (jit_mode < 0) {
+            printf("There isn't enough memory for the block engine, using the interpreter instead\n");
+            new_engine = MIPS_ENGINE_INTERPRETER;
+        } else if (jit_mode == BLOCK_JIT_OFF && new_engine != MIPS_ENGINE_BLOCK) {
+            printf("The JIT is not available on this host, using the block engine instead\n");
+            new_engine = MIPS_ENGINE_BLOCK;
         }
-        registers[0] = 0; // making sure no one changed the $zero register
-    } else if (control.mem_write) { // checking if we need to write to memory (store instructions)
-        store_in_memory(alu_result, registers[current_instruction.itype.rt]);
-    } else { // syscalls, jumps and branches
-        if (current_instruction.commontype.opcode == OPCODE_RTYPE && current_instruction.rtype.funct == FUNCT_SYSCALL) {
-            // handling the syscall and exiting the program if an exit call was made (MARS allows omitting the exit call, but here this is the only way to exit)
-            if (handle_syscall() != 0) {
-                return 1;
-            }
-        } else {
-            if (control.jump) { // j/jal
-                if (control.jump_and_link) {
-                    registers[NUM_REG - 1] = pc + 4; // storing the return address in register 31 (also called $ra - return address)
-                }
-                pc = ((pc + 4) & 0xf0000000) | (current_instruction.jtype.addr << 2); // the new pc should be composed of: {(PC + 4)[31:28], address, 00}
-                return 0; // returning here so that we don't add 4 below
-            }
-            
-            if (control.jump_register) { // jr/jalr
-                tmp = registers[NUM_REG - 1];
-                if (control.jump_and_link) {
-                    registers[NUM_REG - 1] = pc + 4;
-                }
-                pc = tmp;
-                return 0;
-            }
+    }
+    cpu->engine = new_engine;
+    return new_engine;
+}
 
-            // updating branch signal and checking it only if the current instruction is one of the branch instructions
-            if (branch_control(current_instruction.commontype.opcode, (long)alu_src1, alu_result)) {
-                if (control.branch) {
-                    pc += (sign_ext_imm << 2); // we need to add 00 to the low order bits of the sign-extended offset address we should jump to. 4 is also added to the pc afterwards, below
-                }
-            /* The R-type instructions: mthi, mtlo, mult, multu, div, divu will reach here because they don't match any of the previous cases,
-               and in fact we don't need to do anything with them because they already modified hi and lo. But we also need to make sure they are not
-               mistaken for unsupported instructions...
-            */
-            } else if (current_instruction.commontype.opcode != OPCODE_RTYPE) {
-                printf("Unsupported instruction: %x\n", current_instruction.inst); // after checking all options, there is nothing left to do...
-            }
+int MIPS_set_engine(int new_engine)
+{
+    return MIPS_cpu_set_engine(&default_cpu, new_engine);
+}
+
+/* Models that need to see every executed instruction (the trace, the caches, the branch predictors and the pipeline) are handed the record of each
+   instruction (see TRACE_describe). The interpreter then executes one instruction at a time, and the block engine runs BLOCK_run_observed, which
+   calls observe_instruction after each instruction without leaving the block.
+*/
+#define OBSERVED(cpu) ((cpu)->trace != NULL || (cpu)->cache != NULL || (cpu)->predict != NULL || (cpu)->pipeline != NULL)
+
+// hands the instruction at pc, which was just executed, to the models (the pc of the context must already be the address of the next instruction)
+void observe_instruction(MIPS_cpu_t *cpu, uint32_t pc)
+{
+    TRACE_record_t record;
+
+    record.pc = pc;
+    TRACE_describe(cpu, &record);
+    if (cpu->trace != NULL) {
+        TRACE_put(cpu, &record);
+    }
+    if (cpu->cache != NULL) {
+        CACHE_observe(cpu, &record);
+    }
+    if (cpu->predict != NULL) {
+        PREDICT_observe(cpu, &record);
+    }
+    if (cpu->pipeline != NULL) {
+        PIPELINE_observe(cpu, &record);
+    }
+}
+
+static int observed_step(MIPS_cpu_t *cpu, volatile int *stop)
+{
+    unsigned long long instructions = cpu->instructions;
+    uint32_t pc = cpu->pc;
+    int reason;
+
+    reason = MIPS_interpret(cpu, 1, stop);
+    if (cpu->instructions == instructions) {
+        return reason; // stopped before the instruction was executed
+    }
+    observe_instruction(cpu, pc);
+    return reason;
+}
+
+int observed_run(MIPS_cpu_t *cpu, unsigned long long budget, volatile int *stop)
+{
+    unsigned long long executed;
+    int reason;
+
+    for (executed = 0; budget == 0 || executed < budget; executed++) {
+        reason = observed_step(cpu, stop);
+        if (reason != MIPS_RUN_BUDGET) {
+            return reason;
         }
     }
+    return MIPS_RUN_BUDGET;
+}
 
-    pc += 4; // moving on to the next instruction
-    
-    return 0; // indicating that the program is not finished yet
+static int run_engine(MIPS_cpu_t *cpu, unsigned long long budget, volatile int *stop)
+{
+    switch (cpu->engine) {
+    case MIPS_ENGINE_BLOCK:
+    case MIPS_ENGINE_JIT:
+    case MIPS_ENGINE_JIT_CHECK:
+        if (OBSERVED(cpu)) {
+            return BLOCK_run_observed(cpu, budget, stop);
+        }
+        return BLOCK_run(cpu, budget, stop);
+    default:
+        if (OBSERVED(cpu)) {
+            return observed_run(cpu, budget, stop);
+        }
+        return MIPS_interpret(cpu, budget, stop);
+    }
+}
+
+// runs the program in slices that end where the present interval of the framebuffer does, presenting it after each of them
+static int run_presenting(MIPS_cpu_t *cpu, unsigned long long budget, volatile int *stop)
+{
+    unsigned long long end = cpu->instructions + budget, slice;
+    int reason;
+
+    do {
+        slice = FRAME_until_present(cpu);
+        if (budget != 0 && end - cpu->instructions < slice) {
+            slice = end - cpu->instructions;
+        }
+        reason = run_engine(cpu, slice, stop);
+        FRAME_tick(cpu);
+    } while (reason == MIPS_RUN_BUDGET && (budget == 0 || cpu->instructions < end));
+    return reason;
+}
+
+int MIPS_cpu_run(MIPS_cpu_t *cpu, unsigned long long budget, volatile int *stop)
+{
+    unsigned long long start = THREAD_time_ns();
+    int reason;
+
+    if (cpu->frame != NULL && FRAME_until_present(cpu) != 0) {
+        reason = run_presenting(cpu, budget, stop);
+    } else {
+        reason = run_engine(cpu, budget, stop);
+    }
+    cpu->run_ns += THREAD_time_ns() - start;
+    CONSOLE_flush(cpu); // the host may print after running, or stop running
+    end_frame(cpu);
+    return reason;
+}
+
+int MIPS_run(unsigned long long budget, volatile int *stop)
+{
+    return MIPS_cpu_run(&default_cpu, budget, stop);
+}
+
+int MIPS_cpu_step(MIPS_cpu_t *cpu)
+{
+    if (OBSERVED(cpu)) {
+        return (observed_step(cpu, NULL) == MIPS_RUN_EXIT) ? 1 : 0;
+    }
+    return (MIPS_interpret(cpu, 1, NULL) == MIPS_RUN_EXIT) ? 1 : 0;
+}
+
+int MIPS_step(void)
+{
+    return MIPS_cpu_step(&default_cpu);
 }
@@ -15,45 +15,416 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <Windows.h> // for sleep function
+#include "thread.h" // for the sleep function
 #include "mipsdefs.h"
 
-#define DATA_MEM_SIZE 1024
-#define PROG_MEM_SIZE 1024
+#define PROG_MEM_SIZE 1024 // minimal number of words in program memory (it grows to fit larger programs)
 
-// externing registers and data memory for use in draw_syscalls.c
-extern unsigned long registers[NUM_REG];
-extern unsigned long data_mem[DATA_MEM_SIZE];
+/* The machine context, owning all the state of a single simulation (register file, memories, pc, execution engine state, etc.).
+   Any number of contexts can be created and run independently (also from different threads, one thread per context at a time).
+   The functions without a context argument (MIPS_init, MIPS_step, MIPS_run, MIPS_set_engine, MIPS_get_info) operate on a default context, so programs
+   that only run a single simulation don't need to create one.
+*/
+typedef struct MIPS_cpu_s MIPS_cpu_t;
+
+// a saved machine state (see MIPS_snapshot), which any number of contexts can be restored to
+typedef struct MIPS_snapshot_s MIPS_snapshot_t;
+
+#define MIPS_NUM_OP_CLASSES        52 // instruction classes counted separately: one per supported instruction, plus nop and unsupported (see MIPS_op_name)
+#define MIPS_NUM_SYSCALL_COUNTERS  64 // syscall codes counted separately (larger codes share the last counter)
+
+/* Performance counters of a context, counting since the program was loaded (or the context was restored from a snapshot).
+   The engines only count what they can't get otherwise: the number of times every straight-line run of instructions was executed (once per taken
+   branch/jump, or once per block execution in the block engine), taken branches/jumps, and syscalls. Everything else is computed from these and the
+   predecoded program when MIPS_get_info is called, so the counters cost almost nothing while the program runs.
+   Instructions translated by mips_aot aren't counted.
+*/
+typedef struct {
+    unsigned long long instructions; // retired instructions
+    unsigned long long by_op[MIPS_NUM_OP_CLASSES]; // retired instructions of every class
+    unsigned long long branches_taken, branches_not_taken; // beq, bne, blez, bgtz
+    unsigned long long jumps; // j, and jr through any register but $ra
+    unsigned long long calls; // jal, jalr
+    unsigned long long returns; // jr $ra
+    unsigned long long loads_byte, loads_half, loads_word; // lb/lbu, lh/lhu, lw
+    unsigned long long stores_byte, stores_half, stores_word; // sb, sh, sw
+    unsigned long long syscalls[MIPS_NUM_SYSCALL_COUNTERS]; // syscalls by code ($v0)
+    unsigned long long syscall_ns; // host time spent handling syscalls
+    unsigned long long execution_ns; // host time spent in MIPS_run, not including syscalls
+} MIPS_counters_t;
 
-// structure used for debugging
+/* structure used for debugging. Writing to program memory through prog_mem_base is allowed at any time: a modified word is detected and predecoded
+   again before it is executed.
+*/
 typedef struct {
-    unsigned long *prog_mem_base;
-    unsigned long *data_mem_base;
-    unsigned long *reg_mem_base;
-    unsigned long *pc;
-    unsigned long *alu_res;
-    unsigned long *hi, *lo;
-    unsigned int  *prog_size;
+    uint32_t *prog_mem_base;
+    uint32_t *reg_mem_base;
+    uint32_t *pc;
+    uint32_t *alu_res;
+    uint32_t *hi, *lo;
+    unsigned int *prog_size;
+    unsigned long long *instructions; // number of instructions executed since the program was loaded
+    const MIPS_counters_t *counters; // performance counters, brought up to date by every call to MIPS_get_info
 } MIPS_info_t;
 
+/* Console of a context. The console syscalls (print_*, read_int, and the messages printed when the program exits or hits an unknown syscall/instruction)
+   go through it, so a host running several contexts (e.g. batch.c) can give each one its own input and capture each one's output.
+   A context starts with the process console (stdout/stdin).
+*/
+typedef struct {
+    void (*write)(void *user, const char *text, size_t length); // writes length characters of output
+    int (*read_int)(void *user, int32_t *value); // reads the next integer of input. Returns 0 (leaving *value unchanged) if there is none
+    void *user; // passed to both functions
+} MIPS_console_t;
+
+// allocates a new context (with the interpreter engine selected). Returns NULL if there isn't enough memory
+MIPS_cpu_t *MIPS_create(void);
+
+// frees a context created by MIPS_create
+void MIPS_destroy(MIPS_cpu_t *cpu);
+
 /* This function receives two filenames representing:
    1. A text file containing the entire .data segment as 32-bit hex values separated across lines. The non-zero values appearing there will be the ones
       declared and initialized under the .data directive/s in the .asm file.
    2. A text file containing the assembled program as 32-bit hex values separated across lines, representing the instructions written under the .text directive/s
       in the .asm file.
-   You can generate both of these files using MARS, but before doing so go to Settings->Memory Configuration... and make sure that the selected configuration is
-   "Compact, Data at Address 0". That's because we store the memory data as an array read from the dumped data file, and use the offset addresses read from
-   instructions in the program file (calculated by the assembler that generated the file) as the indexes to access this array.
-   For example, in the Default memory configuration, the .data base address is 0x10010000, so if the la (load address) instruction needs to load an address found
-   76 bytes after the beginning of the data segment, then the loaded address will be 0x1001004C. We cannot later use such an address to load the data stored there,
-   because it would go out of range, as array indexes obviously start at 0. So we just need to make sure that the data segment starts at address 0 as well.
+   You can generate both of these files using MARS (File->Dump Memory, "Hexadecimal Text"). The .data segment is loaded at the .data base address of the memory
+   layout selected with MIPS_cpu_set_layout (which must be the MARS memory configuration the program was assembled with, see Settings->Memory Configuration...),
+   and $sp, $gp and the pc are reset the way MARS resets them for that configuration.
+   Data memory is a full 32-bit address space, whose pages are allocated once they are written to (see mips_mem.h), so any address the program computes can
+   be used, and the stack/heap may grow as far as the host's memory allows. Program memory is sized to fit the program (at least PROG_MEM_SIZE instructions).
+   Returns 0 on success, and -1 (after printing why) if a file can't be read or there isn't enough memory for the program.
 */
-void MIPS_init(const char *data_filename, const char *program_filename);
+int MIPS_cpu_init(MIPS_cpu_t *cpu, const char *data_filename, const char *program_filename);
+int MIPS_init(const char *data_filename, const char *program_filename);
+
+/* This function loads a program image (see mips_image.h, converted from the two hex files by tools/hex2img.c) instead of the two hex files, and
+   selects the memory layout recorded in the image. An image written by MIPS_snapshot_save also restores the machine state it holds. Loading an image maps it into memory and only copies its instructions and the non-zero part of
+   its .data segment, so it is the fastest way to start a run. Returns 0 on success, and -1 (after printing why) otherwise.
+*/
+int MIPS_cpu_load_image(MIPS_cpu_t *cpu, const char *image_filename);
+int MIPS_load_image(const char *image_filename);
+
+// memory layouts, matching the memory configurations of MARS
+#define MIPS_LAYOUT_COMPACT_DATA_AT_0 0 // .data at 0x0, heap at 0x2000, $gp = 0x1800, $sp = 0x2ffc, .text at 0x3000 (default)
+#define MIPS_LAYOUT_DEFAULT           1 // .text at 0x00400000, .data at 0x10010000, heap at 0x10040000, $gp = 0x10008000, $sp = 0x7fffeffc
+#define MIPS_LAYOUT_COMPACT_TEXT_AT_0 2 // .text at 0x0, .data at 0x2000, heap at 0x3000, $gp = 0x1800, $sp = 0x3ffc
+
+// This function selects the memory layout used by the following calls to MIPS_init (it is kept across them). Returns -1 for an unknown layout, and 0 otherwise
+int MIPS_cpu_set_layout(MIPS_cpu_t *cpu, int layout);
+int MIPS_set_layout(int layout);
+
+// This function sets the .text and .data base addresses of a memory layout (for tools that write program images). Returns -1 for an unknown layout, and 0 otherwise
+int MIPS_get_layout_bases(int layout, uint32_t *text_base, uint32_t *data_base);
 
 // This function emulates the entire processor operation for a single instruction. It returns 1 if the program is finished (determined solely by reaching an exit syscall), and 0 otherwise.
+int MIPS_cpu_step(MIPS_cpu_t *cpu);
 int MIPS_step(void);
 
+// return values of MIPS_run
+#define MIPS_RUN_EXIT    0 // an exit syscall was executed (the program is finished)
+#define MIPS_RUN_BUDGET  1 // the instruction budget was used up
+#define MIPS_RUN_STOPPED 2 // the stop flag was set
+
+/* This function runs the program until it is finished, the given number of instructions were executed (0 means no limit), or *stop becomes non-zero
+   (stop may be NULL). The flag is checked after every taken branch/jump and syscall, so it may be set from another thread or a signal handler.
+   The results are identical to calling MIPS_step repeatedly, but the instructions are executed inside a single dispatch loop.
+*/
+int MIPS_cpu_run(MIPS_cpu_t *cpu, unsigned long long budget, volatile int *stop);
+int MIPS_run(unsigned long long budget, volatile int *stop);
+
+// execution engines used by MIPS_run
+#define MIPS_ENGINE_INTERPRETER 0 // threaded interpreter, dispatching every instruction (default)
+#define MIPS_ENGINE_BLOCK       1 // basic-block cache with block chaining (see mips_block.h)
+#define MIPS_ENGINE_JIT         2 // block engine, compiling hot blocks to x86-64 code (see mips_jit.h)
+#define MIPS_ENGINE_JIT_CHECK   3 // like MIPS_ENGINE_JIT, but every compiled run is checked against MIPS_step (lockstep self-check)
+
+/* This function selects the engine used by the following calls to MIPS_run (MIPS_step always uses the interpreter).
+   If the JIT can't be used on this host, the block engine is selected instead. Returns the selected engine.
+*/
+int MIPS_cpu_set_engine(MIPS_cpu_t *cpu, int new_engine);
+int MIPS_set_engine(int new_engine);
+
 // this function receives the address of an info object and updates its contents
+void MIPS_cpu_get_info(MIPS_cpu_t *cpu, MIPS_info_t *info);
 void MIPS_get_info(MIPS_info_t *info);
 
+// returns the mnemonic of an instruction class (an index of MIPS_counters_t.by_op)
+const char *MIPS_op_name(int op);
+
+// these functions print the performance counters (brought up to date first), e.g. to stderr once the program exits
+void MIPS_cpu_print_counters(MIPS_cpu_t *cpu, FILE *out);
+void MIPS_print_counters(FILE *out);
+
+// these functions copy length bytes from the data address space to a buffer and back (for debugging, or setting up the input of a program)
+void MIPS_cpu_read_memory(MIPS_cpu_t *cpu, uint32_t addr, void *buffer, size_t length);
+void MIPS_cpu_write_memory(MIPS_cpu_t *cpu, uint32_t addr, const void *buffer, size_t length);
+void MIPS_read_memory(uint32_t addr, void *buffer, size_t length);
+void MIPS_write_memory(uint32_t addr, const void *buffer, size_t length);
+
+/* This function enables (1) or disables (0) profiling of the context. While profiling, the engines report every call (jal/jalr) and return (jr $ra),
+   and a call tree of the functions (identified by their entry addresses) is built, counting the instructions each of them retired.
+   Disabling it drops the profile. Returns 0 on success, and -1 if there isn't enough memory.
+*/
+int MIPS_cpu_set_profiling(MIPS_cpu_t *cpu, int enabled);
+int MIPS_set_profiling(int enabled);
+
+/* This function writes the profile collected since the program was loaded (or the context was restored from a snapshot) to two files (either of the
+   names may be NULL):
+   - flat_filename: the functions by the instructions they retired (self, and including their callees), then the hottest instructions with their
+     execution counts and disassembly
+   - stacks_filename: the call stacks in the collapsed format of flamegraph.pl, e.g. "0x00003000;0x00003040;0x000030a0 1234"
+   Returns 0 on success, and -1 (after printing why) if profiling isn't enabled or a file can't be written.
+*/
+int MIPS_cpu_write_profile(MIPS_cpu_t *cpu, const char *flat_filename, const char *stacks_filename);
+int MIPS_write_profile(const char *flat_filename, const char *stacks_filename);
+
+// cache replacement policies
+#define MIPS_CACHE_LRU    0 // least recently used
+#define MIPS_CACHE_PLRU   1 // tree pseudo-LRU
+#define MIPS_CACHE_RANDOM 2
+
+// cache write policies
+#define MIPS_CACHE_WRITE_BACK    0 // stores allocate a line on a miss, and dirty lines are written back to memory when they are evicted
+#define MIPS_CACHE_WRITE_THROUGH 1 // every store is written to memory, and a store miss doesn't allocate a line
+
+// configuration of a cache. The size, line size and associativity must be powers of 2, with lines of at least 4 bytes and at most 32 ways
+typedef struct {
+    uint32_t size; // bytes of data the cache holds
+    uint32_t line_size; // bytes
+    uint32_t ways; // lines per set (1 for a direct-mapped cache, size / line_size for a fully associative one)
+    int replacement; // MIPS_CACHE_LRU/PLRU/RANDOM
+    int write_policy; // MIPS_CACHE_WRITE_BACK/WRITE_THROUGH (ignored for the instruction cache)
+} MIPS_cache_config_t;
+
+// statistics of a cache, counting since the program was loaded (or the context was restored from a snapshot)
+typedef struct {
+    unsigned long long reads, read_misses; // loads (instruction fetches for the instruction cache)
+    unsigned long long writes, write_misses; // stores
+    unsigned long long evictions; // valid lines replaced by another line
+    unsigned long long writebacks; // dirty lines written back to memory (write-back)
+    unsigned long long memory_writes; // stores written to memory (write-through)
+} MIPS_cache_stats_t;
+
+/* This function models an L1 instruction cache and/or data cache (NULL for a cache that isn't modeled, and both NULL to stop modeling them).
+   While caches are modeled, MIPS_run hands every executed instruction to them (the JIT's native code isn't called), and every instruction fetch and
+   load/store is looked up in the caches, counting hits, misses and evictions, and the misses of every instruction. The caches are emptied whenever
+   the program is loaded. Returns 0 on success, and -1 (after printing why) for an invalid configuration or if there isn't enough memory.
+*/
+int MIPS_cpu_set_caches(MIPS_cpu_t *cpu, const MIPS_cache_config_t *icache, const MIPS_cache_config_t *dcache);
+int MIPS_set_caches(const MIPS_cache_config_t *icache, const MIPS_cache_config_t *dcache);
+
+// these functions receive the addresses of stats objects and update their contents (a cache that isn't modeled gets zeros)
+void MIPS_cpu_get_cache_stats(MIPS_cpu_t *cpu, MIPS_cache_stats_t *icache, MIPS_cache_stats_t *dcache);
+void MIPS_get_cache_stats(MIPS_cache_stats_t *icache, MIPS_cache_stats_t *dcache);
+
+// these functions print the statistics of the caches, with the instructions that missed the most (with their disassembly)
+void MIPS_cpu_print_caches(MIPS_cpu_t *cpu, FILE *out);
+void MIPS_print_caches(FILE *out);
+
+// branch predictors (indices of the statistics arrays). All of them run side by side while branch prediction is modeled
+#define MIPS_PREDICT_NOT_TAKEN 0 // static: every conditional branch is predicted not taken
+#define MIPS_PREDICT_BACKWARD  1 // static: backward branches (loops) are predicted taken, and forward branches not taken
+#define MIPS_PREDICT_BIMODAL   2 // a table of 2-bit saturating counters indexed by the pc of the branch
+#define MIPS_PREDICT_GSHARE    3 // a table of 2-bit saturating counters indexed by the pc of the branch xor the outcomes of the last branches
+#define MIPS_PREDICT_RAS       4 // return address stack: jal/jalr push the return address, and jr $ra is predicted to return to the address on top
+#define MIPS_NUM_PREDICTORS    5
+
+// configuration of the dynamic predictors. The table sizes must be powers of 2
+typedef struct {
+    uint32_t bimodal_entries; // counters in the bimodal table
+    uint32_t gshare_entries; // counters in the gshare table
+    uint32_t history_bits; // outcomes of the last branches that gshare keeps (at most 32)
+    uint32_t ras_depth; // entries of the return address stack (a call overwrites the oldest one when it is full)
+} MIPS_predictor_config_t;
+
+// statistics of a predictor, counting since the program was loaded (or the context was restored from a snapshot)
+typedef struct {
+    unsigned long long predictions; // conditional branches executed (returns for the return address stack)
+    unsigned long long mispredictions;
+} MIPS_predictor_stats_t;
+
+// statistics of a single branch (or jr $ra) instruction
+typedef struct {
+    unsigned long long executions;
+    unsigned long long taken;
+    unsigned long long mispredictions[MIPS_NUM_PREDICTORS]; // only MIPS_PREDICT_RAS for jr $ra, and all the others for a conditional branch
+} MIPS_branch_stats_t;
+
+/* This function models the branch predictors of a pipelined core (NULL stops modeling them). While they are modeled, MIPS_run hands every executed
+   instruction to them (the JIT's native code isn't called), every conditional branch (beq/bne/blez/bgtz) is predicted by all of the direction predictors and every jr $ra
+   by the return address stack, and the predictions are checked against what the instruction actually did. Prediction never changes the results of the
+   program. The predictors start over whenever the program is loaded. Returns 0 on success, and -1 (after printing why) for an invalid configuration
+   or if there isn't enough memory.
+*/
+int MIPS_cpu_set_predictors(MIPS_cpu_t *cpu, const MIPS_predictor_config_t *config);
+int MIPS_set_predictors(const MIPS_predictor_config_t *config);
+
+// these functions receive the address of an array of MIPS_NUM_PREDICTORS stats objects and update its contents (zeros if prediction isn't modeled)
+void MIPS_cpu_get_predictor_stats(MIPS_cpu_t *cpu, MIPS_predictor_stats_t *stats);
+void MIPS_get_predictor_stats(MIPS_predictor_stats_t *stats);
+
+// these functions update the statistics of the branch at the given address (zeros if it was never executed, or prediction isn't modeled)
+void MIPS_cpu_get_branch_stats(MIPS_cpu_t *cpu, uint32_t pc, MIPS_branch_stats_t *stats);
+void MIPS_get_branch_stats(uint32_t pc, MIPS_branch_stats_t *stats);
+
+// these functions print the accuracy of every predictor, and the mispredictions of every predictor at every executed branch (with its disassembly)
+void MIPS_cpu_print_predictors(MIPS_cpu_t *cpu, FILE *out);
+void MIPS_print_predictors(FILE *out);
+
+// stages of the pipeline model
+#define MIPS_STAGE_IF  0 // instruction fetch
+#define MIPS_STAGE_ID  1 // instruction decode and register read
+#define MIPS_STAGE_EX  2 // execute (the ALU)
+#define MIPS_STAGE_MEM 3 // data memory access
+#define MIPS_STAGE_WB  4 // register write back
+
+// configuration of the pipeline model
+typedef struct {
+    int forwarding; // 1: results are forwarded to the stages that need them, 0: an instruction reads its operands only after they were written back
+    int branch_stage; // the stage that resolves conditional branches and jr/jalr (MIPS_STAGE_ID, MIPS_STAGE_EX or MIPS_STAGE_MEM)
+} MIPS_pipeline_config_t;
+
+// statistics of the pipeline model, counting since the program was loaded (or the context was restored from a snapshot)
+typedef struct {
+    unsigned long long instructions;
+    unsigned long long cycles; // until the last instruction left the pipeline (including filling it at the start)
+    unsigned long long load_use_stalls; // cycles an instruction waited for the result of a load
+    unsigned long long data_stalls; // cycles an instruction waited for any other result (all of them without forwarding)
+    unsigned long long branch_flushes; // cycles lost to the instructions fetched after a taken branch or jr/jalr
+    unsigned long long jump_flushes; // cycles lost to the instruction fetched after j/jal (their target is known in ID)
+} MIPS_pipeline_stats_t;
+
+/* This function models the timing of the classic 5-stage pipeline (IF/ID/EX/MEM/WB) for the instructions the single-cycle datapath executes (NULL
+   stops modeling it). While it is modeled, MIPS_run hands every executed instruction to it (the JIT's native code isn't called), and every instruction is timed
+   according to its control signals: its data hazards with the instructions before it (stalling until the result it needs is forwarded or written
+   back), and the instructions fetched after a taken branch or a jump, which are flushed (branches are predicted not taken).
+   The model only adds timing: the results of the program are the same as without it. Returns 0 on success, and -1 (after printing why) for an invalid
+   configuration or if there isn't enough memory.
+*/
+int MIPS_cpu_set_pipeline(MIPS_cpu_t *cpu, const MIPS_pipeline_config_t *config);
+int MIPS_set_pipeline(const MIPS_pipeline_config_t *config);
+
+// these functions receive the address of a stats object and update its contents (zeros if the pipeline isn't modeled)
+void MIPS_cpu_get_pipeline_stats(MIPS_cpu_t *cpu, MIPS_pipeline_stats_t *stats);
+void MIPS_get_pipeline_stats(MIPS_pipeline_stats_t *stats);
+
+// these functions print the cycles, CPI and stall breakdown of the pipeline, and the instructions that stalled it the most (with their disassembly)
+void MIPS_cpu_print_pipeline(MIPS_cpu_t *cpu, FILE *out);
+void MIPS_print_pipeline(FILE *out);
+
+/* These functions start and stop writing an execution trace of the context to a file. While tracing, MIPS_run hands every executed instruction to the
+   trace (the JIT's native code isn't called), and every instruction is recorded: its pc and instruction word, the register it wrote and the value, and the
+   address and value of a load/store. The records are handed to a writer thread through a ring buffer and stored compactly (see mips_trace.h),
+   so a trace costs a few bytes per instruction. tools/trace_read.c prints a trace, filtered by pc range or register.
+   Both return 0 on success, and -1 (after printing why) otherwise (MIPS_cpu_stop_trace fails if the file couldn't be written).
+*/
+int MIPS_cpu_start_trace(MIPS_cpu_t *cpu, const char *filename);
+int MIPS_cpu_stop_trace(MIPS_cpu_t *cpu);
+int MIPS_start_trace(const char *filename);
+int MIPS_stop_trace(void);
+
+// clocks of the sleep and time syscalls
+#define MIPS_CLOCK_REAL    0 // sleep waits for as long as requested, and time returns the host's time (the default)
+#define MIPS_CLOCK_VIRTUAL 1 // sleep advances a virtual clock without waiting, so a program runs as fast as it can, with reproducible times
+#define MIPS_CLOCK_PACED   2 // sleep advances the virtual clock, and waits until the host's clock (times speed) catches up with it
+
+/* This function selects the clock of the sleep and time (30) syscalls of the context. The virtual clock counts the milliseconds since the program was
+   loaded, and is saved in snapshots:
+   - MIPS_CLOCK_VIRTUAL: only sleep advances it (and every time syscall by 1 ms, so a program waiting for the time to pass still gets there). The times
+     a program sees don't depend on the host, so e.g. an animation finishes in milliseconds, with the same output every time (for batch runs and tests).
+   - MIPS_CLOCK_PACED: it also follows the host's clock, times speed (e.g. 1 for real time, or 10 for 10 times faster). A sleep waits until the
+     deadline on the host's clock, rather than for the whole time, so the time spent computing a frame doesn't add up over the frames.
+   speed is ignored by the other clocks. Returns 0 on success, and -1 for an unknown clock or a speed that isn't positive.
+*/
+int MIPS_cpu_set_clock(MIPS_cpu_t *cpu, int mode, double speed);
+int MIPS_set_clock(int mode, double speed);
+
+/* This function replaces the console of the context (NULL restores the process console). The output of the syscalls is buffered in the context,
+   and handed to the console only when a read_int syscall waits for input, the program exits or sleeps, the buffer is full, or MIPS_run returns
+   (see mips_console.h), so console.write gets long runs of text rather than a call per syscall.
+*/
+void MIPS_cpu_set_console(MIPS_cpu_t *cpu, const MIPS_console_t *console);
+
+/* This function redirects the console of the context to memory: read_int reads the integers of the given input (length characters, which are copied),
+   and the output is kept in the context until the console is replaced (see MIPS_cpu_get_console_output). This is how many contexts running at the
+   same time (e.g. in batch mode) keep their outputs apart. Returns 0 on success, and -1 (after printing why) if there isn't enough memory.
+*/
+int MIPS_cpu_set_memory_console(MIPS_cpu_t *cpu, const char *input, size_t length);
+
+// returns the output kept by the memory console of the context so far, with its length in *length (NULL, and 0, if the console isn't in memory)
+const char *MIPS_cpu_get_console_output(MIPS_cpu_t *cpu, size_t *length);
+
+// these functions hand the buffered output to the console right away (e.g. before the host prints something of its own while a program is stepped)
+void MIPS_cpu_flush_console(MIPS_cpu_t *cpu);
+void MIPS_flush_console(void);
+
+/* This function enables (1) or disables (0) the graphics syscalls of the context. A context running without BlankWindow (e.g. one of many batch jobs)
+   disables them, so they are skipped instead of sending UDP messages. They are enabled by default.
+*/
+void MIPS_cpu_set_draw(MIPS_cpu_t *cpu, int enabled);
+
+#define MIPS_FRAMEBUFFER_BASE   0x000a0000 // the default address of the framebuffer (where the A000 segment of mode 13H starts)
+#define MIPS_FRAMEBUFFER_WIDTH  320
+#define MIPS_FRAMEBUFFER_HEIGHT 200
+
+// configuration of the framebuffer
+typedef struct {
+    uint32_t base; // address of the top-left pixel in data memory (a multiple of 4)
+    uint32_t width, height; // in pixels, a byte each (a color index of the mode 13H palette). The width is a multiple of 4, and both are at most 65535
+    unsigned long long present_interval; // MIPS_run presents the framebuffer every present_interval instructions (0: only the present syscall does)
+} MIPS_framebuffer_config_t;
+
+// statistics of the framebuffer, counting since it was mapped
+typedef struct {
+    unsigned long long presents; // presents that found tiles to send
+    unsigned long long tiles; // dirty tiles sent
+    unsigned long long rectangles; // bitmaps the dirty tiles were sent as (a run of dirty tiles in a row of tiles is sent as one bitmap)
+} MIPS_framebuffer_stats_t;
+
+/* This function maps a framebuffer into the data memory of the context (NULL unmaps it), so a program can draw with plain sb/sh/sw stores, like in
+   mode 13H: the pixel at (x, y) is the byte at base + y * width + x. The framebuffer is split into tiles of 16X16 pixels, and the stores to it mark
+   the tiles they write as dirty. Only the dirty tiles are sent to the virtual screen, when the program presents the framebuffer with the present
+   syscall (21), every present_interval instructions, and when it exits. Loading a program or restoring a snapshot makes every tile dirty.
+   The framebuffer's pages never enter the write TLB, so the stores to them are slower than other stores, while all of the others cost nothing extra.
+   Like the graphics syscalls, presents send nothing while they are disabled (see MIPS_cpu_set_draw). Returns 0 on success, and -1 (after printing why)
+   for an invalid configuration or if there isn't enough memory.
+*/
+int MIPS_cpu_set_framebuffer(MIPS_cpu_t *cpu, const MIPS_framebuffer_config_t *config);
+int MIPS_set_framebuffer(const MIPS_framebuffer_config_t *config);
+
+// these functions send the dirty tiles of the framebuffer to the virtual screen right away (as the present syscall does)
+void MIPS_cpu_present(MIPS_cpu_t *cpu);
+void MIPS_present(void);
+
+// these functions receive the address of a stats object and update its contents (zeros if there is no framebuffer)
+void MIPS_cpu_get_framebuffer_stats(MIPS_cpu_t *cpu, MIPS_framebuffer_stats_t *stats);
+void MIPS_get_framebuffer_stats(MIPS_framebuffer_stats_t *stats);
+
+/* This function saves the machine state of the context: registers, hi, lo, pc, program memory and the data address space (and the instruction count).
+   The address space isn't copied: the snapshot shares its pages with the context, and whichever of them writes a shared page first copies it
+   (copy-on-write), so taking a snapshot only costs a reference per allocated page. This makes it cheap to run a program up to an interesting point
+   (e.g. after its data was initialized, or right before it reads its input) and then run the rest of it many times, with different inputs.
+   The engine, console and draw settings belong to the host, so they aren't saved. Returns NULL (after printing why) if there isn't enough memory.
+*/
+MIPS_snapshot_t *MIPS_cpu_snapshot(MIPS_cpu_t *cpu);
+MIPS_snapshot_t *MIPS_snapshot(void);
+
+/* This function restores the context to the state saved in the snapshot. When the context was the one the snapshot was taken of, or it was last
+   restored from the same snapshot, only the pages written since then are put back, and translated blocks are kept as long as the program is the same.
+   The snapshot isn't changed, so contexts on different threads may restore the same snapshot at the same time. Returns 0 on success, and -1 (after
+   printing why) if there isn't enough memory.
+*/
+int MIPS_cpu_restore(MIPS_cpu_t *cpu, const MIPS_snapshot_t *snapshot);
+int MIPS_restore(const MIPS_snapshot_t *snapshot);
+
+// frees a snapshot (contexts restored from it keep the pages they share with it)
+void MIPS_snapshot_free(MIPS_snapshot_t *snapshot);
+
+/* These functions write a snapshot to a file, and read it back (e.g. in another process). The file is a program image (see mips_image.h) with the
+   machine state in an extra segment, so MIPS_load_image can load it as well. Return -1 / NULL (after printing why) on failure.
+*/
+int MIPS_snapshot_save(const MIPS_snapshot_t *snapshot, const char *filename);
+MIPS_snapshot_t *MIPS_snapshot_load(const char *filename);
+
 #endif /* __MIPS_H */
@@ -0,0 +1,601 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_block.c
+*
+* Description:
+* ------------
+* This file contains the basic-block execution engine.
+* A basic block starts at a leader (the first instruction, an instruction following a branch/jump/syscall, or the target of a branch/jump) and ends
+* with the first branch/jump/syscall, or right before the next leader. When a block is first executed, its predecoded records are copied into the
+* block storage followed by a sentinel record, so that the instructions of a block are executed back to back, without fetching them from program
+* memory or updating the pc and checking the budget for each one.
+* When a block ends, the next block is reached through a chain pointer stored in the block (one for the taken target of its last instruction, and
+* one for the next address), so that loops run from block to block without looking blocks up. Returns (jr $ra) are predicted using a small return
+* address stack, which is pushed by jal/jalr.
+* Blocks are checked against program memory the first time they are entered in each BLOCK_run call, and all blocks are dropped if any of them
+* changed (so writing to program memory through MIPS_info_t::prog_mem_base between runs is still allowed).
+* When the JIT is on, a block is compiled once it was executed JIT_THRESHOLD times. If mips_jit.c can compile it whole, entering the block calls its
+* native code instead of dispatching its records, and the exit the native code returns leads to the next block through the same chain slots. Once
+* the next block is compiled whole as well, the exit is linked to it, so the native code goes on to it directly (see JIT_link). Otherwise, the runs of
+* instructions that can be compiled are, and the first record of each compiled run is replaced with a NATIVE record, which calls the native code and
+* skips to the record following the run.
+* The dispatch loop itself is in mips_block_run.h, which is included twice: as BLOCK_run, and as BLOCK_run_observed, used while models that see
+* every executed instruction are on.
+*
+*************************************************************************/
+
+#include "mips_decode.h"
+#include "mips_block.h"
+#include "mips_jit.h"
+#include "mips_profile.h"
+
+#define BLOCK_CODE_FACTOR 4 // the block storage holds this many predecoded records per program memory word (blocks may overlap)
+#define RAS_SIZE        16 // number of entries in the return address stack
+#define OP_BLOCK_END    NUM_OPS // handler class of the sentinel record following the last instruction of every block
+#define OP_NATIVE       (NUM_OPS + 1) // handler class of the first record of a compiled run
+#define JIT_THRESHOLD   64 // number of executions after which a block is compiled
+#define JIT_MIN_LENGTH  2 // shorter runs aren't worth a native call
+#define STORE_LOG_SIZE  64 // stores a compiled run can make in the self-check mode (runs with more stores aren't compiled in that mode)
+
+typedef struct block_s {
+    uint32_t pc; // address of the first instruction (blocks are found by program memory index, so the full address is compared as well)
+    uint32_t index; // program memory index of the first instruction
+    unsigned int length; // number of instructions (not including the sentinel)
+    uint32_t epoch; // the BLOCK_run call in which the block was last checked against program memory
+    decoded_t *code; // copy of the predecoded records of the block, followed by the sentinel
+    struct block_s *taken; // chained successor at the target of the last instruction (taken branch, j, jal)
+    struct block_s *fallthrough; // chained successor at the address following the block (not-taken branch, syscall, or the block ended before a leader)
+    unsigned long long executions; // number of times the block was executed
+    unsigned long long counted; // executions already added to the run counts of the context (see BLOCK_count_runs)
+    JIT_block_t native; // the block compiled whole (native.entry is NULL if it wasn't)
+} block_t;
+
+typedef struct {
+    uint32_t return_pc; // the address following the jal/jalr
+    block_t **successor; // chain slot leading to the block at return_pc (the fallthrough slot of the block ending with the jal/jalr)
+} ras_entry_t;
+
+// compiled run starting at a position of the block code storage
+typedef struct {
+    JIT_code_t code;
+    unsigned int length;
+    unsigned char op; // the handler class the first record had before it was replaced with OP_NATIVE (executed instead by BLOCK_run_observed)
+} native_t;
+
+// a store made by compiled code in the self-check mode, with the aligned word it changed before and after it
+typedef struct {
+    uint32_t addr;
+    uint32_t before;
+    uint32_t after;
+} logged_store_t;
+
+// state of the block engine of a single context (allocated on first use, since it's much larger than the rest of the context)
+typedef struct BLOCK_state_s BLOCK_state_t;
+
+struct BLOCK_state_s {
+    uint32_t capacity; // the program memory size the arrays below were allocated for (see resize_state)
+    block_t *blocks; // capacity blocks (all blocks are dropped when they are used up)
+    unsigned int num_blocks;
+    decoded_t *block_code; // capacity * BLOCK_CODE_FACTOR records
+    unsigned int block_code_used;
+    block_t **block_map; // translated block starting at each program memory index (NULL if none)
+    unsigned char *leaders; // 1 for every program memory index that starts a basic block
+    int leaders_valid;
+    uint32_t epoch; // incremented on every BLOCK_run call
+    ras_entry_t ras[RAS_SIZE];
+    unsigned int ras_top; // number of entries pushed (the stack wraps around, overwriting the oldest entries)
+    BLOCK_stats_t stats;
+    int jit_mode;
+    JIT_t jit;
+    native_t *natives; // compiled run starting at each position of block_code
+    logged_store_t store_log[STORE_LOG_SIZE]; // the stores of the compiled run being checked (in the self-check mode)
+    unsigned int num_logged;
+};
+
+static volatile int no_stop = 0; // the stop flag of the compiled code when BLOCK_run wasn't given one
+
+// returns 1 if the instruction of the given handler class ends a basic block
+static int is_terminator(unsigned char op)
+{
+    switch (op) {
+    case OP_BEQ:
+    case OP_BNE:
+    case OP_BLEZ:
+    case OP_BGTZ:
+    case OP_J:
+    case OP_JAL:
+    case OP_JR:
+    case OP_JALR:
+    case OP_SYSCALL:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// returns the predecoded record at the given index, predecoding it again first if its program memory word was overwritten
+static const decoded_t *current_record(MIPS_cpu_t *cpu, uint32_t index)
+{
+    if (cpu->decoded_prog[index].inst != cpu->prog_mem[index]) {
+        predecode(cpu, index);
+    }
+    return &cpu->decoded_prog[index];
+}
+
+// marks the leaders: the first instruction, every instruction following a block terminator, and every branch/jump target
+static void find_leaders(MIPS_cpu_t *cpu)
+{
+    BLOCK_state_t *bs = cpu->block;
+    uint32_t i, mask = bs->capacity - 1;
+    const decoded_t *d;
+
+    memset(bs->leaders, 0, bs->capacity);
+    bs->leaders[0] = 1;
+    for (i = 0; i < bs->capacity; i++) {
+        d = current_record(cpu, i);
+        if (!is_terminator(d->op)) {
+            continue;
+        }
+        bs->leaders[(i + 1) & mask] = 1;
+        switch (d->op) {
+        case OP_BEQ:
+        case OP_BNE:
+        case OP_BLEZ:
+        case OP_BGTZ:
+            bs->leaders[(i + 1 + d->imm) & mask] = 1; // the offset counts words, relative to the next instruction
+            break;
+        case OP_J:
+        case OP_JAL:
+            // the upper 4 bits of the target come from the address of the next instruction
+            bs->leaders[PROG_INDEX(cpu, ((cpu->text_base + (i + 1) * 4) & 0xf0000000) | (uint32_t)d->imm)] = 1;
+            break;
+        default:
+            break;
+        }
+    }
+    bs->leaders_valid = 1;
+}
+
+// drops all translated blocks
+static void flush_blocks(BLOCK_state_t *bs)
+{
+    bs->num_blocks = 0;
+    bs->block_code_used = 0;
+    memset(bs->block_map, 0, bs->capacity * sizeof(block_t *));
+    bs->leaders_valid = 0;
+    bs->ras_top = 0;
+    JIT_reset(&bs->jit);
+    bs->stats.flushes++;
+}
+
+// frees the arrays sized by the program memory capacity
+static void free_arrays(BLOCK_state_t *bs)
+{
+    free(bs->blocks);
+    free(bs->block_code);
+    free(bs->block_map);
+    free(bs->leaders);
+    free(bs->natives);
+    bs->blocks = NULL;
+    bs->block_code = NULL;
+    bs->block_map = NULL;
+    bs->leaders = NULL;
+    bs->natives = NULL;
+    bs->capacity = 0;
+}
+
+// sizes the arrays for the program memory capacity of the context. Returns -1 if there isn't enough memory
+static int resize_state(MIPS_cpu_t *cpu)
+{
+    BLOCK_state_t *bs = cpu->block;
+    uint32_t capacity = cpu->prog_capacity;
+
+    if (bs->capacity == capacity) {
+        return 0;
+    }
+    free_arrays(bs);
+    if (capacity == 0) {
+        return 0; // no program was loaded yet
+    }
+    bs->blocks = (block_t *)malloc(capacity * sizeof(block_t));
+    bs->block_code = (decoded_t *)malloc(capacity * BLOCK_CODE_FACTOR * sizeof(decoded_t));
+    bs->block_map = (block_t **)calloc(capacity, sizeof(block_t *));
+    bs->leaders = (unsigned char *)calloc(capacity, 1);
+    bs->natives = (native_t *)malloc(capacity * BLOCK_CODE_FACTOR * sizeof(native_t));
+    if (bs->blocks == NULL || bs->block_code == NULL || bs->block_map == NULL || bs->leaders == NULL || bs->natives == NULL) {
+        free_arrays(bs);
+        return -1;
+    }
+    bs->capacity = capacity;
+    return 0;
+}
+
+void BLOCK_reset(MIPS_cpu_t *cpu)
+{
+    if (cpu->block != NULL) {
+        if (resize_state(cpu) != 0) {
+            printf("There isn't enough memory for the block engine, using the interpreter instead\n");
+            BLOCK_free(cpu);
+            cpu->engine = MIPS_ENGINE_INTERPRETER;
+            return;
+        }
+        flush_blocks(cpu->block);
+        memset(&cpu->block->stats, 0, sizeof(cpu->block->stats));
+    }
+}
+
+void BLOCK_count_runs(MIPS_cpu_t *cpu)
+{
+    BLOCK_state_t *bs = cpu->block;
+    block_t *b;
+    unsigned int i;
+
+    // a block is only entered when the budget covers all of it, and only its last instruction can exit, so every execution ran the whole block
+    for (i = 0; i < bs->num_blocks; i++) {
+        b = &bs->blocks[i];
+        if (b->executions != b->counted) {
+            count_run(cpu, b->index, b->length, (long long)(b->executions - b->counted));
+            b->counted = b->executions;
+        }
+    }
+}
+
+void BLOCK_free(MIPS_cpu_t *cpu)
+{
+    if (cpu->block != NULL) {
+        JIT_free(&cpu->block->jit);
+        free_arrays(cpu->block);
+        free(cpu->block);
+        cpu->block = NULL;
+    }
+}
+
+// translates the block starting at the given address
+static block_t *translate(MIPS_cpu_t *cpu, uint32_t block_pc)
+{
+    BLOCK_state_t *bs = cpu->block;
+    uint32_t index = PROG_INDEX(cpu, block_pc);
+    uint32_t i = index;
+    unsigned int length = 0;
+    block_t *b;
+
+    if (!bs->leaders_valid) {
+        find_leaders(cpu);
+    }
+
+    // finding the end of the block
+    while (1) {
+        length++;
+        if (is_terminator(current_record(cpu, i)->op)) {
+            break;
+        }
+        i = (i + 1) & (bs->capacity - 1);
+        if (bs->leaders[i]) { // also stops when wrapping around to index 0
+            break;
+        }
+    }
+
+    if (bs->num_blocks == bs->capacity || bs->block_code_used + length + 1 > bs->capacity * BLOCK_CODE_FACTOR) {
+        BLOCK_count_runs(cpu);
+        flush_blocks(bs);
+    }
+
+    b = &bs->blocks[bs->num_blocks++];
+    b->pc = block_pc;
+    b->index = index;
+    b->length = length;
+    b->epoch = bs->epoch;
+    b->code = &bs->block_code[bs->block_code_used];
+    b->taken = NULL;
+    b->fallthrough = NULL;
+    b->executions = 0;
+    b->counted = 0;
+    memset(&b->native, 0, sizeof(b->native));
+    bs->block_code_used += length + 1;
+
+    for (i = 0; i < length; i++) {
+        b->code[i] = *current_record(cpu, (index + i) & (bs->capacity - 1));
+    }
+    memset(&b->code[length], 0, sizeof(decoded_t));
+    b->code[length].op = OP_BLOCK_END;
+
+    bs->stats.translated++;
+    return b;
+}
+
+// returns the block starting at the given address, translating it if needed
+static block_t *lookup(MIPS_cpu_t *cpu, uint32_t block_pc)
+{
+    BLOCK_state_t *bs = cpu->block;
+    uint32_t index = PROG_INDEX(cpu, block_pc);
+    block_t *b = bs->block_map[index];
+
+    bs->stats.lookups++;
+    if (b != NULL && b->pc == block_pc) {
+        bs->stats.lookup_hits++;
+        return b;
+    }
+    b = translate(cpu, block_pc);
+    bs->block_map[index] = b;
+    return b;
+}
+
+// returns 1 if none of the program memory words the block was translated from were overwritten
+static int is_current(MIPS_cpu_t *cpu, const block_t *b)
+{
+    unsigned int i;
+
+    for (i = 0; i < b->length; i++) {
+        if (b->code[i].inst != cpu->prog_mem[(b->index + i) & (cpu->prog_capacity - 1)]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// the store function of the compiled code in the self-check mode: it logs every store, so check_native can undo them
+static void log_store(MIPS_cpu_t *cpu, unsigned int opcode, uint32_t addr, uint32_t value)
+{
+    BLOCK_state_t *bs = cpu->block;
+    logged_store_t *entry = &bs->store_log[bs->num_logged++]; // compile_block doesn't compile runs with more stores than the log holds
+
+    entry->addr = addr & ~3U;
+    MEM_read(&cpu->mem, entry->addr, &entry->before, sizeof(entry->before));
+    store_in_memory(cpu, opcode, addr, value);
+    MEM_read(&cpu->mem, entry->addr, &entry->after, sizeof(entry->after));
+}
+
+int BLOCK_set_jit(MIPS_cpu_t *cpu, int mode)
+{
+    if (cpu->block == NULL) {
+        cpu->block = (BLOCK_state_t *)calloc(1, sizeof(BLOCK_state_t));
+        if (cpu->block == NULL) {
+            return -1;
+        }
+    }
+    if (resize_state(cpu) != 0) { // the engine may be selected after a program was loaded
+        BLOCK_free(cpu);
+        return -1;
+    }
+    if (mode != BLOCK_JIT_OFF && !JIT_init(&cpu->block->jit)) {
+        mode = BLOCK_JIT_OFF;
+    }
+    if (mode != cpu->block->jit_mode && cpu->block->num_blocks > 0) {
+        // the code compiled for another mode is dropped (the stores of the self-check mode are compiled differently, and its blocks aren't linked)
+        BLOCK_count_runs(cpu);
+        flush_blocks(cpu->block);
+    }
+    cpu->block->jit_mode = mode;
+    cpu->block->jit.store = (mode == BLOCK_JIT_CHECK) ? log_store : NULL;
+    return mode;
+}
+
+// returns 1 if the records can be compiled in the current mode (in the self-check mode, the log has to hold all of their stores)
+static int fits_store_log(BLOCK_state_t *bs, const decoded_t *code, unsigned int length)
+{
+    unsigned int i, stores = 0;
+
+    if (bs->jit_mode != BLOCK_JIT_CHECK) {
+        return 1;
+    }
+    for (i = 0; i < length; i++) {
+        if (code[i].op == OP_SB || code[i].op == OP_SH || code[i].op == OP_SW) {
+            stores++;
+        }
+    }
+    return (stores <= STORE_LOG_SIZE) ? 1 : 0;
+}
+
+/* Compiles a hot block: whole, if all of its instructions can be compiled and it ends with a branch or j (or with no control transfer), and
+   otherwise every run of at least JIT_MIN_LENGTH instructions that the JIT supports. Returns 0 if the buffer is full
+*/
+static int compile_records(MIPS_cpu_t *cpu, block_t *b)
+{
+    BLOCK_state_t *bs = cpu->block;
+    unsigned int start = 0, end;
+    JIT_code_t code;
+
+    for (end = 0; end < b->length - 1 && JIT_can_compile(b->code[end].op); end++);
+    if (end == b->length - 1 && (JIT_can_compile(b->code[end].op) || JIT_can_end_block(b->code[end].op))) {
+        if (fits_store_log(bs, b->code, b->length)) {
+            b->native.tag = (unsigned long long)(uintptr_t)b; // block_t is aligned, so the lowest bit is free for the exit
+            b->native.epoch = &b->epoch;
+            b->native.executions = &b->executions;
+            if (!JIT_compile_block(&bs->jit, cpu, b->code, b->length, &b->native)) {
+                return 0;
+            }
+            bs->stats.jit_compiled++;
+            bs->stats.jit_instructions += b->length;
+            bs->stats.jit_blocks++;
+        }
+        return 1;
+    }
+
+    while (start < b->length) {
+        if (!JIT_can_compile(b->code[start].op)) {
+            start++;
+            continue;
+        }
+        for (end = start + 1; end < b->length && JIT_can_compile(b->code[end].op); end++);
+        if (end - start >= JIT_MIN_LENGTH && fits_store_log(bs, &b->code[start], end - start)) {
+            code = JIT_compile(&bs->jit, cpu, &b->code[start], end - start);
+            if (code == NULL) {
+                return 0;
+            }
+            bs->natives[&b->code[start] - bs->block_code].code = code;
+            bs->natives[&b->code[start] - bs->block_code].length = end - start;
+            bs->natives[&b->code[start] - bs->block_code].op = b->code[start].op;
+            b->code[start].op = OP_NATIVE; // the raw instruction word is kept, so the block is still checked against program memory the same way
+            bs->stats.jit_compiled++;
+            bs->stats.jit_instructions += end - start;
+        }
+        start = end;
+    }
+    return 1;
+}
+
+/* Compiles a hot block. When the buffer is full, the blocks are flushed (which empties the buffer) and the block is translated and compiled again,
+   so that the code of the blocks that are hot now replaces the old one. Returns the block to run (a new one if the blocks were flushed)
+*/
+static block_t *compile_block(MIPS_cpu_t *cpu, block_t *b)
+{
+    BLOCK_state_t *bs = cpu->block;
+    uint32_t block_pc = b->pc;
+
+    if (!compile_records(cpu, b) && bs->jit.used > 0) {
+        BLOCK_count_runs(cpu);
+        flush_blocks(bs);
+        b = lookup(cpu, block_pc);
+        b->epoch = bs->epoch;
+        compile_records(cpu, b); // a block that doesn't fit even in the empty buffer stays interpreted
+    }
+    return b;
+}
+
+// returns the address the taken exit of a block compiled whole leads to (the target of its branch or j)
+static uint32_t taken_target(const block_t *b)
+{
+    const decoded_t *last = &b->code[b->length - 1];
+    uint32_t last_pc = b->pc + ((b->length - 1) << 2);
+
+    if (last->op == OP_J) {
+        return ((last_pc + 4) & 0xf0000000) | (uint32_t)last->imm;
+    }
+    return last_pc + 4 + ((uint32_t)last->imm << 2);
+}
+
+/* Runs compiled code in the self-check mode: the native code is executed first, then its stores are undone, the registers are restored and the
+   same instructions are executed with MIPS_step, and the two results are compared (including the words the stores changed, and for a block compiled
+   whole, the address it exits to and the taken counters). The interpreter's results are the ones kept. Returns the value the native code returned.
+*/
+static unsigned long long check_native(MIPS_cpu_t *cpu, JIT_code_t code, uint32_t native_pc, unsigned int length, const block_t *whole)
+{
+    BLOCK_state_t *bs = cpu->block;
+    uint32_t saved_registers[NUM_REG], native_registers[NUM_REG];
+    unsigned long long saved_taken[NUM_OPS], native_taken[NUM_OPS];
+    uint32_t saved_hi = cpu->hi, saved_lo = cpu->lo, saved_alu_result = cpu->alu_result, saved_pc = cpu->pc;
+    uint32_t native_hi, native_lo, native_alu_result, native_next = 0, word;
+    unsigned long long saved_instructions = cpu->instructions; // the instructions are only counted once (by BLOCK_run)
+    unsigned long long result;
+    unsigned int i, j;
+    int mismatch = 0;
+
+    memcpy(saved_registers, cpu->registers, sizeof(cpu->registers));
+    memcpy(saved_taken, cpu->taken, sizeof(cpu->taken));
+    bs->num_logged = 0;
+    bs->jit.stop = &no_stop;
+    bs->jit.epoch = bs->epoch;
+    bs->jit.budget = 0; // nothing is linked in this mode, but no chained entry could be made anyway
+    result = code();
+    memcpy(native_registers, cpu->registers, sizeof(cpu->registers));
+    memcpy(native_taken, cpu->taken, sizeof(cpu->taken));
+    native_hi = cpu->hi;
+    native_lo = cpu->lo;
+    native_alu_result = cpu->alu_result;
+    if (whole != NULL) {
+        native_next = ((result & 1) == JIT_EXIT_TAKEN) ? taken_target(whole) : native_pc + (length << 2);
+    }
+
+    for (i = bs->num_logged; i > 0; i--) { // in reverse, in case the same word was stored more than once
+        MEM_write(&cpu->mem, bs->store_log[i - 1].addr, &bs->store_log[i - 1].before, sizeof(uint32_t));
+    }
+    memcpy(cpu->registers, saved_registers, sizeof(cpu->registers));
+    memcpy(cpu->taken, saved_taken, sizeof(cpu->taken));
+    cpu->hi = saved_hi;
+    cpu->lo = saved_lo;
+    cpu->alu_result = saved_alu_result;
+    cpu->pc = native_pc;
+    for (i = 0; i < length; i++) {
+        MIPS_cpu_step(cpu);
+    }
+    if (whole != NULL && native_next != cpu->pc) {
+        printf("JIT self-check: the block at %x exits to %x instead of %x\n", native_pc, native_next, cpu->pc);
+        mismatch = 1;
+    }
+    cpu->pc = saved_pc;
+    cpu->instructions = saved_instructions;
+    // the same goes for the run counts of the steps, which counted every instruction once (a compiled run can only end with its last instruction)
+    count_run(cpu, PROG_INDEX(cpu, native_pc), length, -1);
+
+    for (i = 0; i < NUM_REG; i++) {
+        if (native_registers[i] != cpu->registers[i]) {
+            printf("JIT self-check: $%u is %x instead of %x after the run at %x\n", i, native_registers[i], cpu->registers[i], native_pc);
+            mismatch = 1;
+        }
+    }
+    if (native_hi != cpu->hi || native_lo != cpu->lo || native_alu_result != cpu->alu_result) {
+        printf("JIT self-check: hi/lo/alu_result are %x/%x/%x instead of %x/%x/%x after the run at %x\n",
+            native_hi, native_lo, native_alu_result, cpu->hi, cpu->lo, cpu->alu_result, native_pc);
+        mismatch = 1;
+    }
+    for (i = 0; i < bs->num_logged; i++) {
+        for (j = i + 1; j < bs->num_logged && bs->store_log[j].addr != bs->store_log[i].addr; j++);
+        if (j < bs->num_logged) {
+            continue; // a later store changed the same word again
+        }
+        MEM_read(&cpu->mem, bs->store_log[i].addr, &word, sizeof(word));
+        if (word != bs->store_log[i].after) {
+            printf("JIT self-check: the word at %x is %x instead of %x after the run at %x\n", bs->store_log[i].addr, bs->store_log[i].after, word, native_pc);
+            mismatch = 1;
+        }
+    }
+    if (memcmp(native_taken, cpu->taken, sizeof(cpu->taken)) != 0) {
+        printf("JIT self-check: the taken counters differ after the run at %x\n", native_pc);
+        mismatch = 1;
+    }
+    bs->stats.jit_mismatches += mismatch;
+    return result;
+}
+
+/* Compiling or linking code left the buffer writable, because it couldn't be made executable again, so none of the compiled code can run: all
+   blocks are dropped and the JIT is turned off. Returns the block at run_pc, translated again
+*/
+static block_t *disable_jit(MIPS_cpu_t *cpu, uint32_t run_pc)
+{
+    BLOCK_state_t *bs = cpu->block;
+
+    printf("The JIT buffer couldn't be made executable, using the block engine instead\n");
+    BLOCK_count_runs(cpu);
+    flush_blocks(bs);
+    bs->jit_mode = BLOCK_JIT_OFF;
+    return lookup(cpu, run_pc);
+}
+
+#define BLOCK_RUN_NAME BLOCK_run
+#define BLOCK_OBSERVED 0
+#include "mips_block_run.h"
+
+#define BLOCK_RUN_NAME BLOCK_run_observed
+#define BLOCK_OBSERVED 1
+#include "mips_block_run.h"
+
+void BLOCK_get_stats(MIPS_cpu_t *cpu, BLOCK_stats_t *stats)
+{
+    if (cpu->block != NULL) {
+        *stats = cpu->block->stats;
+    } else {
+        memset(stats, 0, sizeof(BLOCK_stats_t)); // the block engine was never selected
+    }
+}
+
+void BLOCK_print_stats(MIPS_cpu_t *cpu, FILE *out)
+{
+    BLOCK_stats_t s;
+    double executions;
+
+    BLOCK_get_stats(cpu, &s);
+    executions = (s.executions > 0) ? (double)s.executions : 1.0;
+
+    fprintf(out, "blocks translated:   %llu (flushes: %llu)\n", s.translated, s.flushes);
+    fprintf(out, "blocks executed:     %llu\n", s.executions);
+    fprintf(out, "block hit rate:      %.2f%% (entries that didn't need a translation)\n", 100.0 * (s.executions - (s.lookups - s.lookup_hits)) / executions);
+    fprintf(out, "chained entries:     %llu (%.2f%%), chains linked: %llu\n", s.chained, 100.0 * s.chained / executions, s.chains_linked);
+    fprintf(out, "lookups:             %llu (hits: %llu)\n", s.lookups, s.lookup_hits);
+    fprintf(out, "return predictions:  %llu hits, %llu misses\n", s.ras_hits, s.ras_misses);
+    if (s.jit_compiled > 0) {
+        fprintf(out, "compiled runs:       %llu (%llu instructions), executed %llu times", s.jit_compiled, s.jit_instructions, s.jit_executions);
+        fprintf(out, (cpu->block->jit_mode == BLOCK_JIT_CHECK) ? ", self-check mismatches: %llu\n" : "\n", s.jit_mismatches);
+        fprintf(out, "whole blocks:        %llu compiled, %llu exits linked\n", s.jit_blocks, s.jit_links);
+    }
+}
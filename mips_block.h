@@ -0,0 +1,67 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_block.h
+*
+* Description:
+* ------------
+* Header file for mips_block.c, the basic-block execution engine (selected with MIPS_set_engine(MIPS_ENGINE_BLOCK)).
+*
+*************************************************************************/
+
+#ifndef __MIPS_BLOCK_H
+#define __MIPS_BLOCK_H
+
+#include "mips.h"
+
+// statistics of the block engine, accumulated since the program was loaded
+typedef struct {
+    unsigned long long translated; // number of blocks translated
+    unsigned long long executions; // number of blocks executed
+    unsigned long long lookups; // block entries that had to look the block up by its address (not reached through a chain)
+    unsigned long long lookup_hits; // lookups that found an already translated block
+    unsigned long long chained; // block entries that directly followed a chain pointer from the previous block
+    unsigned long long chains_linked; // chain pointers set between blocks
+    unsigned long long ras_hits; // jr $ra targets correctly predicted by the return address stack
+    unsigned long long ras_misses; // jr $ra targets that didn't match the top of the return address stack
+    unsigned long long flushes; // times all blocks were dropped (because program memory was modified, or the block storage was full)
+    unsigned long long jit_compiled; // runs of instructions compiled to native code (including whole blocks)
+    unsigned long long jit_blocks; // blocks compiled whole, branch included
+    unsigned long long jit_links; // exits of compiled blocks linked to the next compiled block
+    unsigned long long jit_instructions; // instructions inside the compiled runs
+    unsigned long long jit_executions; // times a compiled run was executed (including the blocks entered from other compiled blocks)
+    unsigned long long jit_mismatches; // compiled runs whose results differed from MIPS_step (in the self-check mode)
+} BLOCK_stats_t;
+
+// JIT modes of the block engine (set by MIPS_set_engine)
+#define BLOCK_JIT_OFF   0
+#define BLOCK_JIT_ON    1
+#define BLOCK_JIT_CHECK 2 // every compiled run is executed, then undone and executed again with MIPS_step, and the results are compared
+
+// runs the program using the block engine. The arguments and return values are the same as MIPS_cpu_run
+int BLOCK_run(MIPS_cpu_t *cpu, unsigned long long budget, volatile int *stop);
+
+// same as BLOCK_run, but handing every executed instruction to the models that need to see them (see observe_instruction), without calling compiled code
+int BLOCK_run_observed(MIPS_cpu_t *cpu, unsigned long long budget, volatile int *stop);
+
+/* Allocates the block engine state of the context (if it wasn't allocated yet) and selects the JIT mode. Returns the selected mode, which is
+   BLOCK_JIT_OFF if the JIT couldn't be initialized, or -1 if the state couldn't be allocated (called by MIPS_cpu_set_engine).
+*/
+int BLOCK_set_jit(MIPS_cpu_t *cpu, int mode);
+
+// drops all translated blocks and clears the statistics (called by MIPS_cpu_init when a program is loaded)
+void BLOCK_reset(MIPS_cpu_t *cpu);
+
+// adds the block executions since the last call to the run counts of the context (see count_run), so the performance counters include them
+void BLOCK_count_runs(MIPS_cpu_t *cpu);
+
+// frees the block engine state of the context (called by MIPS_destroy)
+void BLOCK_free(MIPS_cpu_t *cpu);
+
+// this function receives the address of a stats object and updates its contents
+void BLOCK_get_stats(MIPS_cpu_t *cpu, BLOCK_stats_t *stats);
+
+// prints the statistics, including the block hit rate (blocks entered without translating them) and chain rate
+void BLOCK_print_stats(MIPS_cpu_t *cpu, FILE *out);
+
+#endif /* __MIPS_BLOCK_H */
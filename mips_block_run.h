@@ -0,0 +1,329 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_block_run.h
+*
+* Description:
+* ------------
+* This file contains the dispatch loop of the block engine, and is included twice by mips_block.c: once as BLOCK_run, and once with BLOCK_OBSERVED
+* set to 1 as BLOCK_run_observed, which hands every executed instruction to the models that need to see them (the trace, the caches, the branch
+* predictors and the pipeline) while still running from block to block. Compiled code can't be observed, so the observed loop executes the records
+* of compiled runs and blocks compiled whole instead of calling their native code.
+* The including file provides BLOCK_RUN_NAME (the name of the function) and BLOCK_OBSERVED (0 or 1).
+*
+*************************************************************************/
+
+/* Engine macros for the dispatch loop (see mips_handlers.h). Inside a block, NEXT only advances to the next record (the sentinel after the last instruction
+   leads to the fallthrough successor), and the pc is only computed when an instruction needs it.
+*/
+#define PC (block_pc + ((uint32_t)(d - b->code) << 2))
+
+#if BLOCK_OBSERVED
+// handing the instruction that was just executed to the models, with the pc already at the next instruction (as MIPS_interpret leaves it)
+#define OBSERVE(next_pc) \
+    do { \
+        cpu->pc = (next_pc); \
+        observe_instruction(cpu, PC); \
+    } while (0)
+
+// the first record of a compiled run is executed as the instruction it was compiled from (the native code can't be observed)
+#undef DISPATCH
+#define RECORD_OP(d) (((d)->op == OP_NATIVE) ? bs->natives[(d) - bs->block_code].op : (d)->op)
+#ifdef MIPS_THREADED_DISPATCH
+#define DISPATCH() goto *handlers[RECORD_OP(d)]
+#else
+#define DISPATCH() goto dispatch
+#endif
+#else
+#define OBSERVE(next_pc)
+#define RECORD_OP(d) ((d)->op)
+#endif
+
+#define NEXT() \
+    do { \
+        OBSERVE(PC + 4); \
+        d++; \
+        DISPATCH(); \
+    } while (0)
+
+#define JUMP(target) \
+    do { \
+        cpu->taken[d->op]++; \
+        run_pc = (target); \
+        OBSERVE(run_pc); \
+        slot = &b->taken; \
+        goto chain; \
+    } while (0)
+
+// pushing the return address, together with the chain slot leading to the block that follows the call
+#define RAS_PUSH() \
+    do { \
+        bs->ras[bs->ras_top % RAS_SIZE].return_pc = PC + 4; \
+        bs->ras[bs->ras_top % RAS_SIZE].successor = &b->fallthrough; \
+        bs->ras_top++; \
+    } while (0)
+
+// the number of instructions retired by the context so far, including the current one (reported to the profiler)
+#define RETIRED() (cpu->instructions + initial_budget - budget)
+
+#define CALL(target) \
+    do { \
+        if (cpu->profile != NULL) { \
+            PROFILE_call(cpu, (target), PC + 4, RETIRED()); \
+        } \
+        RAS_PUSH(); \
+        JUMP(target); \
+    } while (0)
+
+// for jr $ra, the target is predicted using the top of the return address stack. Other register targets are looked up
+#define JUMP_REGISTER(target) \
+    do { \
+        cpu->taken[d->op]++; \
+        run_pc = (target); \
+        OBSERVE(run_pc); \
+        if (cpu->profile != NULL && d->rs == NUM_REG - 1) { \
+            PROFILE_return(cpu, run_pc, RETIRED()); \
+        } \
+        if (d->rs == NUM_REG - 1 && bs->ras_top > 0) { \
+            bs->ras_top--; \
+            if (bs->ras[bs->ras_top % RAS_SIZE].return_pc == run_pc) { \
+                bs->stats.ras_hits++; \
+                slot = bs->ras[bs->ras_top % RAS_SIZE].successor; \
+                goto chain; \
+            } \
+            bs->stats.ras_misses++; \
+        } \
+        goto indirect; \
+    } while (0)
+
+#define CALL_REGISTER(target) \
+    do { \
+        cpu->taken[d->op]++; \
+        if (cpu->profile != NULL) { \
+            PROFILE_call(cpu, (target), PC + 4, RETIRED()); \
+        } \
+        RAS_PUSH(); \
+        run_pc = (target); \
+        OBSERVE(run_pc); \
+        goto indirect; \
+    } while (0)
+
+#define RESUME() NEXT()
+
+#define EXIT() \
+    do { \
+        run_pc = PC; \
+        OBSERVE(run_pc); \
+        reason = MIPS_RUN_EXIT; \
+        goto out; \
+    } while (0)
+
+int BLOCK_RUN_NAME(MIPS_cpu_t *cpu, unsigned long long budget, volatile int *stop)
+{
+#ifdef MIPS_THREADED_DISPATCH
+#define MIPS_OP_LABEL(name) &&op_##name,
+#if BLOCK_OBSERVED
+    static void *const handlers[NUM_OPS + 2] = { MIPS_OP_LIST(MIPS_OP_LABEL) &&op_BLOCK_END, &&op_BLOCK_END }; // (NATIVE is never dispatched)
+#else
+    static void *const handlers[NUM_OPS + 2] = { MIPS_OP_LIST(MIPS_OP_LABEL) &&op_BLOCK_END, &&op_NATIVE };
+#endif
+#undef MIPS_OP_LABEL
+#endif
+    BLOCK_state_t *bs = cpu->block;
+    uint32_t run_pc = cpu->pc; // address of the next block
+    uint32_t block_pc = cpu->pc; // address of the current block
+    block_t *b;
+    block_t **slot; // chain slot of the previous block leading to run_pc
+    const decoded_t *d;
+    block_t *from = NULL; // the block compiled whole whose exit led to run_pc, to be linked to the next block
+    int from_exit = 0;
+    unsigned long long from_flushes = 0;
+    unsigned long long flushes;
+    unsigned long long initial_budget;
+#if !BLOCK_OBSERVED
+    const native_t *native;
+    unsigned long long exit_tag, chained;
+#endif
+    int reason;
+
+    if (budget == 0) {
+        budget = ~0ULL; // no limit (practically)
+    }
+    initial_budget = budget;
+    bs->epoch++;
+
+indirect:
+    b = lookup(cpu, run_pc);
+    goto enter;
+
+chain:
+    if (*slot != NULL && (*slot)->pc == run_pc) {
+        b = *slot;
+        bs->stats.chained++;
+    } else {
+        flushes = bs->stats.flushes;
+        b = lookup(cpu, run_pc);
+        if (bs->stats.flushes == flushes) { // if the blocks were flushed while translating, the slot belongs to a dropped block
+            *slot = b;
+            bs->stats.chains_linked++;
+        }
+    }
+
+enter:
+    if (stop != NULL && *stop) {
+        reason = MIPS_RUN_STOPPED;
+        goto out;
+    }
+    if (budget == 0) {
+        reason = MIPS_RUN_BUDGET;
+        goto out;
+    }
+    if (b->length > budget) {
+        // the remaining budget ends inside this block, so the rest is interpreted one instruction at a time
+        cpu->pc = run_pc;
+        cpu->instructions += initial_budget - budget;
+#if BLOCK_OBSERVED
+        return observed_run(cpu, budget, stop);
+#else
+        return MIPS_interpret(cpu, budget, stop);
+#endif
+    }
+    if (b->epoch != bs->epoch) {
+        if (!is_current(cpu, b)) {
+            BLOCK_count_runs(cpu);
+            flush_blocks(bs);
+            b = lookup(cpu, run_pc);
+        }
+        b->epoch = bs->epoch;
+    }
+    if (bs->jit_mode != BLOCK_JIT_OFF && b->executions + 1 == JIT_THRESHOLD) {
+        b = compile_block(cpu, b);
+        if (bs->jit.writable && bs->jit.used > 0) {
+            b = disable_jit(cpu, run_pc);
+            b->epoch = bs->epoch;
+        }
+    }
+    if (from != NULL && b->native.entry != NULL && bs->stats.flushes == from_flushes && bs->jit_mode == BLOCK_JIT_ON) {
+        if (!from->native.linked[from_exit]) {
+            JIT_link(&bs->jit, &from->native, from_exit, &b->native);
+            bs->stats.jit_links++;
+            if (bs->jit.writable) {
+                b = disable_jit(cpu, run_pc);
+                b->epoch = bs->epoch;
+            }
+        }
+    }
+    from = NULL;
+    budget -= b->length;
+    b->executions++;
+    bs->stats.executions++;
+    block_pc = run_pc;
+#if !BLOCK_OBSERVED
+    if (b->native.entry != NULL) {
+        goto native_block;
+    }
+#endif
+    d = b->code;
+
+#ifdef MIPS_THREADED_DISPATCH
+    DISPATCH();
+#else
+dispatch:
+    switch (RECORD_OP(d)) {
+#endif
+
+#include "mips_handlers.h"
+
+#ifdef MIPS_THREADED_DISPATCH
+op_BLOCK_END:
+#else
+    default: // OP_BLOCK_END (the only handler class left)
+#endif
+        run_pc = block_pc + (b->length << 2);
+        slot = &b->fallthrough;
+        goto chain;
+
+#if !BLOCK_OBSERVED
+#ifdef MIPS_THREADED_DISPATCH
+op_NATIVE:
+#else
+    case OP_NATIVE:
+#endif
+        native = &bs->natives[d - bs->block_code];
+        if (cpu->block->jit_mode == BLOCK_JIT_CHECK) {
+            check_native(cpu, native->code, PC, native->length, NULL);
+        } else {
+            native->code();
+        }
+        bs->stats.jit_executions++;
+        d += native->length;
+        DISPATCH();
+
+#endif
+
+#ifndef MIPS_THREADED_DISPATCH
+    }
+#endif
+
+#if !BLOCK_OBSERVED
+native_block:
+    // the native code of a block compiled whole runs until an exit that isn't linked (or whose next block can't be entered) leaves it
+    if (bs->jit_mode == BLOCK_JIT_CHECK) {
+        exit_tag = check_native(cpu, b->native.entry, block_pc, b->length, b);
+    } else {
+        bs->jit.stop = (stop != NULL) ? stop : &no_stop;
+        bs->jit.epoch = bs->epoch;
+        bs->jit.budget = budget;
+        chained = bs->jit.chained;
+        exit_tag = b->native.entry();
+        budget = bs->jit.budget;
+        chained = bs->jit.chained - chained;
+        bs->stats.executions += chained;
+        bs->stats.chained += chained;
+        bs->stats.jit_executions += chained;
+    }
+    bs->stats.jit_executions++;
+    b = (block_t *)(uintptr_t)(exit_tag & ~1ULL); // the block whose exit left the native code
+    block_pc = b->pc;
+    if ((exit_tag & 1) == JIT_EXIT_TAKEN) {
+        run_pc = taken_target(b);
+        slot = &b->taken;
+    } else {
+        run_pc = block_pc + (b->length << 2);
+        slot = &b->fallthrough;
+    }
+    from = b;
+    from_exit = (int)(exit_tag & 1);
+    from_flushes = bs->stats.flushes;
+    goto chain;
+#endif
+
+out:
+    cpu->pc = run_pc;
+    cpu->instructions += initial_budget - budget; // a block's budget is charged when entering it, and a block can only exit at its last instruction
+    return reason;
+}
+
+#undef PC
+#undef OBSERVE
+#undef RECORD_OP
+#undef NEXT
+#undef JUMP
+#undef RAS_PUSH
+#undef RETIRED
+#undef CALL
+#undef JUMP_REGISTER
+#undef CALL_REGISTER
+#undef RESUME
+#undef EXIT
+#if BLOCK_OBSERVED
+// restoring the dispatch of mips_decode.h
+#undef DISPATCH
+#ifdef MIPS_THREADED_DISPATCH
+#define DISPATCH() goto *handlers[d->op]
+#else
+#define DISPATCH() goto dispatch
+#endif
+#endif
+#undef BLOCK_RUN_NAME
+#undef BLOCK_OBSERVED
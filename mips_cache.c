@@ -0,0 +1,339 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_cache.c
+*
+* Description:
+* ------------
+* This file implements the cache model (see mips_cache.h).
+* Every line is a single 32-bit word: the tag (the address bits above the set index) shifted left by 2, a dirty bit and a valid bit, so a set is
+* searched by comparing whole words, and all of the storage is allocated when the caches are configured. With LRU replacement the lines of a set
+* are kept in recency order (the most recently used first), so the victim is always the last line and no ages are stored. With pseudo-LRU, every set
+* has a binary tree of bits (one per internal node, in heap order) pointing away from the most recently used half, and the victim is found by
+* following the bits from the root.
+*
+*************************************************************************/
+
+#include "mips_decode.h"
+#include "mips_cache.h"
+#include "mips_disasm.h"
+
+#define LINE_VALID 0x1
+#define LINE_DIRTY 0x2
+
+typedef struct {
+    MIPS_cache_config_t config;
+    int enabled;
+    unsigned int line_shift; // log2 of the line size
+    unsigned int tag_shift; // log2 of the line size times the number of sets
+    unsigned int levels; // log2 of the number of ways (levels of the pseudo-LRU tree)
+    uint32_t set_mask;
+    uint32_t *lines; // ways lines per set
+    uint32_t *trees; // pseudo-LRU bits of every set
+    unsigned long long *misses; // misses of every instruction (indexed like program memory)
+    MIPS_cache_stats_t stats;
+} cache_t;
+
+struct CACHE_state_s {
+    cache_t icache, dcache;
+    uint32_t last_fetch_line; // the instruction cache line of the previous fetch (see CACHE_observe)
+    uint32_t capacity; // program memory words the misses arrays were allocated for
+    uint32_t random; // state of the xorshift generator of random replacement
+};
+
+static const char *const replacement_names[] = { "LRU", "pseudo-LRU", "random" };
+
+static unsigned int log2_of(uint32_t x)
+{
+    unsigned int log = 0;
+
+    while (x > 1) {
+        x >>= 1;
+        log++;
+    }
+    return log;
+}
+
+// checks a configuration and computes the shifts and masks. Returns -1 (after printing why) if it is invalid
+static int setup_cache(cache_t *c, const MIPS_cache_config_t *config, const char *name)
+{
+    uint32_t sets;
+
+    if (!DISASM_is_power_of_2(config->size) || !DISASM_is_power_of_2(config->line_size) || !DISASM_is_power_of_2(config->ways) ||
+        config->line_size < 4 || config->ways > CACHE_MAX_WAYS || (unsigned long long)config->line_size * config->ways > config->size ||
+        config->replacement < MIPS_CACHE_LRU || config->replacement > MIPS_CACHE_RANDOM ||
+        (config->write_policy != MIPS_CACHE_WRITE_BACK && config->write_policy != MIPS_CACHE_WRITE_THROUGH)) {
+        printf("Invalid %s cache configuration: %u bytes, %u-byte lines, %u ways\n", name, config->size, config->line_size, config->ways);
+        return -1;
+    }
+    sets = config->size / config->line_size / config->ways;
+    c->config = *config;
+    c->line_shift = log2_of(config->line_size);
+    c->tag_shift = c->line_shift + log2_of(sets);
+    c->levels = log2_of(config->ways);
+    c->set_mask = sets - 1;
+    c->lines = (uint32_t *)calloc((size_t)sets * config->ways, sizeof(uint32_t));
+    c->trees = (uint32_t *)calloc(sets, sizeof(uint32_t));
+    if (c->lines == NULL || c->trees == NULL) {
+        printf("Not enough memory for the %s cache\n", name);
+        return -1;
+    }
+    c->enabled = 1;
+    return 0;
+}
+
+static void free_cache(cache_t *c)
+{
+    free(c->lines);
+    free(c->trees);
+    free(c->misses);
+}
+
+static void free_state(CACHE_state_t *s)
+{
+    free_cache(&s->icache);
+    free_cache(&s->dcache);
+    free(s);
+}
+
+int CACHE_configure(MIPS_cpu_t *cpu, const MIPS_cache_config_t *icache, const MIPS_cache_config_t *dcache)
+{
+    CACHE_state_t *s;
+
+    if (cpu->cache != NULL) {
+        free_state(cpu->cache);
+        cpu->cache = NULL;
+    }
+    if (icache == NULL && dcache == NULL) {
+        return 0;
+    }
+    s = (CACHE_state_t *)calloc(1, sizeof(CACHE_state_t));
+    if (s == NULL) {
+        printf("Not enough memory for the caches\n");
+        return -1;
+    }
+    if ((icache != NULL && setup_cache(&s->icache, icache, "instruction") != 0) ||
+        (dcache != NULL && setup_cache(&s->dcache, dcache, "data") != 0)) {
+        free_state(s);
+        return -1;
+    }
+    s->icache.config.write_policy = MIPS_CACHE_WRITE_BACK; // instructions are never stored through the cache
+    s->random = 0x9e3779b9;
+    cpu->cache = s;
+    CACHE_reset(cpu);
+    return (cpu->cache != NULL) ? 0 : -1;
+}
+
+// empties a cache, and makes sure its misses array covers the whole program memory. Returns -1 if it couldn't be allocated
+static int reset_cache(cache_t *c, uint32_t old_capacity, uint32_t capacity)
+{
+    unsigned long long *misses;
+
+    if (!c->enabled) {
+        return 0;
+    }
+    memset(c->lines, 0, (size_t)(c->set_mask + 1) * c->config.ways * sizeof(uint32_t));
+    memset(c->trees, 0, (size_t)(c->set_mask + 1) * sizeof(uint32_t));
+    memset(&c->stats, 0, sizeof(c->stats));
+    misses = (unsigned long long *)DISASM_reset_counts(c->misses, old_capacity, capacity, sizeof(unsigned long long));
+    if (misses == NULL) {
+        return -1;
+    }
+    c->misses = misses;
+    return 0;
+}
+
+void CACHE_reset(MIPS_cpu_t *cpu)
+{
+    CACHE_state_t *s = cpu->cache;
+
+    if (reset_cache(&s->icache, s->capacity, cpu->prog_capacity) != 0 || reset_cache(&s->dcache, s->capacity, cpu->prog_capacity) != 0) {
+        printf("Not enough memory for the caches, so they aren't modeled anymore\n");
+        free_state(s);
+        cpu->cache = NULL;
+        return;
+    }
+    s->capacity = cpu->prog_capacity;
+    s->last_fetch_line = 0xffffffff; // no line (line numbers have at most 30 bits)
+}
+
+// marks a way of a set as the most recently used one in its pseudo-LRU tree (every node on the way's path points to the other half)
+static __inline void plru_touch(const cache_t *c, uint32_t *tree, uint32_t way)
+{
+    unsigned int level, node = 0, bit;
+
+    for (level = 0; level < c->levels; level++) {
+        bit = (way >> (c->levels - 1 - level)) & 1;
+        if (bit) {
+            *tree &= ~(1U << node);
+        } else {
+            *tree |= 1U << node;
+        }
+        node = 2 * node + 1 + bit;
+    }
+}
+
+static __inline uint32_t plru_victim(const cache_t *c, uint32_t tree)
+{
+    unsigned int level, node = 0, bit;
+    uint32_t way = 0;
+
+    for (level = 0; level < c->levels; level++) {
+        bit = (tree >> node) & 1;
+        way = (way << 1) | bit;
+        node = 2 * node + 1 + bit;
+    }
+    return way;
+}
+
+// looks an access up in a cache, updating its statistics and replacement state. Returns 1 on a hit and 0 on a miss
+static int access_cache(CACHE_state_t *s, cache_t *c, uint32_t addr, int write)
+{
+    uint32_t set = (addr >> c->line_shift) & c->set_mask;
+    uint32_t *lines = c->lines + (size_t)set * c->config.ways;
+    uint32_t wanted = ((addr >> c->tag_shift) << 2) | LINE_VALID;
+    uint32_t way, victim, line;
+    int write_back = (c->config.write_policy == MIPS_CACHE_WRITE_BACK);
+
+    if (write) {
+        c->stats.writes++;
+        if (!write_back) {
+            c->stats.memory_writes++;
+        }
+    } else {
+        c->stats.reads++;
+    }
+
+    for (way = 0; way < c->config.ways; way++) {
+        if ((lines[way] & ~LINE_DIRTY) == wanted) {
+            line = lines[way] | ((write && write_back) ? LINE_DIRTY : 0);
+            if (way == 0 && c->config.replacement == MIPS_CACHE_LRU) {
+                lines[0] = line; // already the most recently used line
+            } else if (c->config.replacement == MIPS_CACHE_LRU) {
+                memmove(lines + 1, lines, way * sizeof(uint32_t)); // moving the line to the front
+                lines[0] = line;
+            } else {
+                lines[way] = line;
+                plru_touch(c, &c->trees[set], way);
+            }
+            return 1;
+        }
+    }
+
+    if (write) {
+        c->stats.write_misses++;
+        if (!write_back) {
+            return 0; // no-write-allocate
+        }
+    } else {
+        c->stats.read_misses++;
+    }
+
+    // choosing the victim: with LRU the last line (invalid lines stay at the back), otherwise an invalid line if there is one
+    if (c->config.replacement == MIPS_CACHE_LRU) {
+        victim = c->config.ways - 1;
+    } else {
+        for (victim = 0; victim < c->config.ways && (lines[victim] & LINE_VALID); victim++) {
+        }
+        if (victim == c->config.ways) {
+            if (c->config.replacement == MIPS_CACHE_PLRU) {
+                victim = plru_victim(c, c->trees[set]);
+            } else {
+                s->random ^= s->random << 13;
+                s->random ^= s->random >> 17;
+                s->random ^= s->random << 5;
+                victim = s->random & (c->config.ways - 1);
+            }
+        }
+    }
+    if (lines[victim] & LINE_VALID) {
+        c->stats.evictions++;
+        if (lines[victim] & LINE_DIRTY) {
+            c->stats.writebacks++;
+        }
+    }
+    line = wanted | (write ? LINE_DIRTY : 0);
+    if (c->config.replacement == MIPS_CACHE_LRU) {
+        memmove(lines + 1, lines, victim * sizeof(uint32_t));
+        lines[0] = line;
+    } else {
+        lines[victim] = line;
+        plru_touch(c, &c->trees[set], victim);
+    }
+    return 0;
+}
+
+void CACHE_observe(MIPS_cpu_t *cpu, const TRACE_record_t *record)
+{
+    CACHE_state_t *s = cpu->cache;
+    uint32_t index = PROG_INDEX(cpu, record->pc);
+
+    /* Fetching from the same line as the previous instruction is a hit that doesn't change the replacement state (the line is already the most
+       recently used one in its set), so the lookup is skipped while the program runs through a line.
+    */
+    if (s->icache.enabled) {
+        if ((record->pc >> s->icache.line_shift) == s->last_fetch_line) {
+            s->icache.stats.reads++;
+        } else {
+            s->last_fetch_line = record->pc >> s->icache.line_shift;
+            if (!access_cache(s, &s->icache, record->pc, 0)) {
+                s->icache.misses[index]++;
+            }
+        }
+    }
+    if (s->dcache.enabled && (record->flags & (TRACE_FLAG_LOAD | TRACE_FLAG_STORE)) &&
+        !access_cache(s, &s->dcache, record->mem_addr, record->flags & TRACE_FLAG_STORE)) {
+        s->dcache.misses[index]++;
+    }
+}
+
+void CACHE_get_stats(MIPS_cpu_t *cpu, MIPS_cache_stats_t *icache, MIPS_cache_stats_t *dcache)
+{
+    memset(icache, 0, sizeof(MIPS_cache_stats_t));
+    memset(dcache, 0, sizeof(MIPS_cache_stats_t));
+    if (cpu->cache != NULL) {
+        *icache = cpu->cache->icache.stats;
+        *dcache = cpu->cache->dcache.stats;
+    }
+}
+
+static void print_cache(MIPS_cpu_t *cpu, const cache_t *c, const char *name, FILE *out)
+{
+    const MIPS_cache_stats_t *st = &c->stats;
+
+    fprintf(out, "%s cache: %u bytes, %u-byte lines, %u-way, %s", name, c->config.size, c->config.line_size, c->config.ways,
+        replacement_names[c->config.replacement]);
+    if (c == &cpu->cache->dcache) {
+        fprintf(out, ", %s", (c->config.write_policy == MIPS_CACHE_WRITE_BACK) ? "write-back" : "write-through");
+    }
+    fprintf(out, "\n");
+    fprintf(out, "    reads:           %llu (%llu misses, %.2f%%)\n", st->reads, st->read_misses, DISASM_percent(st->read_misses, st->reads));
+    if (c == &cpu->cache->dcache) {
+        fprintf(out, "    writes:          %llu (%llu misses, %.2f%%)\n", st->writes, st->write_misses, DISASM_percent(st->write_misses, st->writes));
+    }
+    fprintf(out, "    evictions:       %llu\n", st->evictions);
+    if (c == &cpu->cache->dcache) {
+        if (c->config.write_policy == MIPS_CACHE_WRITE_BACK) {
+            fprintf(out, "    writebacks:      %llu\n", st->writebacks);
+        } else {
+            fprintf(out, "    memory writes:   %llu\n", st->memory_writes);
+        }
+    }
+
+    // the instructions with the most misses
+    DISASM_print_top(cpu->prog_mem, c->misses, cpu->prog_capacity, cpu->text_base, CACHE_TOP_MISSES, "misses", out);
+}
+
+void CACHE_print(MIPS_cpu_t *cpu, FILE *out)
+{
+    if (cpu->cache == NULL) {
+        fprintf(out, "No caches are modeled\n");
+        return;
+    }
+    if (cpu->cache->icache.enabled) {
+        print_cache(cpu, &cpu->cache->icache, "L1 instruction", out);
+    }
+    if (cpu->cache->dcache.enabled) {
+        print_cache(cpu, &cpu->cache->dcache, "L1 data", out);
+    }
+}
@@ -0,0 +1,41 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_cache.h
+*
+* Description:
+* ------------
+* Header file for mips_cache.c, the L1 instruction/data cache model (enabled with MIPS_set_caches). The model only keeps the tags of the lines, not
+* their data (the address space stays the only copy of memory), so it affects the statistics and never the results of the program.
+*
+*************************************************************************/
+
+#ifndef __MIPS_CACHE_H
+#define __MIPS_CACHE_H
+
+#include "mips.h"
+#include "mips_trace.h"
+
+#define CACHE_MAX_WAYS 32 // the pseudo-LRU tree of a set is kept in a 32-bit word
+#define CACHE_TOP_MISSES 8 // instructions listed under every cache by MIPS_print_caches
+
+typedef struct CACHE_state_s CACHE_state_t; // caches of a context (allocated while they are enabled)
+
+/* Allocates the caches of the context with the given configurations (NULL for a cache that isn't modeled), replacing the previous ones, or frees
+   them if both are NULL (called by MIPS_cpu_set_caches). Returns 0 on success, and -1 (after printing why) for an invalid configuration or if
+   there isn't enough memory.
+*/
+int CACHE_configure(MIPS_cpu_t *cpu, const MIPS_cache_config_t *icache, const MIPS_cache_config_t *dcache);
+
+// invalidates all lines and clears the statistics (called whenever the performance counters are reset)
+void CACHE_reset(MIPS_cpu_t *cpu);
+
+// looks up the instruction fetch and the load/store (if any) of an executed instruction
+void CACHE_observe(MIPS_cpu_t *cpu, const TRACE_record_t *record);
+
+void CACHE_get_stats(MIPS_cpu_t *cpu, MIPS_cache_stats_t *icache, MIPS_cache_stats_t *dcache);
+
+// prints the configuration and statistics of every cache, and the instructions that missed the most
+void CACHE_print(MIPS_cpu_t *cpu, FILE *out);
+
+#endif /* __MIPS_CACHE_H */
@@ -0,0 +1,330 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_console.c
+*
+* Description:
+* ------------
+* This file implements the console layer of the syscalls (see mips_console.h).
+* The numbers are formatted by hand (from the last digit backwards) instead of with printf, and the process's standard input is read a block at a
+* time (with read/_read, which return what is available, so an interactive program still gets every line as soon as it is typed) and parsed here,
+* instead of calling scanf for every read_int syscall. The input is shared by all of the contexts using the process console, like stdin itself, so
+* it is only parsed under a lock (contexts may run on different threads).
+* The memory console is a MIPS_console_t like any other, whose functions read the integers from a copy of the input and append the output to a
+* growing buffer, so the output of a context can be captured without a host-side console (e.g. for comparing the outputs of many runs).
+*
+*************************************************************************/
+
+#include <stdarg.h>
+#include <ctype.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include "mips_decode.h"
+#include "mips_console.h"
+#include "thread.h"
+
+// input that is parsed a character at a time. refill (NULL if there is nothing more to read) gets more of it once it was all consumed
+typedef struct reader_s {
+    const char *data;
+    size_t pos, length;
+    int (*refill)(struct reader_s *reader); // returns 0 at the end of the input
+} reader_t;
+
+typedef struct {
+    char *input;
+    reader_t reader; // reads input
+    char *output;
+    size_t output_length, output_capacity;
+} memory_console_t;
+
+static char stdin_buffer[CONSOLE_INPUT_SIZE];
+
+static int refill_stdin(reader_t *reader)
+{
+#ifdef _WIN32
+    int n = _read(0, stdin_buffer, sizeof(stdin_buffer));
+#else
+    ssize_t n = read(0, stdin_buffer, sizeof(stdin_buffer));
+#endif
+
+    if (n <= 0) {
+        return 0;
+    }
+    reader->data = stdin_buffer;
+    reader->pos = 0;
+    reader->length = (size_t)n;
+    return 1;
+}
+
+static reader_t stdin_reader = { stdin_buffer, 0, 0, refill_stdin };
+static mutex_t stdin_lock; // protects stdin_reader and stdin_buffer
+static atomic_t stdin_lock_state; // 0 until stdin_lock is initialized by the first reader, 1 while it's being initialized, and 2 once it's ready
+
+// returns the next character of the input without consuming it (EOF at the end of the input)
+static __inline int peek(reader_t *reader)
+{
+    if (reader->pos == reader->length && (reader->refill == NULL || !reader->refill(reader))) {
+        return EOF;
+    }
+    return (unsigned char)reader->data[reader->pos];
+}
+
+// parses the next integer of the input the way scanf("%d") does: leading whitespace is skipped, and a number that doesn't fit in 32 bits wraps around
+static int parse_int(reader_t *reader, int32_t *value)
+{
+    uint32_t number = 0;
+    int c, negative = 0, digits = 0;
+
+    while ((c = peek(reader)) != EOF && isspace(c)) {
+        reader->pos++;
+    }
+    if (c == '-' || c == '+') {
+        negative = (c == '-');
+        reader->pos++;
+    }
+    while ((c = peek(reader)) != EOF && c >= '0' && c <= '9') {
+        number = number * 10 + (c - '0');
+        digits++;
+        reader->pos++;
+    }
+    if (digits == 0) {
+        return 0; // end of input, or something which isn't a number
+    }
+    *value = (int32_t)(negative ? 0 - number : number);
+    return 1;
+}
+
+static void lock_stdin(void)
+{
+    if (ATOMIC_load(&stdin_lock_state) != 2) {
+        if (ATOMIC_cas(&stdin_lock_state, 0, 1)) {
+            MUTEX_init(&stdin_lock);
+            ATOMIC_store(&stdin_lock_state, 2);
+        } else {
+            while (ATOMIC_load(&stdin_lock_state) != 2) {
+                THREAD_sleep_ms(0);
+            }
+        }
+    }
+    MUTEX_lock(&stdin_lock);
+}
+
+static void memory_write(void *user, const char *text, size_t length)
+{
+    memory_console_t *m = (memory_console_t *)user;
+    size_t capacity;
+    char *bigger;
+
+    if (m->output_length + length > m->output_capacity) {
+        capacity = (m->output_capacity == 0) ? CONSOLE_BUFFER_SIZE : m->output_capacity;
+        while (capacity < m->output_length + length) {
+            capacity *= 2;
+        }
+        bigger = (char *)realloc(m->output, capacity);
+        if (bigger == NULL) {
+            return; // the output is cut short
+        }
+        m->output = bigger;
+        m->output_capacity = capacity;
+    }
+    memcpy(m->output + m->output_length, text, length);
+    m->output_length += length;
+}
+
+static int memory_read_int(void *user, int32_t *value)
+{
+    return parse_int(&((memory_console_t *)user)->reader, value);
+}
+
+static void free_memory_console(MIPS_cpu_t *cpu)
+{
+    memory_console_t *m;
+
+    if (cpu->console.write == memory_write) {
+        m = (memory_console_t *)cpu->console.user;
+        free(m->input);
+        free(m->output);
+        free(m);
+    }
+}
+
+void CONSOLE_flush(MIPS_cpu_t *cpu)
+{
+    CONSOLE_buffer_t *b = &cpu->console_buffer;
+
+    if (b->used == 0) {
+        return;
+    }
+    if (cpu->console.write != NULL) {
+        cpu->console.write(cpu->console.user, b->text, b->used);
+    } else {
+        fwrite(b->text, 1, b->used, stdout);
+        fflush(stdout);
+    }
+    b->used = 0;
+}
+
+void CONSOLE_write(MIPS_cpu_t *cpu, const char *text, size_t length)
+{
+    CONSOLE_buffer_t *b = &cpu->console_buffer;
+
+    if (length > CONSOLE_BUFFER_SIZE - b->used) {
+        CONSOLE_flush(cpu);
+        if (length >= CONSOLE_BUFFER_SIZE) {
+            // too long to be worth buffering
+            if (cpu->console.write != NULL) {
+                cpu->console.write(cpu->console.user, text, length);
+            } else {
+                fwrite(text, 1, length, stdout);
+            }
+            return;
+        }
+    }
+    memcpy(b->text + b->used, text, length);
+    b->used += length;
+}
+
+void CONSOLE_printf(MIPS_cpu_t *cpu, const char *format, ...)
+{
+    char buffer[128];
+    va_list args;
+    int length;
+
+    va_start(args, format);
+    length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length < 0) {
+        return;
+    }
+    if (length > (int)sizeof(buffer) - 1) {
+        length = sizeof(buffer) - 1;
+    }
+    CONSOLE_write(cpu, buffer, length);
+}
+
+void CONSOLE_write_uint(MIPS_cpu_t *cpu, uint32_t value)
+{
+    char digits[10];
+    int i = sizeof(digits);
+
+    do {
+        digits[--i] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    CONSOLE_write(cpu, &digits[i], sizeof(digits) - i);
+}
+
+void CONSOLE_write_int(MIPS_cpu_t *cpu, int32_t value)
+{
+    if (value < 0) {
+        CONSOLE_write_char(cpu, '-');
+        CONSOLE_write_uint(cpu, 0 - (uint32_t)value); // also right for the most negative value, which has no positive counterpart
+    } else {
+        CONSOLE_write_uint(cpu, (uint32_t)value);
+    }
+}
+
+void CONSOLE_write_hex(MIPS_cpu_t *cpu, uint32_t value)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+    char digits[8];
+    int i = sizeof(digits);
+
+    do {
+        digits[--i] = hex_digits[value & 0xf];
+        value >>= 4;
+    } while (value != 0);
+    CONSOLE_write(cpu, &digits[i], sizeof(digits) - i);
+}
+
+void CONSOLE_write_binary(MIPS_cpu_t *cpu, uint32_t value)
+{
+    char digits[32];
+    int i = sizeof(digits);
+
+    // filling the buffer from the end, starting with the LSB (a single 0 for 0)
+    do {
+        digits[--i] = (char)('0' + (value & 1));
+        value >>= 1;
+    } while (value != 0);
+    CONSOLE_write(cpu, &digits[i], sizeof(digits) - i);
+}
+
+void CONSOLE_write_char(MIPS_cpu_t *cpu, char c)
+{
+    CONSOLE_buffer_t *b = &cpu->console_buffer;
+
+    if (b->used == CONSOLE_BUFFER_SIZE) {
+        CONSOLE_flush(cpu);
+    }
+    b->text[b->used++] = c;
+}
+
+int CONSOLE_read_int(MIPS_cpu_t *cpu, int32_t *value)
+{
+    int found;
+
+    CONSOLE_flush(cpu);
+    if (cpu->console.read_int != NULL) {
+        return cpu->console.read_int(cpu->console.user, value);
+    }
+    lock_stdin();
+    found = parse_int(&stdin_reader, value);
+    MUTEX_unlock(&stdin_lock);
+    return found;
+}
+
+void CONSOLE_set(MIPS_cpu_t *cpu, const MIPS_console_t *console)
+{
+    CONSOLE_flush(cpu);
+    free_memory_console(cpu);
+    if (console != NULL) {
+        cpu->console = *console;
+    } else {
+        memset(&cpu->console, 0, sizeof(cpu->console));
+    }
+}
+
+int CONSOLE_set_memory(MIPS_cpu_t *cpu, const char *input, size_t length)
+{
+    memory_console_t *m = (memory_console_t *)calloc(1, sizeof(memory_console_t));
+    MIPS_console_t console;
+
+    if (m == NULL || (length != 0 && (m->input = (char *)malloc(length)) == NULL)) {
+        printf("Not enough memory for the memory console\n");
+        free(m);
+        return -1;
+    }
+    if (length != 0) {
+        memcpy(m->input, input, length);
+    }
+    m->reader.data = m->input;
+    m->reader.length = length;
+    console.write = memory_write;
+    console.read_int = memory_read_int;
+    console.user = m;
+    CONSOLE_set(cpu, &console);
+    return 0;
+}
+
+const char *CONSOLE_get_output(MIPS_cpu_t *cpu, size_t *length)
+{
+    memory_console_t *m;
+
+    *length = 0;
+    if (cpu->console.write != memory_write) {
+        return NULL;
+    }
+    CONSOLE_flush(cpu);
+    m = (memory_console_t *)cpu->console.user;
+    *length = m->output_length;
+    return (m->output != NULL) ? m->output : "";
+}
+
+void CONSOLE_free(MIPS_cpu_t *cpu)
+{
+    CONSOLE_set(cpu, NULL);
+}
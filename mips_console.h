@@ -0,0 +1,64 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_console.h
+*
+* Description:
+* ------------
+* Header file for mips_console.c, the console layer of the syscalls. Everything a program prints is formatted straight into an output buffer of its
+* context, which is handed to the console (the process console, the host's MIPS_console_t, or memory) only when a read_int syscall waits for input,
+* the program exits or sleeps, the buffer is full, or MIPS_run returns. So a program printing a number at a time costs a few stores per character,
+* instead of a call to printf and a lock of stdout per syscall.
+*
+*************************************************************************/
+
+#ifndef __MIPS_CONSOLE_H
+#define __MIPS_CONSOLE_H
+
+#include "mips.h"
+
+#define CONSOLE_BUFFER_SIZE (64 * 1024) // output buffer of every context
+#define CONSOLE_INPUT_SIZE  4096 // bytes of the process's standard input read at a time
+
+// output buffer of a context (kept in MIPS_cpu_t)
+typedef struct {
+    size_t used;
+    char text[CONSOLE_BUFFER_SIZE];
+} CONSOLE_buffer_t;
+
+// hands the buffered output of the context to its console
+void CONSOLE_flush(MIPS_cpu_t *cpu);
+
+// writes text to the console of the context (through the buffer)
+void CONSOLE_write(MIPS_cpu_t *cpu, const char *text, size_t length);
+
+// printf to the console of the context, for the messages of the simulator (the formatted text is truncated to 127 characters)
+void CONSOLE_printf(MIPS_cpu_t *cpu, const char *format, ...);
+
+// these functions format a number the way printf does with %d, %u and %x, and in binary (without leading zeros) into the output buffer
+void CONSOLE_write_int(MIPS_cpu_t *cpu, int32_t value);
+void CONSOLE_write_uint(MIPS_cpu_t *cpu, uint32_t value);
+void CONSOLE_write_hex(MIPS_cpu_t *cpu, uint32_t value);
+void CONSOLE_write_binary(MIPS_cpu_t *cpu, uint32_t value);
+void CONSOLE_write_char(MIPS_cpu_t *cpu, char c);
+
+/* Reads the next integer of the context's input (flushing the output first, so a prompt is shown before waiting), the way scanf("%d") does.
+   Returns 0 (leaving *value unchanged) if there is none.
+*/
+int CONSOLE_read_int(MIPS_cpu_t *cpu, int32_t *value);
+
+// replaces the console of the context, flushing the output to the previous one first (called by MIPS_cpu_set_console)
+void CONSOLE_set(MIPS_cpu_t *cpu, const MIPS_console_t *console);
+
+/* Redirects the console of the context to memory (called by MIPS_cpu_set_memory_console): the input is copied, and the output is kept until the
+   console is replaced. Returns 0 on success, and -1 (after printing why) if there isn't enough memory.
+*/
+int CONSOLE_set_memory(MIPS_cpu_t *cpu, const char *input, size_t length);
+
+// returns the output kept by the memory console (flushing first), or NULL (with *length set to 0) if the console isn't in memory
+const char *CONSOLE_get_output(MIPS_cpu_t *cpu, size_t *length);
+
+// flushes the output, and frees the memory console if there is one (called by MIPS_destroy)
+void CONSOLE_free(MIPS_cpu_t *cpu);
+
+#endif /* __MIPS_CONSOLE_H */
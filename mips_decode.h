@@ -0,0 +1,176 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_decode.h
+*
+* Description:
+* ------------
+* This file defines the predecoded form of an instruction. Decoding the instruction_t bitfields and generating the control signals is done once per
+* program memory word (when the program is loaded, or when the word is found to have changed), instead of once per executed instruction.
+* The execution engines then only need to dispatch on the handler class stored in the predecoded record.
+* It also defines the machine context (MIPS_cpu_t), and declares the functions of mips.c that the execution engines (mips.c, mips_block.c) share.
+*
+*************************************************************************/
+
+#ifndef __MIPS_DECODE_H
+#define __MIPS_DECODE_H
+
+#include "mips.h"
+#include "mips_mem.h"
+#include "mips_console.h"
+
+struct control_t {
+    // 1-bit control signals + alu_op
+    unsigned branch : 1; // determines whether to possibly branch to some target (1) or continue to the next instruction (pc + 4) as usual (0)
+    unsigned jump : 1; // this signal is turned on, only when the instruction is j/jal
+    unsigned jump_register : 1; // this signal is turned on, only when the instruction is jr/jalr
+    unsigned jump_and_link : 1; // this signal is turned on, only when the instruction is jal/jalr
+    unsigned reg_dest : 1; // determines whether to take the register destination number for the Write register from rt (0), or from rd (1)
+    unsigned reg_write : 1; // if it's on, the register on the Write register input is written with the value on the Write data input
+    unsigned alu_src : 1; // determines whether to take the second ALU operand from the second register file output (0), or from the sign-extended, lower 16 bits of the instruction (1)
+    unsigned alu_op : 6; // 6-bit field containing the operation that the ALU needs to perform
+    unsigned mem_write : 1; // if it's on, the data memory contents designated by the address input are replaced by the value on the Write data input
+    unsigned mem_read : 1; // if it's on, the data memory contents designated by the address input are put on the Read data output
+    unsigned mem_to_reg : 1; // determines whether to take the value for the register Write data input from the ALU (0), or from the data memory (1)
+};
+
+/* List of handler classes, one per supported instruction (plus NOP for break and unknown R-type functs, and UNSUPPORTED for everything else).
+   It is written as an "X macro" so that the same list can generate the enum below and any table that must follow the enum order.
+*/
+#define MIPS_OP_LIST(X) \
+    X(SLL) X(SRL) X(SRA) X(SLLV) X(SRLV) X(SRAV) \
+    X(JR) X(JALR) X(SYSCALL) X(NOP) \
+    X(MFHI) X(MTHI) X(MFLO) X(MTLO) X(MULT) X(MULTU) X(DIV) X(DIVU) \
+    X(ADD) X(ADDU) X(SUB) X(SUBU) X(AND) X(OR) X(XOR) X(NOR) X(SLT) X(SLTU) X(MUL) \
+    X(ADDI) X(ADDIU) X(SLTI) X(SLTIU) X(ANDI) X(ORI) X(XORI) X(LUI) \
+    X(J) X(JAL) X(BEQ) X(BNE) X(BLEZ) X(BGTZ) \
+    X(LB) X(LH) X(LW) X(LBU) X(LHU) X(SB) X(SH) X(SW) \
+    X(UNSUPPORTED)
+
+#define MIPS_OP_ENUM(name) OP_##name,
+enum {
+    MIPS_OP_LIST(MIPS_OP_ENUM)
+    NUM_OPS
+};
+#undef MIPS_OP_ENUM
+
+/* A predecoded instruction. Everything the execution engine needs is already extracted and extended, so executing it requires no further decoding:
+   - rd is the destination register already selected according to reg_dest (rt for I-type instructions, 31 for jal).
+   - imm is already extended the way the instruction uses it: sign-extended for arithmetic/branches/loads/stores, zero-extended for andi/ori/xori,
+     shifted to the upper half for lui, and holding the (address << 2) bits of the target for j/jal.
+*/
+typedef struct {
+    uint32_t inst; // the raw instruction word this record was decoded from (used to detect writes to program memory)
+    unsigned char op; // handler class (OP_*)
+    unsigned char rs, rt, rd; // operand register indices
+    unsigned char shamt; // shift amount (R-type shifts only)
+    struct control_t control; // control signals, as generated by the Control unit
+    int32_t imm; // pre-extended immediate / jump target bits
+} decoded_t;
+
+/* Dispatch macros for the execution engines.
+   With GCC/Clang, every handler jumps directly to the handler of the next instruction through a table of label addresses ("labels as values"
+   extension, i.e. direct threading), so that each handler has its own indirect jump which the host CPU predicts separately.
+   Other compilers (e.g. MSVC, which doesn't support this extension) fall back to a regular switch statement, which can also be forced by defining
+   MIPS_NO_THREADED_DISPATCH (for comparing the two).
+*/
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(MIPS_NO_THREADED_DISPATCH)
+#define MIPS_THREADED_DISPATCH
+#endif
+
+#ifdef MIPS_THREADED_DISPATCH
+#define HANDLER(name) op_##name
+#define DISPATCH() goto *handlers[d->op]
+#else
+#define HANDLER(name) case OP_##name
+#define DISPATCH() goto dispatch
+#endif
+
+struct BLOCK_state_s; // state of the block engine (defined in mips_block.c)
+struct PROFILE_state_s; // state of the profiler (defined in mips_profile.c)
+struct TRACE_state_s; // state of the execution trace (defined in mips_trace.c)
+struct CACHE_state_s; // state of the cache model (defined in mips_cache.c)
+struct PREDICT_state_s; // state of the branch predictors (defined in mips_predict.c)
+struct PIPELINE_state_s; // state of the pipeline model (defined in mips_pipeline.c)
+struct FRAME_state_s; // state of the framebuffer (defined in mips_frame.c)
+
+// the machine context (see mips.h). The register file is the first member, since the JIT addresses all of the registers relative to it
+struct MIPS_cpu_s {
+    uint32_t registers[NUM_REG]; // register file
+    uint32_t hi, lo; // hi, lo registers for multiplication/division results (since they're not among the first 32 registers)
+    uint32_t pc; // program counter (counts bytes, not words)
+    uint32_t alu_result;
+    uint32_t *prog_mem; // program memory (prog_capacity words, allocated when a program is loaded)
+    unsigned int prog_size; // contains the actual number of instructions in the program
+    uint32_t prog_capacity; // number of words in program memory: a power of 2, and at least PROG_MEM_SIZE (addresses beyond it wrap around)
+    uint32_t text_base; // address of the first program memory word
+    decoded_t *decoded_prog; // predecoded copy of prog_mem (entry i is valid as long as decoded_prog[i].inst == prog_mem[i])
+    int engine; // the engine used by MIPS_cpu_run
+    int clock_mode; // the clock of the sleep and time syscalls (MIPS_CLOCK_*)
+    double clock_speed; // how many times faster than the host's clock the paced clock runs
+    unsigned long long clock_ms; // the virtual clock: milliseconds since the program was loaded
+    unsigned long long clock_origin_ns; // host time (THREAD_time_ns) at which the paced clock was 0
+    struct BLOCK_state_s *block; // allocated when the block engine is first selected (NULL until then)
+    unsigned long long instructions; // number of instructions executed since MIPS_cpu_init (updated whenever an engine returns)
+    MIPS_console_t console; // console used by the syscalls (write == NULL for the process console)
+    CONSOLE_buffer_t console_buffer; // output of the syscalls that wasn't handed to the console yet (see mips_console.h)
+    int no_draw; // set when the graphics syscalls are disabled (see MIPS_cpu_set_draw)
+    int layout; // memory layout (MIPS_LAYOUT_*)
+    uint32_t heap; // the address the next sbrk syscall returns
+    uint32_t syscall_code; // $v0 when the last syscall was made (read_int and sbrk overwrite it with their result)
+    // performance counters (see MIPS_counters_t). run_counts is a difference array over program memory (prog_capacity + 1 entries): every executed run
+    // of instructions i..j adds 1 to entry i and subtracts 1 from entry j + 1, so the prefix sums are the execution counts of the instructions
+    long long *run_counts;
+    long long run_passes; // runs through the whole of program memory, which add to the execution count of every instruction (see count_run)
+    unsigned long long taken[NUM_OPS]; // taken branches/jumps of every class
+    unsigned long long run_ns; // host time spent in MIPS_run
+    MIPS_counters_t counters; // the syscall counters are kept here, and the rest is filled in by update_counters
+    struct PROFILE_state_s *profile; // allocated while profiling is enabled (NULL otherwise), see MIPS_cpu_set_profiling
+    struct TRACE_state_s *trace; // allocated while a trace is written (NULL otherwise), see MIPS_cpu_start_trace
+    struct CACHE_state_s *cache; // allocated while caches are modeled (NULL otherwise), see MIPS_cpu_set_caches
+    struct PREDICT_state_s *predict; // allocated while branch prediction is modeled (NULL otherwise), see MIPS_cpu_set_predictors
+    struct PIPELINE_state_s *pipeline; // allocated while the pipeline is modeled (NULL otherwise), see MIPS_cpu_set_pipeline
+    struct FRAME_state_s *frame; // allocated while a framebuffer is mapped (NULL otherwise), see MIPS_cpu_set_framebuffer
+    MEM_space_t mem; // data address space (last, since it is by far the largest member)
+};
+
+// the program memory index of the instruction at the given address
+#define PROG_INDEX(cpu, addr) ((((addr) - (cpu)->text_base) >> 2) & ((cpu)->prog_capacity - 1))
+
+/* counts an executed run of length instructions, starting at program memory index first (wrapping around the end of program memory, as many times
+   as it takes: every whole pass is counted in run_passes, and the rest as a run ending at index last)
+*/
+static __inline void count_run(MIPS_cpu_t *cpu, uint32_t first, unsigned long long length, long long times)
+{
+    uint32_t last;
+
+    if (length >= cpu->prog_capacity) {
+        cpu->run_passes += times * (long long)(length / cpu->prog_capacity);
+        length %= cpu->prog_capacity;
+        if (length == 0) {
+            return;
+        }
+    }
+    last = (first + (uint32_t)length - 1) & (cpu->prog_capacity - 1);
+    cpu->run_counts[first] += times;
+    if (last < first) {
+        cpu->run_counts[cpu->prog_capacity] -= times;
+        cpu->run_counts[0] += times;
+    }
+    cpu->run_counts[last + 1] -= times;
+}
+
+// functions defined in mips.c
+uint32_t program_capacity(uint32_t words);
+int load_program(MIPS_cpu_t *cpu, const uint32_t *words, uint32_t count);
+void predecode(MIPS_cpu_t *cpu, uint32_t index);
+uint32_t load_from_memory(MIPS_cpu_t *cpu, unsigned int opcode, uint32_t addr);
+void store_in_memory(MIPS_cpu_t *cpu, unsigned int opcode, uint32_t addr, uint32_t value);
+int handle_syscall(MIPS_cpu_t *cpu);
+void observe_instruction(MIPS_cpu_t *cpu, uint32_t pc);
+int observed_run(MIPS_cpu_t *cpu, unsigned long long budget, volatile int *stop);
+
+// runs the program using the (threaded) interpreter. MIPS_cpu_run calls it when the interpreter engine is selected
+int MIPS_interpret(MIPS_cpu_t *cpu, unsigned long long budget, volatile int *stop);
+
+#endif /* __MIPS_DECODE_H */
@@ -0,0 +1,243 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_disasm.c
+*
+* Description:
+* ------------
+* This file implements the disassembler (see mips_disasm.h). Every opcode and funct of mipsdefs.h has an entry giving its mnemonic and the format
+* of its operands, so supporting a new instruction only takes a new line in one of the tables.
+*
+*************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mips_disasm.h"
+
+// operand formats
+#define FORMAT_NONE       0 // syscall, break
+#define FORMAT_DST        1 // op $d, $s, $t
+#define FORMAT_SHIFT      2 // op $d, $t, shamt
+#define FORMAT_SHIFT_VAR  3 // op $d, $t, $s
+#define FORMAT_S          4 // op $s (jr, mthi, mtlo)
+#define FORMAT_D          5 // op $d (mfhi, mflo)
+#define FORMAT_ST         6 // op $s, $t (mult, div)
+#define FORMAT_JALR       7 // jalr $s, or jalr $d, $s when $d isn't $ra
+#define FORMAT_TSI        8 // op $t, $s, signed immediate
+#define FORMAT_TSU        9 // op $t, $s, unsigned immediate (logical immediates are zero-extended)
+#define FORMAT_TU         10 // op $t, immediate (lui)
+#define FORMAT_MEM        11 // op $t, offset($s)
+#define FORMAT_BRANCH2    12 // op $s, $t, target
+#define FORMAT_BRANCH1    13 // op $s, target
+#define FORMAT_JUMP       14 // op target
+
+typedef struct {
+    unsigned int code; // opcode or funct
+    const char *name;
+    int format;
+} entry_t;
+
+static const entry_t opcodes[] = {
+    { OPCODE_J, "j", FORMAT_JUMP },
+    { OPCODE_JAL, "jal", FORMAT_JUMP },
+    { OPCODE_BEQ, "beq", FORMAT_BRANCH2 },
+    { OPCODE_BNE, "bne", FORMAT_BRANCH2 },
+    { OPCODE_BLEZ, "blez", FORMAT_BRANCH1 },
+    { OPCODE_BGTZ, "bgtz", FORMAT_BRANCH1 },
+    { OPCODE_ADDI, "addi", FORMAT_TSI },
+    { OPCODE_ADDIU, "addiu", FORMAT_TSI },
+    { OPCODE_SLTI, "slti", FORMAT_TSI },
+    { OPCODE_SLTIU, "sltiu", FORMAT_TSI },
+    { OPCODE_ANDI, "andi", FORMAT_TSU },
+    { OPCODE_ORI, "ori", FORMAT_TSU },
+    { OPCODE_XORI, "xori", FORMAT_TSU },
+    { OPCODE_LUI, "lui", FORMAT_TU },
+    { OPCODE_LB, "lb", FORMAT_MEM },
+    { OPCODE_LH, "lh", FORMAT_MEM },
+    { OPCODE_LW, "lw", FORMAT_MEM },
+    { OPCODE_LBU, "lbu", FORMAT_MEM },
+    { OPCODE_LHU, "lhu", FORMAT_MEM },
+    { OPCODE_SB, "sb", FORMAT_MEM },
+    { OPCODE_SH, "sh", FORMAT_MEM },
+    { OPCODE_SW, "sw", FORMAT_MEM }
+};
+
+static const entry_t functs[] = {
+    { FUNCT_SLL, "sll", FORMAT_SHIFT },
+    { FUNCT_SRL, "srl", FORMAT_SHIFT },
+    { FUNCT_SRA, "sra", FORMAT_SHIFT },
+    { FUNCT_SLLV, "sllv", FORMAT_SHIFT_VAR },
+    { FUNCT_SRLV, "srlv", FORMAT_SHIFT_VAR },
+    { FUNCT_SRAV, "srav", FORMAT_SHIFT_VAR },
+    { FUNCT_JR, "jr", FORMAT_S },
+    { FUNCT_JALR, "jalr", FORMAT_JALR },
+    { FUNCT_SYSCALL, "syscall", FORMAT_NONE },
+    { FUNCT_BREAK, "break", FORMAT_NONE },
+    { FUNCT_MFHI, "mfhi", FORMAT_D },
+    { FUNCT_MTHI, "mthi", FORMAT_S },
+    { FUNCT_MFLO, "mflo", FORMAT_D },
+    { FUNCT_MTLO, "mtlo", FORMAT_S },
+    { FUNCT_MULT, "mult", FORMAT_ST },
+    { FUNCT_MULTU, "multu", FORMAT_ST },
+    { FUNCT_DIV, "div", FORMAT_ST },
+    { FUNCT_DIVU, "divu", FORMAT_ST },
+    { FUNCT_ADD, "add", FORMAT_DST },
+    { FUNCT_ADDU, "addu", FORMAT_DST },
+    { FUNCT_SUB, "sub", FORMAT_DST },
+    { FUNCT_SUBU, "subu", FORMAT_DST },
+    { FUNCT_AND, "and", FORMAT_DST },
+    { FUNCT_OR, "or", FORMAT_DST },
+    { FUNCT_XOR, "xor", FORMAT_DST },
+    { FUNCT_NOR, "nor", FORMAT_DST },
+    { FUNCT_SLT, "slt", FORMAT_DST },
+    { FUNCT_SLTU, "sltu", FORMAT_DST }
+};
+
+static const entry_t special2_functs[] = {
+    { FUNCT_MUL, "mul", FORMAT_DST }
+};
+
+static const char *const register_names[NUM_REG] = {
+    "$zero", "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3",
+    "$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7",
+    "$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7",
+    "$t8", "$t9", "$k0", "$k1", "$gp", "$sp", "$fp", "$ra"
+};
+
+// returns the entry with the given code, or NULL if there is none
+static const entry_t *find(const entry_t *table, size_t count, unsigned int code)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (table[i].code == code) {
+            return &table[i];
+        }
+    }
+    return NULL;
+}
+
+const char *DISASM_register_name(unsigned int index)
+{
+    return register_names[index % NUM_REG];
+}
+
+void DISASM_instruction(uint32_t inst, uint32_t pc, char *buffer, size_t size)
+{
+    instruction_t i;
+    const entry_t *entry;
+    const char *s, *t, *d;
+    int32_t simm;
+    uint32_t uimm;
+
+    i.inst = inst;
+    if (inst == 0) {
+        snprintf(buffer, size, "nop"); // sll $zero, $zero, 0
+        return;
+    }
+    switch (i.commontype.opcode) {
+    case OPCODE_RTYPE:
+        entry = find(functs, sizeof(functs) / sizeof(functs[0]), i.rtype.funct);
+        break;
+    case OPCODE_SPECIAL2:
+        entry = find(special2_functs, sizeof(special2_functs) / sizeof(special2_functs[0]), i.rtype.funct);
+        break;
+    default:
+        entry = find(opcodes, sizeof(opcodes) / sizeof(opcodes[0]), i.commontype.opcode);
+        break;
+    }
+    if (entry == NULL) {
+        snprintf(buffer, size, ".word 0x%08x", inst);
+        return;
+    }
+
+    s = register_names[i.rtype.rs];
+    t = register_names[i.rtype.rt];
+    d = register_names[i.rtype.rd];
+    simm = (int16_t)i.itype.addr_im;
+    uimm = i.itype.addr_im;
+    switch (entry->format) {
+    case FORMAT_NONE: snprintf(buffer, size, "%s", entry->name); break;
+    case FORMAT_DST: snprintf(buffer, size, "%s %s, %s, %s", entry->name, d, s, t); break;
+    case FORMAT_SHIFT: snprintf(buffer, size, "%s %s, %s, %u", entry->name, d, t, (unsigned int)i.rtype.shamt); break;
+    case FORMAT_SHIFT_VAR: snprintf(buffer, size, "%s %s, %s, %s", entry->name, d, t, s); break;
+    case FORMAT_S: snprintf(buffer, size, "%s %s", entry->name, s); break;
+    case FORMAT_D: snprintf(buffer, size, "%s %s", entry->name, d); break;
+    case FORMAT_ST: snprintf(buffer, size, "%s %s, %s", entry->name, s, t); break;
+    case FORMAT_JALR:
+        if (i.rtype.rd == NUM_REG - 1) {
+            snprintf(buffer, size, "%s %s", entry->name, s);
+        } else {
+            snprintf(buffer, size, "%s %s, %s", entry->name, d, s);
+        }
+        break;
+    case FORMAT_TSI: snprintf(buffer, size, "%s %s, %s, %d", entry->name, t, s, simm); break;
+    case FORMAT_TSU: snprintf(buffer, size, "%s %s, %s, 0x%x", entry->name, t, s, uimm); break;
+    case FORMAT_TU: snprintf(buffer, size, "%s %s, 0x%x", entry->name, t, uimm); break;
+    case FORMAT_MEM: snprintf(buffer, size, "%s %s, %d(%s)", entry->name, t, simm, s); break;
+    // branch offsets count words from the next instruction, and jump targets replace the low 28 bits of the next instruction's address
+    case FORMAT_BRANCH2: snprintf(buffer, size, "%s %s, %s, 0x%08x", entry->name, s, t, pc + 4 + ((uint32_t)simm << 2)); break;
+    case FORMAT_BRANCH1: snprintf(buffer, size, "%s %s, 0x%08x", entry->name, s, pc + 4 + ((uint32_t)simm << 2)); break;
+    case FORMAT_JUMP: snprintf(buffer, size, "%s 0x%08x", entry->name, ((pc + 4) & 0xf0000000) | ((uint32_t)i.jtype.addr << 2)); break;
+    default: snprintf(buffer, size, ".word 0x%08x", inst); break;
+    }
+}
+
+void *DISASM_reset_counts(void *counts, uint32_t old_capacity, uint32_t capacity, size_t size)
+{
+    void *resized;
+
+    if (capacity != old_capacity || counts == NULL) {
+        resized = realloc(counts, ((size_t)capacity + 1) * size);
+        if (resized == NULL) {
+            return NULL;
+        }
+        counts = resized;
+    }
+    memset(counts, 0, ((size_t)capacity + 1) * size);
+    return counts;
+}
+
+double DISASM_percent(unsigned long long part, unsigned long long total)
+{
+    return (total != 0) ? 100.0 * part / total : 0.0;
+}
+
+int DISASM_is_power_of_2(uint32_t x)
+{
+    return x != 0 && (x & (x - 1)) == 0;
+}
+
+void DISASM_print_top(const uint32_t *prog, const unsigned long long *counts, uint32_t length, uint32_t base, unsigned int max, const char *what,
+    FILE *out)
+{
+    uint32_t top[DISASM_MAX_TOP];
+    unsigned int num_top = 0, i, j;
+    uint32_t index, addr;
+    char text[DISASM_MAX_LENGTH];
+
+    if (max > DISASM_MAX_TOP) {
+        max = DISASM_MAX_TOP;
+    }
+    // kept sorted by insertion, since only a few are listed
+    for (index = 0; index < length; index++) {
+        if (counts[index] == 0) {
+            continue;
+        }
+        for (i = num_top; i > 0 && counts[top[i - 1]] < counts[index]; i--) {
+        }
+        if (i < max) {
+            j = (num_top < max) ? num_top++ : max - 1;
+            for (; j > i; j--) {
+                top[j] = top[j - 1];
+            }
+            top[i] = index;
+        }
+    }
+    for (i = 0; i < num_top; i++) {
+        addr = base + (top[i] << 2);
+        DISASM_instruction(prog[top[i]], addr, text, sizeof(text));
+        fprintf(out, "    %12llu %s at 0x%08x: %s\n", counts[top[i]], what, addr, text);
+    }
+}
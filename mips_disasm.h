@@ -0,0 +1,49 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_disasm.h
+*
+* Description:
+* ------------
+* This file declares the disassembler, which turns an instruction word back into MARS-style assembly (e.g. "lw $t1, 8($t0)"), using the opcode and
+* funct tables of mipsdefs.h. It is used to annotate profiles and traces, and also holds the helpers shared by the reports of the models counting
+* events per instruction (caches, branch predictors, pipeline and profiler).
+*
+*************************************************************************/
+
+#ifndef __MIPS_DISASM_H
+#define __MIPS_DISASM_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "mipsdefs.h"
+
+#define DISASM_MAX_LENGTH 48 // the longest text DISASM_instruction writes, including the null terminator
+#define DISASM_MAX_TOP    32 // the most instructions DISASM_print_top lists
+
+/* Writes the assembly of the instruction word at address pc to buffer (which should hold DISASM_MAX_LENGTH characters). Branch and jump targets are
+   written as absolute addresses, and words that aren't supported instructions as ".word 0x...".
+*/
+void DISASM_instruction(uint32_t inst, uint32_t pc, char *buffer, size_t size);
+
+// returns the name of a register ("$zero", "$at", "$v0", ...)
+const char *DISASM_register_name(unsigned int index);
+
+/* Prints the (at most max) instructions of prog with the highest nonzero counts, highest first, one per line with its count followed by what is
+   counted, its address and its assembly. counts and prog hold length entries, indexed like program memory starting at address base.
+*/
+/* Returns an array of capacity + 1 zeroed counters of the given size, one per program memory word (+ 1, since there's no program yet at first).
+   counts is reallocated if it's NULL or was allocated for old_capacity words. Returns NULL if there isn't enough memory, leaving counts allocated.
+*/
+void *DISASM_reset_counts(void *counts, uint32_t old_capacity, uint32_t capacity, size_t size);
+
+// returns part as a percentage of total (0 if total is 0)
+double DISASM_percent(unsigned long long part, unsigned long long total);
+
+// returns 1 if x is a (nonzero) power of 2, for checking the sizes in the configurations of the models
+int DISASM_is_power_of_2(uint32_t x);
+
+void DISASM_print_top(const uint32_t *prog, const unsigned long long *counts, uint32_t length, uint32_t base, unsigned int max, const char *what,
+    FILE *out);
+
+#endif /* __MIPS_DISASM_H */
@@ -0,0 +1,206 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_frame.c
+*
+* Description:
+* ------------
+* This file implements the framebuffer mapped into data memory (see mips_frame.h).
+* The pixels live in the data address space like any other memory, so loads, snapshots and the debugger see them as they are. The address space
+* watches the framebuffer's pages: they are kept out of the write TLB, and every store to them reports the word it writes, which marks its tile
+* dirty (a flag per tile, so a tile written many times between two presents is sent once). A present walks the rows of tiles, and sends every run of
+* dirty tiles in a row as a single bitmap, read back out of data memory, so a frame that only moved a sprite costs a few small messages.
+*
+*************************************************************************/
+
+#include "mips_decode.h"
+#include "mips_frame.h"
+#include "draw.h"
+
+struct FRAME_state_s {
+    MIPS_framebuffer_config_t config;
+    uint32_t tiles_x, tiles_y; // the tiles of a row, and the rows of tiles (the last ones may be cut by the edges of the framebuffer)
+    unsigned char *dirty; // a flag per tile, row by row
+    unsigned int num_dirty;
+    unsigned char *pixels; // a row of tiles, copied out of data memory to be sent
+    unsigned long long next_present; // the instruction count at which the present interval ends
+    MIPS_framebuffer_stats_t stats;
+};
+
+static void free_state(FRAME_state_t *s)
+{
+    free(s->dirty);
+    free(s->pixels);
+    free(s);
+}
+
+// marks the tiles holding the written bytes dirty (called by the address space for every write to the framebuffer's pages, see MEM_watch)
+static void watch_write(void *user, uint32_t addr, size_t length)
+{
+    FRAME_state_t *s = (FRAME_state_t *)user;
+    long long size = (long long)s->config.width * s->config.height;
+    long long start = (long long)addr - s->config.base;
+    long long end = start + (long long)length;
+    uint32_t first_x, last_x, first_y, last_y, tx, ty;
+    unsigned char *flag;
+
+    // only the part of the write inside the framebuffer (its pages may hold other data as well)
+    if (start < 0) {
+        start = 0;
+    }
+    if (end > size) {
+        end = size;
+    }
+    if (start >= end) {
+        return;
+    }
+    first_y = (uint32_t)(start / s->config.width);
+    last_y = (uint32_t)((end - 1) / s->config.width);
+    if (first_y == last_y) {
+        first_x = (uint32_t)(start % s->config.width) / FRAME_TILE_SIZE;
+        last_x = (uint32_t)((end - 1) % s->config.width) / FRAME_TILE_SIZE;
+    } else {
+        first_x = 0; // a write spanning rows (only MEM_write does that) marks whole rows of tiles
+        last_x = s->tiles_x - 1;
+    }
+    for (ty = first_y / FRAME_TILE_SIZE; ty <= last_y / FRAME_TILE_SIZE; ty++) {
+        for (tx = first_x; tx <= last_x; tx++) {
+            flag = &s->dirty[ty * s->tiles_x + tx];
+            if (!*flag) {
+                *flag = 1;
+                s->num_dirty++;
+            }
+        }
+    }
+}
+
+int FRAME_configure(MIPS_cpu_t *cpu, const MIPS_framebuffer_config_t *config)
+{
+    FRAME_state_t *s;
+
+    if (cpu->frame != NULL) {
+        MEM_watch(&cpu->mem, 0, 0, NULL, NULL);
+        free_state(cpu->frame);
+        cpu->frame = NULL;
+    }
+    if (config == NULL) {
+        return 0;
+    }
+    if ((config->base & 3) != 0 || config->width == 0 || config->width > 0xffff || (config->width & 3) != 0 || config->height == 0 ||
+        config->height > 0xffff || (unsigned long long)config->base + (unsigned long long)config->width * config->height > 0x100000000ULL) {
+        printf("Invalid framebuffer configuration: %ux%u pixels at 0x%08x\n", config->width, config->height, config->base);
+        return -1;
+    }
+    s = (FRAME_state_t *)calloc(1, sizeof(FRAME_state_t));
+    if (s == NULL) {
+        printf("Not enough memory for the framebuffer\n");
+        return -1;
+    }
+    s->config = *config;
+    s->tiles_x = (config->width + FRAME_TILE_SIZE - 1) / FRAME_TILE_SIZE;
+    s->tiles_y = (config->height + FRAME_TILE_SIZE - 1) / FRAME_TILE_SIZE;
+    s->dirty = (unsigned char *)malloc(s->tiles_x * s->tiles_y);
+    s->pixels = (unsigned char *)malloc((size_t)config->width * FRAME_TILE_SIZE);
+    if (s->dirty == NULL || s->pixels == NULL) {
+        printf("Not enough memory for the framebuffer\n");
+        free_state(s);
+        return -1;
+    }
+    cpu->frame = s;
+    MEM_watch(&cpu->mem, config->base, config->width * config->height, watch_write, s);
+    FRAME_invalidate(cpu); // the first present sends the whole framebuffer
+    return 0;
+}
+
+void FRAME_invalidate(MIPS_cpu_t *cpu)
+{
+    FRAME_state_t *s = cpu->frame;
+
+    memset(s->dirty, 1, s->tiles_x * s->tiles_y);
+    s->num_dirty = s->tiles_x * s->tiles_y;
+    s->next_present = cpu->instructions + s->config.present_interval;
+}
+
+// sends the tiles first_tx..last_tx of the row of tiles ty as one bitmap
+static void send_tiles(MIPS_cpu_t *cpu, FRAME_state_t *s, uint32_t first_tx, uint32_t last_tx, uint32_t ty)
+{
+    uint32_t x = first_tx * FRAME_TILE_SIZE;
+    uint32_t y = ty * FRAME_TILE_SIZE;
+    uint32_t width = (last_tx + 1) * FRAME_TILE_SIZE;
+    uint32_t height = s->config.height - y;
+    uint32_t row;
+
+    // the tiles at the right and bottom edges may be cut
+    width = ((width < s->config.width) ? width : s->config.width) - x;
+    if (height > FRAME_TILE_SIZE) {
+        height = FRAME_TILE_SIZE;
+    }
+    for (row = 0; row < height; row++) {
+        MEM_read(&cpu->mem, s->config.base + (y + row) * s->config.width + x, s->pixels + row * width, width);
+    }
+    DRAW_bitmap(s->pixels, (uint16_t)x, (uint16_t)y, (uint16_t)width, (uint16_t)height);
+    s->stats.tiles += last_tx - first_tx + 1;
+    s->stats.rectangles++;
+}
+
+void FRAME_present(MIPS_cpu_t *cpu)
+{
+    FRAME_state_t *s = cpu->frame;
+    unsigned char *flags;
+    uint32_t tx, ty, first;
+
+    if (s->num_dirty == 0) {
+        return;
+    }
+    for (ty = 0; ty < s->tiles_y; ty++) {
+        flags = &s->dirty[ty * s->tiles_x];
+        for (tx = 0; tx < s->tiles_x; tx++) {
+            if (!flags[tx]) {
+                continue;
+            }
+            // the run of dirty tiles starting here
+            first = tx;
+            while (tx + 1 < s->tiles_x && flags[tx + 1]) {
+                tx++;
+            }
+            memset(&flags[first], 0, tx - first + 1);
+            if (!cpu->no_draw) {
+                send_tiles(cpu, s, first, tx, ty);
+            }
+        }
+    }
+    s->num_dirty = 0;
+    if (!cpu->no_draw) {
+        DRAW_flush(); // the draw module sends the tiles that changed
+        s->stats.presents++;
+    }
+}
+
+unsigned long long FRAME_until_present(MIPS_cpu_t *cpu)
+{
+    FRAME_state_t *s = cpu->frame;
+
+    if (s->config.present_interval == 0) {
+        return 0;
+    }
+    // at least one instruction, so a run always makes progress
+    return (s->next_present > cpu->instructions) ? s->next_present - cpu->instructions : 1;
+}
+
+void FRAME_tick(MIPS_cpu_t *cpu)
+{
+    FRAME_state_t *s = cpu->frame;
+
+    if (s->config.present_interval != 0 && cpu->instructions >= s->next_present) {
+        FRAME_present(cpu);
+        s->next_present = cpu->instructions + s->config.present_interval;
+    }
+}
+
+void FRAME_get_stats(MIPS_cpu_t *cpu, MIPS_framebuffer_stats_t *stats)
+{
+    memset(stats, 0, sizeof(MIPS_framebuffer_stats_t));
+    if (cpu->frame != NULL) {
+        *stats = cpu->frame->stats;
+    }
+}
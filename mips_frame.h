@@ -0,0 +1,42 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_frame.h
+*
+* Description:
+* ------------
+* Header file for mips_frame.c, the framebuffer mapped into data memory (enabled with MIPS_set_framebuffer). The stores to the framebuffer mark the
+* tiles they write as dirty (through the write watch of the address space, see MEM_watch), and presenting it sends only the dirty tiles to the
+* virtual screen, with DRAW_bitmap.
+*
+*************************************************************************/
+
+#ifndef __MIPS_FRAME_H
+#define __MIPS_FRAME_H
+
+#include "mips.h"
+
+#define FRAME_TILE_SIZE 16 // tiles are FRAME_TILE_SIZE X FRAME_TILE_SIZE pixels (a multiple of 4, so a word store never writes two tiles)
+
+typedef struct FRAME_state_s FRAME_state_t; // framebuffer of a context (allocated while it is mapped)
+
+/* Maps the framebuffer of the context with the given configuration, replacing the previous one, or unmaps it if it is NULL (called by
+   MIPS_cpu_set_framebuffer). Returns 0 on success, and -1 (after printing why) for an invalid configuration or if there isn't enough memory.
+*/
+int FRAME_configure(MIPS_cpu_t *cpu, const MIPS_framebuffer_config_t *config);
+
+// marks every tile dirty, and restarts the present interval (called when a program is loaded or a snapshot restored, which replace the pixels)
+void FRAME_invalidate(MIPS_cpu_t *cpu);
+
+// sends the dirty tiles to the virtual screen (unless the graphics syscalls are disabled), and marks them clean
+void FRAME_present(MIPS_cpu_t *cpu);
+
+// returns the number of instructions until the present interval ends (0 if there is no interval)
+unsigned long long FRAME_until_present(MIPS_cpu_t *cpu);
+
+// presents the framebuffer if the present interval ended, and starts the next one
+void FRAME_tick(MIPS_cpu_t *cpu);
+
+void FRAME_get_stats(MIPS_cpu_t *cpu, MIPS_framebuffer_stats_t *stats);
+
+#endif /* __MIPS_FRAME_H */
@@ -0,0 +1,215 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_handlers.h
+*
+* Description:
+* ------------
+* This file contains the semantics of every instruction handler class, and is included inside the dispatch loop of each execution engine
+* (mips.c, mips_block.c), so that all engines share a single implementation of the instruction set.
+* The including engine provides:
+* - HANDLER(name) and DISPATCH() (see mips_decode.h)
+* - cpu: the machine context being executed
+* - d: pointer to the predecoded record of the current instruction
+* - PC: the address of the current instruction
+* - NEXT(): moves on to the next instruction (pc + 4)
+* - JUMP(target), CALL(target): transfer control to a target known when predecoding (taken branches and j / jal)
+* - JUMP_REGISTER(target), CALL_REGISTER(target): transfer control to a target read from a register (jr / jalr)
+* - RESUME(): moves on to the next instruction after a syscall
+* - EXIT(): returns from the engine after an exit syscall (leaving the pc on the syscall instruction)
+*
+*************************************************************************/
+
+#define RS cpu->registers[d->rs] // first register file output
+#define RT cpu->registers[d->rt] // second register file output
+
+// writing the ALU result to $rd (R-type + mul instruction) or $rt (addi, addiu, slti, sltiu, andi, ori, xori, lui), and moving on to the next instruction
+#define WRITE_BACK(value) \
+    do { \
+        cpu->alu_result = (value); \
+        cpu->registers[d->rd] = cpu->alu_result; \
+        cpu->registers[0] = 0; /* making sure no one changed the $zero register */ \
+        NEXT(); \
+    } while (0)
+
+// computing the address (rs + sign-extended immediate) of a load, and writing the value read from memory to $rt
+#define LOAD(opcode) \
+    do { \
+        cpu->alu_result = (int32_t)RS + d->imm; \
+        cpu->registers[d->rd] = load_from_memory(cpu, opcode, cpu->alu_result); \
+        cpu->registers[0] = 0; \
+        NEXT(); \
+    } while (0)
+
+#define STORE(opcode) \
+    do { \
+        cpu->alu_result = (int32_t)RS + d->imm; \
+        store_in_memory(cpu, opcode, cpu->alu_result, RT); \
+        NEXT(); \
+    } while (0)
+
+// branches: 4 is added to the pc in any case, and the sign-extended offset shifted by 2 is added only if the branch is taken
+#define BRANCH(condition) \
+    do { \
+        if (condition) { \
+            JUMP(PC + 4 + (d->imm << 2)); \
+        } \
+        NEXT(); \
+    } while (0)
+
+    HANDLER(SLL): // shift left logical (there's no special instruction for shift left arithmetic, because it's essentially the same as left logical)
+        WRITE_BACK(RT << d->shamt);
+    HANDLER(SRL): // shift right logical (unsigned right shift)
+        WRITE_BACK(RT >> d->shamt);
+    HANDLER(SRA): // shift right arithmetic (signed right shift)
+        /* The result of a right-shift of a signed negative number is implementation-dependent, but the Microsoft C++ compiler uses arithmetic shift as needed:
+           (https://docs.microsoft.com/en-us/cpp/cpp/left-shift-and-right-shift-operators-input-and-output?view=msvc-170#right-shifts) */
+        WRITE_BACK((int32_t)RT >> d->shamt);
+    HANDLER(SLLV): // shift left logical variable
+        WRITE_BACK(RT << RS);
+    HANDLER(SRLV): // shift right logical variable (unsigned right shift)
+        WRITE_BACK(RT >> RS);
+    HANDLER(SRAV): // shift right arithmetic variable (signed right shift)
+        WRITE_BACK((int32_t)RT >> (int32_t)RS);
+    HANDLER(MFHI): // move from hi
+        WRITE_BACK(cpu->hi);
+    HANDLER(MFLO): // move from lo
+        WRITE_BACK(cpu->lo);
+    HANDLER(ADD):
+        WRITE_BACK((int32_t)RS + (int32_t)RT);
+    HANDLER(ADDU):
+        WRITE_BACK(RS + RT);
+    HANDLER(SUB):
+        WRITE_BACK((int32_t)RS - (int32_t)RT);
+    HANDLER(SUBU):
+        WRITE_BACK(RS - RT);
+    HANDLER(AND):
+        WRITE_BACK(RS & RT);
+    HANDLER(OR):
+        WRITE_BACK(RS | RT);
+    HANDLER(XOR):
+        WRITE_BACK(RS ^ RT);
+    HANDLER(NOR): // not or
+        WRITE_BACK(~(RS | RT));
+    HANDLER(SLT): // set on less than (signed comparison)
+        WRITE_BACK((int32_t)RS < (int32_t)RT);
+    HANDLER(SLTU): // set on less than (unsigned comparison)
+        WRITE_BACK(RS < RT);
+    HANDLER(MUL):
+        /* Multiplying two 32-bit numbers might result in a 64-bit result, from which we need to take the least significant 32 bits according to the
+           documentation of mul. Since alu_result is 32 bits in size, this behavior occurs anyway.
+        */
+        WRITE_BACK((int32_t)RS * (int32_t)RT);
+    HANDLER(ADDI):
+        WRITE_BACK((int32_t)RS + d->imm);
+    HANDLER(ADDIU): // see the note about addiu in generate_control
+        WRITE_BACK(RS + d->imm);
+    HANDLER(SLTI):
+        WRITE_BACK((int32_t)RS < d->imm);
+    HANDLER(SLTIU): // the immediate is still sign-extended, but the comparison is unsigned
+        WRITE_BACK(RS < (uint32_t)d->imm);
+    HANDLER(ANDI): // the immediate was zero-extended when predecoding, so the result contains: src1 & {0 × 16, imm}
+        WRITE_BACK(RS & d->imm);
+    HANDLER(ORI):
+        WRITE_BACK(RS | d->imm);
+    HANDLER(XORI):
+        WRITE_BACK(RS ^ d->imm);
+    HANDLER(LUI): // load upper immediate (the immediate was already shifted when predecoding: {(imm)[15:0], 0 × 16})
+        WRITE_BACK(d->imm);
+
+    HANDLER(LB):
+        LOAD(OPCODE_LB);
+    HANDLER(LH):
+        LOAD(OPCODE_LH);
+    HANDLER(LW):
+        LOAD(OPCODE_LW);
+    HANDLER(LBU):
+        LOAD(OPCODE_LBU);
+    HANDLER(LHU):
+        LOAD(OPCODE_LHU);
+    HANDLER(SB):
+        STORE(OPCODE_SB);
+    HANDLER(SH):
+        STORE(OPCODE_SH);
+    HANDLER(SW):
+        STORE(OPCODE_SW);
+
+    // instructions that only write to hi and lo
+    HANDLER(MTHI): // move to hi
+        cpu->hi = RS;
+        NEXT();
+    HANDLER(MTLO): // move to lo
+        cpu->lo = RS;
+        NEXT();
+    HANDLER(MULT): // signed multiplication
+        {
+            int64_t mult_result = (int64_t)(int32_t)RS * (int32_t)RT; // 64 bits (it is sufficient to cast only one of the operands)
+            cpu->lo = (uint32_t)mult_result; // casting to uint32_t takes only the least significant 32 bits
+            cpu->hi = (uint32_t)(mult_result >> 32); // shifting the higher 32 bits to the lower part so that they are taken when casting to uint32_t
+        }
+        NEXT();
+    HANDLER(MULTU): // unsigned multiplication
+        {
+            uint64_t multu_result = (uint64_t)RS * RT;
+            cpu->lo = (uint32_t)multu_result;
+            cpu->hi = (uint32_t)(multu_result >> 32);
+        }
+        NEXT();
+    HANDLER(DIV): // signed division
+        // the result of dividing by 0 (or the most negative number by -1) is undefined on MIPS, but it must not trap, so hi and lo are left as they are
+        if (RT != 0 && !(RS == 0x80000000 && RT == 0xffffffff)) {
+            cpu->lo = (int32_t)RS / (int32_t)RT;
+            cpu->hi = (int32_t)RS % (int32_t)RT;
+        }
+        NEXT();
+    HANDLER(DIVU): // unsigned division
+        if (RT != 0) {
+            cpu->lo = RS / RT;
+            cpu->hi = RS % RT;
+        }
+        NEXT();
+
+    HANDLER(BEQ):
+        cpu->alu_result = (int32_t)RS - (int32_t)RT; // we need to subtract the register values and check whether or not the ALU result is 0
+        BRANCH(cpu->alu_result == 0);
+    HANDLER(BNE):
+        cpu->alu_result = (int32_t)RS - (int32_t)RT;
+        BRANCH(cpu->alu_result != 0);
+    HANDLER(BLEZ): // not relying on the ALU result, but on the value (and sign) of $rs
+        BRANCH((int32_t)RS <= 0);
+    HANDLER(BGTZ):
+        BRANCH((int32_t)RS > 0);
+
+    HANDLER(J):
+        JUMP(((PC + 4) & 0xf0000000) | d->imm); // the new pc should be composed of: {(PC + 4)[31:28], address, 00}
+    HANDLER(JAL):
+        cpu->registers[NUM_REG - 1] = PC + 4; // storing the return address in register 31 (also called $ra - return address)
+        CALL(((PC + 4) & 0xf0000000) | d->imm);
+    HANDLER(JR):
+        JUMP_REGISTER(RS);
+    HANDLER(JALR):
+        {
+            uint32_t target = RS; // reading $rs before writing the return address, in case they are the same register
+            cpu->registers[d->rd] = PC + 4;
+            cpu->registers[0] = 0;
+            CALL_REGISTER(target);
+        }
+
+    HANDLER(SYSCALL):
+        // handling the syscall and exiting the program if an exit call was made (MARS allows omitting the exit call, but here this is the only way to exit)
+        if (handle_syscall(cpu) != 0) {
+            EXIT();
+        }
+        RESUME();
+    HANDLER(NOP): // break, and R-type functs we don't recognize
+        NEXT();
+    HANDLER(UNSUPPORTED):
+        CONSOLE_printf(cpu, "Unsupported instruction: %x\n", d->inst); // after checking all options, there is nothing left to do...
+        NEXT();
+
+#undef RS
+#undef RT
+#undef WRITE_BACK
+#undef LOAD
+#undef STORE
+#undef BRANCH
@@ -0,0 +1,408 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_image.c
+*
+* Description:
+* ------------
+* This file implements the program image format and the hex file reader declared in mips_image.h.
+*
+*************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mips_image.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define ADLER_MOD        65521 // the largest prime below 2^16
+#define ADLER_BLOCK      5552 // the most bytes that can be summed before the 32-bit sums might overflow
+#define MIN_ZERO_RUN     3 // shorter runs of zeros are kept inside literal runs, since starting a new run costs 2 words
+#define SWAR_ONES        0x0101010101010101ULL // 1 in every byte
+#define SWAR_HIGH_BITS   0x8080808080808080ULL // the high bit of every byte
+
+int IMAGE_map(const char *filename, IMAGE_file_t *file)
+{
+    static const unsigned char empty[1] = { 0 };
+#ifdef _WIN32
+    LARGE_INTEGER size;
+#else
+    struct stat st;
+    void *data;
+    int fd;
+#endif
+
+    memset(file, 0, sizeof(IMAGE_file_t));
+#ifdef _WIN32
+    file->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file->file == INVALID_HANDLE_VALUE) {
+        printf("Can't open %s\n", filename);
+        return -1;
+    }
+    GetFileSizeEx(file->file, &size);
+    file->size = (size_t)size.QuadPart;
+    if (file->size == 0) { // an empty file can't be mapped
+        CloseHandle(file->file);
+        file->file = NULL;
+        file->data = empty;
+        return 0;
+    }
+    file->mapping = CreateFileMappingA(file->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    file->data = (file->mapping != NULL) ? (const unsigned char *)MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (file->data == NULL) {
+        printf("Can't map %s\n", filename);
+        if (file->mapping != NULL) {
+            CloseHandle(file->mapping);
+        }
+        CloseHandle(file->file);
+        return -1;
+    }
+#else
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("Can't open %s\n", filename);
+        return -1;
+    }
+    if (fstat(fd, &st) != 0) {
+        printf("Can't read %s\n", filename);
+        close(fd);
+        return -1;
+    }
+    file->size = (size_t)st.st_size;
+    if (file->size == 0) { // an empty file can't be mapped
+        close(fd);
+        file->data = empty;
+        return 0;
+    }
+    data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping stays valid after closing the file
+    if (data == MAP_FAILED) {
+        printf("Can't map %s\n", filename);
+        return -1;
+    }
+    file->data = (const unsigned char *)data;
+#endif
+    return 0;
+}
+
+void IMAGE_unmap(IMAGE_file_t *file)
+{
+    if (file->size == 0) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(file->data);
+    CloseHandle(file->mapping);
+    CloseHandle(file->file);
+#else
+    munmap((void *)file->data, file->size);
+#endif
+    file->data = NULL;
+    file->size = 0;
+}
+
+/* Converts a line of exactly 8 hex digits, 8 digits at a time (SWAR: SIMD within a register). The digits are loaded into a 64-bit integer
+   (first digit in the lowest byte), checked, converted to their values and then packed into a word. Returns 0 if any of them isn't a hex digit.
+*/
+static int parse_hex8(const unsigned char *line, uint32_t *word)
+{
+    uint64_t v, digits, letters, lower;
+
+    memcpy(&v, line, sizeof(v));
+    if (v & SWAR_HIGH_BITS) {
+        return 0; // not ASCII
+    }
+    // a byte is in [lo, hi] if adding (0x80 - lo) sets its high bit and adding (0x7f - hi) doesn't (no carries cross bytes, since all bytes are below 0x80)
+    digits = (v + (0x80 - '0') * SWAR_ONES) & ~(v + (0x7f - '9') * SWAR_ONES);
+    lower = v | (0x20 * SWAR_ONES); // 'A'-'F' become 'a'-'f'
+    letters = (lower + (0x80 - 'a') * SWAR_ONES) & ~(lower + (0x7f - 'f') * SWAR_ONES);
+    if (((digits | letters) & SWAR_HIGH_BITS) != SWAR_HIGH_BITS) {
+        return 0;
+    }
+
+    // the value of a digit is its low nibble, plus 9 for letters (which have bit 6 set)
+    v = (v & (0x0f * SWAR_ONES)) + 9 * ((v >> 6) & SWAR_ONES);
+    // packing: pairs of nibbles into bytes, pairs of bytes into halfwords, and the two halfwords into the word (the first digit is the most significant)
+    v = ((v & 0x000f000f000f000fULL) << 4) | ((v >> 8) & 0x000f000f000f000fULL);
+    v = ((v & 0x000000ff000000ffULL) << 8) | ((v >> 16) & 0x000000ff000000ffULL);
+    *word = (uint32_t)(((v & 0xffff) << 16) | ((v >> 32) & 0xffff));
+    return 1;
+}
+
+// converts any other line the way strtoul(line, NULL, 16) does (leading spaces, optional 0x, and the digits until the first non-digit)
+static uint32_t parse_hex_slow(const unsigned char *line, size_t length)
+{
+    size_t i = 0;
+    uint32_t word = 0;
+    int digit;
+
+    while (i < length && (line[i] == ' ' || line[i] == '\t')) {
+        i++;
+    }
+    if (i + 1 < length && line[i] == '0' && (line[i + 1] == 'x' || line[i + 1] == 'X')) {
+        i += 2;
+    }
+    for (; i < length; i++) {
+        if (line[i] >= '0' && line[i] <= '9') {
+            digit = line[i] - '0';
+        } else if ((line[i] | 0x20) >= 'a' && (line[i] | 0x20) <= 'f') {
+            digit = (line[i] | 0x20) - 'a' + 10;
+        } else {
+            break;
+        }
+        word = (word << 4) | digit;
+    }
+    return word;
+}
+
+uint32_t *IMAGE_read_hex(const char *filename, uint32_t *count)
+{
+    IMAGE_file_t file;
+    const unsigned char *p, *end, *newline;
+    uint32_t *words, n = 0, lines = 0;
+    size_t length;
+
+    if (IMAGE_map(filename, &file) != 0) {
+        return NULL;
+    }
+
+    // counting the lines first (a last line without a newline counts as well)
+    end = file.data + file.size;
+    for (p = file.data; p < end && (newline = (const unsigned char *)memchr(p, '\n', end - p)) != NULL; p = newline + 1) {
+        lines++;
+    }
+    if (p < end) {
+        lines++;
+    }
+
+    words = (uint32_t *)malloc((lines > 0 ? lines : 1) * sizeof(uint32_t));
+    if (words == NULL) {
+        printf("There isn't enough memory for %s\n", filename);
+        IMAGE_unmap(&file);
+        return NULL;
+    }
+
+    for (p = file.data; p < end; p += length + 1) {
+        newline = (const unsigned char *)memchr(p, '\n', end - p);
+        length = (newline != NULL) ? (size_t)(newline - p) : (size_t)(end - p);
+        if ((length == 8 || (length == 9 && p[8] == '\r')) && parse_hex8(p, &words[n])) {
+            n++;
+        } else {
+            words[n++] = parse_hex_slow(p, length);
+        }
+    }
+
+    IMAGE_unmap(&file);
+    *count = n;
+    return words;
+}
+
+uint32_t IMAGE_checksum(const unsigned char *bytes, size_t length)
+{
+    uint32_t a = 1, b = 0;
+    size_t block;
+
+    while (length > 0) {
+        block = (length < ADLER_BLOCK) ? length : ADLER_BLOCK;
+        length -= block;
+        while (block-- > 0) {
+            a += *bytes++;
+            b += a;
+        }
+        a %= ADLER_MOD;
+        b %= ADLER_MOD;
+    }
+    return (b << 16) | a;
+}
+
+int IMAGE_validate(const IMAGE_file_t *file)
+{
+    const IMAGE_header_t *header = (const IMAGE_header_t *)file->data;
+    const IMAGE_segment_t *segment;
+    size_t offset = sizeof(IMAGE_header_t);
+    uint32_t i, covered, zeros, literals;
+    const uint32_t *run, *run_end;
+
+    if (file->size < sizeof(IMAGE_header_t) || header->magic != IMAGE_MAGIC) {
+        printf("Not a program image\n");
+        return -1;
+    }
+    if (header->version != IMAGE_VERSION) {
+        printf("Unsupported program image version %u\n", header->version);
+        return -1;
+    }
+    if (IMAGE_checksum(file->data + sizeof(IMAGE_header_t), file->size - sizeof(IMAGE_header_t)) != header->checksum) {
+        printf("The program image is corrupt (wrong checksum)\n");
+        return -1;
+    }
+
+    for (i = 0; i < header->num_segments; i++) {
+        if (file->size - offset < sizeof(IMAGE_segment_t)) {
+            printf("The program image is truncated\n");
+            return -1;
+        }
+        segment = (const IMAGE_segment_t *)(file->data + offset);
+        offset += sizeof(IMAGE_segment_t);
+        if ((file->size - offset) / 4 < segment->encoded_words) {
+            printf("The program image is truncated\n");
+            return -1;
+        }
+        if ((segment->type == IMAGE_SEGMENT_TEXT || segment->type == IMAGE_SEGMENT_STATE) && segment->encoded_words != segment->words) {
+            printf("The program image has a bad text/state segment\n");
+            return -1;
+        }
+        if (segment->type == IMAGE_SEGMENT_DATA) {
+            // the runs must stay inside the encoded words, and cover exactly the segment's words
+            run = (const uint32_t *)(file->data + offset);
+            run_end = run + segment->encoded_words;
+            covered = 0;
+            while (run < run_end) {
+                if (run_end - run < 2) {
+                    break;
+                }
+                zeros = run[0];
+                literals = run[1];
+                run += 2;
+                if ((uint32_t)(run_end - run) < literals || segment->words - covered < zeros || segment->words - covered - zeros < literals) {
+                    break;
+                }
+                covered += zeros + literals;
+                run += literals;
+            }
+            if (run != run_end || covered != segment->words) {
+                printf("The program image has a bad data segment\n");
+                return -1;
+            }
+        }
+        offset += (size_t)segment->encoded_words * 4;
+    }
+    return 0;
+}
+
+// appends words to the body of the image being built (once appending fails, the builder only records the error)
+static void append(IMAGE_builder_t *builder, const uint32_t *words, size_t count)
+{
+    uint32_t *bigger;
+    size_t capacity;
+
+    if (builder->error) {
+        return;
+    }
+    if (builder->used + count > builder->capacity) {
+        capacity = (builder->capacity * 2 > builder->used + count) ? builder->capacity * 2 : builder->used + count;
+        bigger = (uint32_t *)realloc(builder->body, capacity * sizeof(uint32_t));
+        if (bigger == NULL) {
+            builder->error = 1;
+            return;
+        }
+        builder->body = bigger;
+        builder->capacity = capacity;
+    }
+    memcpy(builder->body + builder->used, words, count * sizeof(uint32_t));
+    builder->used += count;
+}
+
+void IMAGE_begin(IMAGE_builder_t *builder)
+{
+    memset(builder, 0, sizeof(*builder));
+}
+
+void IMAGE_add_words(IMAGE_builder_t *builder, uint32_t type, uint32_t addr, const uint32_t *words, uint32_t count)
+{
+    IMAGE_segment_t segment;
+
+    segment.type = type;
+    segment.addr = addr;
+    segment.words = count;
+    segment.encoded_words = count;
+    append(builder, (const uint32_t *)&segment, sizeof(segment) / 4);
+    append(builder, words, count);
+    builder->num_segments++;
+}
+
+void IMAGE_add_data(IMAGE_builder_t *builder, uint32_t addr, const uint32_t *data, uint32_t count)
+{
+    IMAGE_segment_t segment;
+    size_t segment_offset = builder->used;
+    uint32_t i, start, end, zeros, gap, run[2];
+
+    segment.type = IMAGE_SEGMENT_DATA;
+    segment.addr = addr;
+    segment.words = count;
+    segment.encoded_words = 0; // set once the runs are written
+    append(builder, (const uint32_t *)&segment, sizeof(segment) / 4);
+    for (i = 0; i < count && !builder->error; i = end) {
+        for (zeros = 0; i + zeros < count && data[i + zeros] == 0; zeros++);
+        start = i + zeros;
+        // the literal run goes on until a run of at least MIN_ZERO_RUN zeros, or the zeros at the end of the segment
+        end = start;
+        while (end < count) {
+            for (gap = 0; end + gap < count && data[end + gap] == 0; gap++);
+            if (gap > 0 && (gap >= MIN_ZERO_RUN || end + gap == count)) {
+                break;
+            }
+            end += gap + 1; // the short run of zeros, and the non-zero word following it
+        }
+        run[0] = zeros;
+        run[1] = end - start;
+        append(builder, run, 2);
+        append(builder, data + start, end - start);
+    }
+    if (!builder->error) {
+        builder->body[segment_offset + 3] = (uint32_t)(builder->used - segment_offset - sizeof(segment) / 4);
+    }
+    builder->num_segments++;
+}
+
+int IMAGE_finish(IMAGE_builder_t *builder, const char *filename, uint32_t layout)
+{
+    IMAGE_header_t header;
+    FILE *fptr;
+    int error = 0;
+
+    if (builder->error) {
+        printf("There isn't enough memory for the program image\n");
+        free(builder->body);
+        return -1;
+    }
+
+    header.magic = IMAGE_MAGIC;
+    header.version = IMAGE_VERSION;
+    header.layout = layout;
+    header.num_segments = builder->num_segments;
+    header.checksum = IMAGE_checksum((const unsigned char *)builder->body, builder->used * 4);
+    header.reserved = 0;
+
+    fptr = fopen(filename, "wb");
+    if (fptr == NULL) {
+        printf("Can't open %s\n", filename);
+        free(builder->body);
+        return -1;
+    }
+    if (fwrite(&header, sizeof(header), 1, fptr) != 1 || fwrite(builder->body, 4, builder->used, fptr) != builder->used) {
+        printf("Can't write %s\n", filename);
+        error = -1;
+    }
+    if (fclose(fptr) != 0) {
+        error = -1;
+    }
+    free(builder->body);
+    return error;
+}
+
+int IMAGE_write(const char *filename, uint32_t layout, const uint32_t *text, uint32_t text_words, uint32_t text_addr,
+    const uint32_t *data, uint32_t data_words, uint32_t data_addr)
+{
+    IMAGE_builder_t builder;
+
+    IMAGE_begin(&builder);
+    IMAGE_add_words(&builder, IMAGE_SEGMENT_TEXT, text_addr, text, text_words);
+    IMAGE_add_data(&builder, data_addr, data, data_words);
+    return IMAGE_finish(&builder, filename, layout);
+}
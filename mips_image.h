@@ -0,0 +1,106 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_image.h
+*
+* Description:
+* ------------
+* This file defines the binary program image format, and declares the functions that read it and the hex text files MARS dumps.
+* An image holds a whole program (its .text and .data segments), so it replaces the pair of hex files. It is mapped into memory (mmap/MapViewOfFile)
+* instead of being read and parsed, and the .data segment is stored as runs of non-zero words, so loading an image only touches the non-zero
+* bytes of the program (the address space starts out as zeros anyway). Images are created from the hex files by tools/hex2img.c.
+*
+* Layout of an image (all fields are 32-bit little-endian words, like the words of the simulated machine):
+*   header                 IMAGE_header_t
+*   for every segment:     IMAGE_segment_t, followed by encoded_words words:
+*     - text segment:      the instruction words, as is
+*     - data segment:      runs of {number of zero words, number of literal words, the literal words}, together covering the segment's words
+*     - state segment:     the machine state of a snapshot (see MIPS_snapshot_save), as is
+* An image holds a text segment and any number of data segments (a snapshot has one for every allocated page of the address space).
+* The checksum in the header is the Adler-32 checksum of all the bytes following the header.
+*
+*************************************************************************/
+
+#ifndef __MIPS_IMAGE_H
+#define __MIPS_IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+#define IMAGE_MAGIC   0x474d494d // "MIMG"
+#define IMAGE_VERSION 1
+
+#define IMAGE_SEGMENT_TEXT 1
+#define IMAGE_SEGMENT_DATA 2
+#define IMAGE_SEGMENT_STATE 3
+
+typedef struct {
+    uint32_t magic; // IMAGE_MAGIC
+    uint32_t version; // IMAGE_VERSION
+    uint32_t layout; // the memory layout the program was assembled for (MIPS_LAYOUT_*)
+    uint32_t num_segments;
+    uint32_t checksum; // Adler-32 of everything following the header
+    uint32_t reserved; // 0
+} IMAGE_header_t;
+
+typedef struct {
+    uint32_t type; // IMAGE_SEGMENT_*
+    uint32_t addr; // address of the segment's first word
+    uint32_t words; // number of words in the segment
+    uint32_t encoded_words; // number of words following this header
+} IMAGE_segment_t;
+
+// a file mapped into memory (read-only)
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file, mapping;
+#endif
+} IMAGE_file_t;
+
+// maps a whole file into memory. Returns 0 on success, and -1 (after printing why) if it can't be opened or mapped
+int IMAGE_map(const char *filename, IMAGE_file_t *file);
+void IMAGE_unmap(IMAGE_file_t *file);
+
+/* Reads a hex text file (one 32-bit hex value per line, like the files MARS dumps) into a new array, and sets *count to the number of words.
+   Returns NULL (after printing why) if the file can't be read. Lines of exactly 8 hex digits (LF or CRLF) are converted 8 digits at a time;
+   any other line is parsed one character at a time, the way strtoul parses it.
+*/
+uint32_t *IMAGE_read_hex(const char *filename, uint32_t *count);
+
+/* Checks the header, segment headers and checksum of an image. Returns 0 if the image is valid, and -1 (after printing why) otherwise,
+   so the loader can walk the segments without checking them again.
+*/
+int IMAGE_validate(const IMAGE_file_t *file);
+
+// an image being built in memory: IMAGE_begin, then the segments in the order they are loaded, then IMAGE_finish writes it
+typedef struct {
+    uint32_t *body; // everything following the header
+    size_t used, capacity; // in words
+    uint32_t num_segments;
+    int error; // set once the body couldn't grow (reported by IMAGE_finish)
+} IMAGE_builder_t;
+
+void IMAGE_begin(IMAGE_builder_t *builder);
+
+// adds a segment whose words are stored as is (text or state)
+void IMAGE_add_words(IMAGE_builder_t *builder, uint32_t type, uint32_t addr, const uint32_t *words, uint32_t count);
+
+// adds a data segment, stored as runs of non-zero words
+void IMAGE_add_data(IMAGE_builder_t *builder, uint32_t addr, const uint32_t *data, uint32_t count);
+
+// writes the image and frees the builder. Returns 0 on success, and -1 (after printing why) otherwise
+int IMAGE_finish(IMAGE_builder_t *builder, const char *filename, uint32_t layout);
+
+// writes an image with a text segment and a data segment. Returns 0 on success, and -1 (after printing why) otherwise
+int IMAGE_write(const char *filename, uint32_t layout, const uint32_t *text, uint32_t text_words, uint32_t text_addr,
+    const uint32_t *data, uint32_t data_words, uint32_t data_addr);
+
+// Adler-32 checksum of a buffer (as defined for zlib)
+uint32_t IMAGE_checksum(const unsigned char *bytes, size_t length);
+
+#endif /* __MIPS_IMAGE_H */
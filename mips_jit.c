@@ -0,0 +1,887 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_jit.c
+*
+* Description:
+* ------------
+* This file contains the x86-64 code generator for hot blocks.
+* The block engine profiles how many times each block is executed, and once a block becomes hot, it's compiled into native code. A block whose
+* instructions can all be compiled, and which ends with a conditional branch or j (or with no control transfer at all), is compiled whole, including
+* the branch: each of its two exits leaves the compiled code with the tag of the block and the exit it took, and once the block the exit leads to is
+* compiled whole as well, the block engine links the exit to it, so that a hot loop keeps running native code from block to block. Any other block
+* has each of its runs of compilable instructions translated into a native function instead, which replaces the run inside the block, while the rest
+* (jal, jr, jalr, syscalls and unsupported instructions) is still executed by the block engine's handlers.
+* Loads and stores look the page up in the TLB of the context (see mips_mem.h) inline, and only call load_from_memory/store_in_memory when it misses,
+* which is also how the stores to watched pages (such as the framebuffer) are still reported.
+* The guest state stays in memory as a pinned context: rbx holds the address of the MIPS_cpu_t the code was compiled for during the whole function,
+* and every guest register is accessed as [rbx + 4 * index] (hi, lo, alu_result, the taken counters and the TLBs are at fixed offsets from it as
+* well). The generated functions take no arguments, save rbx, keep the stack aligned and reserve the shadow space of the Windows calling convention,
+* so they can be called as regular C functions, and can call C functions themselves, on both Windows and System V hosts.
+* The buffer is never writable and executable at the same time: it's mapped read/write, made executable (and read-only) once the code was generated
+* or an exit was linked, and made writable again before the next code is generated or the code is discarded.
+*
+*************************************************************************/
+
+#include "mips_jit.h"
+#include <stddef.h> // for offsetof
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define JIT_SUPPORTED
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+#define JIT_MAX_INSTRUCTION_SIZE 128 // upper bound on the bytes generated for a single instruction, including the slow path of a load/store
+#define JIT_MAX_BLOCK_OVERHEAD   256 // upper bound on the bytes of the entries, exits and epilogue of a function
+// (both are only used to check for room before compiling)
+
+// host registers (their numbers in the ModRM byte)
+#define EAX 0
+#define ECX 1
+#define EDX 2
+#define EBX 3
+
+// offsets of the guest state from rbx
+#define REG_OFFSET(index) (offsetof(MIPS_cpu_t, registers) + 4 * (index))
+#define HI_OFFSET         offsetof(MIPS_cpu_t, hi)
+#define LO_OFFSET         offsetof(MIPS_cpu_t, lo)
+#define ALU_RESULT_OFFSET offsetof(MIPS_cpu_t, alu_result)
+#define TAKEN_OFFSET(op)  (offsetof(MIPS_cpu_t, taken) + sizeof(unsigned long long) * (op))
+#define READ_TLB_OFFSET   offsetof(MIPS_cpu_t, mem.read_tlb)
+#define WRITE_TLB_OFFSET  offsetof(MIPS_cpu_t, mem.write_tlb)
+
+#define TLB_ENTRY_SHIFT 4 // log2 of the size of a TLB entry (a 32-bit tag and a pointer, padded to 16 bytes)
+#ifdef JIT_SUPPORTED
+typedef char tlb_entry_size_check[(sizeof(MEM_tlb_entry_t) == (1 << TLB_ENTRY_SHIFT)) ? 1 : -1]; // fails to compile if the size is different
+#endif
+
+#define SETL 0x9c // signed less than
+#define SETB 0x92 // unsigned less than (below)
+
+// second opcode bytes of the conditional jumps with a 32-bit displacement (JMP stands for the unconditional one)
+#define JMP 0x00
+#define JB  0x82
+#define JE  0x84
+#define JNE 0x85
+#define JLE 0x8e
+#define JG  0x8f
+
+static void emit8(JIT_t *jit, unsigned char byte)
+{
+    *jit->out++ = byte;
+}
+
+static void emit32(JIT_t *jit, uint32_t value)
+{
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        emit8(jit, (unsigned char)(value >> (8 * i)));
+    }
+}
+
+static void emit64(JIT_t *jit, unsigned long long value)
+{
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        emit8(jit, (unsigned char)(value >> (8 * i)));
+    }
+}
+
+// ModRM (and displacement) of the operands reg, [base + offset] (reg may also be an opcode extension)
+static void emit_modrm(JIT_t *jit, int reg, int base, size_t offset)
+{
+    if (offset < 128) {
+        emit8(jit, 0x40 | (reg << 3) | base); // 8-bit displacement
+        emit8(jit, (unsigned char)offset);
+    } else {
+        emit8(jit, 0x80 | (reg << 3) | base); // 32-bit displacement
+        emit32(jit, (uint32_t)offset);
+    }
+}
+
+// opcode host, [rbx + offset] (or the other direction, depending on the opcode: 0x8b loads, 0x89 stores)
+static void emit_context(JIT_t *jit, unsigned char opcode, int host, size_t offset)
+{
+    emit8(jit, opcode);
+    emit_modrm(jit, host, EBX, offset);
+}
+
+// mov host, imm64 (for rax, rcx and rdx)
+static void emit_mov_imm64(JIT_t *jit, int host, unsigned long long value)
+{
+    emit8(jit, 0x48);
+    emit8(jit, 0xb8 | host);
+    emit64(jit, value);
+}
+
+// jcc rel32 (or jmp rel32). Returns the address of the displacement, which is set by patch_jump
+static unsigned char *emit_jump(JIT_t *jit, unsigned char condition)
+{
+    if (condition == JMP) {
+        emit8(jit, 0xe9);
+    } else {
+        emit8(jit, 0x0f);
+        emit8(jit, condition);
+    }
+    emit32(jit, 0);
+    return jit->out - 4;
+}
+
+// makes a jump emitted by emit_jump go to the given target
+static void patch_jump(unsigned char *displacement, const unsigned char *target)
+{
+    int32_t relative = (int32_t)(target - (displacement + 4));
+
+    memcpy(displacement, &relative, sizeof(relative));
+}
+
+// mov host, guest register
+static void emit_load_reg(JIT_t *jit, int host, unsigned char guest)
+{
+    emit_context(jit, 0x8b, host, REG_OFFSET(guest));
+}
+
+// mov guest register, host (writes to $zero are dropped)
+static void emit_store_reg(JIT_t *jit, unsigned char guest, int host)
+{
+    if (guest != 0) {
+        emit_context(jit, 0x89, host, REG_OFFSET(guest));
+    }
+}
+
+// opcode eax, ecx (for the "r/m32, r32" forms of add/sub/and/or/xor/cmp)
+static void emit_alu_reg(JIT_t *jit, unsigned char opcode)
+{
+    emit8(jit, opcode);
+    emit8(jit, 0xc0 | (ECX << 3) | EAX);
+}
+
+// opcode eax, imm32 (for the short eax forms of add/and/or/xor/cmp)
+static void emit_alu_imm(JIT_t *jit, unsigned char opcode, int32_t imm)
+{
+    emit8(jit, opcode);
+    emit32(jit, (uint32_t)imm);
+}
+
+// shift eax by an immediate (extension = 4 for shl, 5 for shr, 7 for sar)
+static void emit_shift_imm(JIT_t *jit, int extension, unsigned char shamt)
+{
+    emit8(jit, 0xc1);
+    emit8(jit, 0xc0 | (extension << 3) | EAX);
+    emit8(jit, shamt);
+}
+
+// shift eax by cl (x86 masks the count to 5 bits, just like the compiled C shift does)
+static void emit_shift_cl(JIT_t *jit, int extension)
+{
+    emit8(jit, 0xd3);
+    emit8(jit, 0xc0 | (extension << 3) | EAX);
+}
+
+// setcc al; movzx eax, al
+static void emit_set(JIT_t *jit, unsigned char condition)
+{
+    emit8(jit, 0x0f);
+    emit8(jit, condition);
+    emit8(jit, 0xc0);
+    emit8(jit, 0x0f);
+    emit8(jit, 0xb6);
+    emit8(jit, 0xc0);
+}
+
+/* push rbx; sub rsp, 32; mov rbx, cpu. Together with the return address, the 32 bytes keep the stack aligned to 16 bytes for the calls to the
+   slow paths, and they are the shadow space the Windows calling convention requires for them
+*/
+static void emit_prologue(JIT_t *jit, MIPS_cpu_t *cpu)
+{
+    emit8(jit, 0x53);
+    emit8(jit, 0x48);
+    emit8(jit, 0x83);
+    emit8(jit, 0xec);
+    emit8(jit, 32);
+    emit8(jit, 0x48);
+    emit8(jit, 0xbb);
+    emit64(jit, (unsigned long long)(uintptr_t)cpu);
+}
+
+// add rsp, 32; pop rbx; ret
+static void emit_epilogue(JIT_t *jit)
+{
+    emit8(jit, 0x48);
+    emit8(jit, 0x83);
+    emit8(jit, 0xc4);
+    emit8(jit, 32);
+    emit8(jit, 0x5b);
+    emit8(jit, 0xc3);
+}
+
+/* Calls a slow path of a load/store: function(cpu, opcode, address in eax, value of a guest register for stores). The function may change any
+   volatile register, but never rbx
+*/
+static void emit_call(JIT_t *jit, unsigned long long function, unsigned int opcode, int value)
+{
+#ifdef _WIN32
+    emit8(jit, 0x41); // mov r8d, eax
+    emit8(jit, 0x89);
+    emit8(jit, 0xc0);
+    emit8(jit, 0xba); // mov edx, opcode
+    emit32(jit, opcode);
+    if (value >= 0) {
+        emit8(jit, 0x44); // mov r9d, guest register
+        emit_context(jit, 0x8b, ECX, REG_OFFSET(value));
+    }
+    emit8(jit, 0x48); // mov rcx, rbx
+    emit8(jit, 0x89);
+    emit8(jit, 0xd9);
+#else
+    emit8(jit, 0x89); // mov edx, eax
+    emit8(jit, 0xc2);
+    emit8(jit, 0xbe); // mov esi, opcode
+    emit32(jit, opcode);
+    if (value >= 0) {
+        emit_load_reg(jit, ECX, (unsigned char)value);
+    }
+    emit8(jit, 0x48); // mov rdi, rbx
+    emit8(jit, 0x89);
+    emit8(jit, 0xdf);
+#endif
+    emit_mov_imm64(jit, EAX, function);
+    emit8(jit, 0xff); // call rax
+    emit8(jit, 0xd0);
+}
+
+// switches the buffer between writable (while generating code) and executable (while running it). Returns 0 if the protection couldn't be changed
+static int set_writable(JIT_t *jit, int writable)
+{
+#ifdef JIT_SUPPORTED
+#ifdef _WIN32
+    DWORD old_protection;
+#endif
+
+    if (jit->writable == writable) {
+        return 1;
+    }
+#ifdef _WIN32
+    if (!VirtualProtect(jit->buffer, JIT_BUFFER_SIZE, writable ? PAGE_READWRITE : PAGE_EXECUTE_READ, &old_protection)) {
+        return 0;
+    }
+    if (!writable) {
+        FlushInstructionCache(GetCurrentProcess(), jit->buffer, JIT_BUFFER_SIZE);
+    }
+#else
+    if (mprotect(jit->buffer, JIT_BUFFER_SIZE, writable ? (PROT_READ | PROT_WRITE) : (PROT_READ | PROT_EXEC)) != 0) {
+        return 0;
+    }
+#endif
+    jit->writable = writable;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+int JIT_init(JIT_t *jit)
+{
+#ifdef JIT_SUPPORTED
+    if (jit->buffer != NULL) {
+        return 1;
+    }
+#ifdef _WIN32
+    jit->buffer = (unsigned char *)VirtualAlloc(NULL, JIT_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+    jit->buffer = (unsigned char *)mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->buffer == MAP_FAILED) {
+        jit->buffer = NULL;
+    }
+#endif
+    jit->used = 0;
+    jit->writable = 1;
+    return (jit->buffer != NULL) ? 1 : 0;
+#else
+    return 0;
+#endif
+}
+
+void JIT_free(JIT_t *jit)
+{
+#ifdef JIT_SUPPORTED
+    if (jit->buffer != NULL) {
+#ifdef _WIN32
+        VirtualFree(jit->buffer, 0, MEM_RELEASE);
+#else
+        munmap(jit->buffer, JIT_BUFFER_SIZE);
+#endif
+        jit->buffer = NULL;
+    }
+#endif
+}
+
+void JIT_reset(JIT_t *jit)
+{
+    if (jit->buffer != NULL) {
+        set_writable(jit, 1);
+    }
+    jit->used = 0;
+}
+
+
+int JIT_can_compile(unsigned char op)
+{
+    switch (op) {
+    case OP_SLL: case OP_SRL: case OP_SRA: case OP_SLLV: case OP_SRLV: case OP_SRAV:
+    case OP_MFHI: case OP_MTHI: case OP_MFLO: case OP_MTLO: case OP_MULT: case OP_MULTU: case OP_DIV: case OP_DIVU:
+    case OP_ADD: case OP_ADDU: case OP_SUB: case OP_SUBU: case OP_AND: case OP_OR: case OP_XOR: case OP_NOR:
+    case OP_SLT: case OP_SLTU: case OP_MUL:
+    case OP_ADDI: case OP_ADDIU: case OP_SLTI: case OP_SLTIU: case OP_ANDI: case OP_ORI: case OP_XORI: case OP_LUI:
+    case OP_LB: case OP_LH: case OP_LW: case OP_LBU: case OP_LHU: case OP_SB: case OP_SH: case OP_SW:
+    case OP_NOP:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+int JIT_can_end_block(unsigned char op)
+{
+    return (op == OP_BEQ || op == OP_BNE || op == OP_BLEZ || op == OP_BGTZ || op == OP_J) ? 1 : 0;
+}
+
+// returns 1 if instructions of the given handler class write alu_result (only the last of them in a function has to store it)
+static int writes_alu_result(unsigned char op)
+{
+    switch (op) {
+    case OP_NOP: case OP_MTHI: case OP_MTLO: case OP_MULT: case OP_MULTU: case OP_DIV: case OP_DIVU:
+    case OP_BLEZ: case OP_BGTZ: case OP_J:
+        return 0;
+    default:
+        return 1;
+    }
+}
+
+// the opcode load_from_memory/store_in_memory expect for a load/store handler class
+static unsigned int memory_opcode(unsigned char op)
+{
+    switch (op) {
+    case OP_LB:  return OPCODE_LB;
+    case OP_LH:  return OPCODE_LH;
+    case OP_LW:  return OPCODE_LW;
+    case OP_LBU: return OPCODE_LBU;
+    case OP_LHU: return OPCODE_LHU;
+    case OP_SB:  return OPCODE_SB;
+    case OP_SH:  return OPCODE_SH;
+    default:     return OPCODE_SW;
+    }
+}
+
+// the offset of an access inside its page (the lower address bits that would make a halfword/word unaligned are ignored, like load_from_memory does)
+static uint32_t page_offset_mask(unsigned char op)
+{
+    switch (op) {
+    case OP_LH: case OP_LHU: case OP_SH:
+        return MEM_PAGE_MASK & ~1U;
+    case OP_LW: case OP_SW:
+        return MEM_PAGE_MASK & ~3U;
+    default:
+        return MEM_PAGE_MASK;
+    }
+}
+
+/* Looks the page of the address in eax up in a TLB (see MEM_read_ptr/MEM_write_ptr). On a hit, rdx holds the host address of the page and eax the
+   offset of the access in it. Returns the jump taken on a miss, with the address still in eax
+*/
+static unsigned char *emit_tlb_lookup(JIT_t *jit, size_t tlb_offset, uint32_t offset_mask)
+{
+    unsigned char *miss;
+
+    emit8(jit, 0x89); // mov ecx, eax
+    emit8(jit, 0xc1);
+    emit8(jit, 0xc1); // shr ecx, 12 (the page number)
+    emit8(jit, 0xe9);
+    emit8(jit, MEM_PAGE_BITS);
+    emit8(jit, 0x89); // mov edx, ecx
+    emit8(jit, 0xca);
+    emit8(jit, 0xc1); // shl edx, 4
+    emit8(jit, 0xe2);
+    emit8(jit, TLB_ENTRY_SHIFT);
+    emit8(jit, 0x81); // and edx, (MEM_TLB_SIZE - 1) << 4 (the offset of the entry)
+    emit8(jit, 0xe2);
+    emit32(jit, (MEM_TLB_SIZE - 1) << TLB_ENTRY_SHIFT);
+    emit8(jit, 0xff); // inc ecx (the tag is the page number plus 1)
+    emit8(jit, 0xc1);
+    emit8(jit, 0x39); // cmp [rbx + rdx + tlb + tag], ecx
+    emit8(jit, 0x8c);
+    emit8(jit, 0x13);
+    emit32(jit, (uint32_t)(tlb_offset + offsetof(MEM_tlb_entry_t, tag)));
+    miss = emit_jump(jit, JNE);
+    emit8(jit, 0x48); // mov rdx, [rbx + rdx + tlb + page]
+    emit8(jit, 0x8b);
+    emit8(jit, 0x94);
+    emit8(jit, 0x13);
+    emit32(jit, (uint32_t)(tlb_offset + offsetof(MEM_tlb_entry_t, page)));
+    emit8(jit, 0x25); // and eax, offset mask
+    emit32(jit, offset_mask);
+    return miss;
+}
+
+// computes the address of a load/store ($rs + imm) in eax, which is also its alu_result
+static void emit_address(JIT_t *jit, const decoded_t *d, int write_alu_result)
+{
+    emit_load_reg(jit, EAX, d->rs);
+    emit_alu_imm(jit, 0x05, d->imm);
+    if (write_alu_result) {
+        emit_context(jit, 0x89, EAX, ALU_RESULT_OFFSET);
+    }
+}
+
+static void compile_load(JIT_t *jit, const decoded_t *d, int write_alu_result)
+{
+    unsigned char *miss, *done;
+
+    emit_address(jit, d, write_alu_result);
+    miss = emit_tlb_lookup(jit, READ_TLB_OFFSET, page_offset_mask(d->op));
+    // eax = [rdx + rax], extended the way the load requires
+    switch (d->op) {
+    case OP_LB:
+        emit8(jit, 0x0f); // movsx eax, byte
+        emit8(jit, 0xbe);
+        break;
+    case OP_LBU:
+        emit8(jit, 0x0f); // movzx eax, byte
+        emit8(jit, 0xb6);
+        break;
+    case OP_LH:
+        emit8(jit, 0x0f); // movsx eax, word
+        emit8(jit, 0xbf);
+        break;
+    case OP_LHU:
+        emit8(jit, 0x0f); // movzx eax, word
+        emit8(jit, 0xb7);
+        break;
+    default:
+        emit8(jit, 0x8b); // mov eax, dword
+        break;
+    }
+    emit8(jit, 0x04);
+    emit8(jit, 0x02);
+    done = emit_jump(jit, JMP);
+
+    patch_jump(miss, jit->out);
+    emit_call(jit, (unsigned long long)(uintptr_t)&load_from_memory, memory_opcode(d->op), -1);
+
+    patch_jump(done, jit->out);
+    emit_store_reg(jit, d->rd, EAX); // a load to $zero still accesses memory, like in the interpreter
+}
+
+static void compile_store(JIT_t *jit, const decoded_t *d, int write_alu_result)
+{
+    unsigned char *miss, *done;
+
+    emit_address(jit, d, write_alu_result);
+    if (jit->store != NULL) {
+        emit_call(jit, (unsigned long long)(uintptr_t)jit->store, memory_opcode(d->op), d->rt);
+        return;
+    }
+    miss = emit_tlb_lookup(jit, WRITE_TLB_OFFSET, page_offset_mask(d->op));
+    emit_load_reg(jit, ECX, d->rt);
+    // [rdx + rax] = ecx (or its lower byte/halfword)
+    switch (d->op) {
+    case OP_SB:
+        emit8(jit, 0x88);
+        break;
+    case OP_SH:
+        emit8(jit, 0x66);
+        emit8(jit, 0x89);
+        break;
+    default:
+        emit8(jit, 0x89);
+        break;
+    }
+    emit8(jit, 0x0c);
+    emit8(jit, 0x02);
+    done = emit_jump(jit, JMP);
+
+    patch_jump(miss, jit->out);
+    emit_call(jit, (unsigned long long)(uintptr_t)&store_in_memory, memory_opcode(d->op), d->rt);
+
+    patch_jump(done, jit->out);
+}
+
+// div/divu, leaving hi and lo as they are when dividing by 0 or the most negative number by -1 (see the DIV handler), where x86 would trap
+static void compile_divide(JIT_t *jit, const decoded_t *d)
+{
+    unsigned char *zero, *overflow = NULL, *divide;
+
+    emit_load_reg(jit, ECX, d->rt);
+    emit8(jit, 0x85); // test ecx, ecx
+    emit8(jit, 0xc9);
+    zero = emit_jump(jit, JE);
+    emit_load_reg(jit, EAX, d->rs);
+    if (d->op == OP_DIV) {
+        emit8(jit, 0x83); // cmp ecx, -1
+        emit8(jit, 0xf9);
+        emit8(jit, 0xff);
+        divide = emit_jump(jit, JNE);
+        emit_alu_imm(jit, 0x3d, INT32_MIN); // cmp eax, INT32_MIN
+        overflow = emit_jump(jit, JE);
+        patch_jump(divide, jit->out);
+        emit8(jit, 0x99); // cdq
+        emit8(jit, 0xf7); // idiv ecx (eax = edx:eax / ecx, edx = the remainder)
+        emit8(jit, 0xf9);
+    } else {
+        emit8(jit, 0x31); // xor edx, edx
+        emit8(jit, 0xd2);
+        emit8(jit, 0xf7); // div ecx
+        emit8(jit, 0xf1);
+    }
+    emit_context(jit, 0x89, EAX, LO_OFFSET);
+    emit_context(jit, 0x89, EDX, HI_OFFSET);
+
+    patch_jump(zero, jit->out);
+    if (overflow != NULL) {
+        patch_jump(overflow, jit->out);
+    }
+}
+
+// generates the code of a single instruction (write_alu_result is set for the last instruction of the function that writes alu_result)
+static void compile_instruction(JIT_t *jit, const decoded_t *d, int write_alu_result)
+{
+    switch (d->op) {
+    // shifts (eax = $rt, shifted by shamt or by $rs in cl)
+    case OP_SLL:
+    case OP_SRL:
+    case OP_SRA:
+        emit_load_reg(jit, EAX, d->rt);
+        emit_shift_imm(jit, (d->op == OP_SLL) ? 4 : (d->op == OP_SRL) ? 5 : 7, d->shamt);
+        break;
+    case OP_SLLV:
+    case OP_SRLV:
+    case OP_SRAV:
+        emit_load_reg(jit, EAX, d->rt);
+        emit_load_reg(jit, ECX, d->rs);
+        emit_shift_cl(jit, (d->op == OP_SLLV) ? 4 : (d->op == OP_SRLV) ? 5 : 7);
+        break;
+
+    case OP_MFHI:
+        emit_context(jit, 0x8b, EAX, HI_OFFSET);
+        break;
+    case OP_MFLO:
+        emit_context(jit, 0x8b, EAX, LO_OFFSET);
+        break;
+    case OP_MTHI:
+        emit_load_reg(jit, EAX, d->rs);
+        emit_context(jit, 0x89, EAX, HI_OFFSET);
+        return;
+    case OP_MTLO:
+        emit_load_reg(jit, EAX, d->rs);
+        emit_context(jit, 0x89, EAX, LO_OFFSET);
+        return;
+    case OP_MULT:
+    case OP_MULTU:
+        emit_load_reg(jit, EAX, d->rs);
+        emit_load_reg(jit, ECX, d->rt);
+        emit8(jit, 0xf7);
+        emit8(jit, (d->op == OP_MULT) ? 0xe9 : 0xe1); // imul ecx / mul ecx (edx:eax = eax * ecx)
+        emit_context(jit, 0x89, EAX, LO_OFFSET);
+        emit_context(jit, 0x89, EDX, HI_OFFSET);
+        return;
+    case OP_DIV:
+    case OP_DIVU:
+        compile_divide(jit, d);
+        return;
+
+    // R-type (eax = $rs op $rt)
+    case OP_ADD:
+    case OP_ADDU:
+    case OP_SUB:
+    case OP_SUBU:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_NOR:
+    case OP_SLT:
+    case OP_SLTU:
+    case OP_MUL:
+        emit_load_reg(jit, EAX, d->rs);
+        emit_load_reg(jit, ECX, d->rt);
+        switch (d->op) {
+        case OP_ADD:
+        case OP_ADDU:
+            emit_alu_reg(jit, 0x01);
+            break;
+        case OP_SUB:
+        case OP_SUBU:
+            emit_alu_reg(jit, 0x29);
+            break;
+        case OP_AND:
+            emit_alu_reg(jit, 0x21);
+            break;
+        case OP_OR:
+            emit_alu_reg(jit, 0x09);
+            break;
+        case OP_XOR:
+            emit_alu_reg(jit, 0x31);
+            break;
+        case OP_NOR:
+            emit_alu_reg(jit, 0x09);
+            emit8(jit, 0xf7); // not eax
+            emit8(jit, 0xd0);
+            break;
+        case OP_SLT:
+        case OP_SLTU:
+            emit_alu_reg(jit, 0x39); // cmp eax, ecx
+            emit_set(jit, (d->op == OP_SLT) ? SETL : SETB);
+            break;
+        case OP_MUL:
+            emit8(jit, 0x0f); // imul eax, ecx
+            emit8(jit, 0xaf);
+            emit8(jit, 0xc0 | (EAX << 3) | ECX);
+            break;
+        }
+        break;
+
+    // I-type (eax = $rs op imm, where imm was already extended when predecoding)
+    case OP_ADDI:
+    case OP_ADDIU:
+        emit_load_reg(jit, EAX, d->rs);
+        emit_alu_imm(jit, 0x05, d->imm);
+        break;
+    case OP_SLTI:
+    case OP_SLTIU:
+        emit_load_reg(jit, EAX, d->rs);
+        emit_alu_imm(jit, 0x3d, d->imm); // cmp eax, imm32
+        emit_set(jit, (d->op == OP_SLTI) ? SETL : SETB);
+        break;
+    case OP_ANDI:
+        emit_load_reg(jit, EAX, d->rs);
+        emit_alu_imm(jit, 0x25, d->imm);
+        break;
+    case OP_ORI:
+        emit_load_reg(jit, EAX, d->rs);
+        emit_alu_imm(jit, 0x0d, d->imm);
+        break;
+    case OP_XORI:
+        emit_load_reg(jit, EAX, d->rs);
+        emit_alu_imm(jit, 0x35, d->imm);
+        break;
+    case OP_LUI:
+        emit8(jit, 0xb8 | EAX); // mov eax, imm32
+        emit32(jit, (uint32_t)d->imm);
+        break;
+
+    case OP_LB:
+    case OP_LH:
+    case OP_LW:
+    case OP_LBU:
+    case OP_LHU:
+        compile_load(jit, d, write_alu_result);
+        return;
+    case OP_SB:
+    case OP_SH:
+    case OP_SW:
+        compile_store(jit, d, write_alu_result);
+        return;
+
+    default: // nop
+        return;
+    }
+
+    if (write_alu_result) {
+        emit_context(jit, 0x89, EAX, ALU_RESULT_OFFSET);
+    }
+    emit_store_reg(jit, d->rd, EAX);
+}
+
+// returns the index of the last record writing alu_result (-1 if none does)
+static int last_alu_result_write(const decoded_t *code, unsigned int length)
+{
+    int i;
+
+    for (i = (int)length - 1; i >= 0; i--) {
+        if (writes_alu_result(code[i].op)) {
+            break;
+        }
+    }
+    return i;
+}
+
+// returns 1 if there's room for a function of the given number of instructions, and the buffer could be made writable
+static int begin_function(JIT_t *jit, unsigned int length)
+{
+    if (jit->buffer == NULL || jit->used + (unsigned long)length * JIT_MAX_INSTRUCTION_SIZE + JIT_MAX_BLOCK_OVERHEAD > JIT_BUFFER_SIZE) {
+        return 0;
+    }
+    if (!set_writable(jit, 1)) {
+        return 0;
+    }
+    jit->out = jit->buffer + jit->used;
+    return 1;
+}
+
+// adds the function generated from start to the used part of the buffer, and makes the buffer executable. Returns 0 if it couldn't be
+static int end_function(JIT_t *jit, unsigned char *start)
+{
+    jit->used += (unsigned long)(jit->out - start);
+    return set_writable(jit, 0);
+}
+
+JIT_code_t JIT_compile(JIT_t *jit, MIPS_cpu_t *cpu, const decoded_t *code, unsigned int length)
+{
+    unsigned int i;
+    int last_write = last_alu_result_write(code, length);
+    unsigned char *start;
+
+    if (!begin_function(jit, length)) {
+        return NULL;
+    }
+    start = jit->out;
+
+    emit_prologue(jit, cpu);
+    for (i = 0; i < length; i++) {
+        compile_instruction(jit, &code[i], (int)i == last_write);
+    }
+    emit_epilogue(jit);
+
+    if (!end_function(jit, start)) {
+        return NULL; // the code can't be executed, so the run stays interpreted
+    }
+    return (JIT_code_t)start;
+}
+
+/* The entry of a block reached from the exit of another compiled block (which left its tag and exit in rax): the block is only entered if the stop
+   flag isn't set, it was checked against program memory in the current epoch and the budget covers it, and otherwise the jumps returned in bail
+   leave the compiled code with rax as it is. Entering the block charges the budget and counts the execution
+*/
+static void emit_chained_entry(JIT_t *jit, const JIT_block_t *block, unsigned int length, unsigned char *bail[3])
+{
+    emit_mov_imm64(jit, ECX, (unsigned long long)(uintptr_t)jit);
+    emit8(jit, 0x48); // mov rdx, [rcx + stop]
+    emit8(jit, 0x8b);
+    emit_modrm(jit, EDX, ECX, offsetof(JIT_t, stop));
+    emit8(jit, 0x83); // cmp dword [rdx], 0
+    emit8(jit, 0x3a);
+    emit8(jit, 0x00);
+    bail[0] = emit_jump(jit, JNE);
+
+    emit_mov_imm64(jit, EDX, (unsigned long long)(uintptr_t)block->epoch);
+    emit8(jit, 0x8b); // mov edx, [rdx]
+    emit8(jit, 0x12);
+    emit8(jit, 0x3b); // cmp edx, [rcx + epoch]
+    emit_modrm(jit, EDX, ECX, offsetof(JIT_t, epoch));
+    bail[1] = emit_jump(jit, JNE);
+
+    emit8(jit, 0x48); // cmp qword [rcx + budget], length
+    emit8(jit, 0x81);
+    emit_modrm(jit, 7, ECX, offsetof(JIT_t, budget));
+    emit32(jit, length);
+    bail[2] = emit_jump(jit, JB);
+    emit8(jit, 0x48); // sub qword [rcx + budget], length
+    emit8(jit, 0x81);
+    emit_modrm(jit, 5, ECX, offsetof(JIT_t, budget));
+    emit32(jit, length);
+
+    emit8(jit, 0x48); // inc qword [rcx + chained]
+    emit8(jit, 0xff);
+    emit_modrm(jit, 0, ECX, offsetof(JIT_t, chained));
+    emit_mov_imm64(jit, EDX, (unsigned long long)(uintptr_t)block->executions);
+    emit8(jit, 0x48); // inc qword [rdx]
+    emit8(jit, 0xff);
+    emit8(jit, 0x02);
+}
+
+int JIT_compile_block(JIT_t *jit, MIPS_cpu_t *cpu, const decoded_t *code, unsigned int length, JIT_block_t *block)
+{
+    const decoded_t *last = &code[length - 1];
+    unsigned int body = JIT_can_end_block(last->op) ? length - 1 : length; // the instructions before the branch
+    unsigned int i;
+    int last_write = last_alu_result_write(code, length);
+    unsigned char *start, *to_body, *taken = NULL, *epilogue, *bail[3];
+
+    if (!begin_function(jit, length)) {
+        return 0;
+    }
+    start = jit->out;
+
+    // the entry called from C
+    emit_prologue(jit, cpu);
+    to_body = emit_jump(jit, JMP);
+
+    block->chained_entry = jit->out;
+    emit_chained_entry(jit, block, length, bail);
+    patch_jump(to_body, jit->out);
+
+    for (i = 0; i < body; i++) {
+        compile_instruction(jit, &code[i], (int)i == last_write);
+    }
+
+    // the branch, jumping to the taken exit
+    switch (last->op) {
+    case OP_BEQ:
+    case OP_BNE:
+        emit_load_reg(jit, EAX, last->rs);
+        emit_context(jit, 0x2b, EAX, REG_OFFSET(last->rt)); // sub eax, $rt
+        emit_context(jit, 0x89, EAX, ALU_RESULT_OFFSET); // it's always the last write of alu_result
+        taken = emit_jump(jit, (last->op == OP_BEQ) ? JE : JNE);
+        break;
+    case OP_BLEZ:
+    case OP_BGTZ:
+        emit8(jit, 0x83); // cmp dword $rs, 0
+        emit_modrm(jit, 7, EBX, REG_OFFSET(last->rs));
+        emit8(jit, 0x00);
+        taken = emit_jump(jit, (last->op == OP_BLEZ) ? JLE : JG);
+        break;
+    default: // j is always taken, and a block that ended before a leader only falls through
+        break;
+    }
+
+    block->exits[JIT_EXIT_FALLTHROUGH] = NULL;
+    block->exits[JIT_EXIT_TAKEN] = NULL;
+    if (last->op != OP_J) {
+        emit_mov_imm64(jit, EAX, block->tag);
+        block->exits[JIT_EXIT_FALLTHROUGH] = emit_jump(jit, JMP);
+    }
+    if (body < length) {
+        if (taken != NULL) {
+            patch_jump(taken, jit->out);
+        }
+        emit8(jit, 0x48); // inc qword [rbx + taken counter]
+        emit8(jit, 0xff);
+        emit_modrm(jit, 0, EBX, TAKEN_OFFSET(last->op));
+        emit_mov_imm64(jit, EAX, block->tag + JIT_EXIT_TAKEN);
+        block->exits[JIT_EXIT_TAKEN] = emit_jump(jit, JMP);
+    }
+
+    // until they are linked, the exits leave the compiled code, and so does an entry that can't be made
+    epilogue = jit->out;
+    emit_epilogue(jit);
+    for (i = 0; i < 2; i++) {
+        if (block->exits[i] != NULL) {
+            patch_jump(block->exits[i], epilogue);
+        }
+        block->linked[i] = 0;
+    }
+    for (i = 0; i < 3; i++) {
+        patch_jump(bail[i], epilogue);
+    }
+
+    if (!end_function(jit, start)) {
+        return 0;
+    }
+    block->entry = (JIT_code_t)start;
+    return 1;
+}
+
+void JIT_link(JIT_t *jit, JIT_block_t *from, int exit, const JIT_block_t *to)
+{
+    if (from->exits[exit] == NULL || from->linked[exit] || !set_writable(jit, 1)) {
+        return;
+    }
+    patch_jump(from->exits[exit], to->chained_entry);
+    from->linked[exit] = 1;
+    set_writable(jit, 0); // if it can't be made executable again, the block engine drops all of the code (see BLOCK_run)
+}
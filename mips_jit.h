@@ -0,0 +1,88 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_jit.h
+*
+* Description:
+* ------------
+* Header file for mips_jit.c, the x86-64 code generator used by the block engine when MIPS_ENGINE_JIT is selected.
+*
+*************************************************************************/
+
+#ifndef __MIPS_JIT_H
+#define __MIPS_JIT_H
+
+#include "mips_decode.h"
+
+#define JIT_BUFFER_SIZE (1024 * 1024) // size of the executable buffer in bytes (when it's full, the blocks are flushed, which discards all compiled code)
+
+// exits of a block compiled whole
+#define JIT_EXIT_FALLTHROUGH 0 // to the address following the block (not-taken branch, or the block ended before a leader)
+#define JIT_EXIT_TAKEN       1 // to the target of the branch or j ending the block
+
+/* Native code of a compiled run of instructions or of a whole block. It executes all of them, reading and writing the register file, hi, lo,
+   alu_result and memory of the context it was compiled for directly. A whole block returns the tag of the block it left the compiled code from,
+   plus the exit it took (the return value of a run means nothing).
+*/
+typedef unsigned long long (*JIT_code_t)(void);
+
+// a function doing a store the way store_in_memory does
+typedef void (*JIT_store_t)(MIPS_cpu_t *cpu, unsigned int opcode, uint32_t addr, uint32_t value);
+
+// code generator state (one per context, as part of the block engine state)
+typedef struct {
+    unsigned char *buffer; // executable buffer (NULL until JIT_init succeeds)
+    unsigned long used; // number of bytes already generated
+    unsigned char *out; // current write position while compiling
+    int writable; // 1 while the buffer is mapped read/write, 0 while it's mapped read/execute
+    JIT_store_t store; // when not NULL, every compiled store calls it instead of writing through the TLB (the self-check mode logs the stores with it)
+    // read and updated by the entries of the compiled blocks that are reached from other compiled blocks (see JIT_link), and set before calling one
+    volatile int *stop; // leaving the compiled code when it's set (never NULL)
+    uint32_t epoch; // a block is only entered if it was checked against program memory in this epoch
+    unsigned long long budget; // a block is only entered if this many instructions are left, which are then charged for it
+    unsigned long long chained; // number of blocks entered from other compiled blocks
+} JIT_t;
+
+// a block compiled whole (see JIT_compile_block)
+typedef struct {
+    // filled in by the caller before compiling
+    unsigned long long tag; // returned by the fallthrough exit (plus 1 by the taken one, so it must be even)
+    const uint32_t *epoch; // the epoch in which the block was last checked against program memory
+    unsigned long long *executions; // incremented when the block is entered from another compiled block
+    // filled in by JIT_compile_block
+    JIT_code_t entry; // NULL if the block wasn't compiled
+    unsigned char *chained_entry; // where the exits of other compiled blocks jump to
+    unsigned char *exits[2]; // the jump of each exit, which leaves the compiled code until it's linked (NULL if the block doesn't have that exit)
+    unsigned char linked[2]; // 1 for each exit linked to another block
+} JIT_block_t;
+
+// allocates the buffer (writable until the first run is compiled). Returns 0 if the host isn't x86-64 or the buffer couldn't be allocated
+int JIT_init(JIT_t *jit);
+
+// frees the executable buffer
+void JIT_free(JIT_t *jit);
+
+// discards all compiled code (making the buffer writable again)
+void JIT_reset(JIT_t *jit);
+
+// returns 1 if instructions of the given handler class can be compiled inside a run (everything except control transfers, syscalls and unsupported
+// instructions, which are left to the interpreter)
+int JIT_can_compile(unsigned char op);
+
+// returns 1 if a block ending with an instruction of the given handler class can be compiled whole (conditional branches and j, whose targets are fixed)
+int JIT_can_end_block(unsigned char op);
+
+// compiles a run of predecoded records that can all be compiled. Returns NULL if there isn't enough room left in the buffer
+JIT_code_t JIT_compile(JIT_t *jit, MIPS_cpu_t *cpu, const decoded_t *code, unsigned int length);
+
+/* Compiles a whole block, whose last record may be a branch or j (see JIT_can_end_block). Every exit leaves the compiled code with the tag of the
+   block until it's linked to the block it leads to. Returns 0 if there isn't enough room left in the buffer.
+*/
+int JIT_compile_block(JIT_t *jit, MIPS_cpu_t *cpu, const decoded_t *code, unsigned int length, JIT_block_t *block);
+
+/* Makes an exit of a compiled block jump to the chained entry of another compiled block, which goes on running native code as long as the stop flag
+   isn't set, the budget covers the block and it was checked against program memory in the current epoch (and otherwise leaves through the exit).
+*/
+void JIT_link(JIT_t *jit, JIT_block_t *from, int exit, const JIT_block_t *to);
+
+#endif /* __MIPS_JIT_H */
@@ -0,0 +1,297 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_mem.c
+*
+* Description:
+* ------------
+* This file implements the page table and TLB refills of the guest address space, and the copy-on-write sharing of its pages with snapshots
+* (see mips_mem.h).
+*
+*************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "mips_mem.h"
+#include "thread.h"
+
+// an allocated page. The contents come first, so the page tables and TLBs can point at the page itself
+typedef struct {
+    unsigned char data[MEM_PAGE_SIZE];
+    atomic_t refs; // number of address spaces (contexts and snapshots) holding the page
+} page_t;
+
+static const unsigned char zero_page[MEM_PAGE_SIZE]; // what reading a page that was never written gives (shared by all address spaces)
+static atomic_t last_snapshot_id;
+
+// drops a reference to a page, freeing it once no address space holds it
+static void release_page(unsigned char *page)
+{
+    if (page != NULL && ATOMIC_decrement(&((page_t *)page)->refs) == 0) {
+        free(page);
+    }
+}
+
+// records that a page is no longer shared with the snapshot the address space is based on
+static void mark_dirty(MEM_space_t *mem, uint32_t page_number)
+{
+    uint32_t *bigger;
+
+    if (mem->base == NULL || mem->dirty_overflow) {
+        return; // nothing to put back on restore
+    }
+    if (mem->num_dirty == mem->dirty_capacity) {
+        bigger = (uint32_t *)realloc(mem->dirty, (mem->dirty_capacity * 2 + 64) * sizeof(uint32_t));
+        if (bigger == NULL) {
+            mem->dirty_overflow = 1;
+            return;
+        }
+        mem->dirty = bigger;
+        mem->dirty_capacity = mem->dirty_capacity * 2 + 64;
+    }
+    mem->dirty[mem->num_dirty++] = page_number;
+}
+
+// returns whether the page holding the given address is watched (see MEM_watch)
+static __inline int is_watched(const MEM_space_t *mem, uint32_t addr)
+{
+    return mem->watch != NULL && (addr >> MEM_PAGE_BITS) - mem->watch_first < mem->watch_pages;
+}
+
+// returns the page holding the given address, or NULL if it was never written
+static unsigned char *find_page(MEM_space_t *mem, uint32_t addr)
+{
+    unsigned char **table = mem->tables[addr >> (MEM_PAGE_BITS + MEM_TABLE_BITS)];
+
+    if (table == NULL) {
+        return NULL;
+    }
+    return table[(addr >> MEM_PAGE_BITS) & (MEM_TABLE_SIZE - 1)];
+}
+
+unsigned char *MEM_read_miss(MEM_space_t *mem, uint32_t addr)
+{
+    MEM_tlb_entry_t *entry = &mem->read_tlb[(addr >> MEM_PAGE_BITS) & (MEM_TLB_SIZE - 1)];
+    unsigned char *page = find_page(mem, addr);
+
+    entry->tag = (addr >> MEM_PAGE_BITS) + 1;
+    entry->page = (page != NULL) ? page : (unsigned char *)zero_page;
+    return entry->page + (addr & MEM_PAGE_MASK);
+}
+
+unsigned char *MEM_write_miss(MEM_space_t *mem, uint32_t addr)
+{
+    MEM_tlb_entry_t *entry = &mem->write_tlb[(addr >> MEM_PAGE_BITS) & (MEM_TLB_SIZE - 1)];
+    MEM_tlb_entry_t *read_entry = &mem->read_tlb[(addr >> MEM_PAGE_BITS) & (MEM_TLB_SIZE - 1)];
+    unsigned char ***table = &mem->tables[addr >> (MEM_PAGE_BITS + MEM_TABLE_BITS)];
+    unsigned char **page;
+    page_t *copy;
+
+    if (*table == NULL) {
+        *table = (unsigned char **)calloc(MEM_TABLE_SIZE, sizeof(unsigned char *));
+        if (*table == NULL) {
+            return mem->discard + (addr & MEM_PAGE_MASK); // the write is lost, but the simulation can go on
+        }
+    }
+    page = &(*table)[(addr >> MEM_PAGE_BITS) & (MEM_TABLE_SIZE - 1)];
+    // a page which is shared with a snapshot is copied, and a page which was never written is allocated. Only one address space can hold a page
+    // with a single reference, so nothing can share it while it is checked
+    if (*page == NULL || ((page_t *)*page)->refs > 1) {
+        copy = (page_t *)malloc(sizeof(page_t));
+        if (copy == NULL) {
+            return mem->discard + (addr & MEM_PAGE_MASK);
+        }
+        if (*page == NULL) {
+            memset(copy->data, 0, MEM_PAGE_SIZE);
+            mem->pages++;
+        } else {
+            memcpy(copy->data, *page, MEM_PAGE_SIZE);
+            release_page(*page);
+        }
+        copy->refs = 1;
+        *page = copy->data;
+        mark_dirty(mem, addr >> MEM_PAGE_BITS);
+        // the page may have been read before, in which case the read TLB still points at the zero page or the shared page
+        if (read_entry->tag == (addr >> MEM_PAGE_BITS) + 1) {
+            read_entry->page = *page;
+        }
+    }
+
+    if (is_watched(mem, addr)) {
+        // reporting the store, and leaving the page out of the write TLB so the next one comes here as well
+        mem->watch(mem->watch_user, addr & ~3U, 4);
+        return *page + (addr & MEM_PAGE_MASK);
+    }
+    entry->tag = (addr >> MEM_PAGE_BITS) + 1;
+    entry->page = *page;
+    return entry->page + (addr & MEM_PAGE_MASK);
+}
+
+void MEM_read(MEM_space_t *mem, uint32_t addr, void *buffer, size_t length)
+{
+    unsigned char *dest = (unsigned char *)buffer;
+    size_t chunk;
+
+    while (length > 0) {
+        chunk = MEM_PAGE_SIZE - (addr & MEM_PAGE_MASK); // the rest of the page
+        if (chunk > length) {
+            chunk = length;
+        }
+        memcpy(dest, MEM_read_ptr(mem, addr), chunk);
+        dest += chunk;
+        addr += (uint32_t)chunk;
+        length -= chunk;
+    }
+}
+
+void MEM_write(MEM_space_t *mem, uint32_t addr, const void *buffer, size_t length)
+{
+    const unsigned char *src = (const unsigned char *)buffer;
+    size_t chunk;
+
+    while (length > 0) {
+        chunk = MEM_PAGE_SIZE - (addr & MEM_PAGE_MASK);
+        if (chunk > length) {
+            chunk = length;
+        }
+        memcpy(MEM_write_ptr(mem, addr), src, chunk);
+        if (is_watched(mem, addr)) {
+            mem->watch(mem->watch_user, addr, chunk);
+        }
+        src += chunk;
+        addr += (uint32_t)chunk;
+        length -= chunk;
+    }
+}
+
+void MEM_watch(MEM_space_t *mem, uint32_t addr, uint32_t length, void (*func)(void *user, uint32_t addr, size_t length), void *user)
+{
+    mem->watch = func;
+    mem->watch_user = user;
+    mem->watch_first = addr >> MEM_PAGE_BITS;
+    mem->watch_pages = (length != 0) ? ((addr + length - 1) >> MEM_PAGE_BITS) - mem->watch_first + 1 : 0;
+    memset(mem->write_tlb, 0, sizeof(mem->write_tlb)); // the watched pages may be in it
+}
+
+void MEM_reset(MEM_space_t *mem)
+{
+    unsigned int i, j;
+
+    for (i = 0; i < MEM_DIRECTORY_SIZE; i++) {
+        if (mem->tables[i] != NULL) {
+            for (j = 0; j < MEM_TABLE_SIZE; j++) {
+                release_page(mem->tables[i][j]);
+            }
+            free(mem->tables[i]);
+            mem->tables[i] = NULL;
+        }
+    }
+    memset(mem->read_tlb, 0, sizeof(mem->read_tlb));
+    memset(mem->write_tlb, 0, sizeof(mem->write_tlb));
+    mem->pages = 0;
+    free(mem->dirty);
+    mem->dirty = NULL;
+    mem->num_dirty = 0;
+    mem->dirty_capacity = 0;
+    mem->dirty_overflow = 0;
+    mem->base = NULL;
+    mem->base_id = 0;
+    mem->id = 0;
+}
+
+// makes dest (an empty address space) hold a reference to every page of src. Returns -1 if there isn't enough memory for the page tables
+static int share_pages(MEM_space_t *dest, const MEM_space_t *src)
+{
+    unsigned int i, j;
+    unsigned char *page;
+
+    for (i = 0; i < MEM_DIRECTORY_SIZE; i++) {
+        if (src->tables[i] == NULL) {
+            continue;
+        }
+        dest->tables[i] = (unsigned char **)malloc(MEM_TABLE_SIZE * sizeof(unsigned char *));
+        if (dest->tables[i] == NULL) {
+            MEM_reset(dest);
+            return -1;
+        }
+        for (j = 0; j < MEM_TABLE_SIZE; j++) {
+            page = src->tables[i][j];
+            if (page != NULL) {
+                ATOMIC_increment(&((page_t *)page)->refs);
+            }
+            dest->tables[i][j] = page;
+        }
+    }
+    dest->pages = src->pages;
+    return 0;
+}
+
+// makes mem based on the snapshot: every page it holds is the snapshot's page, until it is written
+static void set_base(MEM_space_t *mem, const MEM_space_t *snapshot)
+{
+    mem->base = snapshot;
+    mem->base_id = snapshot->id;
+    mem->num_dirty = 0;
+    mem->dirty_overflow = 0;
+}
+
+int MEM_snapshot(MEM_space_t *snapshot, MEM_space_t *mem)
+{
+    if (share_pages(snapshot, mem) != 0) {
+        return -1;
+    }
+    snapshot->id = (uint32_t)ATOMIC_increment(&last_snapshot_id);
+    memset(mem->write_tlb, 0, sizeof(mem->write_tlb)); // all of the pages are shared now, so the next write to each of them must copy it
+    set_base(mem, snapshot);
+    return 0;
+}
+
+int MEM_restore(MEM_space_t *mem, const MEM_space_t *snapshot)
+{
+    unsigned int i;
+    uint32_t page_number;
+    unsigned char **entry, *page;
+    unsigned char **table;
+
+    if (mem->base == snapshot && mem->base_id == snapshot->id && !mem->dirty_overflow) {
+        // only the dirty pages differ from the snapshot: each of them goes back to the snapshot's page (or to no page, if it had none)
+        for (i = 0; i < mem->num_dirty; i++) {
+            page_number = mem->dirty[i];
+            entry = &mem->tables[page_number >> MEM_TABLE_BITS][page_number & (MEM_TABLE_SIZE - 1)];
+            table = snapshot->tables[page_number >> MEM_TABLE_BITS];
+            page = (table != NULL) ? table[page_number & (MEM_TABLE_SIZE - 1)] : NULL;
+            if (page != NULL) {
+                ATOMIC_increment(&((page_t *)page)->refs);
+            } else {
+                mem->pages--;
+            }
+            release_page(*entry);
+            *entry = page;
+        }
+    } else {
+        MEM_reset(mem);
+        if (share_pages(mem, snapshot) != 0) {
+            return -1;
+        }
+    }
+    memset(mem->read_tlb, 0, sizeof(mem->read_tlb));
+    memset(mem->write_tlb, 0, sizeof(mem->write_tlb));
+    set_base(mem, snapshot);
+    return 0;
+}
+
+void MEM_for_each_page(const MEM_space_t *mem, void (*func)(void *user, uint32_t addr, const unsigned char *page), void *user)
+{
+    unsigned int i, j;
+
+    for (i = 0; i < MEM_DIRECTORY_SIZE; i++) {
+        if (mem->tables[i] == NULL) {
+            continue;
+        }
+        for (j = 0; j < MEM_TABLE_SIZE; j++) {
+            if (mem->tables[i][j] != NULL) {
+                func(user, (uint32_t)((i << (MEM_PAGE_BITS + MEM_TABLE_BITS)) | (j << MEM_PAGE_BITS)), mem->tables[i][j]);
+            }
+        }
+    }
+}
@@ -0,0 +1,114 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_mem.h
+*
+* Description:
+* ------------
+* This file defines the guest address space: a sparse, paged 32-bit address space, where a page is only allocated once it is written to
+* (reading a page that was never written gives zeros, like in MARS). Pages are found through a two-level page table (a directory of page tables,
+* each mapping 4 MB), and a small direct-mapped software TLB in front of it, so that the loads/stores of the execution engines normally translate
+* an address with a single compare.
+* Reads and writes have separate TLBs, since a page which was only read is translated to a shared page of zeros, which must never be written.
+* Pages are reference counted, so that a snapshot of an address space (MEM_snapshot) shares its pages instead of copying them. A shared page is
+* copied the first time it is written (copy-on-write), which is why the write TLB only ever holds pages that the address space owns alone, and
+* MEM_restore only has to put back the pages that were written since the snapshot was taken.
+* A range of pages can also be watched (MEM_watch): its pages are never entered in the write TLB either, so every store to them is reported.
+*
+*************************************************************************/
+
+#ifndef __MIPS_MEM_H
+#define __MIPS_MEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MEM_PAGE_BITS      12
+#define MEM_PAGE_SIZE      (1 << MEM_PAGE_BITS) // 4 KB
+#define MEM_PAGE_MASK      (MEM_PAGE_SIZE - 1)
+#define MEM_TABLE_BITS     10 // each page table maps 1024 pages (4 MB)
+#define MEM_TABLE_SIZE     (1 << MEM_TABLE_BITS)
+#define MEM_DIRECTORY_SIZE (1 << (32 - MEM_PAGE_BITS - MEM_TABLE_BITS))
+#define MEM_TLB_SIZE       64 // number of entries in each TLB (must be a power of 2)
+
+/* A TLB entry, translating a guest page to the host address of its contents. The tag is the page number plus 1, so that an all-zeros entry
+   (as in a context allocated with calloc) is empty.
+*/
+typedef struct {
+    uint32_t tag;
+    unsigned char *page;
+} MEM_tlb_entry_t;
+
+typedef struct MEM_space_s {
+    unsigned char **tables[MEM_DIRECTORY_SIZE]; // page tables (NULL until one of their pages is written)
+    MEM_tlb_entry_t read_tlb[MEM_TLB_SIZE];
+    MEM_tlb_entry_t write_tlb[MEM_TLB_SIZE];
+    unsigned int pages; // number of allocated pages
+    // the snapshot the address space was last taken as or restored from, and the pages written since then (which are no longer shared with it)
+    const struct MEM_space_s *base;
+    uint32_t base_id;
+    uint32_t *dirty; // page numbers
+    unsigned int num_dirty, dirty_capacity;
+    int dirty_overflow; // set when the dirty list couldn't grow (the next restore then puts back all of the pages)
+    uint32_t id; // unique number of a snapshot (0 for any other address space)
+    // the watched pages, and the function that is told about the writes to them (NULL if nothing is watched)
+    uint32_t watch_first, watch_pages;
+    void (*watch)(void *user, uint32_t addr, size_t length);
+    void *watch_user;
+    unsigned char discard[MEM_PAGE_SIZE]; // where writes go when a page couldn't be allocated (they are lost, but the simulation can go on)
+} MEM_space_t;
+
+// slow paths of MEM_read_ptr/MEM_write_ptr: translates the address through the page table and refills the TLB entry
+unsigned char *MEM_read_miss(MEM_space_t *mem, uint32_t addr);
+unsigned char *MEM_write_miss(MEM_space_t *mem, uint32_t addr);
+
+// returns the host address of the given guest address for reading. Only the bytes up to the end of its page may be read through it
+static __inline unsigned char *MEM_read_ptr(MEM_space_t *mem, uint32_t addr)
+{
+    MEM_tlb_entry_t *entry = &mem->read_tlb[(addr >> MEM_PAGE_BITS) & (MEM_TLB_SIZE - 1)];
+
+    if (entry->tag == (addr >> MEM_PAGE_BITS) + 1) {
+        return entry->page + (addr & MEM_PAGE_MASK);
+    }
+    return MEM_read_miss(mem, addr);
+}
+
+// returns the host address of the given guest address for writing (allocating its page if needed). Only the bytes up to the end of its page may be written through it
+static __inline unsigned char *MEM_write_ptr(MEM_space_t *mem, uint32_t addr)
+{
+    MEM_tlb_entry_t *entry = &mem->write_tlb[(addr >> MEM_PAGE_BITS) & (MEM_TLB_SIZE - 1)];
+
+    if (entry->tag == (addr >> MEM_PAGE_BITS) + 1) {
+        return entry->page + (addr & MEM_PAGE_MASK);
+    }
+    return MEM_write_miss(mem, addr);
+}
+
+// copy length bytes from the address space to a buffer and back (the range may span any number of pages, and wraps around at the top of the address space)
+void MEM_read(MEM_space_t *mem, uint32_t addr, void *buffer, size_t length);
+void MEM_write(MEM_space_t *mem, uint32_t addr, const void *buffer, size_t length);
+
+/* Watches the writes to the pages holding length bytes from addr: func is called with the aligned word of every store to them (before the store),
+   and with every range MEM_write copies to them (after the copy). Only one range is watched at a time, and func NULL stops watching.
+   The watch belongs to the address space, so MEM_reset and MEM_restore keep it.
+*/
+void MEM_watch(MEM_space_t *mem, uint32_t addr, uint32_t length, void (*func)(void *user, uint32_t addr, size_t length), void *user);
+
+// frees all of the pages, leaving an empty (all zeros) address space
+void MEM_reset(MEM_space_t *mem);
+
+/* Makes snapshot (an empty address space) a copy of mem which shares all of its pages, so both of them copy a page before writing it.
+   Returns 0 on success, and -1 if there isn't enough memory for the page tables of the snapshot (which is then left empty).
+*/
+int MEM_snapshot(MEM_space_t *snapshot, MEM_space_t *mem);
+
+/* Makes mem a copy of the snapshot, sharing its pages. If mem was taken as or last restored from the same snapshot, only the pages written since then
+   are put back, and otherwise all of its pages are replaced. The snapshot itself is only read, so contexts on different threads may restore it at the
+   same time. Returns 0 on success, and -1 if there isn't enough memory for the page tables.
+*/
+int MEM_restore(MEM_space_t *mem, const MEM_space_t *snapshot);
+
+// calls func for every allocated page, in address order, with the address of its first byte
+void MEM_for_each_page(const MEM_space_t *mem, void (*func)(void *user, uint32_t addr, const unsigned char *page), void *user);
+
+#endif /* __MIPS_MEM_H */
@@ -0,0 +1,297 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_pipeline.c
+*
+* Description:
+* ------------
+* This file implements the timing model of the 5-stage pipeline (see mips_pipeline.h).
+* An instruction entering IF at cycle T is in stage s at cycle T + s, unless it waited. So the model only keeps the cycle T of the previous
+* instruction, and for every register the cycle in which its latest value is produced (the end of EX for ALU results, the end of MEM for loads)
+* and the cycle in which it is written back. An instruction enters IF one cycle after the previous one, unless:
+* - the previous instruction was a taken branch or a jump: the instructions fetched after it are flushed, and the target is fetched right after the
+*   stage that knows it (ID for j/jal, the branch resolution stage for branches and jr/jalr), since the pipeline always predicts not taken.
+* - one of its operands isn't ready in time. With forwarding, the value must be produced before the stage that needs it (EX, the branch resolution
+*   stage for branches and jr/jalr, MEM for the value a store writes). Without forwarding, all operands are read in ID, in the cycle the value is
+*   written back at the earliest (the register file is written in the first half of the cycle and read in the second).
+* The cycles an instruction waits are counted as stalls of the instruction that waited, and the flushed cycles as stalls of the branch or jump.
+*
+*************************************************************************/
+
+#include "mips_decode.h"
+#include "mips_pipeline.h"
+#include "mips_disasm.h"
+
+// the hi and lo registers are tracked after the register file
+#define REG_HI NUM_REG
+#define REG_LO (NUM_REG + 1)
+#define NUM_TRACKED (NUM_REG + 2)
+
+#define BIT(reg) (1ULL << (reg))
+
+// registers a syscall may read: the code, the arguments of the regular syscalls and the arguments of the graphics syscalls
+#define SYSCALL_SOURCES (BIT(SYSCALL_CODES_REG) | BIT(4) | BIT(5) | BIT(6) | BIT(7) | BIT(8) | BIT(9) | BIT(10) | BIT(11) | BIT(12))
+
+#define FLUSH_BRANCH 0
+#define FLUSH_JUMP 1
+
+struct PIPELINE_state_s {
+    MIPS_pipeline_config_t config;
+    long long last; // the cycle the previous instruction entered IF (-1 before the first one)
+    long long fetch; // the earliest cycle the next instruction can enter IF (after a taken branch or a jump)
+    int flush; // what delayed fetch (FLUSH_*)
+    uint32_t flush_index; // the program memory index of the branch or jump that delayed fetch
+    long long produced[NUM_TRACKED]; // the cycle at the end of which the latest value of every register is produced
+    long long written[NUM_TRACKED]; // the cycle in which the latest value of every register is written back
+    unsigned char loaded[NUM_TRACKED]; // set if the latest value of the register is loaded from memory
+    MIPS_pipeline_stats_t stats;
+    unsigned long long *stalls; // stall cycles of every instruction (indexed like program memory)
+    uint32_t capacity; // program memory words the stalls array was allocated for
+};
+
+int PIPELINE_configure(MIPS_cpu_t *cpu, const MIPS_pipeline_config_t *config)
+{
+    PIPELINE_state_t *s;
+
+    if (cpu->pipeline != NULL) {
+        free(cpu->pipeline->stalls);
+        free(cpu->pipeline);
+        cpu->pipeline = NULL;
+    }
+    if (config == NULL) {
+        return 0;
+    }
+    if ((config->forwarding != 0 && config->forwarding != 1) || config->branch_stage < MIPS_STAGE_ID || config->branch_stage > MIPS_STAGE_MEM) {
+        printf("Invalid pipeline configuration: forwarding %d, branches resolved in stage %d\n", config->forwarding, config->branch_stage);
+        return -1;
+    }
+    s = (PIPELINE_state_t *)calloc(1, sizeof(PIPELINE_state_t));
+    if (s == NULL) {
+        printf("Not enough memory for the pipeline model\n");
+        return -1;
+    }
+    s->config = *config;
+    cpu->pipeline = s;
+    PIPELINE_reset(cpu);
+    return (cpu->pipeline != NULL) ? 0 : -1;
+}
+
+void PIPELINE_reset(MIPS_cpu_t *cpu)
+{
+    PIPELINE_state_t *s = cpu->pipeline;
+    unsigned long long *stalls;
+    int i;
+
+    s->last = -1;
+    s->fetch = 0;
+    for (i = 0; i < NUM_TRACKED; i++) {
+        s->produced[i] = -MIPS_STAGE_WB - 1; // long enough before the first instruction not to delay it
+        s->written[i] = -MIPS_STAGE_WB - 1;
+        s->loaded[i] = 0;
+    }
+    memset(&s->stats, 0, sizeof(s->stats));
+    stalls = (unsigned long long *)DISASM_reset_counts(s->stalls, s->capacity, cpu->prog_capacity, sizeof(unsigned long long));
+    if (stalls == NULL) {
+        printf("Not enough memory for the pipeline model, so it isn't modeled anymore\n");
+        free(s->stalls);
+        free(s);
+        cpu->pipeline = NULL;
+        return;
+    }
+    s->stalls = stalls;
+    s->capacity = cpu->prog_capacity;
+}
+
+/* Finds the registers an instruction reads: sources are needed in EX, and late_sources in MEM (the value a store writes).
+   Branches and jr/jalr need their sources in the branch resolution stage instead, which the caller handles.
+*/
+static void get_sources(const decoded_t *d, uint64_t *sources, uint64_t *late_sources)
+{
+    *late_sources = 0;
+    switch (d->op) {
+    case OP_SLL:
+    case OP_SRL:
+    case OP_SRA:
+        *sources = BIT(d->rt);
+        break;
+    case OP_JR:
+    case OP_JALR:
+    case OP_MTHI:
+    case OP_MTLO:
+    case OP_BLEZ:
+    case OP_BGTZ:
+    case OP_LB:
+    case OP_LH:
+    case OP_LW:
+    case OP_LBU:
+    case OP_LHU:
+        *sources = BIT(d->rs);
+        break;
+    case OP_SB:
+    case OP_SH:
+    case OP_SW:
+        *sources = BIT(d->rs);
+        *late_sources = BIT(d->rt);
+        break;
+    case OP_MFHI:
+        *sources = BIT(REG_HI);
+        break;
+    case OP_MFLO:
+        *sources = BIT(REG_LO);
+        break;
+    case OP_SYSCALL:
+        *sources = SYSCALL_SOURCES;
+        break;
+    case OP_J:
+    case OP_JAL:
+    case OP_LUI:
+    case OP_NOP:
+    case OP_UNSUPPORTED:
+        *sources = 0;
+        break;
+    default:
+        // the rest read $rs, and $rt unless the second ALU operand is the immediate
+        *sources = BIT(d->rs) | (d->control.alu_src ? 0 : BIT(d->rt));
+        break;
+    }
+    *sources &= ~BIT(0); // $zero is never waited for
+    *late_sources &= ~BIT(0);
+}
+
+// raises *earliest to the first cycle an instruction can enter IF and still have the given registers in time for stage, and sets *load if a load delayed it
+static __inline void wait_for(const PIPELINE_state_t *s, uint64_t registers, int stage, long long *earliest, int *load)
+{
+    int reg;
+    long long ready;
+
+    for (reg = 0; registers != 0; reg++, registers >>= 1) {
+        if (!(registers & 1)) {
+            continue;
+        }
+        if (s->config.forwarding) {
+            ready = s->produced[reg] + 1 - stage; // stage must start after the value is produced
+        } else {
+            ready = s->written[reg] - MIPS_STAGE_ID; // ID must be in the cycle the value is written back, at the earliest
+        }
+        if (ready > *earliest) {
+            *earliest = ready;
+            *load = s->loaded[reg];
+        }
+    }
+}
+
+void PIPELINE_observe(MIPS_cpu_t *cpu, const TRACE_record_t *record)
+{
+    PIPELINE_state_t *s = cpu->pipeline;
+    uint32_t index = PROG_INDEX(cpu, record->pc);
+    const decoded_t *d = &cpu->decoded_prog[index];
+    uint64_t sources, late_sources, destinations = 0;
+    long long sequential = s->last + 1, fetch, cycle;
+    int load = 0, produce_stage = MIPS_STAGE_EX, reg;
+    int resolves = (d->op >= OP_BEQ && d->op <= OP_BGTZ) || d->control.jump_register; // resolved in the branch resolution stage
+
+    // control hazards: waiting for the target of the previous instruction
+    fetch = (s->fetch > sequential) ? s->fetch : sequential;
+    if (fetch > sequential) {
+        if (s->flush == FLUSH_JUMP) {
+            s->stats.jump_flushes += fetch - sequential;
+        } else {
+            s->stats.branch_flushes += fetch - sequential;
+        }
+        s->stalls[s->flush_index] += fetch - sequential;
+    }
+
+    // data hazards: waiting for the operands
+    get_sources(d, &sources, &late_sources);
+    cycle = fetch;
+    wait_for(s, sources, resolves ? s->config.branch_stage : MIPS_STAGE_EX, &cycle, &load);
+    wait_for(s, late_sources, MIPS_STAGE_MEM, &cycle, &load);
+    if (cycle > fetch) {
+        if (load) {
+            s->stats.load_use_stalls += cycle - fetch;
+        } else {
+            s->stats.data_stalls += cycle - fetch;
+        }
+        s->stalls[index] += cycle - fetch;
+    }
+
+    // the registers it writes
+    if (d->control.reg_write) {
+        destinations = BIT(d->rd);
+        produce_stage = d->control.mem_to_reg ? MIPS_STAGE_MEM : MIPS_STAGE_EX;
+    }
+    switch (d->op) {
+    case OP_MULT:
+    case OP_MULTU:
+    case OP_DIV:
+    case OP_DIVU:
+        destinations = BIT(REG_HI) | BIT(REG_LO);
+        break;
+    case OP_MTHI:
+        destinations = BIT(REG_HI);
+        break;
+    case OP_MTLO:
+        destinations = BIT(REG_LO);
+        break;
+    case OP_SYSCALL:
+        destinations = BIT(SYSCALL_CODES_REG) | BIT(SYSCALL_ARG1_REG) | BIT(SYSCALL_ARG2_REG); // $v0, or $a0 and $a1 for the time syscall
+        break;
+    default:
+        break;
+    }
+    destinations &= ~BIT(0);
+    for (reg = 0; destinations != 0; reg++, destinations >>= 1) {
+        if (destinations & 1) {
+            s->produced[reg] = cycle + produce_stage;
+            s->written[reg] = cycle + MIPS_STAGE_WB;
+            s->loaded[reg] = (produce_stage == MIPS_STAGE_MEM);
+        }
+    }
+
+    // where the next instruction is fetched from
+    if (d->control.jump) {
+        s->fetch = cycle + MIPS_STAGE_ID + 1;
+        s->flush = FLUSH_JUMP;
+        s->flush_index = index;
+    } else if (resolves && (d->control.jump_register || cpu->pc != record->pc + 4)) {
+        s->fetch = cycle + s->config.branch_stage + 1;
+        s->flush = FLUSH_BRANCH;
+        s->flush_index = index;
+    }
+
+    s->last = cycle;
+    s->stats.instructions++;
+    s->stats.cycles = (unsigned long long)cycle + MIPS_STAGE_WB + 1; // the cycles until this instruction leaves WB
+}
+
+void PIPELINE_get_stats(MIPS_cpu_t *cpu, MIPS_pipeline_stats_t *stats)
+{
+    memset(stats, 0, sizeof(MIPS_pipeline_stats_t));
+    if (cpu->pipeline != NULL) {
+        *stats = cpu->pipeline->stats;
+    }
+}
+
+void PIPELINE_print(MIPS_cpu_t *cpu, FILE *out)
+{
+    static const char *const stage_names[] = { "IF", "ID", "EX", "MEM", "WB" };
+    PIPELINE_state_t *s = cpu->pipeline;
+    const MIPS_pipeline_stats_t *st;
+
+    if (s == NULL) {
+        fprintf(out, "No pipeline is modeled\n");
+        return;
+    }
+    st = &s->stats;
+    fprintf(out, "5-stage pipeline (%s forwarding, branches resolved in %s):\n", s->config.forwarding ? "with" : "without",
+        stage_names[s->config.branch_stage]);
+    fprintf(out, "    instructions:    %llu\n", st->instructions);
+    fprintf(out, "    cycles:          %llu (CPI %.3f)\n", st->cycles, (st->instructions != 0) ? (double)st->cycles / st->instructions : 0.0);
+    fprintf(out, "    load-use stalls: %llu (%.2f%% of the cycles)\n", st->load_use_stalls, DISASM_percent(st->load_use_stalls, st->cycles));
+    fprintf(out, "    data stalls:     %llu (%.2f%%)\n", st->data_stalls, DISASM_percent(st->data_stalls, st->cycles));
+    fprintf(out, "    branch flushes:  %llu (%.2f%%)\n", st->branch_flushes, DISASM_percent(st->branch_flushes, st->cycles));
+    fprintf(out, "    jump flushes:    %llu (%.2f%%)\n", st->jump_flushes, DISASM_percent(st->jump_flushes, st->cycles));
+
+    // the instructions with the most stall cycles
+    DISASM_print_top(cpu->prog_mem, s->stalls, cpu->prog_capacity, cpu->text_base, PIPELINE_TOP_STALLS, "stall cycles", out);
+}
@@ -0,0 +1,39 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_pipeline.h
+*
+* Description:
+* ------------
+* Header file for mips_pipeline.c, the timing model of the 5-stage pipeline (enabled with MIPS_set_pipeline). The instructions are still executed
+* by the single-cycle datapath (the interpreter), and the model only computes the cycle at which each of them would have entered the pipeline.
+*
+*************************************************************************/
+
+#ifndef __MIPS_PIPELINE_H
+#define __MIPS_PIPELINE_H
+
+#include "mips.h"
+#include "mips_trace.h"
+
+#define PIPELINE_TOP_STALLS 8 // instructions listed by MIPS_print_pipeline
+
+typedef struct PIPELINE_state_s PIPELINE_state_t; // pipeline model of a context (allocated while it is enabled)
+
+/* Allocates the pipeline model of the context with the given configuration, replacing the previous one, or frees it if it is NULL (called by
+   MIPS_cpu_set_pipeline). Returns 0 on success, and -1 (after printing why) for an invalid configuration or if there isn't enough memory.
+*/
+int PIPELINE_configure(MIPS_cpu_t *cpu, const MIPS_pipeline_config_t *config);
+
+// empties the pipeline and clears the statistics (called whenever the performance counters are reset)
+void PIPELINE_reset(MIPS_cpu_t *cpu);
+
+// times an executed instruction after the ones before it (its outcome is cpu->pc)
+void PIPELINE_observe(MIPS_cpu_t *cpu, const TRACE_record_t *record);
+
+void PIPELINE_get_stats(MIPS_cpu_t *cpu, MIPS_pipeline_stats_t *stats);
+
+// prints the cycles, CPI and stall breakdown, and the instructions that stalled the pipeline the most
+void PIPELINE_print(MIPS_cpu_t *cpu, FILE *out);
+
+#endif /* __MIPS_PIPELINE_H */
@@ -0,0 +1,258 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_predict.c
+*
+* Description:
+* ------------
+* This file implements the branch prediction model (see mips_predict.h).
+* The direction predictors see every executed conditional branch: they predict whether it is taken, are updated with the actual outcome (which is
+* known once the instruction was executed, since a branch doesn't write any register), and the predictor and the branch each count the mispredictions.
+* The dynamic predictors keep 2-bit saturating counters (0 and 1 predict not taken, 2 and 3 predict taken), which all start at 1 (weakly not taken).
+* The return address stack is a circular array, so a deep recursion overwrites the oldest return addresses instead of failing, and only the returns
+* that unwind beyond them are mispredicted. A jr $ra with an empty stack is a misprediction as well.
+*
+*************************************************************************/
+
+#include "mips_decode.h"
+#include "mips_predict.h"
+#include "mips_disasm.h"
+
+#define COUNTER_INITIAL 1 // weakly not taken
+#define COUNTER_MAX 3
+
+struct PREDICT_state_s {
+    MIPS_predictor_config_t config;
+    unsigned char *bimodal; // bimodal_entries counters
+    unsigned char *gshare; // gshare_entries counters
+    uint32_t history; // outcomes of the last branches, the most recent one in bit 0 (1 = taken)
+    uint32_t history_mask;
+    uint32_t *ras; // ras_depth return addresses
+    uint32_t ras_top; // index of the next push
+    uint32_t ras_count; // valid entries (at most ras_depth)
+    MIPS_predictor_stats_t stats[MIPS_NUM_PREDICTORS];
+    MIPS_branch_stats_t *branches; // statistics of every branch (indexed like program memory)
+    uint32_t capacity; // program memory words the branches array was allocated for
+};
+
+static const char *const predictor_names[MIPS_NUM_PREDICTORS] = { "not taken", "backward taken", "bimodal", "gshare", "return stack" };
+
+static void free_state(PREDICT_state_t *s)
+{
+    free(s->bimodal);
+    free(s->gshare);
+    free(s->ras);
+    free(s->branches);
+    free(s);
+}
+
+int PREDICT_configure(MIPS_cpu_t *cpu, const MIPS_predictor_config_t *config)
+{
+    PREDICT_state_t *s;
+
+    if (cpu->predict != NULL) {
+        free_state(cpu->predict);
+        cpu->predict = NULL;
+    }
+    if (config == NULL) {
+        return 0;
+    }
+    if (!DISASM_is_power_of_2(config->bimodal_entries) || !DISASM_is_power_of_2(config->gshare_entries) || config->history_bits > 32 ||
+        config->ras_depth == 0) {
+        printf("Invalid branch predictor configuration: %u bimodal counters, %u gshare counters, %u history bits, %u return stack entries\n",
+            config->bimodal_entries, config->gshare_entries, config->history_bits, config->ras_depth);
+        return -1;
+    }
+    s = (PREDICT_state_t *)calloc(1, sizeof(PREDICT_state_t));
+    if (s == NULL) {
+        printf("Not enough memory for the branch predictors\n");
+        return -1;
+    }
+    s->config = *config;
+    s->history_mask = (config->history_bits == 32) ? 0xffffffff : (1U << config->history_bits) - 1;
+    s->bimodal = (unsigned char *)malloc(config->bimodal_entries);
+    s->gshare = (unsigned char *)malloc(config->gshare_entries);
+    s->ras = (uint32_t *)malloc(config->ras_depth * sizeof(uint32_t));
+    if (s->bimodal == NULL || s->gshare == NULL || s->ras == NULL) {
+        printf("Not enough memory for the branch predictors\n");
+        free_state(s);
+        return -1;
+    }
+    cpu->predict = s;
+    PREDICT_reset(cpu);
+    return (cpu->predict != NULL) ? 0 : -1;
+}
+
+void PREDICT_reset(MIPS_cpu_t *cpu)
+{
+    PREDICT_state_t *s = cpu->predict;
+    MIPS_branch_stats_t *branches;
+
+    memset(s->bimodal, COUNTER_INITIAL, s->config.bimodal_entries);
+    memset(s->gshare, COUNTER_INITIAL, s->config.gshare_entries);
+    s->history = 0;
+    s->ras_top = 0;
+    s->ras_count = 0;
+    memset(s->stats, 0, sizeof(s->stats));
+    branches = (MIPS_branch_stats_t *)DISASM_reset_counts(s->branches, s->capacity, cpu->prog_capacity, sizeof(MIPS_branch_stats_t));
+    if (branches == NULL) {
+        printf("Not enough memory for the branch predictors, so they aren't modeled anymore\n");
+        free_state(s);
+        cpu->predict = NULL;
+        return;
+    }
+    s->branches = branches;
+    s->capacity = cpu->prog_capacity;
+}
+
+// counts a prediction of a predictor at a branch
+static __inline void check(PREDICT_state_t *s, MIPS_branch_stats_t *branch, int predictor, int predicted, int actual)
+{
+    s->stats[predictor].predictions++;
+    if (predicted != actual) {
+        s->stats[predictor].mispredictions++;
+        branch->mispredictions[predictor]++;
+    }
+}
+
+// predicts a 2-bit counter's branch, and moves the counter towards the outcome
+static __inline int update_counter(unsigned char *counter, int taken)
+{
+    int predicted = (*counter >= 2);
+
+    if (taken && *counter < COUNTER_MAX) {
+        (*counter)++;
+    } else if (!taken && *counter > 0) {
+        (*counter)--;
+    }
+    return predicted;
+}
+
+// the outcome of an executed conditional branch (the same conditions as the BEQ/BNE/BLEZ/BGTZ handlers, on registers the branch didn't change)
+static __inline int branch_taken(const MIPS_cpu_t *cpu, const decoded_t *d)
+{
+    int32_t rs = (int32_t)cpu->registers[d->rs];
+    int32_t rt = (int32_t)cpu->registers[d->rt];
+
+    switch (d->op) {
+    case OP_BEQ:
+        return rs == rt;
+    case OP_BNE:
+        return rs != rt;
+    case OP_BLEZ:
+        return rs <= 0;
+    default:
+        return rs > 0;
+    }
+}
+
+void PREDICT_observe(MIPS_cpu_t *cpu, const TRACE_record_t *record)
+{
+    PREDICT_state_t *s = cpu->predict;
+    uint32_t index = PROG_INDEX(cpu, record->pc);
+    const decoded_t *d = &cpu->decoded_prog[index];
+    MIPS_branch_stats_t *branch = &s->branches[index];
+    uint32_t word = record->pc >> 2;
+    int taken;
+
+    switch (d->op) {
+    case OP_BEQ:
+    case OP_BNE:
+    case OP_BLEZ:
+    case OP_BGTZ:
+        taken = branch_taken(cpu, d);
+        branch->executions++;
+        branch->taken += taken;
+        check(s, branch, MIPS_PREDICT_NOT_TAKEN, 0, taken);
+        check(s, branch, MIPS_PREDICT_BACKWARD, d->imm < 0, taken);
+        check(s, branch, MIPS_PREDICT_BIMODAL, update_counter(&s->bimodal[word & (s->config.bimodal_entries - 1)], taken), taken);
+        check(s, branch, MIPS_PREDICT_GSHARE, update_counter(&s->gshare[(word ^ s->history) & (s->config.gshare_entries - 1)], taken), taken);
+        s->history = ((s->history << 1) | taken) & s->history_mask;
+        break;
+    case OP_JAL:
+    case OP_JALR:
+        s->ras[s->ras_top] = record->pc + 4;
+        s->ras_top = (s->ras_top + 1) % s->config.ras_depth;
+        if (s->ras_count < s->config.ras_depth) {
+            s->ras_count++;
+        }
+        break;
+    case OP_JR:
+        if (d->rs != NUM_REG - 1) {
+            break; // not a return
+        }
+        branch->executions++;
+        branch->taken++;
+        s->stats[MIPS_PREDICT_RAS].predictions++;
+        if (s->ras_count == 0) {
+            s->stats[MIPS_PREDICT_RAS].mispredictions++;
+            branch->mispredictions[MIPS_PREDICT_RAS]++;
+            break;
+        }
+        s->ras_top = (s->ras_top + s->config.ras_depth - 1) % s->config.ras_depth;
+        s->ras_count--;
+        if (s->ras[s->ras_top] != cpu->pc) {
+            s->stats[MIPS_PREDICT_RAS].mispredictions++;
+            branch->mispredictions[MIPS_PREDICT_RAS]++;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void PREDICT_get_stats(MIPS_cpu_t *cpu, MIPS_predictor_stats_t *stats)
+{
+    memset(stats, 0, MIPS_NUM_PREDICTORS * sizeof(MIPS_predictor_stats_t));
+    if (cpu->predict != NULL) {
+        memcpy(stats, cpu->predict->stats, sizeof(cpu->predict->stats));
+    }
+}
+
+void PREDICT_get_branch_stats(MIPS_cpu_t *cpu, uint32_t pc, MIPS_branch_stats_t *stats)
+{
+    memset(stats, 0, sizeof(MIPS_branch_stats_t));
+    if (cpu->predict != NULL && cpu->prog_mem != NULL) {
+        *stats = cpu->predict->branches[PROG_INDEX(cpu, pc)];
+    }
+}
+
+void PREDICT_print(MIPS_cpu_t *cpu, FILE *out)
+{
+    PREDICT_state_t *s = cpu->predict;
+    const MIPS_branch_stats_t *b;
+    uint32_t index, addr;
+    int i;
+    char text[DISASM_MAX_LENGTH];
+
+    if (s == NULL) {
+        fprintf(out, "No branch predictors are modeled\n");
+        return;
+    }
+    fprintf(out, "Branch predictors (bimodal: %u counters, gshare: %u counters with %u history bits, return stack: %u entries):\n",
+        s->config.bimodal_entries, s->config.gshare_entries, s->config.history_bits, s->config.ras_depth);
+    for (i = 0; i < MIPS_NUM_PREDICTORS; i++) {
+        fprintf(out, "    %-15s %12llu predictions, %12llu mispredictions (%.2f%% accurate)\n", predictor_names[i], s->stats[i].predictions,
+            s->stats[i].mispredictions, 100.0 - DISASM_percent(s->stats[i].mispredictions, s->stats[i].predictions));
+    }
+
+    // every executed branch in address order, with the mispredictions of each predictor
+    fprintf(out, "\n    %-10s %12s %8s %12s %12s %12s %12s %12s  %s\n", "address", "executed", "taken", "not taken", "backward", "bimodal", "gshare",
+        "return stack", "instruction");
+    for (index = 0; index < cpu->prog_capacity; index++) {
+        b = &s->branches[index];
+        if (b->executions == 0) {
+            continue;
+        }
+        addr = cpu->text_base + (index << 2);
+        DISASM_instruction(cpu->prog_mem[index], addr, text, sizeof(text));
+        fprintf(out, "    0x%08x %12llu %7.2f%%", addr, b->executions, DISASM_percent(b->taken, b->executions));
+        if (cpu->decoded_prog[index].op == OP_JR) {
+            fprintf(out, " %12s %12s %12s %12s %12llu", "-", "-", "-", "-", b->mispredictions[MIPS_PREDICT_RAS]);
+        } else {
+            fprintf(out, " %12llu %12llu %12llu %12llu %12s", b->mispredictions[MIPS_PREDICT_NOT_TAKEN], b->mispredictions[MIPS_PREDICT_BACKWARD],
+                b->mispredictions[MIPS_PREDICT_BIMODAL], b->mispredictions[MIPS_PREDICT_GSHARE], "-");
+        }
+        fprintf(out, "  %s\n", text);
+    }
+}
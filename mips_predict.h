@@ -0,0 +1,38 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_predict.h
+*
+* Description:
+* ------------
+* Header file for mips_predict.c, the branch prediction model (enabled with MIPS_set_predictors). The predictors only watch the executed branches
+* and compare their predictions with the outcomes, so they affect the statistics and never the results of the program.
+*
+*************************************************************************/
+
+#ifndef __MIPS_PREDICT_H
+#define __MIPS_PREDICT_H
+
+#include "mips.h"
+#include "mips_trace.h"
+
+typedef struct PREDICT_state_s PREDICT_state_t; // predictors of a context (allocated while they are enabled)
+
+/* Allocates the predictors of the context with the given configuration, replacing the previous ones, or frees them if it is NULL (called by
+   MIPS_cpu_set_predictors). Returns 0 on success, and -1 (after printing why) for an invalid configuration or if there isn't enough memory.
+*/
+int PREDICT_configure(MIPS_cpu_t *cpu, const MIPS_predictor_config_t *config);
+
+// resets the predictors to their initial state and clears the statistics (called whenever the performance counters are reset)
+void PREDICT_reset(MIPS_cpu_t *cpu);
+
+// predicts an executed instruction if it is a conditional branch, a call or a return, and checks the predictions against its outcome (cpu->pc)
+void PREDICT_observe(MIPS_cpu_t *cpu, const TRACE_record_t *record);
+
+void PREDICT_get_stats(MIPS_cpu_t *cpu, MIPS_predictor_stats_t *stats);
+void PREDICT_get_branch_stats(MIPS_cpu_t *cpu, uint32_t pc, MIPS_branch_stats_t *stats);
+
+// prints the accuracy of every predictor, and the mispredictions of every executed branch
+void PREDICT_print(MIPS_cpu_t *cpu, FILE *out);
+
+#endif /* __MIPS_PREDICT_H */
@@ -0,0 +1,403 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_profile.c
+*
+* Description:
+* ------------
+* This file implements the hot-spot profiler (see mips_profile.h).
+* The call tree has a node for every distinct call path (the root being the entry point), so a function called from two places gets two nodes, and a
+* recursive function gets a node per level. A shadow call stack holds the caller's node and the return address of every call. A jr $ra returns to
+* the innermost call whose return address matches its target, so calls that never return (e.g. a function that jumps back to its caller's loop with
+* j) are dropped from the stack by the next matching return, and a jr $ra that matches none of them (e.g. a computed jump through $ra) is ignored.
+* Functions are identified by their entry address: the targets of jal instructions (read from program memory) and of the calls made while profiling
+* (jalr targets are only known then), plus the entry point. In the flat profile every instruction belongs to the closest function entry at or before
+* it, so code reached without a call (e.g. a loop entered with j) is still charged to the function it lies in.
+*
+*************************************************************************/
+
+#include "mips_decode.h"
+#include "mips_profile.h"
+#include "mips_block.h"
+#include "mips_disasm.h"
+
+#define NO_NODE 0xffffffff
+#define INITIAL_NODES 256
+
+typedef struct {
+    uint32_t function; // entry address of the function
+    uint32_t parent, first_child, next_sibling; // node indices (NO_NODE if there is none)
+    int recursive; // the function is already on the path to this node, so its instructions are part of that node's inclusive count
+    unsigned long long self; // instructions retired while this node was on top of the stack
+    unsigned long long calls;
+} node_t;
+
+typedef struct {
+    uint32_t node; // the caller's node
+    uint32_t return_pc;
+} frame_t;
+
+struct PROFILE_state_s {
+    node_t *nodes;
+    uint32_t num_nodes, nodes_capacity;
+    uint32_t current; // node of the function executing now
+    frame_t stack[PROFILE_MAX_DEPTH];
+    unsigned int depth;
+    unsigned long long overflow; // calls made beyond PROFILE_MAX_DEPTH that didn't return yet
+    unsigned long long mark; // retired instructions when the current node was last charged
+    unsigned long long calls, returns, unmatched_returns;
+};
+
+// a function in the flat profile
+typedef struct {
+    uint32_t entry;
+    unsigned long long self, inclusive, calls;
+} function_t;
+
+// an instruction in the flat profile
+typedef struct {
+    uint32_t index; // program memory index
+    unsigned long long count;
+} hot_t;
+
+int PROFILE_enable(MIPS_cpu_t *cpu, int enabled)
+{
+    PROFILE_state_t *p = cpu->profile;
+
+    if (!enabled) {
+        if (p != NULL) {
+            free(p->nodes);
+            free(p);
+            cpu->profile = NULL;
+        }
+        return 0;
+    }
+    if (p != NULL) {
+        return 0; // already enabled (the profile collected so far is kept)
+    }
+    p = (PROFILE_state_t *)calloc(1, sizeof(PROFILE_state_t));
+    if (p == NULL) {
+        return -1;
+    }
+    p->nodes = (node_t *)malloc(INITIAL_NODES * sizeof(node_t));
+    if (p->nodes == NULL) {
+        free(p);
+        return -1;
+    }
+    p->nodes_capacity = INITIAL_NODES;
+    cpu->profile = p;
+    PROFILE_reset(cpu);
+    return 0;
+}
+
+void PROFILE_reset(MIPS_cpu_t *cpu)
+{
+    PROFILE_state_t *p = cpu->profile;
+    node_t *root = &p->nodes[0];
+
+    root->function = cpu->text_base; // after restoring a snapshot, the calls made before it was taken are unknown, so the entry point stands for them
+    root->parent = NO_NODE;
+    root->first_child = NO_NODE;
+    root->next_sibling = NO_NODE;
+    root->recursive = 0;
+    root->self = 0;
+    root->calls = 1;
+    p->num_nodes = 1;
+    p->current = 0;
+    p->depth = 0;
+    p->overflow = 0;
+    p->mark = cpu->instructions;
+    p->calls = 0;
+    p->returns = 0;
+    p->unmatched_returns = 0;
+}
+
+// charges the instructions retired since the last call/return to the current node
+static __inline void charge(PROFILE_state_t *p, unsigned long long retired)
+{
+    p->nodes[p->current].self += retired - p->mark;
+    p->mark = retired;
+}
+
+// returns the child of the current node for a call to target, adding it if this call path is new (NO_NODE if the tree can't grow)
+static uint32_t find_child(PROFILE_state_t *p, uint32_t target)
+{
+    uint32_t i, parent = p->current;
+    node_t *nodes, *child;
+
+    for (i = p->nodes[parent].first_child; i != NO_NODE; i = p->nodes[i].next_sibling) {
+        if (p->nodes[i].function == target) {
+            return i;
+        }
+    }
+    if (p->num_nodes == p->nodes_capacity) {
+        if (p->nodes_capacity >= PROFILE_MAX_NODES) {
+            return NO_NODE;
+        }
+        nodes = (node_t *)realloc(p->nodes, 2 * p->nodes_capacity * sizeof(node_t));
+        if (nodes == NULL) {
+            return NO_NODE;
+        }
+        p->nodes = nodes;
+        p->nodes_capacity *= 2;
+    }
+    i = p->num_nodes++;
+    child = &p->nodes[i];
+    child->function = target;
+    child->parent = parent;
+    child->first_child = NO_NODE;
+    child->next_sibling = p->nodes[parent].first_child;
+    p->nodes[parent].first_child = i;
+    child->self = 0;
+    child->calls = 0;
+    child->recursive = 0;
+    for (; parent != NO_NODE; parent = p->nodes[parent].parent) {
+        if (p->nodes[parent].function == target) {
+            child->recursive = 1;
+            break;
+        }
+    }
+    return i;
+}
+
+void PROFILE_call(MIPS_cpu_t *cpu, uint32_t target, uint32_t return_pc, unsigned long long retired)
+{
+    PROFILE_state_t *p = cpu->profile;
+    uint32_t child;
+
+    charge(p, retired);
+    p->calls++;
+    if (p->depth == PROFILE_MAX_DEPTH) {
+        p->overflow++;
+        return;
+    }
+    child = find_child(p, target);
+    p->stack[p->depth].node = p->current;
+    p->stack[p->depth].return_pc = return_pc;
+    p->depth++;
+    if (child != NO_NODE) {
+        p->nodes[child].calls++;
+        p->current = child;
+    }
+}
+
+void PROFILE_return(MIPS_cpu_t *cpu, uint32_t target, unsigned long long retired)
+{
+    PROFILE_state_t *p = cpu->profile;
+    unsigned int i;
+
+    charge(p, retired);
+    p->returns++;
+    if (p->overflow > 0) {
+        p->overflow--;
+        return;
+    }
+    for (i = p->depth; i > 0; i--) {
+        if (p->stack[i - 1].return_pc == target) {
+            p->depth = i - 1;
+            p->current = p->stack[i - 1].node;
+            return;
+        }
+    }
+    p->unmatched_returns++;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+// orders functions by self instructions (descending), then by address
+static int compare_functions(const void *a, const void *b)
+{
+    const function_t *x = (const function_t *)a, *y = (const function_t *)b;
+
+    if (x->self != y->self) {
+        return (x->self < y->self) ? 1 : -1;
+    }
+    return compare_entries(&x->entry, &y->entry);
+}
+
+// orders instructions by count (descending), then by address
+static int compare_hot(const void *a, const void *b)
+{
+    const hot_t *x = (const hot_t *)a, *y = (const hot_t *)b;
+
+    if (x->count != y->count) {
+        return (x->count < y->count) ? 1 : -1;
+    }
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+// returns the index of the function that addr belongs to: the last entry at or before it (or the first one, if there is none)
+static uint32_t find_function(const uint32_t *entries, uint32_t count, uint32_t addr)
+{
+    uint32_t low = 0, high = count; // the answer is in [low, high)
+
+    while (high - low > 1) {
+        uint32_t middle = low + (high - low) / 2;
+        if (entries[middle] <= addr) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// collects the function entries (sorted, without duplicates). Returns NULL if there isn't enough memory
+static uint32_t *collect_entries(MIPS_cpu_t *cpu, uint32_t *count)
+{
+    PROFILE_state_t *p = cpu->profile;
+    uint32_t *entries = (uint32_t *)malloc(((size_t)cpu->prog_size + p->num_nodes + 1) * sizeof(uint32_t));
+    uint32_t i, n = 0, pc;
+    instruction_t inst;
+
+    if (entries == NULL) {
+        return NULL;
+    }
+    entries[n++] = cpu->text_base;
+    for (i = 0; i < cpu->prog_size; i++) {
+        inst.inst = cpu->prog_mem[i];
+        if (inst.commontype.opcode == OPCODE_JAL) {
+            pc = cpu->text_base + (i << 2);
+            entries[n++] = ((pc + 4) & 0xf0000000) | ((uint32_t)inst.jtype.addr << 2);
+        }
+    }
+    for (i = 0; i < p->num_nodes; i++) {
+        entries[n++] = p->nodes[i].function;
+    }
+    qsort(entries, n, sizeof(uint32_t), compare_entries);
+    *count = 0;
+    for (i = 0; i < n; i++) {
+        if (*count == 0 || entries[*count - 1] != entries[i]) {
+            entries[(*count)++] = entries[i];
+        }
+    }
+    return entries;
+}
+
+static void write_flat(MIPS_cpu_t *cpu, FILE *out)
+{
+    PROFILE_state_t *p = cpu->profile;
+    unsigned long long *counts = (unsigned long long *)malloc(cpu->prog_capacity * sizeof(unsigned long long));
+    unsigned long long *totals = (unsigned long long *)malloc(p->num_nodes * sizeof(unsigned long long));
+    uint32_t *entries;
+    function_t *functions = NULL;
+    hot_t *hot = NULL;
+    uint32_t num_entries = 0, num_hot = 0, i, f;
+    unsigned long long total = 0;
+    long long count = 0;
+    char text[DISASM_MAX_LENGTH];
+
+    entries = collect_entries(cpu, &num_entries);
+    if (entries != NULL) {
+        functions = (function_t *)calloc(num_entries, sizeof(function_t));
+        hot = (hot_t *)malloc(cpu->prog_capacity * sizeof(hot_t));
+    }
+    if (counts == NULL || totals == NULL || functions == NULL || hot == NULL) {
+        fprintf(out, "Not enough memory for the profile\n");
+        goto out;
+    }
+    for (f = 0; f < num_entries; f++) {
+        functions[f].entry = entries[f];
+    }
+
+    // the execution count of every instruction, from the run counts (see count_run), charged to the function it lies in
+    for (i = 0; i < cpu->prog_capacity; i++) {
+        count += cpu->run_counts[i];
+        counts[i] = (unsigned long long)(count + cpu->run_passes);
+        total += counts[i];
+        if (counts[i] != 0) {
+            functions[find_function(entries, num_entries, cpu->text_base + (i << 2))].self += counts[i];
+        }
+    }
+
+    // inclusive counts: every node's instructions are added to its callers (children always come after their parents in the node array)
+    for (i = 0; i < p->num_nodes; i++) {
+        totals[i] = p->nodes[i].self;
+    }
+    for (i = p->num_nodes - 1; i > 0; i--) {
+        totals[p->nodes[i].parent] += totals[i];
+    }
+    for (i = 0; i < p->num_nodes; i++) {
+        f = find_function(entries, num_entries, p->nodes[i].function);
+        functions[f].calls += p->nodes[i].calls;
+        if (!p->nodes[i].recursive) {
+            functions[f].inclusive += totals[i];
+        }
+    }
+
+    fprintf(out, "Flat profile: %llu instructions, %llu calls, %llu returns (%llu not matching a call)\n\n", total, p->calls, p->returns,
+        p->unmatched_returns);
+    fprintf(out, "Functions (by self instructions):\n");
+    fprintf(out, "            self     %%       inclusive     %%          calls  function\n");
+    qsort(functions, num_entries, sizeof(function_t), compare_functions);
+    for (f = 0; f < num_entries && (functions[f].self != 0 || functions[f].inclusive != 0); f++) {
+        fprintf(out, "%16llu %6.2f%% %16llu %6.2f%% %14llu  0x%08x\n", functions[f].self, DISASM_percent(functions[f].self, total),
+            functions[f].inclusive, DISASM_percent(functions[f].inclusive, total), functions[f].calls, functions[f].entry);
+    }
+
+    for (i = 0; i < cpu->prog_capacity; i++) {
+        if (counts[i] != 0 && counts[i] >= total * PROFILE_HOT_SHARE) {
+            hot[num_hot].index = i;
+            hot[num_hot].count = counts[i];
+            num_hot++;
+        }
+    }
+    qsort(hot, num_hot, sizeof(hot_t), compare_hot);
+    fprintf(out, "\nHot instructions (at least %.1f%% of all, by count):\n", 100 * PROFILE_HOT_SHARE);
+    fprintf(out, "           count     %%     address        word    function  instruction\n");
+    for (i = 0; i < num_hot && i < PROFILE_MAX_HOT; i++) {
+        uint32_t addr = cpu->text_base + (hot[i].index << 2);
+        DISASM_instruction(cpu->prog_mem[hot[i].index], addr, text, sizeof(text));
+        fprintf(out, "%16llu %6.2f%%  0x%08x  0x%08x  0x%08x  %s\n", hot[i].count, DISASM_percent(hot[i].count, total), addr,
+            cpu->prog_mem[hot[i].index], entries[find_function(entries, num_entries, addr)], text);
+    }
+
+out:
+    free(counts);
+    free(totals);
+    free(entries);
+    free(functions);
+    free(hot);
+}
+
+// writes a line for every node that retired instructions itself: the functions on its call path from the entry point, and its self count
+static void write_stacks(MIPS_cpu_t *cpu, FILE *out)
+{
+    PROFILE_state_t *p = cpu->profile;
+    uint32_t path[PROFILE_MAX_DEPTH + 1];
+    uint32_t i, node;
+    int length;
+
+    for (i = 0; i < p->num_nodes; i++) {
+        if (p->nodes[i].self == 0) {
+            continue;
+        }
+        length = 0;
+        for (node = i; node != NO_NODE; node = p->nodes[node].parent) {
+            path[length++] = node;
+        }
+        while (length-- > 0) {
+            fprintf(out, "0x%08x%c", p->nodes[path[length]].function, (length > 0) ? ';' : ' ');
+        }
+        fprintf(out, "%llu\n", p->nodes[i].self);
+    }
+}
+
+void PROFILE_write(MIPS_cpu_t *cpu, FILE *flat, FILE *stacks)
+{
+    if (cpu->block != NULL) {
+        BLOCK_count_runs(cpu);
+    }
+    charge(cpu->profile, cpu->instructions); // the instructions retired since the last call/return
+    if (flat != NULL) {
+        write_flat(cpu, flat);
+    }
+    if (stacks != NULL) {
+        write_stacks(cpu, stacks);
+    }
+}
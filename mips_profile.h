@@ -0,0 +1,45 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_profile.h
+*
+* Description:
+* ------------
+* Header file for mips_profile.c, the hot-spot profiler (enabled with MIPS_set_profiling). The execution count of every instruction is already kept by
+* the performance counters (see count_run), so the profiler only adds a call tree: the engines report every call (jal/jalr) and return (jr $ra),
+* and the instructions retired between two of them are charged to the function on top of the call stack.
+*
+*************************************************************************/
+
+#ifndef __MIPS_PROFILE_H
+#define __MIPS_PROFILE_H
+
+#include "mips.h"
+
+#define PROFILE_MAX_DEPTH 1024 // deeper calls are charged to the function at this depth (e.g. in a runaway recursion)
+#define PROFILE_MAX_NODES (1 << 20) // calls along call paths that weren't seen yet are charged to the caller once the tree has this many nodes
+#define PROFILE_MAX_HOT   64 // number of instructions listed in the flat profile
+#define PROFILE_HOT_SHARE 0.001 // instructions below this share of all the retired instructions aren't listed
+
+typedef struct PROFILE_state_s PROFILE_state_t; // profiler state of a context (allocated while profiling is enabled)
+
+/* Allocates (enabled = 1) or frees (enabled = 0) the profiler state of the context (called by MIPS_cpu_set_profiling).
+   Returns 0 on success, and -1 if the state couldn't be allocated.
+*/
+int PROFILE_enable(MIPS_cpu_t *cpu, int enabled);
+
+// clears the call tree, charging the following instructions to the entry point (called whenever the performance counters are reset)
+void PROFILE_reset(MIPS_cpu_t *cpu);
+
+/* Called by the engines when a jal/jalr to target is executed, and when a jr $ra to target is executed. retired is the number of instructions
+   retired so far by the context, including the jump itself (so the jal is charged to the caller and the jr to the callee).
+*/
+void PROFILE_call(MIPS_cpu_t *cpu, uint32_t target, uint32_t return_pc, unsigned long long retired);
+void PROFILE_return(MIPS_cpu_t *cpu, uint32_t target, unsigned long long retired);
+
+/* Writes the flat profile (functions by self instructions, then the hottest instructions with their disassembly) to flat, and the call stacks in
+   the collapsed format of flamegraph.pl ("entry;caller;callee <instructions>" per line) to stacks. Either of them may be NULL.
+*/
+void PROFILE_write(MIPS_cpu_t *cpu, FILE *flat, FILE *stacks);
+
+#endif /* __MIPS_PROFILE_H */
@@ -0,0 +1,423 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_trace.c
+*
+* Description:
+* ------------
+* This file implements the execution trace (see mips_trace.h).
+* The ring buffer has a single producer (the thread running the context) and a single consumer (the writer thread), so it needs no lock: the
+* producer only writes head and the consumer only writes tail, each publishing its progress with ATOMIC_store after it is done with the records.
+* Both keep to their own cache line, and the producer only reads tail again once its last copy says the ring is full. When the ring is full the
+* producer yields until the writer catches up, so a trace is never missing records; the writer sleeps while the ring is empty.
+*
+*************************************************************************/
+
+#include "mips_decode.h"
+#include "mips_trace.h"
+#include "thread.h"
+
+#define MAX_ENCODED_RECORD 32 // bytes (1 + 5 + 4 + 1 + 5 + 5 + 5, rounded up)
+#define TAIL_PUBLISH_INTERVAL 1024 // records the writer encodes before telling the producer they are free
+
+struct TRACE_state_s {
+    // written by the producer
+    atomic_t head; // records put in the ring
+    unsigned long tail_copy; // the last value of tail the producer read
+    char producer_padding[CACHE_LINE_SIZE];
+    // written by the consumer
+    atomic_t tail; // records taken from the ring
+    char consumer_padding[CACHE_LINE_SIZE];
+    atomic_t stopping; // set by TRACE_stop once the last record was put in the ring
+    TRACE_record_t *ring;
+    thread_t writer;
+    FILE *file;
+    const char *filename;
+    int error; // set once the file couldn't be written (the remaining records are dropped)
+    unsigned long long stalls; // times the producer found the ring full
+    // encoder state (see mips_trace.h), owned by the writer thread
+    unsigned char *buffer;
+    size_t length;
+    uint32_t pc, mem_addr;
+    uint32_t registers[NUM_REG];
+    uint32_t inst_cache[TRACE_INST_CACHE_SIZE];
+};
+
+// maps a signed difference to an unsigned number that is small when the difference is small
+static __inline uint32_t zigzag(uint32_t difference)
+{
+    return (difference << 1) ^ (uint32_t)((int32_t)difference >> 31);
+}
+
+static __inline uint32_t unzigzag(uint32_t value)
+{
+    return (value >> 1) ^ (0U - (value & 1));
+}
+
+static __inline unsigned char *put_varint(unsigned char *p, uint32_t value)
+{
+    while (value >= 0x80) {
+        *p++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (unsigned char)value;
+    return p;
+}
+
+// writes the encoded records to the file, unless it already failed
+static void flush_buffer(TRACE_state_t *t)
+{
+    if (!t->error && t->length > 0 && fwrite(t->buffer, 1, t->length, t->file) != t->length) {
+        t->error = 1;
+    }
+    t->length = 0;
+}
+
+static void encode(TRACE_state_t *t, const TRACE_record_t *r)
+{
+    unsigned char *start = t->buffer + t->length;
+    unsigned char *p = start + 1; // after the flags
+    unsigned char flags = r->flags & (TRACE_FLAG_LOAD | TRACE_FLAG_STORE | (3 << TRACE_FLAG_SIZE_SHIFT));
+    uint32_t slot = (r->pc >> 2) & (TRACE_INST_CACHE_SIZE - 1);
+
+    if (r->pc == t->pc + 4) {
+        flags |= TRACE_FLAG_SEQUENTIAL;
+    } else {
+        p = put_varint(p, zigzag(r->pc - (t->pc + 4)));
+    }
+    t->pc = r->pc;
+    if (t->inst_cache[slot] == r->inst) {
+        flags |= TRACE_FLAG_SAME_INST;
+    } else {
+        t->inst_cache[slot] = r->inst;
+        p[0] = (unsigned char)r->inst;
+        p[1] = (unsigned char)(r->inst >> 8);
+        p[2] = (unsigned char)(r->inst >> 16);
+        p[3] = (unsigned char)(r->inst >> 24);
+        p += 4;
+    }
+    if (r->reg < NUM_REG) {
+        flags |= TRACE_FLAG_REG;
+        *p++ = r->reg;
+        p = put_varint(p, zigzag(r->reg_value - t->registers[r->reg]));
+        t->registers[r->reg] = r->reg_value;
+    }
+    if (flags & (TRACE_FLAG_LOAD | TRACE_FLAG_STORE)) {
+        p = put_varint(p, zigzag(r->mem_addr - t->mem_addr));
+        t->mem_addr = r->mem_addr;
+        if (flags & TRACE_FLAG_STORE) {
+            p = put_varint(p, r->mem_value);
+        }
+    }
+    *start = flags;
+    t->length += p - start;
+    if (t->length > TRACE_BUFFER_SIZE - MAX_ENCODED_RECORD) {
+        flush_buffer(t);
+    }
+}
+
+// the writer thread: encodes the records as they arrive, until the trace is stopped and the ring is empty
+static void writer_main(void *arg)
+{
+    TRACE_state_t *t = (TRACE_state_t *)arg;
+    unsigned long head, tail = (unsigned long)t->tail;
+    int stopping;
+
+    for (;;) {
+        stopping = (int)ATOMIC_load(&t->stopping); // read before head, so no record put in the ring before stopping is missed
+        head = (unsigned long)ATOMIC_load(&t->head);
+        if (head == tail) {
+            if (stopping) {
+                break;
+            }
+            flush_buffer(t); // writing what was encoded so far while the program is idle (e.g. waiting for input)
+            THREAD_sleep_ms(1);
+            continue;
+        }
+        while (tail != head) {
+            encode(t, &t->ring[tail & (TRACE_RING_SIZE - 1)]);
+            tail++;
+            if (tail % TAIL_PUBLISH_INTERVAL == 0) {
+                ATOMIC_store(&t->tail, (long)tail);
+            }
+        }
+        ATOMIC_store(&t->tail, (long)tail);
+    }
+    flush_buffer(t);
+}
+
+static void free_state(TRACE_state_t *t)
+{
+    free(t->ring);
+    free(t->buffer);
+    free(t);
+}
+
+int TRACE_start(MIPS_cpu_t *cpu, const char *filename)
+{
+    TRACE_state_t *t;
+    TRACE_header_t header;
+
+    if (cpu->trace != NULL) {
+        printf("A trace is already being written\n");
+        return -1;
+    }
+    t = (TRACE_state_t *)calloc(1, sizeof(TRACE_state_t));
+    if (t == NULL) {
+        printf("Not enough memory for the trace\n");
+        return -1;
+    }
+    t->ring = (TRACE_record_t *)malloc(TRACE_RING_SIZE * sizeof(TRACE_record_t));
+    t->buffer = (unsigned char *)malloc(TRACE_BUFFER_SIZE);
+    if (t->ring == NULL || t->buffer == NULL) {
+        printf("Not enough memory for the trace\n");
+        free_state(t);
+        return -1;
+    }
+    t->pc = (uint32_t)-4; // so that a trace starting at address 0 starts sequentially
+    t->file = fopen(filename, "wb");
+    if (t->file == NULL) {
+        printf("Can't write %s\n", filename);
+        free_state(t);
+        return -1;
+    }
+    t->filename = filename;
+    header.magic = TRACE_MAGIC;
+    header.version = TRACE_VERSION;
+    if (fwrite(&header, sizeof(header), 1, t->file) != 1) {
+        t->error = 1;
+    }
+    if (THREAD_create(&t->writer, writer_main, t) != 0) {
+        printf("Can't start the trace writer thread\n");
+        fclose(t->file);
+        free_state(t);
+        return -1;
+    }
+    cpu->trace = t;
+    return 0;
+}
+
+int TRACE_stop(MIPS_cpu_t *cpu)
+{
+    TRACE_state_t *t = cpu->trace;
+    int result = 0;
+
+    if (t == NULL) {
+        return 0;
+    }
+    ATOMIC_store(&t->stopping, 1);
+    THREAD_join(&t->writer);
+    if (fclose(t->file) != 0) {
+        t->error = 1;
+    }
+    if (t->error) {
+        printf("Can't write the trace to %s\n", t->filename);
+        result = -1;
+    }
+    free_state(t);
+    cpu->trace = NULL;
+    return result;
+}
+
+// returns the mask of the bytes a load/store accesses (see TRACE_FLAG_SIZE_SHIFT)
+static __inline uint32_t access_mask(unsigned char flags)
+{
+    static const uint32_t masks[4] = { 0xff, 0xffff, 0xffffffff, 0xffffffff };
+
+    return masks[(flags >> TRACE_FLAG_SIZE_SHIFT) & 3];
+}
+
+void TRACE_describe(MIPS_cpu_t *cpu, TRACE_record_t *record)
+{
+    const decoded_t *d = &cpu->decoded_prog[PROG_INDEX(cpu, record->pc)]; // predecoded again by MIPS_interpret if the word was modified
+
+    record->inst = d->inst;
+    record->reg = TRACE_NO_REG;
+    record->reg_value = 0;
+    record->flags = 0;
+    record->mem_addr = 0;
+    record->mem_value = 0;
+    record->reserved[0] = record->reserved[1] = 0;
+
+    if (d->op == OP_SYSCALL) {
+        // read_int and sbrk return their result in $v0, and time returns the low word of the time in $a0 (the high word in $a1 isn't recorded)
+        // (the code is the one handle_syscall saw, since $v0 holds the result by now)
+        record->reg = (cpu->syscall_code == SYSCALL_CODE_TIME) ? SYSCALL_ARG1_REG : SYSCALL_CODES_REG;
+    } else if (d->control.reg_write && d->rd != 0) {
+        record->reg = d->rd;
+    }
+    if (record->reg != TRACE_NO_REG) {
+        record->reg_value = cpu->registers[record->reg];
+    }
+
+    // the address of a load/store is left in alu_result, and the value is in the register it was loaded to/stored from
+    switch (d->op) {
+    case OP_LB: case OP_LBU:
+        record->flags = TRACE_FLAG_LOAD | (0 << TRACE_FLAG_SIZE_SHIFT);
+        break;
+    case OP_LH: case OP_LHU:
+        record->flags = TRACE_FLAG_LOAD | (1 << TRACE_FLAG_SIZE_SHIFT);
+        break;
+    case OP_LW:
+        record->flags = TRACE_FLAG_LOAD | (2 << TRACE_FLAG_SIZE_SHIFT);
+        break;
+    case OP_SB:
+        record->flags = TRACE_FLAG_STORE | (0 << TRACE_FLAG_SIZE_SHIFT);
+        record->mem_value = cpu->registers[d->rt] & 0xff;
+        break;
+    case OP_SH:
+        record->flags = TRACE_FLAG_STORE | (1 << TRACE_FLAG_SIZE_SHIFT);
+        record->mem_value = cpu->registers[d->rt] & 0xffff;
+        break;
+    case OP_SW:
+        record->flags = TRACE_FLAG_STORE | (2 << TRACE_FLAG_SIZE_SHIFT);
+        record->mem_value = cpu->registers[d->rt];
+        break;
+    }
+    if (record->flags != 0) {
+        record->mem_addr = cpu->alu_result;
+        if (record->flags & TRACE_FLAG_LOAD) {
+            record->mem_value = cpu->registers[d->rd] & access_mask(record->flags); // lb/lh sign-extend the value in the register
+        }
+    }
+}
+
+void TRACE_put(MIPS_cpu_t *cpu, const TRACE_record_t *record)
+{
+    TRACE_state_t *t = cpu->trace;
+    unsigned long head = (unsigned long)t->head; // only written by this thread
+
+    if (head - t->tail_copy == TRACE_RING_SIZE) {
+        t->tail_copy = (unsigned long)ATOMIC_load(&t->tail);
+        while (head - t->tail_copy == TRACE_RING_SIZE) {
+            t->stalls++;
+            THREAD_sleep_ms(0);
+            t->tail_copy = (unsigned long)ATOMIC_load(&t->tail);
+        }
+    }
+    t->ring[head & (TRACE_RING_SIZE - 1)] = *record;
+    ATOMIC_store(&t->head, (long)(head + 1));
+}
+
+int TRACE_open(TRACE_reader_t *reader, const char *filename)
+{
+    TRACE_header_t header;
+
+    memset(reader, 0, sizeof(TRACE_reader_t));
+    reader->file = fopen(filename, "rb");
+    if (reader->file == NULL) {
+        printf("Can't open %s\n", filename);
+        return -1;
+    }
+    if (fread(&header, sizeof(header), 1, reader->file) != 1 || header.magic != TRACE_MAGIC || header.version != TRACE_VERSION) {
+        printf("%s is not a trace file\n", filename);
+        fclose(reader->file);
+        return -1;
+    }
+    reader->buffer = (unsigned char *)malloc(TRACE_BUFFER_SIZE);
+    if (reader->buffer == NULL) {
+        printf("Not enough memory for reading the trace\n");
+        fclose(reader->file);
+        return -1;
+    }
+    reader->pc = (uint32_t)-4;
+    return 0;
+}
+
+// reads a varint at the position. Returns -1 if it runs past the buffer
+static int get_varint(TRACE_reader_t *reader, uint32_t *value)
+{
+    unsigned int shift = 0;
+    unsigned char byte;
+
+    *value = 0;
+    do {
+        if (reader->position == reader->length || shift > 28) {
+            return -1;
+        }
+        byte = reader->buffer[reader->position++];
+        *value |= (uint32_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return 0;
+}
+
+int TRACE_next(TRACE_reader_t *reader, TRACE_record_t *record)
+{
+    unsigned char flags;
+    uint32_t value, slot;
+    const unsigned char *p;
+
+    // keeping at least a whole record in the buffer (unless the file ends first)
+    if (reader->length - reader->position < MAX_ENCODED_RECORD) {
+        memmove(reader->buffer, reader->buffer + reader->position, reader->length - reader->position);
+        reader->length -= reader->position;
+        reader->position = 0;
+        reader->length += fread(reader->buffer + reader->length, 1, TRACE_BUFFER_SIZE - reader->length, reader->file);
+    }
+    if (reader->position == reader->length) {
+        return 0;
+    }
+
+    memset(record, 0, sizeof(TRACE_record_t));
+    flags = reader->buffer[reader->position++];
+    record->flags = flags & (TRACE_FLAG_LOAD | TRACE_FLAG_STORE | (3 << TRACE_FLAG_SIZE_SHIFT));
+    record->pc = reader->pc + 4;
+    if (!(flags & TRACE_FLAG_SEQUENTIAL)) {
+        if (get_varint(reader, &value) != 0) {
+            goto corrupt;
+        }
+        record->pc += unzigzag(value);
+    }
+    reader->pc = record->pc;
+    slot = (record->pc >> 2) & (TRACE_INST_CACHE_SIZE - 1);
+    if (!(flags & TRACE_FLAG_SAME_INST)) {
+        if (reader->length - reader->position < 4) {
+            goto corrupt;
+        }
+        p = reader->buffer + reader->position;
+        reader->inst_cache[slot] = p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+        reader->position += 4;
+    }
+    record->inst = reader->inst_cache[slot];
+    record->reg = TRACE_NO_REG;
+    if (flags & TRACE_FLAG_REG) {
+        if (reader->position == reader->length || reader->buffer[reader->position] >= NUM_REG) {
+            goto corrupt;
+        }
+        record->reg = reader->buffer[reader->position++];
+        if (get_varint(reader, &value) != 0) {
+            goto corrupt;
+        }
+        reader->registers[record->reg] += unzigzag(value);
+        record->reg_value = reader->registers[record->reg];
+    }
+    if (flags & (TRACE_FLAG_LOAD | TRACE_FLAG_STORE)) {
+        if (get_varint(reader, &value) != 0) {
+            goto corrupt;
+        }
+        reader->mem_addr += unzigzag(value);
+        record->mem_addr = reader->mem_addr;
+        if (flags & TRACE_FLAG_STORE) {
+            if (get_varint(reader, &record->mem_value) != 0) {
+                goto corrupt;
+            }
+        } else {
+            record->mem_value = record->reg_value & access_mask(flags);
+        }
+    }
+    return 1;
+
+corrupt:
+    printf("The trace file is corrupt (or was cut short)\n");
+    return -1;
+}
+
+void TRACE_close(TRACE_reader_t *reader)
+{
+    if (reader->file != NULL) {
+        fclose(reader->file);
+    }
+    free(reader->buffer);
+    memset(reader, 0, sizeof(TRACE_reader_t));
+}
@@ -0,0 +1,102 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_trace.h
+*
+* Description:
+* ------------
+* Header file for mips_trace.c, the execution trace (started with MIPS_start_trace). Every executed instruction produces a fixed-size record, which
+* the simulator thread puts in a single-producer/single-consumer ring buffer. A writer thread drains the ring, encodes the records and writes them to
+* the trace file, so the simulator thread never waits for the disk unless the ring is full. tools/trace_read.c prints a trace file.
+*
+* Layout of a trace file: a TRACE_header_t, followed by the encoded records. A record is encoded relative to the records before it:
+*   flags                  1 byte (TRACE_FLAG_*)
+*   pc                     unless TRACE_FLAG_SEQUENTIAL: the difference from the previous pc + 4 (zigzag varint)
+*   instruction            unless TRACE_FLAG_SAME_INST: the instruction word (4 bytes, little-endian)
+*   register               with TRACE_FLAG_REG: its index (1 byte), and the difference from its previous value in the trace (zigzag varint)
+*   memory address         with TRACE_FLAG_LOAD/TRACE_FLAG_STORE: the difference from the previous memory address in the trace (zigzag varint)
+*   stored value           with TRACE_FLAG_STORE: the value (varint)
+* A varint holds 7 bits per byte, least significant first, with the top bit set on all but the last byte, and zigzag maps signed differences to
+* small unsigned numbers (0, -1, 1, -2, ... to 0, 1, 2, 3, ...). TRACE_FLAG_SAME_INST is set when the instruction word equals the last one traced at
+* the same address modulo TRACE_INST_CACHE_SIZE words (the writer and the reader keep the same table), so a loop costs a few bytes per instruction.
+*
+*************************************************************************/
+
+#ifndef __MIPS_TRACE_H
+#define __MIPS_TRACE_H
+
+#include "mips.h"
+
+#define TRACE_MAGIC   0x4352544d // "MTRC"
+#define TRACE_VERSION 1
+
+#define TRACE_RING_SIZE       (1 << 16) // records in the ring buffer (a power of 2)
+#define TRACE_BUFFER_SIZE     (1 << 16) // bytes the writer encodes before writing them to the file
+#define TRACE_INST_CACHE_SIZE 4096 // instruction words remembered by the encoder (a power of 2)
+#define TRACE_NO_REG          0xff // TRACE_record_t.reg of an instruction that doesn't write a register
+
+// flags of an encoded record
+#define TRACE_FLAG_SEQUENTIAL 0x01 // the pc follows the previous one
+#define TRACE_FLAG_SAME_INST  0x02
+#define TRACE_FLAG_REG        0x04 // a register was written
+#define TRACE_FLAG_LOAD       0x08
+#define TRACE_FLAG_STORE      0x10
+#define TRACE_FLAG_SIZE_SHIFT 5 // bits 5-6 hold log2 of the access size of a load/store (0, 1 or 2)
+
+typedef struct {
+    uint32_t magic; // TRACE_MAGIC
+    uint32_t version; // TRACE_VERSION
+} TRACE_header_t;
+
+// the record of an executed instruction
+typedef struct {
+    uint32_t pc;
+    uint32_t inst; // the raw instruction word
+    uint32_t reg_value; // the value written to reg
+    uint32_t mem_addr; // the address of a load/store
+    uint32_t mem_value; // the value loaded/stored (zero-extended to 32 bits for bytes and halfwords)
+    unsigned char reg; // the register written (TRACE_NO_REG for none). The syscall result in $v0 is recorded as well
+    unsigned char flags; // TRACE_FLAG_LOAD/TRACE_FLAG_STORE and the access size (the other flags are only used in the file)
+    unsigned char reserved[2];
+} TRACE_record_t;
+
+typedef struct TRACE_state_s TRACE_state_t; // trace of a context (allocated while tracing)
+
+/* Creates the trace file, and starts the writer thread (called by MIPS_cpu_start_trace).
+   Returns 0 on success, and -1 (after printing why) otherwise.
+*/
+int TRACE_start(MIPS_cpu_t *cpu, const char *filename);
+
+/* Waits for the writer thread to write the remaining records, and closes the file (called by MIPS_cpu_stop_trace).
+   Returns 0 on success, and -1 (after printing why) if the file couldn't be written.
+*/
+int TRACE_stop(MIPS_cpu_t *cpu);
+
+/* Fills in the record of the instruction at record->pc, which was just executed, from its predecoded record and the machine state after it.
+   The records are also used by the models that observe every instruction (see observed_step in mips.c), whether or not a trace is written.
+*/
+void TRACE_describe(MIPS_cpu_t *cpu, TRACE_record_t *record);
+
+// puts a record in the ring buffer, waiting for the writer thread if the ring is full
+void TRACE_put(MIPS_cpu_t *cpu, const TRACE_record_t *record);
+
+// reads the records of a trace file (for tools/trace_read.c)
+typedef struct {
+    FILE *file;
+    unsigned char *buffer;
+    size_t length, position; // bytes in the buffer, and the next one to decode
+    uint32_t pc; // the previous record's pc
+    uint32_t mem_addr;
+    uint32_t registers[NUM_REG];
+    uint32_t inst_cache[TRACE_INST_CACHE_SIZE];
+} TRACE_reader_t;
+
+// opens a trace file. Returns 0 on success, and -1 (after printing why) otherwise
+int TRACE_open(TRACE_reader_t *reader, const char *filename);
+
+// decodes the next record. Returns 1 if a record was read, 0 at the end of the file, and -1 (after printing why) if the file is corrupt
+int TRACE_next(TRACE_reader_t *reader, TRACE_record_t *record);
+
+void TRACE_close(TRACE_reader_t *reader);
+
+#endif /* __MIPS_TRACE_H */
@@ -16,8 +16,10 @@
 #ifndef __MIPSDEFS_H
 #define __MIPSDEFS_H
 
+#include <stdint.h> // for fixed-size 32-bit types (registers, memory words and instructions are 32 bits wide on every host)
+
 #define NUM_REG 32 // number of registers in the register file
-#define RESET_ADDR 0x3000 // program counter reset address (same as .text base address in MARS's "Compact, Data at Address 0" memory configuration)
+#define RESET_ADDR 0x3000 // program counter reset address in the default memory layout (same as .text base address in MARS's "Compact, Data at Address 0" memory configuration)
 
 // Opcodes
 #define OPCODE_RTYPE    0x00 // all R-type instructions have an opcode of 0, and they are differentiated by their funct values (see below)
@@ -80,13 +82,16 @@
 
 #define SYSCALL_CODES_REG 2 // the syscall code must be stored in register 2 ($v0) before executing syscall
 #define SYSCALL_ARG1_REG  4 // the argument to print_int, print_string, print_char, sleep, print_int_hex, print_int_bin, print_uint is stored in $a0 (register 4)
+#define SYSCALL_ARG2_REG  5 // $a1 (register 5), where the time syscall returns the high word of the time
 
 // SYSCALL Codes
 #define SYSCALL_CODE_PRINT_INT     1   // $a0 (reg 4) = integer to print
 #define SYSCALL_CODE_PRINT_STRING  4   // $a0 (reg 4) = address of null terminated string
 #define SYSCALL_CODE_READ_INT      5   // $v0 (reg 2) will contain result
+#define SYSCALL_CODE_SBRK          9   // $a0 (reg 4) = number of bytes to allocate, $v0 (reg 2) will contain the address of the allocated memory
 #define SYSCALL_CODE_EXIT          10  // end program
 #define SYSCALL_CODE_PRINT_CHAR    11  // $a0 (reg 4) contains the char
+#define SYSCALL_CODE_TIME          30  // $a0 (reg 4) will contain the low 32 bits, and $a1 (reg 5) the high 32 bits, of the time in milliseconds
 #define SYSCALL_CODE_SLEEP         32  // $a0 (reg 4) = the length of time to sleep in milliseconds
 #define SYSCALL_CODE_PRINT_INT_HEX 34  // Prints int in hex format. $a0 (reg 4) = integer to print
 #define SYSCALL_CODE_PRINT_INT_BIN 35  // Prints int in binary format. $a0 (reg 4) = integer to print
@@ -96,6 +101,7 @@
 #define SYSCALL_CODE_DRAW_PIXEL     18 // $t0 (reg 8) = color, $t1 = x, $t2 = y
 #define SYSCALL_CODE_DRAW_RECTANGLE 19 // $t0 (reg 8) = color, $t1 = x, $t2 = y, $t3 = width, $t4 = height
 #define SYSCALL_CODE_DRAW_BITMAP    20 // $t0 (reg 8) = bitmap array base address, $t1 = x, $t2 = y, $t3 = width, $t4 = height
+#define SYSCALL_CODE_PRESENT        21 // sends the tiles of the framebuffer written since the last present to the virtual screen (see MIPS_set_framebuffer)
 // registers for arguments to the custom syscalls
 #define SYSCALL_DRAW_ARG1_REG       8  // $t0
 #define SYSCALL_DRAW_ARG2_REG       9  // $t1
@@ -145,7 +151,7 @@ typedef union {
     struct i_type itype;
     struct j_type jtype;
     struct common_type commontype;
-    unsigned long inst;
+    uint32_t inst;
 } instruction_t;
 
 #endif /* __MIPSDEFS_H */
@@ -0,0 +1,260 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : render.c
+*
+* Description:
+* ------------
+* This file implements the software rasterizer of the draw messages (see render.h).
+* Everything is drawn as horizontal spans of a single color, clipped once per span: a fill is a span per row, and a run of the run-length or the
+* delta encoding is a span per row it covers. A span is filled 16 pixels (four 128-bit stores) at a time with SSE2 on x86-64, which every x86-64
+* processor has, and a pixel at a time elsewhere. The raw bitmaps are looked up in a table of the palette's 32-bit colors, a row at a time.
+*
+*************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "render.h"
+#include "draw_protocol.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#include <emmintrin.h>
+#define RENDER_SSE2
+#endif
+
+static uint32_t colors[DRAW_PALETTE_SIZE]; // the palette as pixels
+static int colors_ready;
+
+int RENDER_init(RENDER_target_t *target, unsigned int width, unsigned int height)
+{
+    int i;
+
+    if (!colors_ready) {
+        for (i = 0; i < DRAW_PALETTE_SIZE; i++) {
+            colors[i] = ((uint32_t)DRAW_palette[i].R << 16) | ((uint32_t)DRAW_palette[i].G << 8) | DRAW_palette[i].B;
+        }
+        colors_ready = 1;
+    }
+    target->pixels = (uint32_t *)calloc((size_t)width * height, sizeof(uint32_t));
+    target->width = width;
+    target->height = height;
+    target->messages = 0;
+    target->pixels_drawn = 0;
+    target->dirty_x0 = target->dirty_y0 = target->dirty_x1 = target->dirty_y1 = 0;
+    return (target->pixels != NULL) ? 0 : -1;
+}
+
+void RENDER_free(RENDER_target_t *target)
+{
+    free(target->pixels);
+    target->pixels = NULL;
+}
+
+// extends the bounds of the pixels drawn to a rectangle (inside the image)
+static __inline void mark_dirty(RENDER_target_t *target, unsigned int x, unsigned int y, unsigned int width, unsigned int height)
+{
+    if (target->dirty_x1 == 0) {
+        target->dirty_x0 = x;
+        target->dirty_y0 = y;
+        target->dirty_x1 = x + width;
+        target->dirty_y1 = y + height;
+    } else {
+        if (x < target->dirty_x0) {
+            target->dirty_x0 = x;
+        }
+        if (y < target->dirty_y0) {
+            target->dirty_y0 = y;
+        }
+        if (x + width > target->dirty_x1) {
+            target->dirty_x1 = x + width;
+        }
+        if (y + height > target->dirty_y1) {
+            target->dirty_y1 = y + height;
+        }
+    }
+    target->pixels_drawn += (unsigned long long)width * height;
+}
+
+int RENDER_take_dirty(RENDER_target_t *target, unsigned int *x, unsigned int *y, unsigned int *width, unsigned int *height)
+{
+    if (target->dirty_x1 == 0) {
+        return 0;
+    }
+    *x = target->dirty_x0;
+    *y = target->dirty_y0;
+    *width = target->dirty_x1 - target->dirty_x0;
+    *height = target->dirty_y1 - target->dirty_y0;
+    target->dirty_x0 = target->dirty_y0 = target->dirty_x1 = target->dirty_y1 = 0;
+    return 1;
+}
+
+static __inline void fill_span(uint32_t *p, uint32_t color, unsigned int count)
+{
+#ifdef RENDER_SSE2
+    __m128i c = _mm_set1_epi32((int)color);
+
+    for (; count >= 16; count -= 16, p += 16) {
+        _mm_storeu_si128((__m128i *)p, c);
+        _mm_storeu_si128((__m128i *)(p + 4), c);
+        _mm_storeu_si128((__m128i *)(p + 8), c);
+        _mm_storeu_si128((__m128i *)(p + 12), c);
+    }
+    for (; count >= 4; count -= 4, p += 4) {
+        _mm_storeu_si128((__m128i *)p, c);
+    }
+#endif
+    for (; count > 0; count--) {
+        *p++ = color;
+    }
+}
+
+void RENDER_fill(RENDER_target_t *target, uint32_t color, unsigned int x, unsigned int y, unsigned int width, unsigned int height)
+{
+    unsigned int row;
+    uint32_t *p;
+
+    if (x >= target->width || y >= target->height) {
+        return;
+    }
+    if (width > target->width - x) {
+        width = target->width - x;
+    }
+    if (height > target->height - y) {
+        height = target->height - y;
+    }
+    if (width == 0 || height == 0) {
+        return;
+    }
+    mark_dirty(target, x, y, width, height);
+    p = &target->pixels[(size_t)y * target->width + x];
+    for (row = 0; row < height; row++, p += target->width) {
+        fill_span(p, color, width);
+    }
+}
+
+// draws count pixels of a color, from pixel number start of a width X height bitmap at (x,y), continuing from the end of a row to the next
+static void fill_run(RENDER_target_t *target, uint32_t color, unsigned int x, unsigned int y, unsigned int width, unsigned int start,
+                     unsigned int count)
+{
+    unsigned int row = start / width, col = start % width, n;
+
+    while (count > 0) {
+        n = (count < width - col) ? count : width - col;
+        RENDER_fill(target, color, x + col, y + row, n, 1);
+        count -= n;
+        col = 0;
+        row++;
+    }
+}
+
+// draws the rows of a raw bitmap (whose length was checked)
+static void draw_raw(RENDER_target_t *target, const unsigned char *payload, unsigned int x, unsigned int y, unsigned int width, unsigned int height)
+{
+    unsigned int row, col, count;
+    uint32_t *p;
+
+    if (x >= target->width || y >= target->height) {
+        return;
+    }
+    count = (width < target->width - x) ? width : target->width - x;
+    if (height > target->height - y) {
+        height = target->height - y;
+    }
+    if (count == 0 || height == 0) {
+        return;
+    }
+    mark_dirty(target, x, y, count, height);
+    for (row = 0; row < height; row++) {
+        p = &target->pixels[(size_t)(y + row) * target->width + x];
+        for (col = 0; col < count; col++) {
+            p[col] = colors[payload[(size_t)row * width + col]];
+        }
+    }
+}
+
+static unsigned int get16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+void RENDER_message(RENDER_target_t *target, const unsigned char *msg, int msg_size)
+{
+    const unsigned char *payload = msg + DRAW_HEADER_SIZE;
+    unsigned int x, y, width, height, count, length, i, p, size;
+    int pos;
+
+    if (msg_size == DRAW_RECT_MSG_SIZE) {
+        if (msg[5] > msg[3] && msg[6] > msg[4]) {
+            RENDER_fill(target, ((uint32_t)msg[0] << 16) | ((uint32_t)msg[1] << 8) | msg[2], msg[3], msg[4], msg[5] - msg[3], msg[6] - msg[4]);
+        }
+        target->messages++;
+        return;
+    }
+    if (msg_size < DRAW_BATCH_HEADER_SIZE || msg[0] != DRAW_MSG_MAGIC || msg[1] == 0 || msg[1] > DRAW_PROTOCOL_VERSION) {
+        return;
+    }
+    if (msg[2] == DRAW_MSG_BATCH) {
+        for (i = 0, pos = DRAW_BATCH_HEADER_SIZE; i < msg[3] && pos + 2 <= msg_size; i++) {
+            size = get16(&msg[pos]);
+            pos += 2;
+            if (size > (unsigned int)(msg_size - pos)) {
+                break;
+            }
+            if (size == DRAW_RECT_MSG_SIZE || (size > 2 && msg[pos + 2] != DRAW_MSG_BATCH)) {
+                RENDER_message(target, msg + pos, (int)size);
+            }
+            pos += size;
+        }
+        return;
+    }
+    if (msg_size <= DRAW_HEADER_SIZE) {
+        return;
+    }
+
+    x = get16(&msg[4]);
+    y = get16(&msg[6]);
+    width = get16(&msg[8]);
+    height = get16(&msg[10]);
+    count = width * height;
+    length = msg_size - DRAW_HEADER_SIZE;
+    if (msg[2] == DRAW_MSG_FILL) {
+        RENDER_fill(target, colors[payload[0]], x, y, width, height);
+        target->messages++;
+        return;
+    }
+    if (msg[2] != DRAW_MSG_BITMAP || count == 0) {
+        return;
+    }
+
+    switch (msg[3]) {
+    case DRAW_ENCODING_RAW:
+        if (length < count) {
+            return;
+        }
+        draw_raw(target, payload, x, y, width, height);
+        break;
+    case DRAW_ENCODING_RLE:
+        // the runs fill the pixels one after the other
+        for (i = 0, p = 0; i + 1 < length && p < count; i += 2) {
+            size = (payload[i] < count - p) ? payload[i] : count - p;
+            fill_run(target, colors[payload[i + 1]], x, y, width, p, size);
+            p += size;
+        }
+        break;
+    case DRAW_ENCODING_DELTA:
+        // only the runs of changed pixels are drawn, and the pixels skipped stay as they are
+        for (i = 0, p = 0; i + 2 < length && p < count; i += 3) {
+            p += payload[i];
+            if (p >= count) {
+                break;
+            }
+            size = (payload[i + 1] < count - p) ? payload[i + 1] : count - p;
+            fill_run(target, colors[payload[i + 2]], x, y, width, p, size);
+            p += size;
+        }
+        break;
+    default:
+        return;
+    }
+    target->messages++;
+}
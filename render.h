@@ -0,0 +1,51 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : render.h
+*
+* Description:
+* ------------
+* Header file for render.c, which draws the messages of draw_protocol.h into an in-memory image of 32-bit pixels (0x00RRGGBB), the way BlankWindow
+* draws them on its window: the rectangles, fills and bitmaps in any encoding, and the batches packing them. It has no dependencies besides the
+* C library, so it can draw the messages anywhere (see headless.h).
+*
+*************************************************************************/
+
+#ifndef __RENDER_H
+#define __RENDER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// an image the messages are drawn into (whatever falls outside of it is clipped)
+typedef struct {
+    uint32_t *pixels; // width X height pixels, row by row
+    unsigned int width, height;
+    unsigned long long messages; // messages drawn into it (not counting the batches themselves)
+    unsigned long long pixels_drawn; // pixels written (counting a pixel again every time it is drawn)
+    unsigned int dirty_x0, dirty_y0, dirty_x1, dirty_y1; // the bounds of the pixels drawn since RENDER_take_dirty (x1 and y1 excluded)
+} RENDER_target_t;
+
+// allocates the pixels of an image, all black. Returns 0 on success, and -1 if there isn't enough memory
+int RENDER_init(RENDER_target_t *target, unsigned int width, unsigned int height);
+void RENDER_free(RENDER_target_t *target);
+
+// draws a message (of any kind, including a batch of messages) into the image. Malformed messages are ignored, like BlankWindow does
+void RENDER_message(RENDER_target_t *target, const unsigned char *msg, int msg_size);
+
+/* Returns whether anything was drawn since the last call, with the bounds of what was (in *x, *y, *width and *height), and starts collecting
+   the bounds again. A display can copy just these pixels to the screen.
+*/
+int RENDER_take_dirty(RENDER_target_t *target, unsigned int *x, unsigned int *y, unsigned int *width, unsigned int *height);
+
+// fills a rectangle of the image with a color (0x00RRGGBB), clipped to the image
+void RENDER_fill(RENDER_target_t *target, uint32_t color, unsigned int x, unsigned int y, unsigned int width, unsigned int height);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RENDER_H */
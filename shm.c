@@ -0,0 +1,174 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : shm.c
+*
+* Description:
+* ------------
+* This file implements the shared-memory transport of the draw messages (see shm.h and draw_ring.h).
+* It is only called by the sender thread of draw_queue.c, which is the ring's single producer, so head is kept here and only published (and
+* BlankWindow woken up) once a whole batch of messages was written, or when the ring is full and BlankWindow has to read the ones before.
+*
+*************************************************************************/
+
+#ifdef __linux__
+#define _GNU_SOURCE // for syscall
+#endif
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#endif
+#include "shm.h"
+#include "draw_ring.h"
+#include "thread.h"
+
+static draw_ring_t *ring;
+static uint32_t head; // bytes written, which BlankWindow only sees once they are published
+static int reader_gone; // BlankWindow didn't read for SHM_TIMEOUT_MS, so the messages are dropped until it does
+static uint32_t gone_tail; // tail when BlankWindow was found gone
+#ifdef _WIN32
+static HANDLE mapping, event;
+#endif
+
+int SHM_init(void)
+{
+#ifdef _WIN32
+    mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(draw_ring_t), DRAW_RING_NAME);
+    if (mapping == NULL) {
+        printf("Couldn't create the shared memory of the draw messages (error %lu)\n", GetLastError());
+        return -1;
+    }
+    ring = (draw_ring_t *)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(draw_ring_t));
+    event = CreateEventA(NULL, FALSE, FALSE, DRAW_RING_EVENT_NAME);
+    if (ring == NULL || event == NULL) {
+        printf("Couldn't map the shared memory of the draw messages (error %lu)\n", GetLastError());
+        SHM_terminate();
+        return -1;
+    }
+#else
+    int fd = shm_open(DRAW_RING_NAME, O_RDWR | O_CREAT, 0600);
+    void *p;
+
+    if (fd < 0 || ftruncate(fd, sizeof(draw_ring_t)) != 0) {
+        perror("Couldn't create the shared memory of the draw messages");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    p = mmap(NULL, sizeof(draw_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("Couldn't map the shared memory of the draw messages");
+        return -1;
+    }
+    ring = (draw_ring_t *)p;
+#endif
+
+    // a new mapping is all zeros, which is an empty ring, so whichever side comes first only has to sign it
+    if (ring->magic == 0) {
+        ring->version = DRAW_RING_VERSION;
+        ring->magic = DRAW_RING_MAGIC;
+    } else if (ring->magic != DRAW_RING_MAGIC || ring->version != DRAW_RING_VERSION) {
+        printf("The shared memory of the draw messages has an unknown format (version %u)\n", ring->version);
+        SHM_terminate();
+        return -1;
+    }
+    head = (uint32_t)DRAW_RING_load(&ring->head); // continuing after the messages of an earlier run
+    reader_gone = 0;
+    return 0;
+}
+
+void SHM_terminate(void)
+{
+#ifdef _WIN32
+    if (ring != NULL) {
+        UnmapViewOfFile(ring);
+    }
+    if (event != NULL) {
+        CloseHandle(event);
+    }
+    if (mapping != NULL) {
+        CloseHandle(mapping);
+    }
+    event = NULL;
+    mapping = NULL;
+#else
+    if (ring != NULL) {
+        munmap(ring, sizeof(draw_ring_t));
+    }
+#endif
+    ring = NULL;
+}
+
+// publishes the messages written so far, waking BlankWindow up if it sleeps
+static void publish(void)
+{
+    DRAW_RING_store(&ring->head, head);
+    if (DRAW_RING_load(&ring->waiting)) {
+#ifdef _WIN32
+        SetEvent(event);
+#elif defined(__linux__)
+        DRAW_RING_increment(&ring->wake_sequence);
+        syscall(SYS_futex, &ring->wake_sequence, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif
+    }
+}
+
+// returns whether a record of the given size fits in the ring, waiting for BlankWindow to read if it doesn't yet
+static int wait_for_room(uint32_t size)
+{
+    uint32_t tail = (uint32_t)DRAW_RING_load(&ring->tail);
+    unsigned long long start;
+
+    if (reader_gone) {
+        if (tail == gone_tail) {
+            return 0;
+        }
+        reader_gone = 0; // it reads again
+    }
+    if (DRAW_RING_SIZE - (head - tail) >= size) {
+        return 1;
+    }
+    publish(); // BlankWindow can only make room by reading the messages before
+    start = THREAD_time_ms();
+    while (DRAW_RING_SIZE - (head - tail) < size) {
+        if (THREAD_time_ms() - start >= SHM_TIMEOUT_MS) {
+            printf("BlankWindow doesn't read the shared memory, so the draw messages are dropped until it does\n");
+            reader_gone = 1;
+            gone_tail = tail;
+            return 0;
+        }
+        THREAD_sleep_ms(1);
+        tail = (uint32_t)DRAW_RING_load(&ring->tail);
+    }
+    return 1;
+}
+
+void SHM_send_many(unsigned char *msgs[], const int msg_sizes[], int count)
+{
+    unsigned char length[DRAW_RING_RECORD_SIZE];
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (!wait_for_room(DRAW_RING_RECORD_SIZE + msg_sizes[i])) {
+            continue;
+        }
+        length[0] = (unsigned char)msg_sizes[i];
+        length[1] = (unsigned char)(msg_sizes[i] >> 8);
+        DRAW_ring_write(ring, head, length, DRAW_RING_RECORD_SIZE);
+        DRAW_ring_write(ring, head + DRAW_RING_RECORD_SIZE, msgs[i], msg_sizes[i]);
+        head += DRAW_RING_RECORD_SIZE + msg_sizes[i];
+    }
+    publish();
+}
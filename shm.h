@@ -0,0 +1,27 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : shm.h
+*
+* Description:
+* ------------
+* Header file for shm.c, the shared-memory transport of the draw messages (selected with UDP_set_transport). The messages are written into the
+* ring of draw_ring.h, which BlankWindow reads on the same machine, instead of going through the network stack as datagrams to 127.0.0.1.
+*
+*************************************************************************/
+
+#ifndef __SHM_H
+#define __SHM_H
+
+#define SHM_TIMEOUT_MS 1000 // how long a full ring waits for BlankWindow to read before it is considered gone
+
+// creates or opens the ring. Returns 0 on success, and -1 (after printing why) if the shared memory can't be mapped
+int SHM_init(void);
+void SHM_terminate(void);
+
+/* Writes count messages into the ring and wakes BlankWindow up once they are all there. If the ring is full, waits for BlankWindow to make room,
+   unless it hasn't read anything for SHM_TIMEOUT_MS, in which case the messages are dropped until it reads again.
+*/
+void SHM_send_many(unsigned char *msgs[], const int msg_sizes[], int count);
+
+#endif /* __SHM_H */
@@ -0,0 +1,160 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : draw_test.c
+*
+* Description:
+* ------------
+* A randomized test of the tile differencing of the draw module (draw.c). Random pixels, rectangles and bitmaps (noise, stripes that compress
+* well, and solid ones) are drawn for many frames, some of them larger than the canvas copy or partly outside of it. The messages the module
+* sends are drawn with render.c, the way BlankWindow draws them, and after every DRAW_flush the image must be identical to a full frame drawn
+* here pixel by pixel. The test replaces udp.c, so it is built with the draw module but without udp.c, and run without arguments:
+*     gcc -I.. draw_test.c ../draw.c ../draw_queue.c ../headless.c ../render.c ../thread.c -o draw_test -lpthread
+* It prints the first frame that differs (and returns 1), or the number of messages and bytes sent.
+*
+*************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "draw.h"
+#include "draw_protocol.h"
+#include "render.h"
+#include "thread.h"
+#include "udp.h"
+
+#define TEST_WIDTH   640 // the image, which extends past the canvas copy of the draw module (320X256)
+#define TEST_HEIGHT  320
+#define TEST_FRAMES  3000
+#define TEST_SEED    2
+#define MAX_BITMAP   (1500 * 300) // pixels of the largest bitmap drawn
+
+static RENDER_target_t target; // drawn by the sender thread of draw_queue.c
+static uint32_t expected[TEST_HEIGHT][TEST_WIDTH]; // the full frame
+static atomic_t received; // messages drawn into target so far
+static unsigned long long bytes;
+static unsigned char bitmap[MAX_BITMAP];
+
+// the transport of the draw module, which draws the datagrams (of any kind, including batches) into target instead of sending them
+void UDP_set_transport(int transport)
+{
+    (void)transport;
+}
+
+void UDP_init(void)
+{
+}
+
+void UDP_terminate(void)
+{
+}
+
+void UDP_send(unsigned char *msg, int msg_size)
+{
+    RENDER_message(&target, msg, msg_size);
+    bytes += msg_size;
+    ATOMIC_store(&received, (long)target.messages);
+}
+
+void UDP_send_many(unsigned char *msgs[], const int msg_sizes[], int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        UDP_send(msgs[i], msg_sizes[i]);
+    }
+}
+
+void UDP_recover(void)
+{
+}
+
+unsigned long long UDP_lost(void)
+{
+    return 0;
+}
+
+static uint32_t color(unsigned char index)
+{
+    return ((uint32_t)DRAW_palette[index].R << 16) | ((uint32_t)DRAW_palette[index].G << 8) | DRAW_palette[index].B;
+}
+
+static void expect_pixel(int x, int y, uint32_t rgb)
+{
+    if (x < TEST_WIDTH && y < TEST_HEIGHT) {
+        expected[y][x] = rgb;
+    }
+}
+
+// waits until the sender thread drew every message drawn so far (nothing is dropped with DRAW_QUEUE_BLOCK)
+static void wait_for_messages(void)
+{
+    DRAW_queue_stats_t stats;
+
+    DRAW_get_queue_stats(&stats);
+    while ((unsigned long long)ATOMIC_load(&received) < stats.messages) {
+        THREAD_sleep_ms(0);
+    }
+}
+
+int main(void)
+{
+    int frame, i, n, kind, big, mode, x, y, width, height, row, col;
+    unsigned char index;
+
+    if (RENDER_init(&target, TEST_WIDTH, TEST_HEIGHT) != 0) {
+        printf("Not enough memory\n");
+        return 1;
+    }
+    DRAW_set_queue_policy(DRAW_QUEUE_BLOCK);
+    DRAW_init();
+    srand(TEST_SEED);
+    for (frame = 0; frame < TEST_FRAMES; frame++) {
+        for (n = 1 + rand() % 6; n > 0; n--) {
+            kind = rand() % 5;
+            big = (rand() % 8 == 0);
+            width = 1 + rand() % (big ? 1500 : 40);
+            height = 1 + rand() % (big ? 300 : 40);
+            x = rand() % (big ? 300 : 330);
+            y = rand() % (big ? 100 : 270);
+            index = (unsigned char)(rand() % 256);
+            if (kind == 0) {
+                DRAW_pixel(index, (uint16_t)x, (uint16_t)y);
+                expect_pixel(x, y, color(index));
+            } else if (kind == 1) {
+                DRAW_rectangle(index, (uint16_t)x, (uint16_t)y, (uint16_t)width, (uint16_t)height);
+                for (row = 0; row < height; row++) {
+                    for (col = 0; col < width; col++) {
+                        expect_pixel(x + col, y + row, color(index));
+                    }
+                }
+            } else {
+                mode = rand() % 3;
+                for (i = 0; i < width * height; i++) {
+                    bitmap[i] = (unsigned char)((mode == 0) ? rand() % 256 : (mode == 1) ? ((i % width) / 4) % 3 : index);
+                }
+                DRAW_bitmap(bitmap, (uint16_t)x, (uint16_t)y, (uint16_t)width, (uint16_t)height);
+                for (row = 0; row < height; row++) {
+                    for (col = 0; col < width; col++) {
+                        expect_pixel(x + col, y + row, color(bitmap[row * width + col]));
+                    }
+                }
+            }
+        }
+        DRAW_flush();
+        wait_for_messages();
+        for (y = 0; y < TEST_HEIGHT; y++) {
+            for (x = 0; x < TEST_WIDTH; x++) {
+                if (target.pixels[y * TEST_WIDTH + x] != expected[y][x]) {
+                    printf("Frame %d differs from the full frame at (%d,%d): %06x instead of %06x\n", frame, x, y,
+                           target.pixels[y * TEST_WIDTH + x], expected[y][x]);
+                    return 1;
+                }
+            }
+        }
+    }
+    DRAW_terminate();
+    printf("OK: %d frames, %ld messages, %llu bytes\n", TEST_FRAMES, (long)ATOMIC_load(&received), bytes);
+    RENDER_free(&target);
+    return 0;
+}
@@ -0,0 +1,303 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : headless_test.c
+*
+* Description:
+* ------------
+* A round-trip test of the headless display (headless.c). Random frames of pixels, rectangles and bitmaps are drawn through the draw module into
+* a PPM file per frame, then a PNG file per frame, and then a Y4M stream (each display starting with the canvas the one before it left). Every
+* PPM and PNG file is read back as soon as its frame was written, and must hold exactly the frame drawn here pixel by pixel. The PNG reader
+* checks the signature, the header, the CRC of every chunk and the Adler-32 of the zlib stream, and only inflates stored blocks (the only kind
+* headless.c writes). The luma of every Y4M frame must be the BT.601 luma of the frame (within rounding), and the stream must hold every frame.
+* It is built with the draw module, and run without arguments in a folder it can write its files to (which it deletes when it passes):
+*     gcc -I.. headless_test.c ../draw.c ../draw_queue.c ../headless.c ../render.c ../udp.c ../shm.c ../thread.c -o headless_test -lpthread -lrt
+* It prints the first frame that differs (and returns 1), or the number of frames checked.
+*
+*************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "draw.h"
+#include "draw_protocol.h"
+#include "headless.h"
+
+#define TEST_FRAMES  40 // frames of every format
+#define TEST_SEED    3
+#define MAX_BITMAP   (400 * 300) // pixels of the largest bitmap drawn
+#define PPM_PATH     "headless_test_%03d.ppm"
+#define PNG_PATH     "headless_test_%03d.png"
+#define Y4M_PATH     "headless_test.y4m"
+#define FRAME_BYTES  (HEADLESS_WIDTH * HEADLESS_HEIGHT * 3)
+#define PNG_ROW_SIZE (1 + 3 * HEADLESS_WIDTH)
+#define PNG_RAW_SIZE (HEADLESS_HEIGHT * PNG_ROW_SIZE)
+
+static unsigned char expected[HEADLESS_HEIGHT][HEADLESS_WIDTH][3]; // the frame drawn so far, as RGB bytes
+static unsigned char image[FRAME_BYTES]; // a frame read back
+static unsigned char file_data[2 * PNG_RAW_SIZE]; // a whole PNG file (stored deflate blocks are a little larger than the raw rows)
+static unsigned char raw[PNG_RAW_SIZE]; // the inflated rows of a PNG
+static unsigned char bitmap[MAX_BITMAP];
+static unsigned char y_planes[TEST_FRAMES][HEADLESS_HEIGHT][HEADLESS_WIDTH]; // the expected luma of every Y4M frame
+static uint32_t crc_table[256];
+
+static void expect_pixel(int x, int y, unsigned char index)
+{
+    if (x < HEADLESS_WIDTH && y < HEADLESS_HEIGHT) {
+        expected[y][x][0] = DRAW_palette[index].R;
+        expected[y][x][1] = DRAW_palette[index].G;
+        expected[y][x][2] = DRAW_palette[index].B;
+    }
+}
+
+// draws a random frame, starting with a pixel of a new color on the top row, so that every frame changes the image (and gets written)
+static void draw_frame(int frame)
+{
+    int i, n, kind, big, x, y, width, height, row, col;
+    unsigned char index;
+
+    x = frame % HEADLESS_WIDTH;
+    for (index = 0; DRAW_palette[index].R == expected[0][x][0] && DRAW_palette[index].G == expected[0][x][1] &&
+                    DRAW_palette[index].B == expected[0][x][2]; index++);
+    DRAW_pixel(index, (uint16_t)x, 0);
+    expect_pixel(x, 0, index);
+    for (n = rand() % 5; n > 0; n--) {
+        kind = rand() % 3;
+        big = (rand() % 6 == 0);
+        width = 1 + rand() % (big ? 400 : 40);
+        height = 1 + rand() % (big ? 300 : 40);
+        x = rand() % 330;
+        y = rand() % 270;
+        index = (unsigned char)(rand() % 256);
+        if (kind == 0) {
+            DRAW_pixel(index, (uint16_t)x, (uint16_t)y);
+            expect_pixel(x, y, index);
+        } else if (kind == 1) {
+            DRAW_rectangle(index, (uint16_t)x, (uint16_t)y, (uint16_t)width, (uint16_t)height);
+            for (row = 0; row < height; row++) {
+                for (col = 0; col < width; col++) {
+                    expect_pixel(x + col, y + row, index);
+                }
+            }
+        } else {
+            for (i = 0; i < width * height; i++) {
+                bitmap[i] = (unsigned char)((rand() % 2) ? rand() % 256 : index);
+            }
+            DRAW_bitmap(bitmap, (uint16_t)x, (uint16_t)y, (uint16_t)width, (uint16_t)height);
+            for (row = 0; row < height; row++) {
+                for (col = 0; col < width; col++) {
+                    expect_pixel(x + col, y + row, bitmap[row * width + col]);
+                }
+            }
+        }
+    }
+    DRAW_flush();
+}
+
+static size_t read_file(const char *name, unsigned char *data, size_t capacity)
+{
+    FILE *file = fopen(name, "rb");
+    size_t length;
+
+    if (file == NULL) {
+        return 0;
+    }
+    length = fread(data, 1, capacity, file);
+    fclose(file);
+    return length;
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint32_t crc32(const unsigned char *data, size_t length)
+{
+    uint32_t crc = 0xffffffff;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffff;
+}
+
+// reads a PPM file into image. Returns 0 if it is a HEADLESS_WIDTH X HEADLESS_HEIGHT binary PPM
+static int read_ppm(const char *name)
+{
+    char header[32];
+    int length = sprintf(header, "P6\n%u %u\n255\n", HEADLESS_WIDTH, HEADLESS_HEIGHT);
+
+    if (read_file(name, file_data, sizeof(file_data)) != (size_t)length + FRAME_BYTES || memcmp(file_data, header, length) != 0) {
+        return -1;
+    }
+    memcpy(image, file_data + length, FRAME_BYTES);
+    return 0;
+}
+
+// reads a PNG file into image. Returns 0 if its chunks, zlib stream and rows are all valid
+static int read_png(const char *name)
+{
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    static unsigned char zlib[2 * PNG_RAW_SIZE];
+    size_t length = read_file(name, file_data, sizeof(file_data)), pos = 8, zlib_length = 0, used = 0, in, block;
+    uint32_t chunk_length, a = 1, b = 0;
+    int ended = 0, final = 0, row;
+
+    if (length < 8 || memcmp(file_data, signature, 8) != 0) {
+        return -1;
+    }
+    while (!ended) {
+        if (pos + 12 > length) {
+            return -1;
+        }
+        chunk_length = get32(&file_data[pos]);
+        if (chunk_length > length - pos - 12 || crc32(&file_data[pos + 4], chunk_length + 4) != get32(&file_data[pos + 8 + chunk_length])) {
+            return -1;
+        }
+        if (memcmp(&file_data[pos + 4], "IHDR", 4) == 0) {
+            if (chunk_length != 13 || get32(&file_data[pos + 8]) != HEADLESS_WIDTH || get32(&file_data[pos + 12]) != HEADLESS_HEIGHT ||
+                memcmp(&file_data[pos + 16], "\x08\x02\x00\x00\x00", 5) != 0) {
+                return -1;
+            }
+        } else if (memcmp(&file_data[pos + 4], "IDAT", 4) == 0) {
+            memcpy(&zlib[zlib_length], &file_data[pos + 8], chunk_length);
+            zlib_length += chunk_length;
+        } else if (memcmp(&file_data[pos + 4], "IEND", 4) == 0) {
+            ended = 1;
+        }
+        pos += 12 + chunk_length;
+    }
+
+    // the zlib header (deflate, and a valid check), then stored blocks up to the final one, and the Adler-32 of the rows
+    if (zlib_length < 6 || (zlib[0] & 0x0f) != 8 || ((zlib[0] << 8) | zlib[1]) % 31 != 0 || (zlib[1] & 0x20) != 0) {
+        return -1;
+    }
+    for (in = 2; !final; in += 5 + block) {
+        if (in + 5 > zlib_length || (zlib[in] & 0x06) != 0) {
+            return -1; // not a stored block
+        }
+        final = zlib[in] & 1;
+        block = zlib[in + 1] | (zlib[in + 2] << 8);
+        if ((block ^ (zlib[in + 3] | (zlib[in + 4] << 8))) != 0xffff || in + 5 + block > zlib_length || used + block > PNG_RAW_SIZE) {
+            return -1;
+        }
+        memcpy(&raw[used], &zlib[in + 5], block);
+        used += block;
+    }
+    if (used != PNG_RAW_SIZE || in + 4 != zlib_length) {
+        return -1;
+    }
+    for (pos = 0; pos < used; pos++) {
+        a = (a + raw[pos]) % 65521;
+        b = (b + a) % 65521;
+    }
+    if (get32(&zlib[in]) != ((b << 16) | a)) {
+        return -1;
+    }
+    for (row = 0; row < HEADLESS_HEIGHT; row++) {
+        if (raw[row * PNG_ROW_SIZE] != 0) {
+            return -1; // only filter type 0 (none) is written
+        }
+        memcpy(&image[row * 3 * HEADLESS_WIDTH], &raw[row * PNG_ROW_SIZE + 1], 3 * HEADLESS_WIDTH);
+    }
+    return 0;
+}
+
+// draws TEST_FRAMES frames into a file per frame, reading every one back. Returns 0 if they all hold their frame
+static int test_files(const char *path, int format)
+{
+    char name[64];
+    int frame, pixel;
+
+    if (DRAW_init_headless(path, format) != 0) {
+        return -1;
+    }
+    for (frame = 0; frame < TEST_FRAMES; frame++) {
+        draw_frame(frame);
+        sprintf(name, path, frame);
+        if (((format == DRAW_HEADLESS_PNG) ? read_png(name) : read_ppm(name)) != 0) {
+            printf("%s isn't a valid image\n", name);
+            return -1;
+        }
+        if (memcmp(image, expected, FRAME_BYTES) != 0) {
+            for (pixel = 0; image[3 * pixel] == ((unsigned char *)expected)[3 * pixel] &&
+                            image[3 * pixel + 1] == ((unsigned char *)expected)[3 * pixel + 1]; pixel++);
+            printf("%s differs from the frame drawn at (%d,%d)\n", name, pixel % HEADLESS_WIDTH, pixel / HEADLESS_WIDTH);
+            return -1;
+        }
+    }
+    DRAW_terminate();
+    for (frame = 0; frame < TEST_FRAMES; frame++) {
+        sprintf(name, path, frame);
+        remove(name);
+    }
+    return 0;
+}
+
+// draws TEST_FRAMES frames into a Y4M stream. Returns 0 if it holds all of them, each with the luma of its frame
+static int test_y4m(void)
+{
+    static unsigned char stream[128 + TEST_FRAMES * (6 + FRAME_BYTES / 2)];
+    char header[64];
+    size_t length, pos, header_length;
+    int frame, row, col, luma;
+
+    if (DRAW_init_headless(Y4M_PATH, DRAW_HEADLESS_Y4M) != 0) {
+        return -1;
+    }
+    for (frame = 0; frame < TEST_FRAMES; frame++) {
+        draw_frame(frame);
+        for (row = 0; row < HEADLESS_HEIGHT; row++) {
+            for (col = 0; col < HEADLESS_WIDTH; col++) {
+                y_planes[frame][row][col] = (unsigned char)(0.299 * expected[row][col][0] + 0.587 * expected[row][col][1] +
+                                                            0.114 * expected[row][col][2] + 0.5);
+            }
+        }
+    }
+    DRAW_terminate();
+
+    header_length = (size_t)sprintf(header, "YUV4MPEG2 W%u H%u %s Ip A1:1 C420jpeg\n", HEADLESS_WIDTH, HEADLESS_HEIGHT, HEADLESS_Y4M_RATE);
+    length = read_file(Y4M_PATH, stream, sizeof(stream));
+    if (length != header_length + TEST_FRAMES * (6 + FRAME_BYTES / 2) || memcmp(stream, header, header_length) != 0) {
+        printf("%s doesn't hold %d frames\n", Y4M_PATH, TEST_FRAMES);
+        return -1;
+    }
+    for (frame = 0, pos = header_length; frame < TEST_FRAMES; frame++, pos += 6 + FRAME_BYTES / 2) {
+        if (memcmp(&stream[pos], "FRAME\n", 6) != 0) {
+            printf("Frame %d of %s has no FRAME header\n", frame, Y4M_PATH);
+            return -1;
+        }
+        for (row = 0; row < HEADLESS_HEIGHT; row++) {
+            for (col = 0; col < HEADLESS_WIDTH; col++) {
+                luma = stream[pos + 6 + row * HEADLESS_WIDTH + col];
+                if (luma < y_planes[frame][row][col] - 1 || luma > y_planes[frame][row][col] + 1) {
+                    printf("The luma of frame %d of %s is %d instead of %d at (%d,%d)\n", frame, Y4M_PATH, luma, y_planes[frame][row][col], col, row);
+                    return -1;
+                }
+            }
+        }
+    }
+    remove(Y4M_PATH);
+    return 0;
+}
+
+int main(void)
+{
+    uint32_t c;
+    int i, k;
+
+    for (i = 0; i < 256; i++) {
+        for (c = (uint32_t)i, k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+    srand(TEST_SEED);
+    if (test_files(PPM_PATH, DRAW_HEADLESS_PPM) != 0 || test_files(PNG_PATH, DRAW_HEADLESS_PNG) != 0 || test_y4m() != 0) {
+        return 1;
+    }
+    printf("OK: %d PPM, %d PNG and %d Y4M frames\n", TEST_FRAMES, TEST_FRAMES, TEST_FRAMES);
+    return 0;
+}
@@ -0,0 +1,182 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : ring_test.c
+*
+* Description:
+* ------------
+* A stress test of the shared-memory ring of draw_ring.h. shm.c writes batches of messages of random lengths (up to DRAW_MAX_DATAGRAM bytes, each
+* filled with a pattern of its sequence number) while a thread of this program reads them the way BlankWindow does, pausing now and then so
+* that the writer has to wait for room. The records wrap around the end of the data about every thousand messages, and head and tail start
+* right below 2^32 so that they wrap around as well. Every message must arrive once, in order, with its length and bytes intact.
+* It is built with shm.c and thread.c, and run without arguments while BlankWindow isn't running (the ring is the one BlankWindow reads):
+*     gcc -I.. ring_test.c ../shm.c ../thread.c -o ring_test -lpthread -lrt
+* It prints the first message that differs (and returns 1), or the number of messages and bytes read.
+*
+*************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "draw_protocol.h"
+#include "draw_ring.h"
+#include "shm.h"
+#include "thread.h"
+
+#define TEST_MESSAGES 300000
+#define TEST_MAX_BATCH 64 // messages written by a single SHM_send_many
+#define TEST_START    (0xffffffffU - 5 * DRAW_RING_SIZE / 2 + 12345) // head and tail before the first message (wrapping around after a few MB)
+#define TEST_PAUSE_EVERY 4096 // the reader sleeps a millisecond every this many messages
+
+static draw_ring_t *ring; // this program's own mapping of the ring
+static volatile int failed;
+static unsigned long long bytes_read;
+
+// a hash of the sequence number of a message, from which its length and bytes are derived
+static uint32_t mix(uint32_t seq)
+{
+    seq ^= seq >> 16;
+    seq *= 0x7feb352d;
+    seq ^= seq >> 15;
+    seq *= 0x846ca68b;
+    seq ^= seq >> 16;
+    return seq;
+}
+
+static int message_size(uint32_t seq)
+{
+    return 1 + (int)(mix(seq) % DRAW_MAX_DATAGRAM);
+}
+
+static void fill_message(uint32_t seq, unsigned char *msg)
+{
+    int i, size = message_size(seq);
+
+    for (i = 0; i < size; i++) {
+        msg[i] = (unsigned char)(mix(seq) >> (8 * (i & 3))) ^ (unsigned char)i;
+    }
+}
+
+// creates the ring and positions head and tail (shm.c then opens it and continues from head)
+static int create_ring(void)
+{
+#ifdef _WIN32
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(draw_ring_t), DRAW_RING_NAME);
+
+    if (mapping == NULL) {
+        return -1;
+    }
+    ring = (draw_ring_t *)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(draw_ring_t));
+    if (ring == NULL) {
+        return -1;
+    }
+#else
+    int fd;
+    void *p;
+
+    shm_unlink(DRAW_RING_NAME); // a fresh ring, whatever an earlier run left in it
+    fd = shm_open(DRAW_RING_NAME, O_RDWR | O_CREAT, 0600);
+    if (fd < 0 || ftruncate(fd, sizeof(draw_ring_t)) != 0) {
+        return -1;
+    }
+    p = mmap(NULL, sizeof(draw_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+    ring = (draw_ring_t *)p;
+#endif
+    ring->version = DRAW_RING_VERSION;
+    ring->magic = DRAW_RING_MAGIC;
+    DRAW_RING_store(&ring->head, TEST_START);
+    DRAW_RING_store(&ring->tail, TEST_START);
+    return 0;
+}
+
+// reads the messages the way BlankWindow does, checking each of them
+static void reader_main(void *arg)
+{
+    static unsigned char msg[DRAW_MAX_DATAGRAM], expected[DRAW_MAX_DATAGRAM];
+    unsigned char length[DRAW_RING_RECORD_SIZE];
+    uint32_t tail = (uint32_t)DRAW_RING_load(&ring->tail), seq = 0;
+    int size;
+
+    (void)arg;
+    while (seq < TEST_MESSAGES) {
+        if ((uint32_t)DRAW_RING_load(&ring->head) == tail) {
+            THREAD_sleep_ms(0);
+            continue;
+        }
+        DRAW_ring_read(ring, tail, length, DRAW_RING_RECORD_SIZE);
+        size = length[0] | (length[1] << 8);
+        if (size != message_size(seq)) {
+            printf("Message %u has %d bytes instead of %d\n", seq, size, message_size(seq));
+            failed = 1;
+            return;
+        }
+        DRAW_ring_read(ring, tail + DRAW_RING_RECORD_SIZE, msg, size);
+        fill_message(seq, expected);
+        if (memcmp(msg, expected, size) != 0) {
+            printf("The bytes of message %u (at %u) differ\n", seq, tail);
+            failed = 1;
+            return;
+        }
+        tail += DRAW_RING_RECORD_SIZE + size;
+        bytes_read += size;
+        DRAW_RING_store(&ring->tail, tail);
+        seq++;
+        if (seq % TEST_PAUSE_EVERY == 0) {
+            THREAD_sleep_ms(1);
+        }
+    }
+}
+
+int main(void)
+{
+    static unsigned char batch[TEST_MAX_BATCH][DRAW_MAX_DATAGRAM];
+    unsigned char *msgs[TEST_MAX_BATCH];
+    int sizes[TEST_MAX_BATCH];
+    thread_t reader;
+    uint32_t seq = 0;
+    int i, count;
+
+    if (create_ring() != 0 || SHM_init() != 0) {
+        printf("Couldn't create the ring\n");
+        return 1;
+    }
+    if (THREAD_create(&reader, reader_main, NULL) != 0) {
+        printf("Couldn't start the reader\n");
+        return 1;
+    }
+    srand(1);
+    while (seq < TEST_MESSAGES && !failed) {
+        count = 1 + rand() % TEST_MAX_BATCH;
+        if (count > TEST_MESSAGES - (int)seq) {
+            count = TEST_MESSAGES - (int)seq;
+        }
+        for (i = 0; i < count; i++, seq++) {
+            fill_message(seq, batch[i]);
+            msgs[i] = batch[i];
+            sizes[i] = message_size(seq);
+        }
+        SHM_send_many(msgs, sizes, count);
+    }
+    THREAD_join(&reader);
+    SHM_terminate();
+#ifndef _WIN32
+    shm_unlink(DRAW_RING_NAME);
+#endif
+    if (failed) {
+        return 1;
+    }
+    printf("OK: %d messages, %llu bytes, head wrapped around to %u\n", TEST_MESSAGES, bytes_read, (uint32_t)DRAW_RING_load(&ring->head));
+    return 0;
+}
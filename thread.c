@@ -0,0 +1,190 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : thread.c
+*
+* Description:
+* ------------
+* This file implements the thread, lock and clock functions declared in thread.h, using the Win32 API on Windows and POSIX threads elsewhere.
+*
+*************************************************************************/
+
+#include <stdlib.h>
+#include "thread.h"
+
+#ifndef _WIN32
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+// the function and argument of a new thread, passed from THREAD_create to the start routine (which frees them)
+typedef struct {
+    void (*func)(void *arg);
+    void *arg;
+} thread_start_t;
+
+#ifdef _WIN32
+static DWORD WINAPI thread_start(LPVOID param)
+#else
+static void *thread_start(void *param)
+#endif
+{
+    thread_start_t start = *(thread_start_t *)param;
+
+    free(param);
+    start.func(start.arg);
+    return 0;
+}
+
+int THREAD_create(thread_t *thread, void (*func)(void *arg), void *arg)
+{
+    thread_start_t *start = (thread_start_t *)malloc(sizeof(thread_start_t));
+
+    if (start == NULL) {
+        return -1;
+    }
+    start->func = func;
+    start->arg = arg;
+#ifdef _WIN32
+    *thread = CreateThread(NULL, 0, thread_start, start, 0, NULL);
+    if (*thread == NULL) {
+        free(start);
+        return -1;
+    }
+#else
+    if (pthread_create(thread, NULL, thread_start, start) != 0) {
+        free(start);
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+void THREAD_join(thread_t *thread)
+{
+#ifdef _WIN32
+    WaitForSingleObject(*thread, INFINITE);
+    CloseHandle(*thread);
+#else
+    pthread_join(*thread, NULL);
+#endif
+}
+
+int THREAD_cpu_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return (info.dwNumberOfProcessors > 0) ? (int)info.dwNumberOfProcessors : 1;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (count > 0) ? (int)count : 1;
+#endif
+}
+
+unsigned long long THREAD_time_ms(void)
+{
+#ifdef _WIN32
+    return GetTickCount64();
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+#endif
+}
+
+unsigned long long THREAD_time_ns(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER frequency; // counts per second (fixed at boot, so it is only queried once)
+    LARGE_INTEGER now;
+
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&now);
+    // splitting the conversion, so that the multiplication doesn't overflow
+    return (unsigned long long)(now.QuadPart / frequency.QuadPart) * 1000000000ULL +
+        (unsigned long long)(now.QuadPart % frequency.QuadPart) * 1000000000ULL / frequency.QuadPart;
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+unsigned long long THREAD_epoch_ms(void)
+{
+#ifdef _WIN32
+    FILETIME now;
+    ULARGE_INTEGER ticks;
+
+    GetSystemTimeAsFileTime(&now); // 100 ns ticks since January 1, 1601
+    ticks.LowPart = now.dwLowDateTime;
+    ticks.HighPart = now.dwHighDateTime;
+    return (ticks.QuadPart - 116444736000000000ULL) / 10000;
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (unsigned long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+#endif
+}
+
+void THREAD_sleep_ms(unsigned int ms)
+{
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    struct timespec duration;
+
+    if (ms == 0) {
+        sched_yield();
+        return;
+    }
+    duration.tv_sec = ms / 1000;
+    duration.tv_nsec = (long)(ms % 1000) * 1000000;
+    nanosleep(&duration, NULL);
+#endif
+}
+
+void MUTEX_init(mutex_t *mutex)
+{
+#ifdef _WIN32
+    InitializeCriticalSection(mutex);
+#else
+    pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+void MUTEX_destroy(mutex_t *mutex)
+{
+#ifdef _WIN32
+    DeleteCriticalSection(mutex);
+#else
+    pthread_mutex_destroy(mutex);
+#endif
+}
+
+void MUTEX_lock(mutex_t *mutex)
+{
+#ifdef _WIN32
+    EnterCriticalSection(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+}
+
+void MUTEX_unlock(mutex_t *mutex)
+{
+#ifdef _WIN32
+    LeaveCriticalSection(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+}
@@ -0,0 +1,87 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : thread.h
+*
+* Description:
+* ------------
+* This file declares a thin portability layer over the threads, locks and clocks of the host (Win32 on Windows, POSIX threads elsewhere),
+* used by the parts of the simulator that run more than one thread (e.g. the batch runner), or share data between threads (snapshot pages).
+*
+*************************************************************************/
+
+#ifndef __THREAD_H
+#define __THREAD_H
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#endif
+
+// size of a cache line on the hosts we run on. Data written by different threads is kept this far apart, so the threads don't share cache lines
+#define CACHE_LINE_SIZE 64
+
+#ifdef _WIN32
+typedef HANDLE thread_t;
+typedef CRITICAL_SECTION mutex_t;
+#else
+typedef pthread_t thread_t;
+typedef pthread_mutex_t mutex_t;
+#endif
+
+// starts a thread running func(arg). Returns 0 on success, and -1 if the thread couldn't be created
+int THREAD_create(thread_t *thread, void (*func)(void *arg), void *arg);
+
+// waits for a thread created by THREAD_create to return
+void THREAD_join(thread_t *thread);
+
+// returns the number of processors available to the process (at least 1)
+int THREAD_cpu_count(void);
+
+// returns the time in milliseconds since some fixed point (a monotonic clock, which is only meaningful for measuring intervals)
+unsigned long long THREAD_time_ms(void);
+
+// the same clock in nanoseconds (for timing short intervals, e.g. a single syscall)
+unsigned long long THREAD_time_ns(void);
+
+// returns the wall-clock time in milliseconds since January 1, 1970 (UTC)
+unsigned long long THREAD_epoch_ms(void);
+
+// suspends the calling thread for the given number of milliseconds (0 only gives up the rest of its time slice)
+void THREAD_sleep_ms(unsigned int ms);
+
+// a counter shared between threads, changed with ATOMIC_increment/ATOMIC_decrement (which return its new value)
+typedef volatile long atomic_t;
+#ifdef _WIN32
+#define ATOMIC_increment(counter) InterlockedIncrement(counter)
+#define ATOMIC_decrement(counter) InterlockedDecrement(counter)
+#else
+#define ATOMIC_increment(counter) __sync_add_and_fetch(counter, 1)
+#define ATOMIC_decrement(counter) __sync_sub_and_fetch(counter, 1)
+#endif
+
+/* Reading a counter written by another thread, and writing a counter another thread reads. Everything written before ATOMIC_store is visible to
+   a thread that reads the stored value with ATOMIC_load (e.g. the records of a ring buffer, published by storing its new head).
+*/
+#ifdef _WIN32
+#define ATOMIC_load(counter) InterlockedCompareExchange(counter, 0, 0)
+#define ATOMIC_store(counter, value) InterlockedExchange(counter, value)
+#else
+#define ATOMIC_load(counter) __atomic_load_n(counter, __ATOMIC_ACQUIRE)
+#define ATOMIC_store(counter, value) __atomic_store_n(counter, value, __ATOMIC_RELEASE)
+#endif
+
+// sets a counter to value if it still holds expected, and returns whether it did (for a counter which more than one thread may change)
+#ifdef _WIN32
+#define ATOMIC_cas(counter, expected, value) (InterlockedCompareExchange(counter, value, expected) == (expected))
+#else
+#define ATOMIC_cas(counter, expected, value) __sync_bool_compare_and_swap(counter, expected, value)
+#endif
+
+void MUTEX_init(mutex_t *mutex);
+void MUTEX_destroy(mutex_t *mutex);
+void MUTEX_lock(mutex_t *mutex);
+void MUTEX_unlock(mutex_t *mutex);
+
+#endif /* __THREAD_H */
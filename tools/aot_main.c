@@ -0,0 +1,60 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : aot_main.c
+*
+* Description:
+* ------------
+* Main file for running a program translated by mips_aot. It is built together with the generated C file and the simulator sources (instead of
+* main.c), and it loads the data and program files the same way main.c does, so syscalls, memory and graphics behave exactly the same.
+*
+*************************************************************************/
+
+#include "mips_aot.h"
+#include "draw.h"
+
+int main(int argc, char *argv[])
+{
+    MIPS_cpu_t *cpu;
+    MIPS_info_t mips_info;
+    unsigned int i;
+
+    if (argc != 3) {
+        printf("Usage: %s <data hex file> <program hex file>\n", argv[0]);
+        return 1;
+    }
+
+    cpu = MIPS_create();
+    if (cpu == NULL) {
+        printf("Not enough memory\n");
+        return 1;
+    }
+    MIPS_cpu_set_layout(cpu, AOT_layout);
+    if (MIPS_cpu_init(cpu, argv[1], argv[2]) != 0) {
+        return 1;
+    }
+    MIPS_cpu_get_info(cpu, &mips_info);
+
+    // the translated code doesn't read program memory, so running it with a different program file would silently run the wrong program
+    if (*(mips_info.prog_size) != AOT_program_size) {
+        printf("%s doesn't contain the program this file was generated from\n", argv[2]);
+        return 1;
+    }
+    for (i = 0; i < AOT_program_size; i++) {
+        if (mips_info.prog_mem_base[i] != AOT_program[i]) {
+            printf("%s doesn't contain the program this file was generated from\n", argv[2]);
+            return 1;
+        }
+    }
+
+    DRAW_init();
+
+    if (AOT_run(cpu) == AOT_RUN_UNTRANSLATED) {
+        MIPS_cpu_run(cpu, 0, NULL); // finishing in the simulator from the address the translated code couldn't reach
+    }
+
+    DRAW_terminate();
+    MIPS_destroy(cpu);
+
+    return 0;
+}
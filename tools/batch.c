@@ -0,0 +1,578 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : batch.c
+*
+* Description:
+* ------------
+* Batch runner, which runs many program/input jobs on all of the processors. It is built together with the simulator sources and thread.c
+* (instead of main.c), and run as:
+*     batch <manifest> <summary file> [-j threads] [-e engine] [-l layout] [-b budget] [-t milliseconds] [-o output folder] [-p profile folder]
+* Every line of the manifest describes one job (empty lines and lines starting with # are skipped):
+*     <name> <data hex file> <program hex file> [<input file> [<instruction budget> [<time limit in milliseconds>]]]
+* A program image (see hex2img.c) can be given instead of the hex files, as the data file with - as the program file (it records its own layout).
+* The input file (- for none) holds the integers read by the read_int syscall. A budget or time limit of 0 (or one that is missing) takes the
+* default given with -b/-t, and 0 there means no limit.
+*
+* Every worker thread owns a simulator context, which it initializes again for every job it runs, and a deque of jobs. A worker takes jobs from the
+* back of its own deque, and once it is empty, steals jobs from the front of the other workers' deques, so the workers stay busy until the whole
+* batch is finished even when the jobs take very different times. The console of the context is redirected to the worker, which feeds it the job's
+* input and captures its output (written to <output folder>/<name>.out with -o). The summary file gets a line for every job (in manifest order) with
+* its status, the number of instructions it executed, its run time, and the size and FNV-1a hash of its output.
+* The jobs run on the virtual clock (see MIPS_set_clock), so an animation that sleeps between its frames doesn't wait, and its output is reproducible.
+* With -p, the jobs are profiled, and the profile of every job is written to <profile folder>/<name>.prof and <name>.stacks (see MIPS_write_profile),
+* so the guest functions that dominate the run time of a whole batch can be found (e.g. by concatenating the .stacks files for flamegraph.pl).
+*
+*************************************************************************/
+
+#include "mips.h"
+#include "thread.h"
+
+#define MAX_LINE            1024 // maximal length of a manifest line
+#define SLICE_INSTRUCTIONS  1000000 // jobs run in slices of this many instructions, and the time limit is checked between slices
+#define MAX_OUTPUT_SIZE     (16 * 1024 * 1024) // output beyond this size is counted and hashed, but not stored
+#define FNV_OFFSET_BASIS    0xcbf29ce484222325ULL
+#define FNV_PRIME           0x100000001b3ULL
+
+// job statuses
+#define JOB_PENDING 0 // not run yet
+#define JOB_EXIT    1 // the program executed an exit syscall
+#define JOB_BUDGET  2 // the instruction budget was used up
+#define JOB_TIMEOUT 3 // the time limit was reached
+#define JOB_ERROR   4 // one of the files couldn't be read
+
+static const char *status_names[] = { "pending", "exit", "budget", "timeout", "error" };
+
+typedef struct {
+    // read from the manifest
+    char *name;
+    char *data_filename;
+    char *prog_filename;
+    char *input_filename; // NULL for none
+    unsigned long long budget; // 0 for no limit
+    unsigned long long time_limit; // in milliseconds, 0 for no limit
+    // results, written once by the worker that ran the job
+    int status;
+    unsigned long long instructions;
+    unsigned long long ms;
+    unsigned long long output_size;
+    unsigned long long output_hash;
+} job_t;
+
+struct batch_s;
+
+/* State of a worker thread. It is only written by its own thread, except for the deque (top is also advanced by thieves), which is protected by
+   the lock. Every worker starts on its own cache line (see padded_worker_t), so the workers don't slow each other down through false sharing.
+*/
+typedef struct {
+    mutex_t lock; // protects top and bottom
+    unsigned int *deque; // job indices. The worker pops from bottom, thieves take from top
+    unsigned int top, bottom;
+    struct batch_s *batch;
+    MIPS_cpu_t *cpu; // allocated by the worker thread itself, so its memory is local to the processor running it
+    thread_t thread;
+    // console of the running job
+    char *output;
+    size_t output_stored; // number of bytes in output (at most MAX_OUTPUT_SIZE)
+    size_t output_capacity;
+    unsigned long long output_size; // number of bytes written by the job (including the ones that weren't stored)
+    unsigned long long output_hash;
+    const char *input; // the rest of the job's input (null-terminated)
+    // statistics
+    unsigned long long jobs_run;
+    unsigned long long steals;
+} worker_t;
+
+typedef union {
+    worker_t worker;
+    char padding[(sizeof(worker_t) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE];
+} padded_worker_t;
+
+typedef struct batch_s {
+    job_t *jobs;
+    unsigned int num_jobs;
+    padded_worker_t *workers;
+    int num_workers;
+    int engine;
+    int layout; // memory layout of all the jobs (MIPS_LAYOUT_*)
+    const char *output_folder; // NULL if the outputs aren't written
+    const char *profile_folder; // NULL if the jobs aren't profiled
+} batch_t;
+
+// copies a string to a new allocation (strdup isn't part of standard C)
+static char *copy_string(const char *str)
+{
+    size_t length = strlen(str) + 1;
+    char *copy = (char *)malloc(length);
+
+    if (copy != NULL) {
+        memcpy(copy, str, length);
+    }
+    return copy;
+}
+
+// reads an entire file into a new null-terminated buffer. Returns NULL if the file can't be read
+static char *read_whole_file(const char *filename)
+{
+    FILE *fptr = fopen(filename, "rb");
+    char *buffer = NULL;
+    size_t size = 0, capacity = 0, n;
+
+    if (fptr == NULL) {
+        return NULL;
+    }
+    do {
+        if (capacity - size < 4096 + 1) {
+            char *bigger = (char *)realloc(buffer, capacity * 2 + 4096 + 1);
+            if (bigger == NULL) {
+                free(buffer);
+                fclose(fptr);
+                return NULL;
+            }
+            buffer = bigger;
+            capacity = capacity * 2 + 4096 + 1;
+        }
+        n = fread(buffer + size, 1, capacity - size - 1, fptr);
+        size += n;
+    } while (n > 0);
+    fclose(fptr);
+    buffer[size] = '\0';
+    return buffer;
+}
+
+// console write function of the workers: the output is hashed, and stored up to MAX_OUTPUT_SIZE
+static void worker_write(void *user, const char *text, size_t length)
+{
+    worker_t *w = (worker_t *)user;
+    size_t i, store = length;
+
+    for (i = 0; i < length; i++) {
+        w->output_hash = (w->output_hash ^ (unsigned char)text[i]) * FNV_PRIME;
+    }
+    w->output_size += length;
+
+    if (store > MAX_OUTPUT_SIZE - w->output_stored) {
+        store = MAX_OUTPUT_SIZE - w->output_stored;
+    }
+    if (w->output_stored + store > w->output_capacity) {
+        size_t capacity = (w->output_capacity == 0) ? 4096 : w->output_capacity;
+        char *bigger;
+
+        while (capacity < w->output_stored + store) {
+            capacity *= 2;
+        }
+        bigger = (char *)realloc(w->output, capacity);
+        if (bigger == NULL) {
+            return;
+        }
+        w->output = bigger;
+        w->output_capacity = capacity;
+    }
+    memcpy(w->output + w->output_stored, text, store);
+    w->output_stored += store;
+}
+
+// console read_int function of the workers, reading the next integer of the job's input (the same way scanf("%d") does)
+static int worker_read_int(void *user, int32_t *value)
+{
+    worker_t *w = (worker_t *)user;
+    char *end;
+    long number;
+
+    if (w->input == NULL) {
+        return 0;
+    }
+    number = strtol(w->input, &end, 10);
+    if (end == w->input) {
+        return 0; // end of input, or something which isn't a number
+    }
+    w->input = end;
+    *value = (int32_t)number;
+    return 1;
+}
+
+// returns <folder>/<name><extension> in a new allocation (NULL if there isn't enough memory)
+static char *job_filename(const char *folder, const job_t *job, const char *extension)
+{
+    char *filename = (char *)malloc(strlen(folder) + strlen(job->name) + strlen(extension) + 2);
+
+    if (filename != NULL) {
+        sprintf(filename, "%s/%s%s", folder, job->name, extension);
+    }
+    return filename;
+}
+
+// writes the captured output of the job to <output folder>/<name>.out
+static void write_output(batch_t *batch, worker_t *w, job_t *job)
+{
+    char *filename = job_filename(batch->output_folder, job, ".out");
+    FILE *fptr;
+
+    if (filename == NULL) {
+        return;
+    }
+    fptr = fopen(filename, "wb");
+    if (fptr != NULL) {
+        fwrite(w->output, 1, w->output_stored, fptr);
+        fclose(fptr);
+    } else {
+        fprintf(stderr, "Can't write %s\n", filename);
+    }
+    free(filename);
+}
+
+// writes the profile of the job to <profile folder>/<name>.prof and <name>.stacks
+static void write_profile(batch_t *batch, worker_t *w, job_t *job)
+{
+    char *flat_filename = job_filename(batch->profile_folder, job, ".prof");
+    char *stacks_filename = job_filename(batch->profile_folder, job, ".stacks");
+
+    if (flat_filename != NULL && stacks_filename != NULL) {
+        MIPS_cpu_write_profile(w->cpu, flat_filename, stacks_filename);
+    }
+    free(flat_filename);
+    free(stacks_filename);
+}
+
+static void run_job(batch_t *batch, worker_t *w, job_t *job)
+{
+    MIPS_info_t info;
+    char *input = NULL;
+    unsigned long long start, slice;
+    int reason, result;
+
+    w->output_stored = 0;
+    w->output_size = 0;
+    w->output_hash = FNV_OFFSET_BASIS;
+    w->input = NULL;
+
+    start = THREAD_time_ms();
+    if (strcmp(job->prog_filename, "-") == 0) {
+        result = MIPS_cpu_load_image(w->cpu, job->data_filename);
+    } else {
+        MIPS_cpu_set_layout(w->cpu, batch->layout); // an image loaded by a previous job may have selected another layout
+        result = MIPS_cpu_init(w->cpu, job->data_filename, job->prog_filename);
+    }
+    if (result != 0) {
+        job->status = JOB_ERROR;
+        return;
+    }
+    if (job->input_filename != NULL) {
+        input = read_whole_file(job->input_filename);
+        if (input == NULL) {
+            job->status = JOB_ERROR;
+            return;
+        }
+        w->input = input;
+    }
+    MIPS_cpu_get_info(w->cpu, &info);
+
+    for (;;) {
+        slice = SLICE_INSTRUCTIONS;
+        if (job->budget != 0 && job->budget - *info.instructions < slice) {
+            slice = job->budget - *info.instructions;
+        }
+        reason = MIPS_cpu_run(w->cpu, slice, NULL);
+        if (reason == MIPS_RUN_EXIT) {
+            job->status = JOB_EXIT;
+            break;
+        }
+        if (job->budget != 0 && *info.instructions >= job->budget) {
+            job->status = JOB_BUDGET;
+            break;
+        }
+        if (job->time_limit != 0 && THREAD_time_ms() - start >= job->time_limit) {
+            job->status = JOB_TIMEOUT;
+            break;
+        }
+    }
+
+    job->instructions = *info.instructions;
+    job->ms = THREAD_time_ms() - start;
+    job->output_size = w->output_size;
+    job->output_hash = w->output_hash;
+    if (batch->output_folder != NULL) {
+        write_output(batch, w, job);
+    }
+    if (batch->profile_folder != NULL) {
+        write_profile(batch, w, job);
+    }
+    free(input);
+}
+
+// takes a job from the back of the worker's own deque. Returns -1 if it is empty
+static int pop_job(worker_t *w)
+{
+    int job = -1;
+
+    MUTEX_lock(&w->lock);
+    if (w->bottom != w->top) {
+        job = w->deque[--w->bottom];
+    }
+    MUTEX_unlock(&w->lock);
+    return job;
+}
+
+// takes a job from the front of another worker's deque. Returns -1 if all of the deques are empty
+static int steal_job(batch_t *batch, int thief)
+{
+    int i, job = -1;
+
+    for (i = 1; i < batch->num_workers && job < 0; i++) {
+        worker_t *victim = &batch->workers[(thief + i) % batch->num_workers].worker;
+
+        MUTEX_lock(&victim->lock);
+        if (victim->top != victim->bottom) {
+            job = victim->deque[victim->top++];
+        }
+        MUTEX_unlock(&victim->lock);
+    }
+    return job;
+}
+
+static void worker_main(void *arg)
+{
+    worker_t *w = (worker_t *)arg;
+    batch_t *batch = w->batch;
+    int index = (int)((padded_worker_t *)w - batch->workers);
+    MIPS_console_t console;
+    int job;
+
+    w->cpu = MIPS_create();
+    if (w->cpu == NULL) {
+        fprintf(stderr, "Not enough memory for worker %d\n", index);
+        return; // the other workers steal its jobs
+    }
+    MIPS_cpu_set_engine(w->cpu, batch->engine);
+    MIPS_cpu_set_layout(w->cpu, batch->layout);
+    MIPS_cpu_set_draw(w->cpu, 0); // there is no BlankWindow to draw on
+    MIPS_cpu_set_clock(w->cpu, MIPS_CLOCK_VIRTUAL, 1); // sleeping doesn't hold up the batch, and the times a job sees are the same on every run
+    if (batch->profile_folder != NULL && MIPS_cpu_set_profiling(w->cpu, 1) != 0) {
+        fprintf(stderr, "Not enough memory for the profile of worker %d\n", index);
+    }
+    console.write = worker_write;
+    console.read_int = worker_read_int;
+    console.user = w;
+    MIPS_cpu_set_console(w->cpu, &console);
+
+    for (;;) {
+        job = pop_job(w);
+        if (job < 0) {
+            job = steal_job(batch, index);
+            if (job < 0) {
+                break; // no job is left waiting (jobs are never added, so the batch is finishing)
+            }
+            w->steals++;
+        }
+        run_job(batch, w, &batch->jobs[job]);
+        w->jobs_run++;
+    }
+
+    MIPS_destroy(w->cpu);
+    free(w->output);
+}
+
+// reads the manifest into batch->jobs. Returns 0 on success, and -1 on error
+static int read_manifest(batch_t *batch, const char *filename, unsigned long long budget, unsigned long long time_limit)
+{
+    FILE *fptr = fopen(filename, "r");
+    char line[MAX_LINE];
+    char *fields[6], *token;
+    unsigned int capacity = 0, line_number = 0;
+    int num_fields;
+    job_t *job;
+
+    if (fptr == NULL) {
+        printf("Can't open %s\n", filename);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fptr) != NULL) {
+        line_number++;
+        num_fields = 0;
+        token = strtok(line, " \t\r\n");
+        while (token != NULL && num_fields < 6) {
+            fields[num_fields++] = token;
+            token = strtok(NULL, " \t\r\n");
+        }
+        if (num_fields == 0 || fields[0][0] == '#') {
+            continue;
+        }
+        if (num_fields < 3) {
+            printf("%s:%u: expected <name> <data hex file> <program hex file> [<input file> [<budget> [<time limit>]]]\n", filename, line_number);
+            fclose(fptr);
+            return -1;
+        }
+
+        if (batch->num_jobs == capacity) {
+            job_t *bigger;
+
+            capacity = (capacity == 0) ? 64 : capacity * 2;
+            bigger = (job_t *)realloc(batch->jobs, capacity * sizeof(job_t));
+            if (bigger == NULL) {
+                printf("Not enough memory for %u jobs\n", capacity);
+                fclose(fptr);
+                return -1;
+            }
+            batch->jobs = bigger;
+        }
+        job = &batch->jobs[batch->num_jobs++];
+        memset(job, 0, sizeof(job_t));
+        job->name = copy_string(fields[0]);
+        job->data_filename = copy_string(fields[1]);
+        job->prog_filename = copy_string(fields[2]);
+        job->input_filename = (num_fields > 3 && strcmp(fields[3], "-") != 0) ? copy_string(fields[3]) : NULL;
+        job->budget = (num_fields > 4) ? strtoull(fields[4], NULL, 0) : 0;
+        job->time_limit = (num_fields > 5) ? strtoull(fields[5], NULL, 0) : 0;
+        if (job->budget == 0) {
+            job->budget = budget;
+        }
+        if (job->time_limit == 0) {
+            job->time_limit = time_limit;
+        }
+        job->status = JOB_PENDING;
+    }
+    fclose(fptr);
+    return 0;
+}
+
+static int write_summary(batch_t *batch, const char *filename, unsigned long long wall_ms)
+{
+    FILE *fptr = fopen(filename, "w");
+    unsigned long long instructions = 0, steals = 0;
+    unsigned int i, counts[5] = { 0 };
+    int w;
+
+    if (fptr == NULL) {
+        printf("Can't write %s\n", filename);
+        return -1;
+    }
+    fprintf(fptr, "# name\tstatus\tinstructions\tms\toutput_bytes\toutput_hash\n");
+    for (i = 0; i < batch->num_jobs; i++) {
+        job_t *job = &batch->jobs[i];
+
+        fprintf(fptr, "%s\t%s\t%llu\t%llu\t%llu\t%016llx\n", job->name, status_names[job->status], job->instructions, job->ms, job->output_size,
+            job->output_hash);
+        instructions += job->instructions;
+        counts[job->status]++;
+    }
+    for (w = 0; w < batch->num_workers; w++) {
+        steals += batch->workers[w].worker.steals;
+    }
+
+    fprintf(fptr, "# %u jobs (%u exit, %u budget, %u timeout, %u error), %d threads, %llu steals\n", batch->num_jobs, counts[JOB_EXIT], counts[JOB_BUDGET],
+        counts[JOB_TIMEOUT], counts[JOB_ERROR], batch->num_workers, steals);
+    fprintf(fptr, "# %llu instructions in %llu ms (%.1f million instructions per second)\n", instructions, wall_ms,
+        (wall_ms != 0) ? instructions / (wall_ms * 1000.0) : 0.0);
+    fclose(fptr);
+
+    printf("%u jobs (%u exit, %u budget, %u timeout, %u error) on %d threads: %llu instructions in %llu ms\n", batch->num_jobs, counts[JOB_EXIT],
+        counts[JOB_BUDGET], counts[JOB_TIMEOUT], counts[JOB_ERROR], batch->num_workers, instructions, wall_ms);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    batch_t batch;
+    char *memory;
+    unsigned long long budget = 0, time_limit = 0, start, wall_ms;
+    unsigned int i;
+    int w, arg, result;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.num_workers = THREAD_cpu_count();
+    batch.engine = MIPS_ENGINE_JIT; // falls back to the block engine where the JIT isn't available
+
+    if (argc < 3) {
+        printf("Usage: %s <manifest> <summary file> [-j threads] [-e engine] [-l layout] [-b budget] [-t milliseconds] [-o output folder] [-p profile folder]\n", argv[0]);
+        return 1;
+    }
+    for (arg = 3; arg + 1 < argc; arg += 2) {
+        if (strcmp(argv[arg], "-j") == 0) {
+            batch.num_workers = atoi(argv[arg + 1]);
+        } else if (strcmp(argv[arg], "-e") == 0) {
+            batch.engine = atoi(argv[arg + 1]);
+        } else if (strcmp(argv[arg], "-l") == 0) {
+            batch.layout = atoi(argv[arg + 1]);
+        } else if (strcmp(argv[arg], "-b") == 0) {
+            budget = strtoull(argv[arg + 1], NULL, 0);
+        } else if (strcmp(argv[arg], "-t") == 0) {
+            time_limit = strtoull(argv[arg + 1], NULL, 0);
+        } else if (strcmp(argv[arg], "-o") == 0) {
+            batch.output_folder = argv[arg + 1];
+        } else if (strcmp(argv[arg], "-p") == 0) {
+            batch.profile_folder = argv[arg + 1];
+        } else {
+            break;
+        }
+    }
+    if (arg != argc || batch.num_workers < 1 || batch.layout < MIPS_LAYOUT_COMPACT_DATA_AT_0 || batch.layout > MIPS_LAYOUT_COMPACT_TEXT_AT_0) {
+        printf("Usage: %s <manifest> <summary file> [-j threads] [-e engine] [-l layout] [-b budget] [-t milliseconds] [-o output folder] [-p profile folder]\n", argv[0]);
+        return 1;
+    }
+
+    if (read_manifest(&batch, argv[1], budget, time_limit) != 0) {
+        return 1;
+    }
+    if ((unsigned int)batch.num_workers > batch.num_jobs && batch.num_jobs > 0) {
+        batch.num_workers = batch.num_jobs;
+    }
+
+    // the workers are aligned to a cache line (malloc only guarantees the alignment of the basic types)
+    memory = (char *)malloc(batch.num_workers * sizeof(padded_worker_t) + CACHE_LINE_SIZE);
+    if (memory == NULL) {
+        printf("Not enough memory for %d threads\n", batch.num_workers);
+        return 1;
+    }
+    batch.workers = (padded_worker_t *)(memory + CACHE_LINE_SIZE - (size_t)memory % CACHE_LINE_SIZE);
+    memset(batch.workers, 0, batch.num_workers * sizeof(padded_worker_t));
+
+    // dealing the jobs out in contiguous ranges. Stealing evens out the differences between the run times of the ranges
+    for (w = 0; w < batch.num_workers; w++) {
+        worker_t *worker = &batch.workers[w].worker;
+        unsigned int first = (unsigned int)((unsigned long long)batch.num_jobs * w / batch.num_workers);
+        unsigned int last = (unsigned int)((unsigned long long)batch.num_jobs * (w + 1) / batch.num_workers);
+
+        MUTEX_init(&worker->lock);
+        worker->batch = &batch;
+        worker->deque = (unsigned int *)malloc((last - first + 1) * sizeof(unsigned int));
+        if (worker->deque == NULL) {
+            printf("Not enough memory for the job queues\n");
+            return 1;
+        }
+        // the worker pops from the back, so the range is stored in reverse to run the jobs in manifest order
+        for (i = first; i < last; i++) {
+            worker->deque[last - 1 - i] = i;
+        }
+        worker->top = 0;
+        worker->bottom = last - first;
+    }
+
+    start = THREAD_time_ms();
+    for (w = 0; w < batch.num_workers; w++) {
+        if (THREAD_create(&batch.workers[w].worker.thread, worker_main, &batch.workers[w].worker) != 0) {
+            printf("Can't create thread %d\n", w);
+            return 1;
+        }
+    }
+    for (w = 0; w < batch.num_workers; w++) {
+        THREAD_join(&batch.workers[w].worker.thread);
+    }
+    wall_ms = THREAD_time_ms() - start;
+
+    result = write_summary(&batch, argv[2], wall_ms);
+
+    for (w = 0; w < batch.num_workers; w++) {
+        MUTEX_destroy(&batch.workers[w].worker.lock);
+        free(batch.workers[w].worker.deque);
+    }
+    free(memory);
+    for (i = 0; i < batch.num_jobs; i++) {
+        free(batch.jobs[i].name);
+        free(batch.jobs[i].data_filename);
+        free(batch.jobs[i].prog_filename);
+        free(batch.jobs[i].input_filename);
+    }
+    free(batch.jobs);
+
+    return (result == 0) ? 0 : 1;
+}
@@ -0,0 +1,50 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : hex2img.c
+*
+* Description:
+* ------------
+* Converts the pair of hex files MARS dumps (the .data segment and the program) into a single program image (see mips_image.h), which the simulator
+* loads with MIPS_load_image. It is built together with mips_image.c and the simulator sources (except main.c), and run as:
+*     hex2img <data hex file> <program hex file> <image file> [layout]
+* The layout (MIPS_LAYOUT_*, 0 by default) must be the MARS memory configuration the program was assembled with, and it is recorded in the image.
+*
+*************************************************************************/
+
+#include "mips.h"
+#include "mips_image.h"
+
+int main(int argc, char *argv[])
+{
+    uint32_t *data, *program, data_words, program_words, text_base, data_base;
+    int layout = MIPS_LAYOUT_COMPACT_DATA_AT_0;
+    int result;
+
+    if (argc != 4 && argc != 5) {
+        printf("Usage: %s <data hex file> <program hex file> <image file> [layout]\n", argv[0]);
+        return 1;
+    }
+    if (argc == 5) {
+        layout = atoi(argv[4]);
+    }
+    if (MIPS_get_layout_bases(layout, &text_base, &data_base) != 0) {
+        printf("Unknown memory layout %d\n", layout);
+        return 1;
+    }
+
+    data = IMAGE_read_hex(argv[1], &data_words);
+    if (data == NULL) {
+        return 1;
+    }
+    program = IMAGE_read_hex(argv[2], &program_words);
+    if (program == NULL) {
+        free(data);
+        return 1;
+    }
+
+    result = IMAGE_write(argv[3], (uint32_t)layout, program, program_words, text_base, data, data_words, data_base);
+    free(data);
+    free(program);
+    return (result == 0) ? 0 : 1;
+}
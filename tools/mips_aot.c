@@ -0,0 +1,384 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_aot.c
+*
+* Description:
+* ------------
+* Ahead-of-time translator: reads a program hex file (the same format MIPS_init reads) and generates a C file implementing the program as native
+* code, with a label for every reachable instruction. The generated file is compiled together with aot_main.c and the simulator sources, so loads,
+* stores and syscalls still go through the simulator's memory model and syscall handler.
+* Every instruction is decoded by the simulator's own predecoder, so the generated code follows exactly the same decoding as the interpreter.
+* The guest registers are kept in local variables (which the compiler can keep in host registers), and written back to the register file around
+* syscalls. Targets of jr/jalr are looked up in a dispatch switch, which contains every return address (the instruction following a jal/jalr) and
+* every code address built by a lui + ori/addiu pair (la). Any other target makes AOT_run return, and the rest of the program runs in the simulator.
+*
+* Program memory is sized to fit the program (see program_capacity), and addresses are relative to the .text base address of the memory layout,
+* so the layout the program was assembled for must be given when it isn't the default one.
+*
+* Usage: mips_aot <program hex file> <output C file> [layout]
+*
+*************************************************************************/
+
+#include "mips_decode.h"
+#include "mips_image.h"
+
+#define ADDRESS_MASK (cpu->prog_capacity * 4 - 1) // bits of the offset from the .text base address that select the program memory word
+
+static MIPS_cpu_t *cpu; // the context the program is loaded into (only used for its program memory and predecoder)
+static unsigned char *reachable; // 1 for every instruction that can be reached from the start address or from the dispatch table
+static unsigned char *dispatch_target; // 1 for every instruction in the dispatch table
+static unsigned int program_size;
+static FILE *out;
+
+// returns the name of the local variable holding the given guest register (the $zero register is always the constant 0)
+static const char *reg(unsigned char index)
+{
+    static char names[4][8];
+    static int next;
+    char *name = names[next];
+
+    next = (next + 1) % 4; // a few names may be used in the same statement
+    if (index == 0) {
+        return "0U";
+    }
+    sprintf(name, "r%u", index);
+    return name;
+}
+
+// returns 1 if the instruction never continues to the next address (j, jr, jal/jalr continue through the dispatch table when returning)
+static int ends_flow(const decoded_t *d)
+{
+    return (d->op == OP_J || d->op == OP_JAL || d->op == OP_JR || d->op == OP_JALR) ? 1 : 0;
+}
+
+// returns the index of the target of a branch, and sets *page_delta to the change of the pc's upper bits when the target wraps around memory
+static uint32_t branch_target(uint32_t index, const decoded_t *d, int32_t *page_delta)
+{
+    int32_t target = (int32_t)index + 1 + d->imm;
+
+    *page_delta = 0;
+    while (target < 0) {
+        target += cpu->prog_capacity;
+        *page_delta -= cpu->prog_capacity * 4;
+    }
+    while (target >= (int32_t)cpu->prog_capacity) {
+        target -= cpu->prog_capacity;
+        *page_delta += cpu->prog_capacity * 4;
+    }
+    return (uint32_t)target;
+}
+
+// fills the dispatch table: return addresses, and code addresses built by lui + ori/addiu
+static void find_dispatch_targets(void)
+{
+    uint32_t i, value;
+    const decoded_t *d, *next;
+
+    for (i = 0; i < program_size; i++) {
+        d = &cpu->decoded_prog[i];
+        if (d->op == OP_JAL || d->op == OP_JALR) {
+            dispatch_target[(i + 1) & (cpu->prog_capacity - 1)] = 1;
+        }
+        if (d->op == OP_LUI && i + 1 < program_size) {
+            next = &cpu->decoded_prog[i + 1];
+            if ((next->op == OP_ORI || next->op == OP_ADDIU) && next->rs == d->rd && next->rd == d->rd) {
+                value = (next->op == OP_ORI) ? ((uint32_t)d->imm | next->imm) : ((uint32_t)d->imm + next->imm);
+                if ((value & 3) == 0 && (((value - cpu->text_base) & ADDRESS_MASK) >> 2) < program_size) {
+                    dispatch_target[((value - cpu->text_base) & ADDRESS_MASK) >> 2] = 1;
+                }
+            }
+        }
+    }
+}
+
+// marks every instruction reachable from the start address (the .text base address) and the dispatch table. Returns -1 if there isn't enough memory
+static int find_reachable(void)
+{
+    uint32_t *stack = (uint32_t *)malloc(cpu->prog_capacity * 2 * sizeof(uint32_t)); // every instruction is pushed at most twice
+    unsigned int top = 0;
+    uint32_t i;
+    int32_t page_delta;
+    const decoded_t *d;
+
+    if (stack == NULL) {
+        return -1;
+    }
+    stack[top++] = 0;
+    for (i = 0; i < cpu->prog_capacity; i++) {
+        if (dispatch_target[i]) {
+            stack[top++] = i;
+        }
+    }
+
+    while (top > 0) {
+        i = stack[--top];
+        if (reachable[i]) {
+            continue;
+        }
+        reachable[i] = 1;
+        d = &cpu->decoded_prog[i];
+        switch (d->op) {
+        case OP_BEQ:
+        case OP_BNE:
+        case OP_BLEZ:
+        case OP_BGTZ:
+            stack[top++] = branch_target(i, d, &page_delta);
+            break;
+        case OP_J:
+        case OP_JAL:
+            stack[top++] = (((uint32_t)d->imm - cpu->text_base) & ADDRESS_MASK) >> 2;
+            break;
+        default:
+            break;
+        }
+        if (!ends_flow(d)) {
+            stack[top++] = (i + 1) & (cpu->prog_capacity - 1);
+        }
+    }
+    free(stack);
+    return 0;
+}
+
+// writes the code of a single instruction
+static void translate(uint32_t i)
+{
+    const decoded_t *d = &cpu->decoded_prog[i];
+    const char *rd = reg(d->rd), *rs = reg(d->rs), *rt = reg(d->rt);
+    uint32_t imm = (uint32_t)d->imm;
+    uint32_t target;
+    int32_t page_delta;
+    int writes_rd = 1;
+    char value[96];
+
+    fprintf(out, "L_%03x: // %08x: %08x\n", i, cpu->text_base + i * 4, d->inst);
+
+    switch (d->op) {
+    case OP_SLL: sprintf(value, "%s << %u", rt, d->shamt); break;
+    case OP_SRL: sprintf(value, "%s >> %u", rt, d->shamt); break;
+    case OP_SRA: sprintf(value, "(uint32_t)((int32_t)%s >> %u)", rt, d->shamt); break;
+    // the variable shifts use the lower 5 bits of $rs, like the x86 shift instructions the interpreter's shifts compile to
+    case OP_SLLV: sprintf(value, "%s << (%s & 31)", rt, rs); break;
+    case OP_SRLV: sprintf(value, "%s >> (%s & 31)", rt, rs); break;
+    case OP_SRAV: sprintf(value, "(uint32_t)((int32_t)%s >> (%s & 31))", rt, rs); break;
+    case OP_MFHI: sprintf(value, "cpu->hi"); break;
+    case OP_MFLO: sprintf(value, "cpu->lo"); break;
+    // the arithmetic is done on unsigned values, which gives the same 32 bits without relying on signed overflow
+    case OP_ADD: case OP_ADDU: sprintf(value, "%s + %s", rs, rt); break;
+    case OP_SUB: case OP_SUBU: sprintf(value, "%s - %s", rs, rt); break;
+    case OP_AND: sprintf(value, "%s & %s", rs, rt); break;
+    case OP_OR: sprintf(value, "%s | %s", rs, rt); break;
+    case OP_XOR: sprintf(value, "%s ^ %s", rs, rt); break;
+    case OP_NOR: sprintf(value, "~(%s | %s)", rs, rt); break;
+    case OP_SLT: sprintf(value, "(int32_t)%s < (int32_t)%s", rs, rt); break;
+    case OP_SLTU: sprintf(value, "%s < %s", rs, rt); break;
+    case OP_MUL: sprintf(value, "%s * %s", rs, rt); break;
+    case OP_ADDI: case OP_ADDIU: sprintf(value, "%s + 0x%xU", rs, imm); break;
+    case OP_SLTI: sprintf(value, "(int32_t)%s < %d", rs, d->imm); break;
+    case OP_SLTIU: sprintf(value, "%s < 0x%xU", rs, imm); break;
+    case OP_ANDI: sprintf(value, "%s & 0x%xU", rs, imm); break;
+    case OP_ORI: sprintf(value, "%s | 0x%xU", rs, imm); break;
+    case OP_XORI: sprintf(value, "%s ^ 0x%xU", rs, imm); break;
+    case OP_LUI: sprintf(value, "0x%xU", imm); break;
+    case OP_LB: sprintf(value, "load_from_memory(cpu, OPCODE_LB, %s + 0x%xU)", rs, imm); break;
+    case OP_LH: sprintf(value, "load_from_memory(cpu, OPCODE_LH, %s + 0x%xU)", rs, imm); break;
+    case OP_LW: sprintf(value, "load_from_memory(cpu, OPCODE_LW, %s + 0x%xU)", rs, imm); break;
+    case OP_LBU: sprintf(value, "load_from_memory(cpu, OPCODE_LBU, %s + 0x%xU)", rs, imm); break;
+    case OP_LHU: sprintf(value, "load_from_memory(cpu, OPCODE_LHU, %s + 0x%xU)", rs, imm); break;
+    default:
+        writes_rd = 0;
+        break;
+    }
+
+    if (writes_rd) {
+        if (d->rd != 0) {
+            fprintf(out, "    %s = %s;\n", rd, value);
+        } else if (d->op >= OP_LB && d->op <= OP_LHU) {
+            fprintf(out, "    %s;\n", value); // the load still has to happen (it may print an error for a bad address)
+        }
+        return;
+    }
+
+    switch (d->op) {
+    case OP_MTHI: fprintf(out, "    cpu->hi = %s;\n", rs); break;
+    case OP_MTLO: fprintf(out, "    cpu->lo = %s;\n", rs); break;
+    case OP_MULT:
+        fprintf(out, "    { int64_t t = (int64_t)(int32_t)%s * (int32_t)%s; cpu->lo = (uint32_t)t; cpu->hi = (uint32_t)(t >> 32); }\n", rs, rt);
+        break;
+    case OP_MULTU:
+        fprintf(out, "    { uint64_t t = (uint64_t)%s * %s; cpu->lo = (uint32_t)t; cpu->hi = (uint32_t)(t >> 32); }\n", rs, rt);
+        break;
+    // a division by 0 (or of the most negative number by -1) leaves hi and lo as they are, like the handlers do, instead of trapping
+    case OP_DIV:
+        fprintf(out, "    if (%s != 0 && !(%s == 0x80000000U && %s == 0xffffffffU)) { cpu->lo = (int32_t)%s / (int32_t)%s; cpu->hi = (int32_t)%s %% (int32_t)%s; }\n",
+            rt, rs, rt, rs, rt, rs, rt);
+        break;
+    case OP_DIVU: fprintf(out, "    if (%s != 0) { cpu->lo = %s / %s; cpu->hi = %s %% %s; }\n", rt, rs, rt, rs, rt); break;
+
+    case OP_SB: fprintf(out, "    store_in_memory(cpu, OPCODE_SB, %s + 0x%xU, %s);\n", rs, imm, rt); break;
+    case OP_SH: fprintf(out, "    store_in_memory(cpu, OPCODE_SH, %s + 0x%xU, %s);\n", rs, imm, rt); break;
+    case OP_SW: fprintf(out, "    store_in_memory(cpu, OPCODE_SW, %s + 0x%xU, %s);\n", rs, imm, rt); break;
+
+    case OP_BEQ:
+    case OP_BNE:
+    case OP_BLEZ:
+    case OP_BGTZ:
+        target = branch_target(i, d, &page_delta);
+        if (d->op == OP_BEQ) sprintf(value, "%s == %s", rs, rt);
+        if (d->op == OP_BNE) sprintf(value, "%s != %s", rs, rt);
+        if (d->op == OP_BLEZ) sprintf(value, "(int32_t)%s <= 0", rs);
+        if (d->op == OP_BGTZ) sprintf(value, "(int32_t)%s > 0", rs);
+        if (page_delta != 0) {
+            fprintf(out, "    if (%s) { page += %d; goto L_%03x; }\n", value, page_delta, target);
+        } else {
+            fprintf(out, "    if (%s) goto L_%03x;\n", value, target);
+        }
+        break;
+
+    case OP_JAL:
+        fprintf(out, "    r31 = page + 0x%xU;\n", (i + 1) * 4);
+        // the target is computed the same way as for j
+        /* fall through */
+    case OP_J:
+        fprintf(out, "    target = ((page + 0x%xU) & 0xf0000000U) | 0x%xU;\n", (i + 1) * 4, imm);
+        fprintf(out, "    page = target - ((target - TEXT_BASE) & ADDRESS_MASK);\n");
+        fprintf(out, "    goto L_%03x;\n", ((imm - cpu->text_base) & ADDRESS_MASK) >> 2);
+        break;
+    case OP_JR:
+        fprintf(out, "    target = %s;\n    goto dispatch;\n", rs);
+        break;
+    case OP_JALR:
+        fprintf(out, "    target = %s;\n", rs);
+        if (d->rd != 0) {
+            fprintf(out, "    %s = page + 0x%xU;\n", rd, (i + 1) * 4);
+        }
+        fprintf(out, "    goto dispatch;\n");
+        break;
+
+    case OP_SYSCALL:
+        fprintf(out, "    SPILL();\n    cpu->pc = page + 0x%xU;\n    if (handle_syscall(cpu) != 0) {\n        return MIPS_RUN_EXIT;\n    }\n    RELOAD();\n", i * 4);
+        break;
+    case OP_UNSUPPORTED:
+        fprintf(out, "    CONSOLE_printf(cpu, \"Unsupported instruction: %%x\\n\", 0x%xU);\n", d->inst);
+        break;
+    default: // nop
+        break;
+    }
+
+    // the next instruction is reachable as well, so it's translated right after this one, unless this is the last word of program memory
+    if (!ends_flow(d) && i + 1 == cpu->prog_capacity) {
+        fprintf(out, "    page += 0x%xU;\n    goto L_000;\n", cpu->prog_capacity * 4);
+    }
+}
+
+// writes the statements copying the local registers to the register file, or back
+static void write_register_copy(const char *format)
+{
+    int i;
+
+    for (i = 1; i < NUM_REG; i++) {
+        fprintf(out, format, i, i);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t i, *program;
+    int layout = MIPS_LAYOUT_COMPACT_DATA_AT_0;
+
+    if (argc != 3 && argc != 4) {
+        printf("Usage: %s <program hex file> <output C file> [layout]\n", argv[0]);
+        return 1;
+    }
+
+    cpu = MIPS_create();
+    if (cpu == NULL) {
+        printf("Not enough memory\n");
+        return 1;
+    }
+    if (argc == 4) {
+        layout = atoi(argv[3]);
+        if (MIPS_cpu_set_layout(cpu, layout) != 0) {
+            printf("Unknown memory layout %s\n", argv[3]);
+            return 1;
+        }
+    }
+    program = IMAGE_read_hex(argv[1], &program_size);
+    if (program == NULL || load_program(cpu, program, program_size) != 0) {
+        return 1;
+    }
+    free(program);
+    reachable = (unsigned char *)calloc(cpu->prog_capacity, 1);
+    dispatch_target = (unsigned char *)calloc(cpu->prog_capacity, 1);
+    if (reachable == NULL || dispatch_target == NULL) {
+        printf("Not enough memory\n");
+        return 1;
+    }
+    find_dispatch_targets();
+    if (find_reachable() != 0) {
+        printf("Not enough memory\n");
+        return 1;
+    }
+
+    out = fopen(argv[2], "w");
+    if (out == NULL) {
+        printf("Can't open %s\n", argv[2]);
+        return 1;
+    }
+
+    fprintf(out, "// Generated by mips_aot from %s. Build it together with aot_main.c and the simulator sources (except main.c).\n\n", argv[1]);
+    fprintf(out, "#include \"mips_decode.h\"\n#include \"mips_aot.h\"\n\n");
+    fprintf(out, "// every reachable instruction has a label, even if nothing jumps to it, and an instruction may compare a register with itself\n");
+    fprintf(out, "#ifdef _MSC_VER\n#pragma warning(disable : 4102)\n#elif defined(__GNUC__)\n#pragma GCC diagnostic ignored \"-Wunused-label\"\n");
+    fprintf(out, "#pragma GCC diagnostic ignored \"-Wtautological-compare\"\n#endif\n\n");
+    fprintf(out, "#define ADDRESS_MASK 0x%xU\n", ADDRESS_MASK);
+    fprintf(out, "#define TEXT_BASE 0x%08xU\n\n", cpu->text_base);
+
+    fprintf(out, "const int AOT_layout = %d;\n", layout);
+    fprintf(out, "const unsigned int AOT_program_size = %u;\n", program_size);
+    fprintf(out, "const uint32_t AOT_program[%u] = {", (program_size > 0) ? program_size : 1);
+    for (i = 0; i < program_size; i++) {
+        fprintf(out, "%s0x%08x", (i % 8 == 0) ? "\n    " : " ", cpu->prog_mem[i]);
+        if (i + 1 < program_size) {
+            fprintf(out, ",");
+        }
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "#define SPILL() do {");
+    write_register_copy(" cpu->registers[%d] = r%d;");
+    fprintf(out, " } while (0)\n");
+    fprintf(out, "#define RELOAD() do {");
+    write_register_copy(" r%d = cpu->registers[%d];");
+    fprintf(out, " } while (0)\n\n");
+
+    fprintf(out, "int AOT_run(MIPS_cpu_t *cpu)\n{\n");
+    for (i = 1; i < NUM_REG; i++) {
+        fprintf(out, "    uint32_t r%u = cpu->registers[%u];\n", i, i);
+    }
+    fprintf(out, "    uint32_t target = cpu->pc; // target of jr/jalr (and the start address)\n");
+    fprintf(out, "    uint32_t page; // the pc of label L_000 in the current copy of program memory (the pc of label L_i is page + 4 * i)\n\n");
+
+    // the dispatch table (also used for starting from the current pc)
+    fprintf(out, "dispatch:\n    page = target - ((target - TEXT_BASE) & ADDRESS_MASK);\n    switch ((target - TEXT_BASE) & ADDRESS_MASK) {\n");
+    for (i = 0; i < cpu->prog_capacity; i++) {
+        if (dispatch_target[i] || i == 0) {
+            fprintf(out, "    case 0x%x: goto L_%03x;\n", i * 4, i);
+        }
+    }
+    fprintf(out, "    default: SPILL(); cpu->pc = target; return AOT_RUN_UNTRANSLATED;\n    }\n\n");
+
+    for (i = 0; i < cpu->prog_capacity; i++) {
+        if (reachable[i]) {
+            translate(i);
+        }
+    }
+    // running past the last instruction continues at the start of the next copy of program memory, like the pc does in the simulator
+    fprintf(out, "    target = page + 0x%xU;\n    goto dispatch;\n}\n", cpu->prog_capacity * 4);
+
+    fclose(out);
+    free(reachable);
+    free(dispatch_target);
+    MIPS_destroy(cpu);
+    return 0;
+}
@@ -0,0 +1,30 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : mips_aot.h
+*
+* Description:
+* ------------
+* Header file for the C files generated by mips_aot (the ahead-of-time translator), and for the program that runs them (aot_main.c).
+*
+*************************************************************************/
+
+#ifndef __MIPS_AOT_H
+#define __MIPS_AOT_H
+
+#include "mips.h"
+
+#define AOT_RUN_UNTRANSLATED 3 // control reached an address that wasn't translated (pc holds it, so the program can continue in MIPS_run)
+
+/* Runs the translated program on the given context, starting from its current pc and register file (set by MIPS_cpu_init), until an exit syscall
+   (returning MIPS_RUN_EXIT) or a jr/jalr to an address outside the dispatch table (returning AOT_RUN_UNTRANSLATED). Registers, hi, lo and pc are
+   written back to the context before returning and around every syscall, so syscalls and MIPS_cpu_get_info see the same state as with the interpreter.
+*/
+int AOT_run(MIPS_cpu_t *cpu);
+
+// the program memory words the file was generated from (so that the runner can check it was given the same program)
+extern const uint32_t AOT_program[];
+extern const unsigned int AOT_program_size;
+extern const int AOT_layout; // the memory layout the program was translated for (MIPS_LAYOUT_*)
+
+#endif /* __MIPS_AOT_H */
@@ -0,0 +1,103 @@
+/*************************************************************************
+*
+* AUTHOR   : Ron Greenberg
+* FILENAME : trace_read.c
+*
+* Description:
+* ------------
+* Prints an execution trace written by MIPS_start_trace (see mips_trace.h), one executed instruction per line: its address, instruction word and
+* disassembly, the register it wrote, and the address and value of a load/store. It is built together with mips_trace.c, mips_disasm.c and the
+* simulator sources (except main.c), and run as:
+*     trace_read <trace file> [-pc <first address> <last address>] [-reg <register>] [-n <maximal number of lines>]
+* -pc only prints the instructions in the given address range (inclusive), and -reg only the ones that wrote the given register (a number, or a
+* name such as $t0). The last line counts the records in the trace and the ones printed.
+*
+*************************************************************************/
+
+#include "mips.h"
+#include "mips_trace.h"
+#include "mips_disasm.h"
+
+// parses a register given as a number or a name ($t0, t0, $8). Returns -1 if it isn't one
+static int parse_register(const char *text)
+{
+    char *end;
+    long number;
+    unsigned int i;
+
+    if (*text == '$') {
+        text++;
+    }
+    number = strtol(text, &end, 10);
+    if (end != text && *end == '\0') {
+        return (number >= 0 && number < NUM_REG) ? (int)number : -1;
+    }
+    for (i = 0; i < NUM_REG; i++) {
+        if (strcmp(DISASM_register_name(i) + 1, text) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static void print_record(const TRACE_record_t *record)
+{
+    char text[DISASM_MAX_LENGTH];
+
+    DISASM_instruction(record->inst, record->pc, text, sizeof(text));
+    printf("%08x  %08x  %-32s", record->pc, record->inst, text);
+    if (record->reg != TRACE_NO_REG) {
+        printf("  %s = 0x%08x", DISASM_register_name(record->reg), record->reg_value);
+    }
+    if (record->flags & TRACE_FLAG_LOAD) {
+        printf("  [0x%08x] -> 0x%x", record->mem_addr, record->mem_value);
+    } else if (record->flags & TRACE_FLAG_STORE) {
+        printf("  [0x%08x] <- 0x%x", record->mem_addr, record->mem_value);
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    TRACE_reader_t reader;
+    TRACE_record_t record;
+    uint32_t first_pc = 0, last_pc = 0xffffffff;
+    unsigned long long records = 0, printed = 0, max_lines = 0;
+    int reg = -1, arg, result;
+
+    for (arg = 2; arg < argc; arg++) {
+        if (strcmp(argv[arg], "-pc") == 0 && arg + 2 < argc) {
+            first_pc = (uint32_t)strtoul(argv[arg + 1], NULL, 0);
+            last_pc = (uint32_t)strtoul(argv[arg + 2], NULL, 0);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-reg") == 0 && arg + 1 < argc && (reg = parse_register(argv[arg + 1])) >= 0) {
+            arg++;
+        } else if (strcmp(argv[arg], "-n") == 0 && arg + 1 < argc) {
+            max_lines = strtoull(argv[arg + 1], NULL, 0);
+            arg++;
+        } else {
+            break;
+        }
+    }
+    if (argc < 2 || arg != argc) {
+        printf("Usage: %s <trace file> [-pc <first address> <last address>] [-reg <register>] [-n <maximal number of lines>]\n", argv[0]);
+        return 1;
+    }
+
+    if (TRACE_open(&reader, argv[1]) != 0) {
+        return 1;
+    }
+    while ((result = TRACE_next(&reader, &record)) == 1) {
+        records++;
+        if (record.pc < first_pc || record.pc > last_pc || (reg >= 0 && record.reg != reg)) {
+            continue;
+        }
+        if (max_lines == 0 || printed < max_lines) {
+            print_record(&record);
+            printed++;
+        }
+    }
+    TRACE_close(&reader);
+    printf("%llu records, %llu printed\n", records, printed);
+    return (result == 0) ? 0 : 1;
+}
@@ -1,23 +1,66 @@
+#ifdef __linux__
+#define _GNU_SOURCE // for sendmmsg
+#endif
 #include <stdio.h>
-#include <winsock2.h>
+#include <stdlib.h>
+#include <string.h>
 #include "udp.h"
+#include "shm.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
 
 #pragma comment(lib,"ws2_32.lib") // Winsock Library
 
-#define BUFLEN 128	//Max length of buffer
+WSADATA wsa;
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define SOCKET_ERROR     (-1)
+#define closesocket      close
+#define WSAGetLastError() errno
+#endif
+
+#include "thread.h" // after winsock2.h, which must come before Windows.h
 
 struct sockaddr_in si_other;
 int s, slen=sizeof(si_other);
-unsigned char message[BUFLEN];
-WSADATA wsa;
+static int transport = UDP_TRANSPORT_SOCKET; // selected by UDP_set_transport
+static int shared_memory; // whether the messages currently go through the shared-memory ring
+// after a failed send, the datagrams are dropped until retry_ns, and the sender thread then recreates the socket (see UDP_recover)
+static int failed;
+static unsigned long long retry_ns;
+static unsigned int backoff_ms = UDP_RETRY_MS; // doubled by every failure until a send succeeds again
+static unsigned long long lost; // datagrams which failed or were dropped while waiting to retry (see UDP_lost)
+
+void UDP_set_transport(int new_transport)
+{
+  transport = new_transport;
+} /* UDP_set_transport */
+
 
 void UDP_init(void)
 {
+  shared_memory = (transport == UDP_TRANSPORT_SHARED_MEMORY && SHM_init() == 0);
+  if (shared_memory) {
+    return;
+  }
+  if (transport == UDP_TRANSPORT_SHARED_MEMORY) {
+    printf("Sending the draw messages over UDP instead\n");
+  }
+
+#ifdef _WIN32
   //Initialise winsock
 	if (WSAStartup(MAKEWORD(2,2),&wsa) != 0) {
 		printf("Failed. Error Code : %d",WSAGetLastError());
 		exit(EXIT_FAILURE);
 	}
+#endif
 	
 	//create socket
 	if ( (s=socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == SOCKET_ERROR) {
@@ -29,23 +72,129 @@ void UDP_init(void)
 	memset((char *) &si_other, 0, sizeof(si_other));
 	si_other.sin_family = AF_INET;
 	si_other.sin_port = htons(PORT);
-	si_other.sin_addr.S_un.S_addr = inet_addr(SERVER);
+	si_other.sin_addr.s_addr = inet_addr(SERVER);
 } /* UDP_init */
 
 
 void UDP_terminate(void)
 {
+  if (shared_memory) {
+    SHM_terminate();
+    return;
+  }
   closesocket(s);
+#ifdef _WIN32
 	WSACleanup();
+#endif
 } /* UDP_terminate */
 
 
+// counts a failed send and backs off: nothing is sent until the delay passes, and the delay doubles as long as the sends keep failing
+static void fail(int datagrams)
+{
+  lost += datagrams;
+  failed = 1;
+  retry_ns = THREAD_time_ns() + (unsigned long long)backoff_ms * 1000000;
+  backoff_ms = (backoff_ms * 2 < UDP_MAX_RETRY_MS) ? backoff_ms * 2 : UDP_MAX_RETRY_MS;
+} /* fail */
+
+
+// returns whether the datagrams must be dropped, since the last send failed and the delay didn't pass yet
+static int backing_off(int datagrams)
+{
+  if (failed && THREAD_time_ns() < retry_ns) {
+    lost += datagrams;
+    return 1;
+  }
+  return 0;
+} /* backing_off */
+
+
+void UDP_recover(void)
+{
+  if (!failed || shared_memory || THREAD_time_ns() < retry_ns) {
+    return;
+  }
+  closesocket(s);
+  s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (s == SOCKET_ERROR) {
+    fail(0); // tried again after a longer delay
+    return;
+  }
+  failed = 0;
+} /* UDP_recover */
+
+
+unsigned long long UDP_lost(void)
+{
+  return lost;
+} /* UDP_lost */
+
+
 void UDP_send(unsigned char *msg, int msg_size)
 {
-  int res = sendto(s, (char *)msg, msg_size , 0 , (struct sockaddr *)&si_other, slen);
+  int res;
+
+  if (shared_memory) {
+    SHM_send_many(&msg, &msg_size, 1);
+    return;
+  }
+  if (backing_off(1)) {
+    return;
+  }
+  res = sendto(s, (char *)msg, msg_size , 0 , (struct sockaddr *)&si_other, slen);
   if (res == SOCKET_ERROR) {
-    printf("Socket error detected, reinitializing\n\r");
-    UDP_terminate();
-    UDP_init();
+    fail(1);
+  } else {
+    failed = 0; // the delay passed without the sender thread recreating the socket (there is none), and the socket works again
+    backoff_ms = UDP_RETRY_MS;
   }
 } /* UDP_send */
+
+
+void UDP_send_many(unsigned char *msgs[], const int msg_sizes[], int count)
+{
+#ifdef __linux__
+  struct mmsghdr headers[UDP_MAX_BATCH];
+  struct iovec iov[UDP_MAX_BATCH];
+  int i, n, sent = 0, res;
+
+  if (shared_memory) {
+    SHM_send_many(msgs, msg_sizes, count);
+    return;
+  }
+  if (backing_off(count)) {
+    return;
+  }
+  while (sent < count) {
+    n = (count - sent < UDP_MAX_BATCH) ? count - sent : UDP_MAX_BATCH;
+    memset(headers, 0, n * sizeof(headers[0]));
+    for (i = 0; i < n; i++) {
+      iov[i].iov_base = msgs[sent + i];
+      iov[i].iov_len = msg_sizes[sent + i];
+      headers[i].msg_hdr.msg_name = &si_other;
+      headers[i].msg_hdr.msg_namelen = sizeof(si_other);
+      headers[i].msg_hdr.msg_iov = &iov[i];
+      headers[i].msg_hdr.msg_iovlen = 1;
+    }
+    res = sendmmsg(s, headers, n, 0);
+    if (res <= 0) {
+      fail(count - sent); // the rest of the datagrams are lost
+      return;
+    }
+    sent += res;
+  }
+  failed = 0;
+  backoff_ms = UDP_RETRY_MS;
+#else
+  int i;
+
+  if (shared_memory) {
+    SHM_send_many(msgs, msg_sizes, count);
+    return;
+  }
+  for (i = 0; i < count; i++) {
+    UDP_send(msgs[i], msg_sizes[i]);
+  }
+#endif
+} /* UDP_send_many */
@@ -1,8 +1,34 @@
+#ifndef __UDP_H
+#define __UDP_H
 
 #define SERVER "127.0.0.1"	// IP address of the virtual screen
 #define PORT   9999 // UDP port on which the virtual screen listens to data
 
+#define UDP_MAX_BATCH 64 // datagrams sent by a single system call of UDP_send_many (sendmmsg)
+#define UDP_RETRY_MS 100 // after a failed send, the datagrams are dropped for this long before the socket is recreated
+#define UDP_MAX_RETRY_MS 5000 // the delay doubles with every failure in a row, up to this
+
+// how the messages reach BlankWindow (see UDP_set_transport)
+#define UDP_TRANSPORT_SOCKET        0 // datagrams to SERVER:PORT
+#define UDP_TRANSPORT_SHARED_MEMORY 1 // the shared-memory ring of draw_ring.h, for a BlankWindow on the same machine (see shm.h)
+
+// selects the transport used from the next UDP_init on. If the shared memory can't be mapped, UDP_init falls back to the socket
+void UDP_set_transport(int transport);
+
 void UDP_init(void);
 void UDP_terminate(void);
 
 void UDP_send(unsigned char *msg, int msg_size);
+
+// sends count datagrams, in as few system calls as possible (sendmmsg on Linux, and a sendto per datagram elsewhere)
+void UDP_send_many(unsigned char *msgs[], const int msg_sizes[], int count);
+
+/* Recreates the socket once the delay after a failed send passed (called by the sender thread of draw_queue.c, so the simulation never waits for it).
+   Without a sender thread, the sends simply try the same socket again after the delay.
+*/
+void UDP_recover(void);
+
+// the datagrams lost to failed sends, including the ones dropped while waiting to retry
+unsigned long long UDP_lost(void);
+
+#endif /* __UDP_H */